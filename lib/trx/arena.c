@@ -0,0 +1,202 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * arena.c
+ *
+ * a bump allocator for short-lived objects that are freed all at once
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "arena.h"
+
+
+/* size of the block header, rounded up so the data is aligned */
+#define ARENA_HEADER_SIZE \
+    ((sizeof(arena_block_t) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+#define arena_block_data(block) ((unsigned char *) (block) + ARENA_HEADER_SIZE)
+
+
+static arena_block_t *arena_block_new(arena_t *arena, size_t size)
+{
+    arena_block_t *block = malloc(ARENA_HEADER_SIZE + size);
+    if (block == NULL) {
+        debug("malloc() of %zd byte arena block failed", size);
+        return NULL;
+    }
+
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    arena->mallocs++;
+
+    return block;
+}
+
+
+/* create an empty arena that grows block_size bytes at a time, or
+   ARENA_BLOCK_SIZE bytes if block_size is 0 */
+arena_t *arena_new(size_t block_size)
+{
+    arena_t *arena = malloc(sizeof(arena_t));
+    if (arena == NULL) {
+        debug("malloc() failed");
+        return NULL;
+    }
+
+    memset(arena, 0, sizeof(arena_t));
+    arena->block_size = block_size ? block_size : ARENA_BLOCK_SIZE;
+
+    return arena;
+}
+
+
+/* free the arena and everything allocated from it */
+void arena_free(arena_t *arena)
+{
+    arena_block_t *block;
+    arena_block_t *next;
+
+    if (arena == NULL)
+        return;
+
+    for (block = arena->blocks; block != NULL; block = next) {
+        next = block->next;
+        free(block);
+    }
+
+    free(arena);
+}
+
+
+/**
+ * allocate size bytes from the arena.  the memory is not initialized
+ * and stays valid until the arena is reset or freed.
+ *
+ * returns NULL if the memory can't be allocated
+ */
+void *arena_alloc(arena_t *arena, size_t size)
+{
+    arena_block_t *block = arena->current;
+    void *p;
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+
+    if ((block == NULL) || (block->used + size > block->size)) {
+        /* blocks after the current one are empty, since they were
+           left over from before the last reset */
+        arena_block_t *next = block ? block->next : arena->blocks;
+
+        if ((next == NULL) || (next->size < size)) {
+            arena_block_t *new = arena_block_new(arena,
+                                                 size > arena->block_size ?
+                                                 size : arena->block_size);
+            if (new == NULL)
+                return NULL;
+            new->next = next;
+            if (block)
+                block->next = new;
+            else
+                arena->blocks = new;
+            next = new;
+        }
+        block = next;
+        arena->current = block;
+    }
+
+    p = arena_block_data(block) + block->used;
+    block->used += size;
+    arena->allocs++;
+
+    return p;
+}
+
+
+/* allocate size bytes of zeroed memory from the arena */
+void *arena_zalloc(arena_t *arena, size_t size)
+{
+    void *p = arena_alloc(arena, size);
+
+    if (p)
+        memset(p, 0, size);
+
+    return p;
+}
+
+
+/* copy a string into the arena */
+char *arena_strdup(arena_t *arena, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *p = arena_alloc(arena, len);
+
+    if (p)
+        memcpy(p, s, len);
+
+    return p;
+}
+
+
+/* free everything allocated from the arena at once.  the blocks are
+   kept for the allocations that follow. */
+void arena_reset(arena_t *arena)
+{
+    arena_block_t *block;
+
+    for (block = arena->blocks; block != NULL; block = block->next) {
+        block->used = 0;
+    }
+
+    arena->current = arena->blocks;
+    arena->allocs = 0;
+    arena->resets++;
+}
+
+
+/* bytes allocated from the arena since the last reset */
+size_t arena_used(arena_t *arena)
+{
+    arena_block_t *block;
+    size_t used = 0;
+
+    for (block = arena->blocks; block != NULL; block = block->next) {
+        used += block->used;
+    }
+
+    return used;
+}
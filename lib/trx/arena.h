@@ -0,0 +1,80 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * arena.h
+ *
+ * a bump allocator for short-lived objects that are freed all at once
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+/* default size of each block of arena storage */
+#define ARENA_BLOCK_SIZE 16384
+
+/* every allocation is aligned to this many bytes */
+#define ARENA_ALIGN 16
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size;               /* usable bytes in the block */
+    size_t used;               /* bytes handed out since the last reset */
+} arena_block_t;
+
+/* an arena hands out memory from large blocks and frees it all at once.
+   arena_reset() keeps the blocks, so an arena that is filled and reset
+   over and over stops calling malloc() once it has grown big enough. */
+typedef struct arena {
+    arena_block_t *blocks;     /* every block, in the order they are used */
+    arena_block_t *current;    /* block being allocated from */
+    size_t block_size;
+
+    /* instrumentation */
+    unsigned long mallocs;     /* blocks obtained from malloc(), ever */
+    unsigned long allocs;      /* allocations since the last reset */
+    unsigned long resets;
+} arena_t;
+
+arena_t *arena_new(size_t block_size);
+void arena_free(arena_t *arena);
+void *arena_alloc(arena_t *arena, size_t size);
+void *arena_zalloc(arena_t *arena, size_t size);
+char *arena_strdup(arena_t *arena, const char *s);
+void arena_reset(arena_t *arena);
+size_t arena_used(arena_t *arena);
+
+#endif /* _ARENA_H_ */
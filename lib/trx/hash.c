@@ -0,0 +1,345 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * hash.c
+ *
+ * an open addressing hash map with string or integer keys
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "hash.h"
+
+
+#define HASH_MIN_CAPACITY 8
+
+#define hash_mask(hash) ((uint32_t) (hash)->capacity - 1)
+
+
+/* fnv-1a.  the top bit is set so no key hashes to 0 (an empty slot) */
+static uint32_t hash_string(const char *key)
+{
+    uint32_t h = 2166136261U;
+
+    while (*key) {
+        h ^= (unsigned char) *key++;
+        h *= 16777619U;
+    }
+
+    return h | 0x80000000U;
+}
+
+
+/* the murmur3 finalizer, which spreads every bit of the key */
+static uint32_t hash_int(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+
+    return (uint32_t) key | 0x80000000U;
+}
+
+
+static hash_t *hash_alloc(int size, int int_keys)
+{
+    int capacity = HASH_MIN_CAPACITY;
+
+    /* room for size entries without growing */
+    while (capacity < size * 2)
+        capacity *= 2;
+
+    hash_t *hash = malloc(sizeof(hash_t));
+    if (hash == NULL) {
+        debug("malloc() failed");
+        return NULL;
+    }
+
+    memset(hash, 0, sizeof(hash_t));
+    hash->entries = calloc(capacity, sizeof(hash_entry_t));
+    if (hash->entries == NULL) {
+        debug("calloc() of %d entries failed", capacity);
+        free(hash);
+        return NULL;
+    }
+    hash->capacity = capacity;
+    hash->int_keys = int_keys;
+
+    return hash;
+}
+
+
+/* create an empty map with string keys, sized for size entries */
+hash_t *hash_new(int size)
+{
+    return hash_alloc(size, 0);
+}
+
+
+/* create an empty map with integer keys, sized for size entries */
+hash_t *hash_new_int(int size)
+{
+    return hash_alloc(size, 1);
+}
+
+
+/* free the map, calling free_data (if not NULL) on each value */
+void hash_free(hash_t *hash, hash_free_data_f free_data)
+{
+    hash_entry_t *e;
+
+    if (hash == NULL)
+        return;
+
+    if (free_data) {
+        hash_for_each(hash, e) {
+            free_data(e->value);
+        }
+    }
+
+    free(hash->entries);
+    free(hash);
+}
+
+
+/* remove every entry, keeping the table */
+void hash_clear(hash_t *hash)
+{
+    memset(hash->entries, 0, sizeof(hash_entry_t) * hash->capacity);
+    hash->count = 0;
+}
+
+
+/* the entry after e, or the first entry if e is NULL.  returns NULL
+   after the last entry. */
+hash_entry_t *hash_next(hash_t *hash, hash_entry_t *e)
+{
+    hash_entry_t *end = hash->entries + hash->capacity;
+
+    for (e = e ? e + 1 : hash->entries; e < end; e++) {
+        if (e->hash)
+            return e;
+    }
+
+    return NULL;
+}
+
+
+/* the slot holding the key, or the empty slot where it would go */
+static hash_entry_t *hash_slot(hash_t *hash, const char *key,
+                               uint64_t ikey, uint32_t h)
+{
+    uint32_t mask = hash_mask(hash);
+    uint32_t i;
+
+    for (i = h & mask; ; i = (i + 1) & mask) {
+        hash_entry_t *e = &(hash->entries[i]);
+
+        if (e->hash == 0)
+            return e;
+        if (e->hash != h)
+            continue;
+        if (hash->int_keys ? (e->ikey == ikey) : (strcmp(e->key, key) == 0))
+            return e;
+    }
+}
+
+
+/* double the table, moving every entry into its new slot */
+static int hash_grow(hash_t *hash)
+{
+    hash_entry_t *old = hash->entries;
+    int old_capacity = hash->capacity;
+    int i;
+
+    hash->entries = calloc(old_capacity * 2, sizeof(hash_entry_t));
+    if (hash->entries == NULL) {
+        debug("calloc() of %d entries failed", old_capacity * 2);
+        hash->entries = old;
+        return -1;
+    }
+    hash->capacity = old_capacity * 2;
+
+    for (i = 0; i < old_capacity; i++) {
+        if (old[i].hash)
+            *hash_slot(hash, old[i].key, old[i].ikey, old[i].hash) = old[i];
+    }
+
+    free(old);
+
+    return 0;
+}
+
+
+static int hash_put_entry(hash_t *hash, const char *key,
+                          uint64_t ikey, uint32_t h, void *value)
+{
+    hash_entry_t *e = hash_slot(hash, key, ikey, h);
+
+    if (e->hash) {
+        e->value = value;
+        return 1;
+    }
+
+    if ((hash->count + 1) * 2 > hash->capacity) {
+        if (hash_grow(hash) < 0)
+            return -1;
+        e = hash_slot(hash, key, ikey, h);
+    }
+
+    e->key = key;
+    e->ikey = ikey;
+    e->hash = h;
+    e->value = value;
+    hash->count++;
+
+    return 0;
+}
+
+
+/* empty slot e, moving up the entries that follow it so that every
+   entry can still be reached from its home slot */
+static void hash_del_entry(hash_t *hash, hash_entry_t *e)
+{
+    uint32_t mask = hash_mask(hash);
+    uint32_t i = e - hash->entries;
+    uint32_t j = i;
+
+    for (;;) {
+        j = (j + 1) & mask;
+        if (hash->entries[j].hash == 0)
+            break;
+
+        /* the entry at j can fill the hole at i unless its home slot
+           lies cyclically in (i, j] */
+        uint32_t home = hash->entries[j].hash & mask;
+        if ((i < j) ? ((home <= i) || (home > j))
+                    : ((home <= i) && (home > j))) {
+            hash->entries[i] = hash->entries[j];
+            i = j;
+        }
+    }
+
+    memset(&(hash->entries[i]), 0, sizeof(hash_entry_t));
+    hash->count--;
+}
+
+
+/**
+ * set the value for a string key.  the key is not copied.
+ *
+ * returns 0 if the key was added, 1 if its value was replaced, or -1
+ * if the table couldn't grow.
+ */
+int hash_put(hash_t *hash, const char *key, void *value)
+{
+    return hash_put_entry(hash, key, 0, hash_string(key), value);
+}
+
+
+/* the entry for a string key, or NULL if it isn't in the map */
+hash_entry_t *hash_find(hash_t *hash, const char *key)
+{
+    hash_entry_t *e = hash_slot(hash, key, 0, hash_string(key));
+
+    return e->hash ? e : NULL;
+}
+
+
+/* the value for a string key, or NULL if it isn't in the map */
+void *hash_get(hash_t *hash, const char *key)
+{
+    hash_entry_t *e = hash_find(hash, key);
+
+    return e ? e->value : NULL;
+}
+
+
+/* remove a string key.  returns 1 if it was removed, 0 if it wasn't
+   in the map */
+int hash_del(hash_t *hash, const char *key)
+{
+    hash_entry_t *e = hash_find(hash, key);
+
+    if (e == NULL)
+        return 0;
+
+    hash_del_entry(hash, e);
+
+    return 1;
+}
+
+
+/* hash_put() for an integer key */
+int hash_put_int(hash_t *hash, uint64_t key, void *value)
+{
+    return hash_put_entry(hash, NULL, key, hash_int(key), value);
+}
+
+
+/* hash_find() for an integer key */
+hash_entry_t *hash_find_int(hash_t *hash, uint64_t key)
+{
+    hash_entry_t *e = hash_slot(hash, NULL, key, hash_int(key));
+
+    return e->hash ? e : NULL;
+}
+
+
+/* hash_get() for an integer key */
+void *hash_get_int(hash_t *hash, uint64_t key)
+{
+    hash_entry_t *e = hash_find_int(hash, key);
+
+    return e ? e->value : NULL;
+}
+
+
+/* hash_del() for an integer key */
+int hash_del_int(hash_t *hash, uint64_t key)
+{
+    hash_entry_t *e = hash_find_int(hash, key);
+
+    if (e == NULL)
+        return 0;
+
+    hash_del_entry(hash, e);
+
+    return 1;
+}
@@ -0,0 +1,92 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * hash.h
+ *
+ * an open addressing hash map with string or integer keys
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef _HASH_H_
+#define _HASH_H_
+
+#include <stdint.h>
+
+#define hash_count(hash) ((hash)->count)
+
+/* one slot of the table.  string keys are not copied, so they must
+   outlive the entry. */
+typedef struct hash_entry {
+    const char *key;           /* string key, NULL in integer maps */
+    uint64_t ikey;             /* integer key */
+    void *value;
+    uint32_t hash;             /* hash of the key, 0 if the slot is empty */
+} hash_entry_t;
+
+/* entries are kept in one array and collisions are resolved by probing
+   the slots that follow, so a lookup usually touches one cache line.
+   the table doubles when it is half full. */
+typedef struct hash {
+    hash_entry_t *entries;
+    int capacity;              /* a power of 2 */
+    int count;
+    int int_keys;              /* keyed by integers instead of strings */
+} hash_t;
+
+/* macro for iterating over every entry of the map, in no particular
+   order.  e must be a pointer to hash_entry_t.  the map must not be
+   changed while iterating. */
+#define hash_for_each(hash, e)                                      \
+    for ((e) = hash_next((hash), NULL); (e) != NULL;                \
+         (e) = hash_next((hash), (e)))
+
+typedef void (*hash_free_data_f)(void *value);
+
+hash_t *hash_new(int size);
+hash_t *hash_new_int(int size);
+void hash_free(hash_t *hash, hash_free_data_f free_data);
+void hash_clear(hash_t *hash);
+hash_entry_t *hash_next(hash_t *hash, hash_entry_t *e);
+
+int hash_put(hash_t *hash, const char *key, void *value);
+hash_entry_t *hash_find(hash_t *hash, const char *key);
+void *hash_get(hash_t *hash, const char *key);
+int hash_del(hash_t *hash, const char *key);
+
+int hash_put_int(hash_t *hash, uint64_t key, void *value);
+hash_entry_t *hash_find_int(hash_t *hash, uint64_t key);
+void *hash_get_int(hash_t *hash, uint64_t key);
+int hash_del_int(hash_t *hash, uint64_t key);
+
+#endif /* _HASH_H_ */
@@ -0,0 +1,344 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * sink.c
+ *
+ * buffered output to a FILE, a file descriptor or memory
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "debug.h"
+#include "sink.h"
+
+
+static sink_t *sink_new(sink_type_t type, size_t size)
+{
+    sink_t *sink = malloc(sizeof(sink_t));
+    if (sink == NULL) {
+        debug("malloc() failed");
+        return NULL;
+    }
+
+    memset(sink, 0, sizeof(sink_t));
+    sink->type = type;
+    sink->fd = -1;
+    sink->flush_size = SINK_FLUSH_SIZE;
+
+    sink->buf = buffer_new(size);
+    if ((sink->buf == NULL) || (sink->buf->start == NULL)) {
+        debug("can't allocate %zd byte buffer", size);
+        if (sink->buf)
+            buffer_free(sink->buf);
+        free(sink);
+        return NULL;
+    }
+
+    return sink;
+}
+
+
+/* a sink that keeps everything written to it; size is the initial
+   size of the buffer, which grows as needed */
+sink_t *sink_new_memory(size_t size)
+{
+    return sink_new(SINK_MEMORY, size > 0 ? size : 1024);
+}
+
+
+/* a sink that writes to stream when flushed */
+sink_t *sink_new_file(FILE *stream)
+{
+    sink_t *sink = sink_new(SINK_FILE, SINK_FLUSH_SIZE);
+    if (sink)
+        sink->stream = stream;
+
+    return sink;
+}
+
+
+/* a sink that writes to the file descriptor fd when flushed */
+sink_t *sink_new_fd(int fd)
+{
+    sink_t *sink = sink_new(SINK_FD, SINK_FLUSH_SIZE);
+    if (sink)
+        sink->fd = fd;
+
+    return sink;
+}
+
+
+/* flush whatever is left and free the sink */
+void sink_free(sink_t *sink)
+{
+    if (sink == NULL)
+        return;
+
+    sink_flush(sink);
+    buffer_free(sink->buf);
+    free(sink);
+}
+
+
+/* throw away the data in the sink without writing it */
+void sink_reset(sink_t *sink)
+{
+    buffer_reset(sink->buf);
+}
+
+
+/* write everything in the sink to its stream or file descriptor.
+   returns 0 on success, -1 if the write failed (the data is dropped
+   either way).  a memory sink keeps its data. */
+int sink_flush(sink_t *sink)
+{
+    buffer_t *buf = sink->buf;
+    ssize_t rc;
+    int ret = 0;
+
+    switch (sink->type) {
+    case SINK_MEMORY:
+        return 0;
+
+    case SINK_FILE:
+        if ((buffer_len(buf) > 0) &&
+            (fwrite(buffer_data(buf), 1, buffer_len(buf), sink->stream) !=
+             buffer_len(buf))) {
+            debug("fwrite() failed: %m");
+            ret = -1;
+        }
+        if (fflush(sink->stream) != 0)
+            ret = -1;
+        break;
+
+    case SINK_FD:
+        while (buffer_len(buf) > 0) {
+            rc = write(sink->fd, buffer_data(buf), buffer_len(buf));
+            if (rc < 0) {
+                if (errno == EINTR)
+                    continue;
+                debug("write() failed: %m");
+                ret = -1;
+                break;
+            }
+            buf->out += rc;
+        }
+        break;
+    }
+
+    buffer_reset(buf);
+    if (ret < 0)
+        sink->error = 1;
+
+    return ret;
+}
+
+
+/* flush the sink if at least sink->flush_size is waiting */
+int sink_flush_full(sink_t *sink)
+{
+    if (sink_len(sink) < sink->flush_size)
+        return 0;
+
+    return sink_flush(sink);
+}
+
+
+/* make room for len more chars and return where they go.  write into
+   the space and then call sink_commit() with the number of chars
+   actually used.  returns NULL if the buffer can't grow. */
+char *sink_reserve(sink_t *sink, size_t len)
+{
+    buffer_t *buf = sink->buf;
+    size_t size;
+
+    if (buffer_space(buf) < len) {
+        buffer_compact(buf);
+        if (buffer_space(buf) < len) {
+            size = buffer_size(buf) * 2;
+            if (size < buffer_len(buf) + len)
+                size = buffer_len(buf) + len;
+            if (buffer_resize(buf, size) < 0) {
+                debug("can't grow buffer to %zd bytes", size);
+                sink->error = 1;
+                return NULL;
+            }
+        }
+    }
+
+    return buf->in;
+}
+
+
+/* append len chars of data */
+int sink_write(sink_t *sink, const char *data, size_t len)
+{
+    char *p = sink_reserve(sink, len);
+    if (p == NULL)
+        return -1;
+
+    memcpy(p, data, len);
+    sink_commit(sink, len);
+
+    return len;
+}
+
+
+/* append a string.  like printf(), a NULL string is written as
+   "(null)" */
+int sink_puts(sink_t *sink, const char *s)
+{
+    if (s == NULL)
+        s = "(null)";
+
+    return sink_write(sink, s, strlen(s));
+}
+
+
+/* append a single char */
+int sink_putc(sink_t *sink, char c)
+{
+    char *p = sink_reserve(sink, 1);
+    if (p == NULL)
+        return -1;
+
+    *p = c;
+    sink_commit(sink, 1);
+
+    return 1;
+}
+
+
+/* append s padded with spaces to width chars, like printf("%*s");
+   a negative width pads on the right instead of the left */
+int sink_pad(sink_t *sink, const char *s, int width)
+{
+    size_t len;
+    size_t pad = 0;
+    char *p;
+
+    if (s == NULL)
+        s = "(null)";
+    len = strlen(s);
+
+    if ((width < 0) && (len < (size_t) -width))
+        pad = -width - len;
+    else if ((width > 0) && (len < (size_t) width))
+        pad = width - len;
+
+    p = sink_reserve(sink, len + pad);
+    if (p == NULL)
+        return -1;
+
+    if (width > 0) {
+        memset(p, ' ', pad);
+        memcpy(p + pad, s, len);
+    } else {
+        memcpy(p, s, len);
+        memset(p + len, ' ', pad);
+    }
+    sink_commit(sink, len + pad);
+
+    return len + pad;
+}
+
+
+/* append x in decimal */
+int sink_int(sink_t *sink, long x)
+{
+    char digits[24];
+    char *end = digits + sizeof(digits);
+    char *p = end;
+    unsigned long u = (x < 0) ? -(unsigned long) x : (unsigned long) x;
+
+    do {
+        *--p = '0' + (u % 10);
+        u /= 10;
+    } while (u);
+    if (x < 0)
+        *--p = '-';
+
+    return sink_write(sink, p, end - p);
+}
+
+
+/* printf to the sink, growing the buffer to fit */
+int sink_printf(sink_t *sink, const char *format, ...)
+{
+    va_list ap;
+    size_t space;
+    char *p;
+    int rc;
+
+    p = sink_reserve(sink, 128);
+    if (p == NULL)
+        return -1;
+    space = buffer_space(sink->buf);
+
+    va_start(ap, format);
+    rc = vsnprintf(p, space, format, ap);
+    va_end(ap);
+    if (rc < 0)
+        return -1;
+
+    if (rc >= space) {
+        p = sink_reserve(sink, rc + 1);
+        if (p == NULL)
+            return -1;
+        va_start(ap, format);
+        vsnprintf(p, rc + 1, format, ap);
+        va_end(ap);
+    }
+    sink_commit(sink, rc);
+
+    return rc;
+}
+
+
+/* the data in the sink as a NUL terminated string.  the string
+   belongs to the sink, and moves if more is written. */
+char *sink_string(sink_t *sink)
+{
+    char *p = sink_reserve(sink, 1);
+    if (p == NULL)
+        return NULL;
+
+    *p = '\0';
+
+    return sink_data(sink);
+}
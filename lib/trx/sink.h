@@ -0,0 +1,95 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * sink.h
+ *
+ * buffered output to a FILE, a file descriptor or memory
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef _SINK_H_
+#define _SINK_H_
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "buffer.h"
+
+/* default buffer size, and how much sink_flush_full() waits for */
+#define SINK_FLUSH_SIZE 65536
+
+/* length of, and pointer to, the data waiting in the sink */
+#define sink_len(sink) buffer_len((sink)->buf)
+#define sink_data(sink) buffer_data((sink)->buf)
+
+/* mark len chars written into the space returned by sink_reserve() */
+#define sink_commit(sink, len) ((sink)->buf->in += (len))
+
+typedef enum sink_type {
+    SINK_MEMORY = 0,   /* data stays in the buffer until it is reset */
+    SINK_FILE,
+    SINK_FD,
+} sink_type_t;
+
+/* a sink collects output in a growable buffer_t and writes it out in
+   large chunks, so formatting a value doesn't cost a stdio call.  data
+   is only written when the sink is flushed, so callers can flush at
+   record boundaries and a record is never split between two writes. */
+typedef struct sink {
+    buffer_t *buf;
+    sink_type_t type;
+    FILE *stream;        /* SINK_FILE */
+    int fd;              /* SINK_FD */
+    size_t flush_size;   /* sink_flush_full() writes once this is buffered */
+    int error;           /* set once a write has failed */
+} sink_t;
+
+sink_t *sink_new_memory(size_t size);
+sink_t *sink_new_file(FILE *stream);
+sink_t *sink_new_fd(int fd);
+void sink_free(sink_t *sink);
+void sink_reset(sink_t *sink);
+int sink_flush(sink_t *sink);
+int sink_flush_full(sink_t *sink);
+char *sink_reserve(sink_t *sink, size_t len);
+int sink_write(sink_t *sink, const char *data, size_t len);
+int sink_puts(sink_t *sink, const char *s);
+int sink_putc(sink_t *sink, char c);
+int sink_pad(sink_t *sink, const char *s, int width);
+int sink_int(sink_t *sink, long x);
+int sink_printf(sink_t *sink, const char *format, ...)
+    __attribute__ ((format (printf, 2, 3)));
+char *sink_string(sink_t *sink);
+
+#endif /* _SINK_H_ */
@@ -57,6 +57,11 @@
 #include "macros.h"
 #include "date.h"
 #include "string.h"
+#include "arena.h"
+#include "list.h"
+#include "vector.h"
+#include "hash.h"
+#include "sink.h"
 
 /* unit test function prototype */
 typedef int (*unit_test_f)(const char **name);
@@ -64,6 +69,11 @@ typedef int (*unit_test_f)(const char **name);
 /* unit test prototypes */
 int unit_test_date_parse_rfc3339_tm(const char **name);
 int unit_test_string_parse_decimal(const char **name);
+int unit_test_arena(const char **name);
+int unit_test_vector(const char **name);
+int unit_test_hash(const char **name);
+int unit_test_hash_int(const char **name);
+int unit_test_sink(const char **name);
 
 
 int test_getopt(int argc, char *argv[])
@@ -98,6 +108,11 @@ int main (int argc, char *argv[])
     unit_test_f test_list[] = {
         unit_test_date_parse_rfc3339_tm,
         unit_test_string_parse_decimal,
+        unit_test_arena,
+        unit_test_vector,
+        unit_test_hash,
+        unit_test_hash_int,
+        unit_test_sink,
         NULL,
     };
 
@@ -368,3 +383,276 @@ int unit_test_string_parse_decimal(const char **name)
     return 1;
 }
 
+
+
+int unit_test_arena(const char **name)
+{
+    *name = __FUNCTION__;
+
+    arena_t *arena = arena_new(256);
+    char *s;
+    void *p, *q, *big;
+    int i;
+
+    UNIT_ASSERT(arena != NULL);
+
+    /* allocations are aligned and don't overlap */
+    p = arena_alloc(arena, 3);
+    q = arena_alloc(arena, 8);
+    UNIT_ASSERT(((uintptr_t) p & (ARENA_ALIGN - 1)) == 0);
+    UNIT_ASSERT(((uintptr_t) q & (ARENA_ALIGN - 1)) == 0);
+    UNIT_ASSERT((char *) q >= (char *) p + 3);
+    UNIT_ASSERT(arena->mallocs == 1);
+
+    s = arena_strdup(arena, "PV String");
+    UNIT_ASSERT(strcmp(s, "PV String") == 0);
+
+    /* filling a block starts a new one, and requests bigger than a
+       block get a block of their own */
+    for (i = 0; i < 16; i++)
+        UNIT_ASSERT(arena_zalloc(arena, 32) != NULL);
+    big = arena_alloc(arena, 1000);
+    UNIT_ASSERT(big != NULL);
+    memset(big, 0xff, 1000);
+    UNIT_ASSERT(arena->allocs == 20);
+    UNIT_ASSERT(arena_used(arena) >= 1000 + (16 * 32));
+    UNIT_ASSERT(arena->mallocs == 4);
+
+    /* once reset, the same allocations are made without malloc() */
+    arena_reset(arena);
+    UNIT_ASSERT(arena_used(arena) == 0);
+    UNIT_ASSERT(arena_alloc(arena, 3) == p);
+    for (i = 0; i < 17; i++)
+        UNIT_ASSERT(arena_zalloc(arena, 32) != NULL);
+    UNIT_ASSERT(arena_alloc(arena, 1000) != NULL);
+    UNIT_ASSERT(arena->mallocs == 4);
+    UNIT_ASSERT(arena->resets == 1);
+
+    arena_free(arena);
+
+    return 0;
+}
+
+
+int unit_test_vector(const char **name)
+{
+    *name = __FUNCTION__;
+
+    char *words[] = { "alpha", "beta", "gamma", "delta", "epsilon" };
+    vector_t *vector = vector_new(0);
+    list_t *list = list_new();
+    char *word;
+    int i;
+
+    UNIT_ASSERT(vector != NULL);
+    UNIT_ASSERT(vector_pop(vector) == NULL);
+
+    /* push past the initial capacity */
+    for (i = 0; i < 100; i++) {
+        word = words[i % 5];
+        UNIT_ASSERT(vector_push(vector, word) == 0);
+    }
+    UNIT_ASSERT(vector_count(vector) == 100);
+    UNIT_ASSERT(vector->capacity >= 100);
+    UNIT_ASSERT(vector_get(vector, 57) == words[2]);
+
+    vector_clear(vector);
+    UNIT_ASSERT(vector_count(vector) == 0);
+
+    for (i = 0; i < 5; i++)
+        list_node_add(list, list_node_new(words[i]));
+    UNIT_ASSERT(vector_push(vector, "omega") == 0);
+    UNIT_ASSERT(vector_append_list(vector, list) == 0);
+    UNIT_ASSERT(vector_count(vector) == 6);
+
+    vector_for_each(vector, i, word) {
+        UNIT_ASSERT(strcmp(word, i ? words[i - 1] : "omega") == 0);
+    }
+    UNIT_ASSERT(i == 6);
+
+    UNIT_ASSERT(vector_pop(vector) == words[4]);
+    UNIT_ASSERT(vector_count(vector) == 5);
+
+    list_free(list, NULL);
+    vector_free(vector, NULL);
+
+    return 0;
+}
+
+
+int unit_test_hash(const char **name)
+{
+    *name = __FUNCTION__;
+
+    char keys[500][16];
+    hash_t *hash = hash_new(0);
+    hash_entry_t *e;
+    int i, n;
+
+    UNIT_ASSERT(hash != NULL);
+    UNIT_ASSERT(hash_get(hash, "W") == NULL);
+
+    /* enough keys to grow the table several times */
+    for (i = 0; i < 500; i++) {
+        snprintf(keys[i], sizeof(keys[i]), "A,%02d", i);
+        UNIT_ASSERT(hash_put(hash, keys[i], keys[i]) == 0);
+    }
+    UNIT_ASSERT(hash_count(hash) == 500);
+    UNIT_ASSERT(hash->capacity >= 1000);
+
+    for (i = 0; i < 500; i++)
+        UNIT_ASSERT(hash_get(hash, keys[i]) == keys[i]);
+    UNIT_ASSERT(hash_get(hash, "A,500") == NULL);
+
+    /* keys are compared by value, not by pointer */
+    UNIT_ASSERT(hash_get(hash, "A,42") == keys[42]);
+
+    /* replacing a value doesn't add an entry */
+    UNIT_ASSERT(hash_put(hash, "A,07", keys[8]) == 1);
+    UNIT_ASSERT(hash_get(hash, keys[7]) == keys[8]);
+    UNIT_ASSERT(hash_count(hash) == 500);
+
+    /* every other key is deleted, and the rest can still be found */
+    for (i = 0; i < 500; i += 2)
+        UNIT_ASSERT(hash_del(hash, keys[i]) == 1);
+    UNIT_ASSERT(hash_del(hash, keys[0]) == 0);
+    UNIT_ASSERT(hash_count(hash) == 250);
+    for (i = 0; i < 500; i++) {
+        e = hash_find(hash, keys[i]);
+        UNIT_ASSERT((i & 1) ? (e != NULL) : (e == NULL));
+    }
+
+    n = 0;
+    hash_for_each(hash, e) {
+        UNIT_ASSERT(e->key[0] == 'A');
+        n++;
+    }
+    UNIT_ASSERT(n == 250);
+
+    hash_clear(hash);
+    UNIT_ASSERT(hash_count(hash) == 0);
+    UNIT_ASSERT(hash_next(hash, NULL) == NULL);
+    UNIT_ASSERT(hash_get(hash, keys[1]) == NULL);
+
+    hash_free(hash, NULL);
+
+    return 0;
+}
+
+
+int unit_test_hash_int(const char **name)
+{
+    *name = __FUNCTION__;
+
+    static char present[4096];
+    hash_t *hash = hash_new_int(16);
+    int i, n;
+
+    UNIT_ASSERT(hash != NULL);
+    UNIT_ASSERT(hash->capacity == 32);
+
+    /* random inserts and deletes, checked against a plain array */
+    srand(16);
+    for (n = 0; n < 20000; n++) {
+        uint64_t key = rand() & 4095;
+        if (rand() & 1) {
+            UNIT_ASSERT(hash_put_int(hash, key << 32, present + key) ==
+                        present[key]);
+            present[key] = 1;
+        } else {
+            UNIT_ASSERT(hash_del_int(hash, key << 32) == present[key]);
+            present[key] = 0;
+        }
+    }
+
+    n = 0;
+    for (i = 0; i < 4096; i++) {
+        if (present[i]) {
+            UNIT_ASSERT(hash_get_int(hash, (uint64_t) i << 32) ==
+                        present + i);
+            n++;
+        } else {
+            UNIT_ASSERT(hash_find_int(hash, (uint64_t) i << 32) == NULL);
+        }
+    }
+    UNIT_ASSERT(hash_count(hash) == n);
+
+    hash_free(hash, NULL);
+
+    return 0;
+}
+
+
+int unit_test_sink(const char **name)
+{
+    *name = __FUNCTION__;
+
+    sink_t *sink = sink_new_memory(8);
+    char big[1000];
+    char out[64];
+    int fds[2];
+    int rc;
+    int i;
+
+    UNIT_ASSERT(sink != NULL);
+
+    /* a memory sink grows to hold everything */
+    UNIT_ASSERT(sink_puts(sink, "id=") == 3);
+    UNIT_ASSERT(sink_int(sink, -1234567) == 8);
+    UNIT_ASSERT(sink_putc(sink, ',') == 1);
+    UNIT_ASSERT(sink_pad(sink, "ab", 5) == 5);
+    UNIT_ASSERT(sink_pad(sink, "cd", -4) == 4);
+    UNIT_ASSERT(sink_pad(sink, "toolong", 3) == 7);
+    rc = sink_printf(sink, "|%02d|", 7);
+    UNIT_ASSERT(rc == 4);
+    UNIT_ASSERT(strcmp(sink_string(sink),
+                       "id=-1234567,   abcd  toolong|07|") == 0);
+    UNIT_ASSERT(sink_flush(sink) == 0);
+    UNIT_ASSERT(sink_len(sink) == 32);
+
+    sink_reset(sink);
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    rc = sink_printf(sink, "<%s>", big);
+    UNIT_ASSERT(rc == sizeof(big) + 1);
+    UNIT_ASSERT(sink_len(sink) == sizeof(big) + 1);
+    UNIT_ASSERT(sink_data(sink)[sizeof(big)] == '>');
+    sink_free(sink);
+
+    /* a fd sink only writes when it is flushed */
+    UNIT_ASSERT(pipe(fds) == 0);
+    sink = sink_new_fd(fds[1]);
+    UNIT_ASSERT(sink != NULL);
+    for (i = 0; i < 3; i++) {
+        sink_puts(sink, "line ");
+        sink_int(sink, i);
+        sink_putc(sink, '\n');
+    }
+    UNIT_ASSERT(sink_flush_full(sink) == 0);
+    UNIT_ASSERT(sink_len(sink) == 21);
+    sink->flush_size = 16;
+    UNIT_ASSERT(sink_flush_full(sink) == 0);
+    UNIT_ASSERT(sink_len(sink) == 0);
+    UNIT_ASSERT(read(fds[0], out, sizeof(out)) == 21);
+    UNIT_ASSERT(memcmp(out, "line 0\nline 1\nline 2\n", 21) == 0);
+    sink_free(sink);
+    close(fds[0]);
+    close(fds[1]);
+
+    /* so does a FILE sink */
+    char *mem = NULL;
+    size_t mem_size = 0;
+    FILE *stream = open_memstream(&mem, &mem_size);
+    UNIT_ASSERT(stream != NULL);
+    sink = sink_new_file(stream);
+    UNIT_ASSERT(sink != NULL);
+    sink_puts(sink, "hello");
+    fflush(stream);
+    UNIT_ASSERT(mem_size == 0);
+    sink_free(sink);
+    UNIT_ASSERT((mem_size == 5) && (memcmp(mem, "hello", 5) == 0));
+    fclose(stream);
+    free(mem);
+
+    return 0;
+}
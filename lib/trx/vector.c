@@ -0,0 +1,155 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * vector.c
+ *
+ * a growable array of pointers
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "vector.h"
+
+
+/* create an empty vector with room for capacity items */
+vector_t *vector_new(int capacity)
+{
+    vector_t *vector = malloc(sizeof(vector_t));
+    if (vector == NULL) {
+        debug("malloc() failed");
+        return NULL;
+    }
+
+    memset(vector, 0, sizeof(vector_t));
+    if ((capacity > 0) && (vector_reserve(vector, capacity) < 0)) {
+        free(vector);
+        return NULL;
+    }
+
+    return vector;
+}
+
+
+/* free the vector, calling free_data (if not NULL) on each item */
+void vector_free(vector_t *vector, vector_free_data_f free_data)
+{
+    int i;
+
+    if (vector == NULL)
+        return;
+
+    if (free_data) {
+        for (i = 0; i < vector->count; i++) {
+            free_data(vector->items[i]);
+        }
+    }
+
+    free(vector->items);
+    free(vector);
+}
+
+
+/* make room for at least capacity items
+   returns 0 on success or -1 if the memory can't be allocated */
+int vector_reserve(vector_t *vector, int capacity)
+{
+    void **items;
+
+    if (capacity <= vector->capacity)
+        return 0;
+
+    items = realloc(vector->items, sizeof(void *) * capacity);
+    if (items == NULL) {
+        debug("realloc() of %d items failed", capacity);
+        return -1;
+    }
+
+    vector->items = items;
+    vector->capacity = capacity;
+
+    return 0;
+}
+
+
+/* add an item to the end of the vector, doubling its size if it is
+   full.  returns 0 on success or -1 on failure. */
+int vector_push(vector_t *vector, void *item)
+{
+    if (vector->count == vector->capacity) {
+        if (vector_reserve(vector, vector->capacity ?
+                           vector->capacity * 2 : 8) < 0)
+            return -1;
+    }
+
+    vector->items[vector->count++] = item;
+
+    return 0;
+}
+
+
+/* remove and return the last item, or NULL if the vector is empty */
+void *vector_pop(vector_t *vector)
+{
+    if (vector->count == 0)
+        return NULL;
+
+    return vector->items[--vector->count];
+}
+
+
+/* empty the vector, keeping its storage */
+void vector_clear(vector_t *vector)
+{
+    vector->count = 0;
+}
+
+
+/* add the data of each node of list to the end of the vector
+   returns 0 on success or -1 on failure */
+int vector_append_list(vector_t *vector, list_t *list)
+{
+    list_node_t *c;
+
+    if (vector_reserve(vector, vector->count + list->count) < 0)
+        return -1;
+
+    list_for_each(list, c) {
+        vector->items[vector->count++] = c->data;
+    }
+
+    return 0;
+}
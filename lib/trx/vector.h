@@ -0,0 +1,74 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * vector.h
+ *
+ * a growable array of pointers
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef _VECTOR_H_
+#define _VECTOR_H_
+
+#include "list.h"
+
+#define vector_count(vector) ((vector)->count)
+#define vector_get(vector, i) ((vector)->items[(i)])
+
+/* a vector keeps its items in one array, so walking it doesn't chase
+   pointers the way a list_t does.  items are appended at the end. */
+typedef struct vector {
+    void **items;
+    int count;
+    int capacity;
+} vector_t;
+
+/* macro for iterating over the vector, in the manner of list_for_each().
+   i must be an int, item is set to each item in turn */
+#define vector_for_each(vector, i, item)                                \
+    for ((i) = 0;                                                       \
+         ((i) < (vector)->count) && (((item) = (vector)->items[(i)]), 1); \
+         (i)++)
+
+typedef void (*vector_free_data_f)(void *data);
+
+vector_t *vector_new(int capacity);
+void vector_free(vector_t *vector, vector_free_data_f free_data);
+int vector_reserve(vector_t *vector, int capacity);
+int vector_push(vector_t *vector, void *item);
+void *vector_pop(vector_t *vector);
+void vector_clear(vector_t *vector);
+int vector_append_list(vector_t *vector, list_t *list);
+
+#endif /* _VECTOR_H_ */
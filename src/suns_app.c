@@ -50,12 +50,21 @@
 #include <endian.h>
 #include <getopt.h>
 #include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/time.h>
 
 #include "trx/macros.h"
 #include "trx/debug.h"
 #include "suns_app.h"
 #include "suns_model.h"
+#include "suns_map.h"
+#include "suns_poller.h"
+#include "suns_bus.h"
+#include "suns_regs.h"
+#include "suns_changes.h"
 #include "suns_output.h"
+#include "suns_bin.h"
 #include "suns_parser.h"
 #include "suns_lang.tab.h"
 #include "suns_host.h"
@@ -84,6 +93,8 @@ void suns_app_init(suns_app_t *app)
     app->retries = 2;
     app->override_model_searchpath = 0;
     app->check_only = 0;
+    app->threads = 1;
+    app->keyframe = -1;
 
     /* override model_searchpath with SUNS_MODELPATH_ENV if it is set */
     if ((app->model_searchpath = getenv(SUNS_MODELPATH_ENV)) == NULL)
@@ -96,6 +107,7 @@ int suns_app_getopt(int argc, char *argv[], suns_app_t *app)
 {
     int opt;
     float timeout_tmp;
+    float poll_tmp;
 
     /* option_error is used to signal that some invalid combination of
        arguments has been used.  if option_error is non-zero getopt()
@@ -105,7 +117,7 @@ int suns_app_getopt(int argc, char *argv[], suns_app_t *app)
 
     /* FIXME: add long options */
 
-    while ((opt = getopt(argc, argv, "t:i:P:p:b:M:m:o:sx:va:I:l:X:T:r:M:hHcV"))
+    while ((opt = getopt(argc, argv, "t:i:P:p:b:M:m:o:sx:va:I:l:X:T:r:M:hHcVC:D:L:j:w:B:K:R:"))
            != -1) {
         switch (opt) {
         case 't':
@@ -238,6 +250,61 @@ int suns_app_getopt(int argc, char *argv[], suns_app_t *app)
             app->check_only = 1;
             break;
 
+        case 'C':
+            app->map_cache_dir = optarg;
+            break;
+
+        case 'D':
+            if (sscanf(optarg, "%f", &poll_tmp) != 1 || poll_tmp <= 0) {
+                error("unknown poll interval format: %s, "
+                      "must provide a positive number of seconds", optarg);
+                option_error = 1;
+            }
+            app->poll_interval = poll_tmp * 1000;
+            break;
+
+        case 'L':
+            app->device_list = optarg;
+            break;
+
+        case 'j':
+            if ((sscanf(optarg, "%d", &(app->threads)) != 1) ||
+                (app->threads < 1)) {
+                error("must provide a positive decimal number of threads");
+                option_error = 1;
+            }
+            break;
+
+        case 'w':
+            if ((sscanf(optarg, "%d", &(app->pipeline)) != 1) ||
+                (app->pipeline < 1)) {
+                error("must provide a positive decimal number of reads");
+                option_error = 1;
+            }
+            if (app->pipeline > SUNS_POLLER_MAX_PIPELINE) {
+                warning("no more than %d reads can be kept in flight",
+                        SUNS_POLLER_MAX_PIPELINE);
+                app->pipeline = SUNS_POLLER_MAX_PIPELINE;
+            }
+            break;
+
+        case 'B':
+            app->bus_units = optarg;
+            break;
+
+        case 'R':
+            app->replay_file = optarg;
+            break;
+
+        case 'K':
+            if ((sscanf(optarg, "%d", &(app->keyframe)) != 1) ||
+                (app->keyframe < 0)) {
+                error("must provide a decimal number of polls, "
+                      "or 0 for only the first");
+                option_error = 1;
+            }
+            break;
+
         case 'V':
             printf(SUNS_VERSION_NUMBER "\n");
             exit(EXIT_SUCCESS);
@@ -266,7 +333,7 @@ int suns_app_getopt(int argc, char *argv[], suns_app_t *app)
 void suns_app_help(int argc, char *argv[])
 {
     printf("Usage: %s: \n", argv[0]);
-    printf("      -o: output mode for data (text, xml)\n");
+    printf("      -o: output mode for data (text, xml, json, ndjson, bin)\n");
     printf("      -x: export model description (slang, xml)\n");
     printf("      -t: transport type: tcp or rtu (default: tcp)\n");
     printf("      -a: modbus slave address (default: 1)\n");
@@ -275,7 +342,7 @@ void suns_app_help(int argc, char *argv[])
     printf("      -P: port number for modbus tcp (default: 502)\n");
     printf("      -p: serial port for modbus rtu (default: /dev/ttyUSB0)\n");
     printf("      -b: baud rate for modbus rtu (default: 9600)\n");
-    printf("      -T: timeout, in seconds (can be fractional, such as 1.5; default: 2.0)\n");
+    printf("      -T: longest timeout, in seconds (can be fractional, such as 1.5; default: 2.0)\n");
     printf("      -r: number of retries attempted for each modbus read\n");
     printf("      -m: specify model file\n");
     printf("      -M: specify directory containing model files\n");
@@ -284,6 +351,24 @@ void suns_app_help(int argc, char *argv[])
     printf("      -N: logger id namespace (for sunspec logger xml output, defaults to 'mac')\n");
     printf("      -l: limit number of registers requested in a single read (max is 125)\n");
     printf("      -c: check models for internal consistency then exit\n");
+    printf("      -C: directory used to cache device register maps\n");
+    printf("      -D: poll the device every interval seconds until killed\n"
+           "          (can be fractional, such as 0.5)\n");
+    printf("      -L: poll every modbus tcp device listed in a file, one\n"
+           "          \"host[:port] [address [logger id]]\" per line\n");
+    printf("      -j: number of threads used to poll a device list "
+           "(default: 1)\n");
+    printf("      -B: read each of a list of unit ids on one bus in turn,\n"
+           "          such as 1-20,25 (port opened once; timing reported)\n");
+    printf("      -w: keep up to n modbus tcp reads in flight on each "
+           "connection\n"
+           "          (the device must accept pipelined requests; "
+           "max is %d)\n", SUNS_POLLER_MAX_PIPELINE);
+    printf("      -K: when polling, only output values that changed since\n"
+           "          the last poll, and every value every n polls "
+           "(0: only the first)\n");
+    printf("      -R: decode a capture written with -o bin (- for stdin)\n"
+           "          and output it in the -o format\n");
     printf("      -v: verbose level (up to -vvvv for most verbose)\n");
     printf("      -V: print current release number and exit\n");
     printf("\n");
@@ -299,6 +384,8 @@ int suns_app_logger_host(suns_app_t *app)
     char *result_xml;
    int rc = 0;
     list_node_t *c;
+    sink_t *out;
+    int n = 0;
 
     rc = suns_host_parse_logger_xml(stdin, devices, result);
     debug("rc = %d", rc);
@@ -308,9 +395,19 @@ int suns_app_logger_host(suns_app_t *app)
     fwrite(result_xml, 1, strlen(result_xml), stdout);
     free(result_xml);
 
+    out = sink_new_file(stdout);
+    if (out == NULL) {
+        error("memory error: sink_new_file() failed");
+        return -1;
+    }
+    /* the devices of the post go out in a single document */
+    suns_output_begin(app->output_fmt, out);
     list_for_each(devices, c) {
-        suns_device_output(app->output_fmt, c->data, stdout);
+        suns_device_output_item(app->output_fmt, c->data, n++, out);
+        sink_flush_full(out);
     }
+    suns_output_end(app->output_fmt, out);
+    sink_free(out);
 
     debug("rc = %d", rc);
 
@@ -318,6 +415,59 @@ int suns_app_logger_host(suns_app_t *app)
 }
 
 
+/* decode every record of a capture written with -o bin and output it,
+   as if the devices had just been read */
+int suns_app_replay(suns_app_t *app)
+{
+    suns_parser_state_t *sps = suns_get_parser_state();
+    suns_device_t *device;
+    unsigned char *buf = NULL;
+    size_t size = 0;
+    FILE *stream;
+    sink_t *out;
+    int len;
+    int rc = 0;
+
+    if (strcmp(app->replay_file, "-") == 0) {
+        stream = stdin;
+    } else if ((stream = fopen(app->replay_file, "r")) == NULL) {
+        error("can't open %s: %s", app->replay_file,
+              strerror(errno));
+        return -1;
+    }
+
+    device = suns_device_new_with_arena();
+    out = sink_new_file(stdout);
+    if ((device == NULL) || (out == NULL)) {
+        error("memory error: can't allocate a device to replay into");
+        rc = -1;
+        goto done;
+    }
+
+    while ((len = suns_bin_fread(stream, &buf, &size)) > 0) {
+        if (suns_bin_decode(sps->did_index, buf, len, device) < 0) {
+            rc = -1;
+            break;
+        }
+        suns_device_output(app->output_fmt, device, out);
+        sink_flush_full(out);
+    }
+    if (len < 0)
+        rc = -1;
+
+ done:
+    if (out)
+        sink_free(out);
+    if (device)
+        suns_device_free(device);
+    free(buf);
+    if (stream != stdin)
+        fclose(stream);
+
+    return rc;
+}
+
+
 int suns_app_test_server(suns_app_t *app)
 {
     modbus_mapping_t *mapping;
@@ -542,59 +692,115 @@ int suns_app_swap_registers(uint16_t *reg,
                             int num_regs,
                             unsigned char *buf)
 {
-    int i;
-
-    for (i = 0; i < num_regs; i++) {
-        ((uint16_t*)buf)[i] = htobe16(reg[i]);
-    }
+    suns_regs_htobe((uint16_t *) buf, reg, num_regs);
 
     return 0;
 }
 
 
 
-int suns_app_read_device(suns_app_t *app, suns_device_t *device)
+/* monotonic microseconds, for timing modbus requests */
+static int64_t suns_app_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((int64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+
+/**
+ * read len registers at start (base address 0) in a single modbus
+ * request, trying up to app->retries times.  the response timeout comes
+ * from app->link, which learns from every answer to a first try.
+ *
+ * exceptions meaning the device can't serve the read (illegal function,
+ * address or value) aren't retried.  a device that is busy is given one
+ * timeout to get ready before it is asked again, up to
+ * SUNS_LINK_MAX_WAITS times without using up a try.
+ *
+ * returns the number of registers read, or -1 with errno set
+ */
+static int suns_app_modbus_read(suns_app_t *app,
+                                int start,
+                                int len,
+                                uint16_t *regs)
+{
+    struct timeval timeout;
+    int64_t sent;
+    int retries;
+    int waits = 0;      /* busy answers that didn't count as tries */
+    int err = 0;
+    int rc = -1;
+
+    for (retries = 0; retries < app->retries; retries++) {
+        timeout.tv_sec = app->link.timeout / 1000;
+        timeout.tv_usec = (app->link.timeout % 1000) * 1000;
+        modbus_set_response_timeout(app->mb_ctx, &timeout);
+
+        sent = suns_app_now_us();
+        rc = modbus_read_registers(app->mb_ctx, start, len, regs);
+        err = errno;
+
+        /* an answer to a retry could belong to any of the tries, so
+           only first tries are timed */
+        if ((retries == 0) && (waits == 0) &&
+            ((rc >= 0) || (err > MODBUS_ENOBASE)))
+            suns_link_sample(&(app->link), suns_app_now_us() - sent);
+
+        if (rc >= 0)
+            return rc;
+
+        if (err == ETIMEDOUT) {
+            suns_link_timed_out(&(app->link));
+        } else if ((err == EMBXILFUN) ||
+                   (err == EMBXILADD) ||
+                   (err == EMBXILVAL)) {
+            break;
+        } else if ((err == EMBXSBUSY) || (err == EMBXACK)) {
+            /* waiting for a busy device doesn't use up a try */
+            if (waits < SUNS_LINK_MAX_WAITS) {
+                waits++;
+                retries--;
+            }
+            /* nothing is sent again after the last try */
+            if (retries + 1 < app->retries) {
+                verbose(1, "address %d is busy; waiting %d ms",
+                        app->addr, app->link.timeout);
+                usleep(app->link.timeout * 1000);
+            }
+        }
+    }
+
+    errno = err;
+
+    return rc;
+}
+
+
+/* search the usual places for the sunspec signature
+   returns the register holding the signature (base address 1), or -1 */
+int suns_app_find_signature(suns_app_t *app)
 {
     int rc = 0;
     int i;
-    uint16_t regs[1024];
-    unsigned char buf[2048];
-    suns_model_did_t *did;
-    int offset = 0;
-    uint16_t len;
-    suns_dataset_t *data;  /* holds decoded datapoints */
-
-    /* we need the parser state to gain access to the data model definitions */
-    suns_parser_state_t *sps = suns_get_parser_state();    
+    uint16_t regs[2];
 
     /* places to look for the sunspec signature */
     int search_registers[] = { 40001, 1, 50001, 0x40001, -1 };
     int base_register = -1;
 
-    /* record if we've found a common model and an end marker */
-    int found_common_model = 0;
-    int found_common_model_first = 0;
-    int found_end_marker = 0;
-    int model_count = 0;
-
     /* look for sunspec signature */
     for (i = 0; search_registers[i] >= 0; i++) {
-        int retries;
-        rc = -1;
-        for (retries = 0; retries < app->retries && rc < 0; retries++) {
-            /* libmodbus uses zero as the base address */
-            debug("read register %d, try %d",
-                    search_registers[i], retries);
-            rc = modbus_read_registers(app->mb_ctx, search_registers[i] - 1,
-                                       2, regs);
-            /* don't retry for illegal address exception
-               this means we can talk to the slave, but the slave
-               said the address is invalid */
-            if ((rc < 0) && (errno == EMBXILADD)) {
-                verbose(1,"illegal address exception when "
-                        "reading register %d", search_registers[i]);
-                break;
-            }
+        /* libmodbus uses zero as the base address */
+        debug("read register %d", search_registers[i]);
+        rc = suns_app_modbus_read(app, search_registers[i] - 1, 2, regs);
+        /* an illegal address exception means we can talk to the
+           slave, but the slave said the address is invalid */
+        if ((rc < 0) && (errno == EMBXILADD)) {
+            verbose(1,"illegal address exception when "
+                    "reading register %d", search_registers[i]);
         }
 
         if (rc < 0) {
@@ -621,7 +827,33 @@ int suns_app_read_device(suns_app_t *app, suns_device_t *device)
 
     if (base_register == 0x40001)
         error("sunspec block found at 0x40001, not decimal 40001!");
-    
+
+    return base_register;
+}
+
+
+/**
+ * learn the register map of a device by finding the sunspec signature
+ * and walking the chain of model headers.  only the did and length
+ * registers of each model are read; the model bodies are read later by
+ * suns_app_read_map().
+ *
+ * returns 0 on success or -1 on failure
+ */
+int suns_app_discover_map(suns_app_t *app, suns_map_t *map)
+{
+    int rc = 0;
+    uint16_t regs[2];
+    int offset = 0;
+
+    /* we need the parser state to gain access to the data model definitions */
+    suns_parser_state_t *sps = suns_get_parser_state();    
+
+    map->base_register = suns_app_find_signature(app);
+    if (map->base_register < 0)
+        return -1;
+
+    int base_register = map->base_register;
     offset = 2;
     
     /* loop over all data models as they are discovered */
@@ -630,15 +862,9 @@ int suns_app_read_device(suns_app_t *app, suns_device_t *device)
         debug("looking for sunspec data block at %d",
               base_register + offset);
 
-        int retries;
-        rc = -1;
-        for (retries = 0; retries < app->retries && rc < 0; retries++) { 
-            debug("read register %d, try %d", base_register + offset, retries);
-            rc = modbus_read_registers(app->mb_ctx,
-                                       base_register + offset - 1,
-                                       2, regs);
-        }
-            
+        debug("read register %d", base_register + offset);
+        rc = suns_app_modbus_read(app, base_register + offset - 1, 2, regs);
+
         if (rc < 0) {
             debug("modbus_read_registers() returned %d: %s",
                   rc, modbus_strerror(errno));
@@ -648,123 +874,557 @@ int suns_app_read_device(suns_app_t *app, suns_device_t *device)
             break;
         }
 
-        model_count++;
-
-        /* did we stumble upon an end marker? */
-        if ((regs[0] == 0xFFFF) &&
-            (regs[1] == 0x0000)) {
-            verbose(1, "found end marker at register %d and %d",
-                    base_register + offset , base_register + offset + 1);
-            found_end_marker = 1;
-            rc = 0;
+        rc = suns_map_add_header(map, sps->did_index, offset, regs);
+        if (rc != 0)
             break;
-        }
 
-        /* since we're a test program we need to check for a missing
-           end marker.  all we can really do is check for zero, since
-           we can't tell the difference between a did we don't know
-           and some other data. */
-        if (regs[0] == 0) {
-            error("found 0x0000 where we should have found "
-                  "an end marker or another did.");
-            rc = -1;
-            break;
-        }
+        /* jump ahead to next data block */
+        offset += regs[1] + 2;
+    }
 
-        len = regs[1];
-        verbose(1, "found did = %d, len = %d", regs[0], len);
-        did = suns_find_did(sps->did_list, regs[0]);
-        
-        if (did == NULL) {
-            warning("unknown did: %d", regs[0]);
-            /* skip ahead the reported length */
-            /* offset += len + 2; */
-        } else {
-            /* we found a did we know about */
-            
-            /* is the length what we expect? */
-            /* check out this pointer indirection!! */
-            suns_dp_block_t *last_dp_block = did->model->dp_blocks->tail->data;
-            if ((did->model->len != len) &&
-                (last_dp_block->repeating &&
-                 (((len - did->model->base_len) %
-                   (did->model->len - did->model->base_len)) != 0))) {
-                error("data model length %d does not match expected length (base length %d + multiple of repeating block length %d)",
-                      len, did->model->len, (did->model->len - did->model->base_len));
-            }
+    /* an end marker completes the map */
+    if (rc > 0)
+        rc = 0;
 
-            /* record if we found a common model where we expect it */
-            if (did->did == 1) {
-                found_common_model = 1;
-                if (model_count == 1)
-                    found_common_model_first = 1;
-            }
-        }
+    /* keep what we learned so the models found so far can be read */
+    if ((rc < 0) && (list_count(map->models) > 0))
+        return 0;
+
+    return rc;
+}
+
+
+/**
+ * read every model in a register map, using as few reads as possible,
+ * and decode the known models into datasets attached to device.
+ *
+ * if device already holds datasets from an earlier read of the same
+ * map they are decoded into again, reusing their storage.
+ *
+ * returns 0 on success, -1 on failure, or 1 if the model headers on the
+ * device no longer match the map (the map must be rediscovered).
+ */
+int suns_app_read_map(suns_app_t *app,
+                      suns_map_t *map,
+                      suns_device_t *device)
+{
+    int rc = 0;
+    int i;
+    int map_len = suns_map_len(map);
+    uint16_t *regs;
+    suns_map_read_t *reads;
+    int count;
+
+    /* we need the parser state to gain access to the data model definitions */
+    suns_parser_state_t *sps = suns_get_parser_state();    
+
+    count = suns_map_plan_reads(map, app->link.max_read, &reads);
+    if (count < 0)
+        return -1;
 
-        rc = suns_app_read_registers(app, base_register + offset - 1,
-                                   len + 2, regs);
+    regs = malloc(sizeof(uint16_t) * map_len);
+    if (regs == NULL) {
+        error("memory error: can't malloc() buffer for %d registers",
+              map_len);
+        free(reads);
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        rc = suns_app_read_registers(app,
+                                     map->base_register + reads[i].offset - 1,
+                                     reads[i].len, regs + reads[i].offset);
         if (rc < 0) {
             debug("suns_app_read_registers() returned %d: %s",
                   rc, modbus_strerror(errno));
             rc = -1;
-            break;
+            goto out;
         }
+    }
+    rc = suns_map_decode(map, sps->did_index, regs, device);
 
-        /* kludge around the way libmodbus works */
-        suns_app_swap_registers(regs, len + 2, buf);
+ out:
+    free(reads);
+    free(regs);
 
-        /* dump the binary data in test model form */
-        if (verbose_level > 2) {
-            /* suns_binary_model_fprintf requires the length in bytes,
-               not modbus registers */
-            suns_binary_model_fprintf(stdout, sps->did_list,
-                                      buf, ((len + 2) * 2));
+    return rc;
+}
+
+
+/**
+ * build the name of the register map cache file for the device
+ * app is configured to talk to.  maps are keyed by host, port and
+ * slave address for tcp, and by serial port and slave address for rtu.
+ *
+ * returns 0 on success or -1 if the path doesn't fit in len
+ */
+int suns_app_map_cache_path(suns_app_t *app, char *path, size_t len)
+{
+    char port[BUFFER_SIZE];
+    int i;
+    int n;
+
+    if (app->transport == SUNS_TCP) {
+        return suns_map_cache_path(path, len, app->map_cache_dir,
+                                   app->hostname, app->tcp_port, app->addr);
+    } else {
+        /* flatten the serial device path into a file name */
+        snprintf(port, sizeof(port), "%s", app->serial_port);
+        for (i = 0; port[i]; i++) {
+            if (port[i] == '/')
+                port[i] = '_';
         }
+        n = snprintf(path, len, "%s/rtu%s_%d.map", app->map_cache_dir,
+                     port, app->addr);
+    }
 
-        /* if the did for this blob is known, decode it and
-           attach it to the suns_device_t */
-        if (did) {
-            /* suns_decode_data() requires the length in bytes, not
-               modbus registers */
+    if (n >= len) {
+        error("map cache path for %s is too long", app->map_cache_dir);
+        return -1;
+    }
 
-            /* add 2 to len to include did & len registers */
-            data = suns_decode_data(sps->did_list, buf, (len + 2) * 2);
+    return 0;
+}
 
-            /* assign index */
-            /* suns_model_get_did_index() must be called before the
-               dataset is added to the device */
-            data->index = suns_model_get_did_index(device, data->did->did);
 
-            /* add the dataset to the device */
-            suns_device_add_dataset(device, data);
-        } else {
-            /* unknown data block */
-            if (verbose_level > 0) {
-                dump_buffer(stdout, buf, (len + 2) * 2);
+/**
+ * check that a cached map still describes the device with a single
+ * read of the signature and the common model.
+ *
+ * returns 0 if the map is valid, 1 if the device doesn't match it, or
+ * -1 if the device couldn't be read
+ */
+int suns_app_validate_map(suns_app_t *app, suns_map_t *map)
+{
+    int rc;
+    uint16_t *regs;
+    int len = suns_map_validate_len(map);
+
+    if (len < 0) {
+        verbose(1, "cached map has no common model to check");
+        return 1;
+    }
+
+    regs = malloc(sizeof(uint16_t) * len);
+    if (regs == NULL) {
+        error("memory error: can't malloc() %d registers", len);
+        return -1;
+    }
+
+    rc = suns_app_read_registers(app, map->base_register - 1, len, regs);
+    if (rc >= 0)
+        rc = suns_map_validate(map, regs);
+
+    free(regs);
+
+    return rc;
+}
+
+
+/* load and validate the cached map for the device, if there is one */
+suns_map_t *suns_app_load_cached_map(suns_app_t *app)
+{
+    char path[BIG_BUFFER_SIZE];
+    suns_map_t *map;
+
+    if (suns_app_map_cache_path(app, path, sizeof(path)) < 0)
+        return NULL;
+
+    map = suns_map_load(path, &(app->link));
+    if (map == NULL)
+        return NULL;
+
+    if (suns_app_validate_map(app, map) != 0) {
+        verbose(1, "cached map %s is stale; rediscovering", path);
+        suns_map_free(map);
+        return NULL;
+    }
+
+    verbose(1, "using cached map %s", path);
+
+    return map;
+}
+
+
+/**
+ * read all models from a device.  the register map is discovered on
+ * the first call (or loaded from the map cache) and reused after that,
+ * so later reads of the same device only cost the reads planned by
+ * suns_map_plan_reads().
+ */
+int suns_app_read_device(suns_app_t *app, suns_device_t *device)
+{
+    int rc = 0;
+    int check_rc = 0;
+    int attempt;
+    int discovered = 0;
+
+    if ((app->map == NULL) && app->map_cache_dir) {
+        app->map = suns_app_load_cached_map(app);
+    }
+
+    /* a freshly discovered map should always match, so only
+       rediscover once */
+    for (attempt = 0; attempt < 2; attempt++) {
+        if (app->map == NULL) {
+            app->map = suns_map_new();
+            if (app->map == NULL)
+                return -1;
+
+            if (suns_app_discover_map(app, app->map) < 0) {
+                suns_map_free(app->map);
+                app->map = NULL;
+                return -1;
             }
+            discovered = 1;
         }
-        
-        /* jump ahead to next data block */
-        offset += len + 2;
+
+        check_rc = suns_map_check(app->map);
+
+        rc = suns_app_read_map(app, app->map, device);
+        if (rc != 1)
+            break;
+
+        warning("register map on address %d has changed; rediscovering",
+                app->addr);
+        suns_map_free(app->map);
+        app->map = NULL;
+
+        /* datasets from the old map can't be reused */
+        suns_device_free_datasets(device);
     }
 
-    if (! found_common_model) {
-        error("no common model found");
-        rc = -1;
+    if (rc != 0)
+        return -1;
+
+    /* only cache complete maps.  the cache also keeps what was
+       learned about the link, so save again when that changes. */
+    if ((discovered || app->link.changed) &&
+        app->map_cache_dir && (check_rc == 0)) {
+        char path[BIG_BUFFER_SIZE];
+        if (suns_app_map_cache_path(app, path, sizeof(path)) == 0) {
+            if (suns_map_save(app->map, &(app->link), path) == 0)
+                verbose(1, "saved register map to %s", path);
+        }
     }
-    if (found_common_model && (! found_common_model_first)) {
-        error("common model exists but is not the first model");
-        rc = -1;
+
+    return check_rc;
+}
+
+
+
+/* set by signal handlers to stop the polling loop */
+static volatile sig_atomic_t suns_app_stop = 0;
+
+static void suns_app_stop_handler(int signum)
+{
+    suns_app_stop = 1;
+}
+
+
+/* stop polling on SIGINT or SIGTERM */
+static void suns_app_catch_signals(void)
+{
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = suns_app_stop_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+}
+
+
+/* milliseconds since the epoch */
+static int64_t suns_app_now_ms(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return ((int64_t) tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+}
+
+
+/* sleep until the next poll is due.  keep to the schedule, but don't
+   try to catch up on polls we've missed. */
+static void suns_app_wait_for_poll(int64_t *next, int interval)
+{
+    int64_t now = suns_app_now_ms();
+
+    *next += interval;
+    if (*next < now) {
+        *next = now;
+    } else {
+        /* interrupted early if we're signaled */
+        usleep((*next - now) * 1000);
     }
-    if (! found_end_marker) {
-        error("end marker model is not present");
-        rc = -1;
+}
+
+
+/**
+ * poll the device every app->poll_interval milliseconds until SIGINT or
+ * SIGTERM is received.
+ *
+ * the models, the modbus connection, the register map and the
+ * suns_device_t are all kept between polls.  each poll decodes into the
+ * device's arena, which is reset rather than freed, so polls stop
+ * allocating memory once the arena is big enough.  each successful poll
+ * is written to stdout in app->output_fmt.
+ */
+int suns_app_poll(suns_app_t *app)
+{
+    suns_device_t *device;
+    sink_t *out;
+    int64_t next;
+
+    out = sink_new_file(stdout);
+    if (out == NULL) {
+        error("memory error: sink_new_file() failed");
+        return -1;
     }
-    
+
+    device = suns_device_new_with_arena();
+    if (device == NULL) {
+        error("memory error: suns_device_new_with_arena() failed");
+        sink_free(out);
+        return -1;
+    }
+    device->lid = app->lid;
+    device->ns = app->ns;
+    device->columnar = suns_output_columnar(app->output_fmt);
+    if (app->keyframe >= 0) {
+        device->changes = suns_changes_new(app->keyframe);
+        if (device->changes == NULL) {
+            error("memory error: suns_changes_new() failed");
+            suns_device_free(device);
+            sink_free(out);
+            return -1;
+        }
+    }
+
+    suns_app_catch_signals();
+
+    next = suns_app_now_ms();
+
+    while (! suns_app_stop) {
+        device->unixtime = time(NULL);
+
+        if (suns_app_read_device(app, device) < 0) {
+            error("failure while reading device");
+            /* start over with a fresh connection next time */
+            modbus_close(app->mb_ctx);
+            if (modbus_connect(app->mb_ctx) < 0) {
+                error("modbus_connect() failed: %s",
+                      modbus_strerror(errno));
+            }
+        } else {
+            suns_device_output(app->output_fmt, device, out);
+            sink_flush(out);
+        }
+
+        suns_app_wait_for_poll(&next, app->poll_interval);
+    }
+
+    verbose(1, "stopping");
+
+    sink_free(out);
+    suns_device_free(device);
+    modbus_close(app->mb_ctx);
+    modbus_free(app->mb_ctx);
+
+    return 0;
+}
+
+
+/**
+ * poll every device in app->device_list concurrently, or the single
+ * device given by app->hostname, app->tcp_port and app->addr if there
+ * is no list.  devices are polled once, or every app->poll_interval
+ * milliseconds until SIGINT or SIGTERM is received.
+ */
+int suns_app_poll_devices(suns_app_t *app)
+{
+    suns_poller_t *poller;
+    int rc;
+
+    poller = suns_poller_new();
+    if (poller == NULL)
+        return -1;
+
+    poller->threads = app->threads;
+    poller->timeout = app->timeout;
+    poller->retries = app->retries;
+    poller->max_read = app->max_modbus_read;
+    poller->pipeline = max(app->pipeline, 1);
+    poller->interval = app->poll_interval;
+    poller->output_fmt = app->output_fmt;
+    poller->ns = app->ns;
+    poller->keyframe = app->keyframe;
+    poller->map_cache_dir = app->map_cache_dir;
+    poller->stop = &suns_app_stop;
+
+    if (app->device_list) {
+        if (suns_poller_load_devices(poller, app->device_list,
+                                     app->tcp_port, app->addr) < 0) {
+            suns_poller_free(poller);
+            return -1;
+        }
+    } else {
+        suns_poller_device_t *dev =
+            suns_poller_add_device(poller, app->hostname, app->tcp_port,
+                                   app->addr);
+        if (dev == NULL) {
+            suns_poller_free(poller);
+            return -1;
+        }
+        dev->device->lid = app->lid;
+    }
+
+    suns_app_catch_signals();
+
+    rc = suns_poller_run(poller);
+
+    suns_poller_free(poller);
+
     return rc;
 }
 
 
+/**
+ * read every unit id in app->bus_units in turn over the one modbus
+ * context, such as the devices on a multi-drop rs-485 line.  the port
+ * stays open and each unit keeps its own register map and datasets.
+ *
+ * the bus is read once, or a cycle is started every
+ * app->poll_interval milliseconds until SIGINT or SIGTERM is received.
+ * per unit timing and the bus utilization are reported on stderr.
+ *
+ * returns 0 if every unit was read in the last cycle, or -1
+ */
+int suns_app_poll_bus(suns_app_t *app)
+{
+    suns_bus_t *bus;
+    suns_bus_unit_t *unit;
+    list_node_t *c;
+    sink_t *out;
+    int64_t next;
+    int64_t start;
+    int failures = 0;
+    int n;
+    int rc;
+
+    bus = suns_bus_new();
+    if (bus == NULL)
+        return -1;
+
+    if (suns_bus_parse_units(bus, app->bus_units) < 0) {
+        suns_bus_free(bus);
+        return -1;
+    }
+
+    /* each unit learns its own read size and timeout */
+    list_for_each(bus->units, c) {
+        unit = c->data;
+        suns_link_init(&(unit->link), app->max_modbus_read, app->timeout);
+        unit->device->columnar = suns_output_columnar(app->output_fmt);
+        if (app->keyframe >= 0) {
+            unit->device->changes = suns_changes_new(app->keyframe);
+            if (unit->device->changes == NULL) {
+                error("memory error: suns_changes_new() failed");
+                suns_bus_free(bus);
+                return -1;
+            }
+        }
+    }
+
+    /* units are written out together once per cycle, or sooner if
+       there is a lot of output */
+    out = sink_new_file(stdout);
+    if (out == NULL) {
+        error("memory error: sink_new_file() failed");
+        suns_bus_free(bus);
+        return -1;
+    }
+
+    suns_app_catch_signals();
+
+    bus->start_ms = suns_app_now_ms();
+    next = bus->start_ms;
+
+    while (! suns_app_stop) {
+        failures = 0;
+        n = 0;
+
+        /* one document for each cycle of the bus */
+        suns_output_begin(app->output_fmt, out);
+
+        list_for_each(bus->units, c) {
+            unit = c->data;
+
+            if (suns_app_stop)
+                break;
+
+            if (unit->skip > 0) {
+                unit->skip--;
+                continue;
+            }
+
+            /* suns_app_read_device() works on app->addr, app->map and
+               app->link */
+            app->addr = unit->addr;
+            app->map = unit->map;
+            app->link = unit->link;
+            modbus_set_slave(app->mb_ctx, unit->addr);
+
+            unit->device->unixtime = time(NULL);
+            start = suns_app_now_ms();
+            rc = suns_app_read_device(app, unit->device);
+            suns_bus_unit_done(bus, unit, start, suns_app_now_ms(), rc);
+            unit->map = app->map;
+            unit->link = app->link;
+
+            if (rc < 0) {
+                error("failure while reading unit %d", unit->addr);
+                failures++;
+                /* drop whatever is left of the failed exchange */
+                if (app->transport == SUNS_RTU) {
+                    modbus_flush(app->mb_ctx);
+                } else {
+                    modbus_close(app->mb_ctx);
+                    if (modbus_connect(app->mb_ctx) < 0) {
+                        error("modbus_connect() failed: %s",
+                              modbus_strerror(errno));
+                    }
+                }
+            } else {
+                suns_device_output_item(app->output_fmt, unit->device,
+                                        n++, out);
+                sink_flush_full(out);
+            }
+        }
+        suns_output_end(app->output_fmt, out);
+        sink_flush(out);
+        bus->cycles++;
+
+        if (verbose_level > 1)
+            suns_bus_report(bus, stderr, suns_app_now_ms());
+
+        if (app->poll_interval <= 0)
+            break;
+
+        suns_app_wait_for_poll(&next, app->poll_interval);
+    }
+
+    sink_free(out);
+    suns_bus_report(bus, stderr, suns_app_now_ms());
+
+    /* the maps belong to the units */
+    app->map = NULL;
+    suns_bus_free(bus);
+
+    return failures ? -1 : 0;
+}
+
 
 int suns_app_read_data_model(modbus_t *ctx)
 {
@@ -795,6 +1455,10 @@ int main(int argc, char **argv)
     /* this has the side effect of parsing any specified model files */
     suns_app_getopt(argc, argv, &app);
 
+    /* reads and timeouts start out as configured, until we learn
+       better */
+    suns_link_init(&(app.link), app.max_modbus_read, app.timeout);
+
     /* now load models found in the model searchpath */
     /* ignore errors */
     if (! app.override_model_searchpath)
@@ -829,6 +1493,7 @@ int main(int argc, char **argv)
     /* maybe this should be part of suns_parser.c? */
     list_for_each(sps->model_list, c) {
         suns_model_fill_offsets(c->data);
+        suns_model_compile_plan(c->data);
     }
 
     /* display options in debug mode */
@@ -865,11 +1530,43 @@ int main(int argc, char **argv)
             exit(EXIT_SUCCESS);
     }
 
+    /* are we invoked to decode a binary capture? */
+    if (app.replay_file) {
+        if (suns_app_replay(&app) < 0)
+            exit(EXIT_FAILURE);
+        else
+            exit(EXIT_SUCCESS);
+    }
+
+    /* poll a list of devices, or pipeline reads of a single
+       modbus tcp device */
+    if (app.device_list ||
+        ((app.pipeline > 0) && (app.transport == SUNS_TCP) &&
+         ! app.test_server && ! app.bus_units)) {
+        if (suns_app_poll_devices(&app) < 0)
+            exit(EXIT_FAILURE);
+        exit(EXIT_SUCCESS);
+    }
+
     /* initialize the modbus layer (same for server and client) */
     if (suns_init_modbus(&app) < 0) {
         exit(EXIT_FAILURE);
     }
 
+    /* read every unit on a shared bus */
+    if (app.bus_units) {
+        if (suns_app_poll_bus(&app) < 0)
+            exit(EXIT_FAILURE);
+        exit(EXIT_SUCCESS);
+    }
+
+    /* run as a polling daemon */
+    if (app.poll_interval > 0) {
+        if (suns_app_poll(&app) < 0)
+            exit(EXIT_FAILURE);
+        exit(EXIT_SUCCESS);
+    }
+
     /* run server / slave */
     if (app.test_server) {
         debug("test server mode - acting as modbus slave");
@@ -878,15 +1575,16 @@ int main(int argc, char **argv)
     } else {
         /* run client / master */
         debug("suns client (master) mode");
-        device = suns_device_new();
+        device = suns_device_new_with_arena();
 
         if (device == NULL) {
-            error("memory error: suns_device_new() failed");
+            error("memory error: suns_device_new_with_arena() failed");
             exit(EXIT_FAILURE);
         }
         
         device->lid = app.lid;
         device->ns = app.ns;
+        device->columnar = suns_output_columnar(app.output_fmt);
                   
         if (suns_app_read_device(&app, device) < 0) {
             error("failure while reading device");
@@ -894,7 +1592,13 @@ int main(int argc, char **argv)
             suns_device_free(device);
         }
         
-        suns_device_output(app.output_fmt, device, stdout);
+        sink_t *out = sink_new_file(stdout);
+        if (out == NULL) {
+            error("memory error: sink_new_file() failed");
+            exit(EXIT_FAILURE);
+        }
+        suns_device_output(app.output_fmt, device, out);
+        sink_free(out);
     }
     
     exit(EXIT_SUCCESS);
@@ -907,7 +1611,8 @@ int main(int argc, char **argv)
  * blocks of registers larger than what is allowed in a single modbus
  * read.  A maximum of 125 registers may be read in a single read, per
  * the modbus application protocol spec.  The number of registers read
- * in a single modbus read can be set using app->max_modbus_read.
+ * in a single modbus read can be set using app->max_modbus_read, and
+ * gets smaller if the device rejects reads that long.
  *
  * \param app app context
  * \param start starting registers
@@ -922,21 +1627,25 @@ int suns_app_read_registers(suns_app_t *app,
 {
     int rc = 0;
     int reg_offset = 0;
+    int max_read = app->link.max_read;
 
     while (reg_offset < len) {
-        int read_len = min((len - reg_offset), app->max_modbus_read);
+        int read_len = min((len - reg_offset), app->link.max_read);
         
         debug("start = %d, read_len = %d, (len - reg_offset) = %d", start + 1 + reg_offset, read_len, (len - reg_offset));
 
-        int retries;
-        rc = -1;
-        for (retries = 0; retries < app->retries && rc < 0; retries++) { 
-            if (verbose_level > 1)
-                fprintf(stderr, "    read register %d, length %d, retry %d\n",
-                        start + 1 + reg_offset, read_len, retries);
-            rc = modbus_read_registers(app->mb_ctx, start + reg_offset,
-                                       read_len, regs + reg_offset);
-        }
+        if (verbose_level > 1)
+            fprintf(stderr, "    read register %d, length %d\n",
+                    start + 1 + reg_offset, read_len);
+        rc = suns_app_modbus_read(app, start + reg_offset,
+                                  read_len, regs + reg_offset);
+
+        /* some devices answer reads longer than they support with an
+           exception, so try again with shorter reads */
+        if ((rc < 0) &&
+            ((errno == EMBXILVAL) || (errno == EMBXILADD)) &&
+            (suns_link_reject_read(&(app->link), read_len) > 0))
+            continue;
 
         if (rc < 0) {
             debug("modbus_read_registers() returned %d: %s",
@@ -944,6 +1653,8 @@ int suns_app_read_registers(suns_app_t *app,
             error("modbus_read_registers() failed: register %d, "
                   "length %d on address %d",
                   start + 1 + reg_offset , read_len, app->addr);
+            /* shorter reads didn't help, so length wasn't the problem */
+            app->link.max_read = max_read;
             return -1;
         }
 
@@ -954,6 +1665,7 @@ int suns_app_read_registers(suns_app_t *app,
 }
 
 
+
 int suns_app_model_search_path(suns_app_t *app, char const *path)
 {
     int rc = 0;
@@ -43,6 +43,7 @@
 #include <modbus.h>
 
 #include "suns_model.h"
+#include "suns_map.h"
 
 
 
@@ -88,6 +89,21 @@ typedef struct suns_app {
     int override_model_searchpath;  /* don't load from search path */
     char *model_searchpath;  /* search path for model files */
     int check_only;       /* check models then exit */
+    suns_map_t *map;      /* register map of the device, once discovered */
+    suns_link_t link;     /* read size and timeout learned for the device */
+    char *map_cache_dir;  /* directory of cached register maps, or NULL */
+    int poll_interval;    /* daemon mode poll interval, in milliseconds,
+                             or 0 to read once */
+    char *device_list;    /* file listing devices to poll concurrently */
+    int threads;          /* poller worker threads */
+    int pipeline;         /* modbus tcp reads kept in flight, or 0 to
+                             use libmodbus one read at a time */
+    char *bus_units;      /* unit ids to read in turn on one bus */
+    int keyframe;         /* when polling, decode and output only the
+                             values that changed, and everything every
+                             keyframe polls (0: only the first poll);
+                             -1 to output everything every poll */
+    char *replay_file;    /* binary capture to decode, or "-" for stdin */
 } suns_app_t;
 
 
@@ -99,7 +115,18 @@ int suns_init_modbus(suns_app_t *app);
 int suns_app_swap_registers(uint16_t *reg,
                             int num_regs,
                             unsigned char *buf);
+int suns_app_find_signature(suns_app_t *app);
+int suns_app_discover_map(suns_app_t *app, suns_map_t *map);
+int suns_app_read_map(suns_app_t *app,
+                      suns_map_t *map,
+                      suns_device_t *device);
+int suns_app_map_cache_path(suns_app_t *app, char *path, size_t len);
+int suns_app_validate_map(suns_app_t *app, suns_map_t *map);
+suns_map_t *suns_app_load_cached_map(suns_app_t *app);
 int suns_app_read_device(suns_app_t *app, suns_device_t *device);
+int suns_app_poll(suns_app_t *app);
+int suns_app_poll_devices(suns_app_t *app);
+int suns_app_poll_bus(suns_app_t *app);
 int suns_app_read_data_model(modbus_t *ctx);
 void suns_app_help(int argc, char *argv[]);
 int suns_app_read_registers(suns_app_t *app,
@@ -109,6 +136,7 @@ int suns_app_read_registers(suns_app_t *app,
 int suns_app_model_search_path(suns_app_t *app, char const *path);
 int suns_app_model_search_dir(suns_app_t *app, char const *dirpath);
 int suns_app_logger_host(suns_app_t *app);
+int suns_app_replay(suns_app_t *app);
 
 
 #endif /* _SUNS_APP_H_ */
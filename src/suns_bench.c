@@ -0,0 +1,1083 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * suns_bench.c
+ *
+ * Micro-benchmarks for the decode path.
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <endian.h>
+#include <getopt.h>
+#include <sys/time.h>
+
+#include "trx/macros.h"
+#include "trx/debug.h"
+#include "trx/vector.h"
+#include "suns_model.h"
+#include "suns_columns.h"
+#include "suns_view.h"
+#include "suns_regs.h"
+#include "suns_samples.h"
+#include "suns_parser.h"
+#include "suns_output.h"
+
+
+#define BENCH_MODEL_FILE "../models/smdx/smdx_00404.xml"
+#define BENCH_DID 404
+#define BENCH_COLUMN "InDCA"   /* summed over every instance */
+
+
+typedef struct bench_ctx {
+    suns_did_index_t *did_index;
+    suns_model_t *model;
+    unsigned char *buf;      /* did, length and model registers */
+    size_t len;              /* in bytes */
+    int repeats;             /* instances of the repeating block */
+    int iterations;
+} bench_ctx_t;
+
+typedef int (*bench_f)(bench_ctx_t *ctx, const char **name);
+
+int bench_decode(bench_ctx_t *ctx, const char **name);
+int bench_decode_arena(bench_ctx_t *ctx, const char **name);
+int bench_decode_columns(bench_ctx_t *ctx, const char **name);
+int bench_decode_samples(bench_ctx_t *ctx, const char **name);
+int bench_sum_list(bench_ctx_t *ctx, const char **name);
+int bench_sum_vector(bench_ctx_t *ctx, const char **name);
+int bench_index_list(bench_ctx_t *ctx, const char **name);
+int bench_index_vector(bench_ctx_t *ctx, const char **name);
+int bench_sum_columns(bench_ctx_t *ctx, const char **name);
+int bench_view_points(bench_ctx_t *ctx, const char **name);
+int bench_resolve_sf_by_name(bench_ctx_t *ctx, const char **name);
+int bench_decode_sf_compare(bench_ctx_t *ctx, const char **name);
+int bench_regs_load_scalar(bench_ctx_t *ctx, const char **name);
+int bench_regs_load(bench_ctx_t *ctx, const char **name);
+int bench_find_dp_search(bench_ctx_t *ctx, const char **name);
+int bench_find_dp_index(bench_ctx_t *ctx, const char **name);
+int bench_format_sf_string(bench_ctx_t *ctx, const char **name);
+int bench_format_sf(bench_ctx_t *ctx, const char **name);
+int bench_write_xml(bench_ctx_t *ctx, const char **name);
+int bench_write_xml_escaped(bench_ctx_t *ctx, const char **name);
+int bench_write_json_escaped(bench_ctx_t *ctx, const char **name);
+int bench_write_json(bench_ctx_t *ctx, const char **name);
+int bench_write_json_columns(bench_ctx_t *ctx, const char **name);
+
+
+/* count calls to the allocator, so each benchmark can report what it
+   costs in allocations as well as time.  this relies on the glibc
+   names for the real allocator. */
+static unsigned long bench_mallocs = 0;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+    bench_mallocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    bench_mallocs++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    bench_mallocs++;
+    return __libc_realloc(ptr, size);
+}
+
+
+static double bench_now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+
+static void bench_report(const char *name, int iterations, double elapsed,
+                         unsigned long mallocs)
+{
+    printf("%-28s %8d iterations %10.3f us/iteration %8.1f allocs/iteration\n",
+           name, iterations, (elapsed * 1000000.0) / iterations,
+           (double) mallocs / iterations);
+}
+
+
+/* build a register image of the benchmark model with ctx->repeats
+   instances of the repeating block.  every register is set to 1, so
+   scale factors are implemented and no warnings are produced. */
+static int bench_build_buf(bench_ctx_t *ctx)
+{
+    suns_model_t *m = ctx->model;
+    int regs = m->base_len + (ctx->repeats * (m->len - m->base_len));
+    uint16_t *p;
+    int i;
+
+    ctx->len = (regs + 2) * 2;
+    ctx->buf = malloc(ctx->len);
+    if (ctx->buf == NULL) {
+        error("memory error: can't malloc() %zd bytes", ctx->len);
+        return -1;
+    }
+
+    p = (uint16_t *) ctx->buf;
+    p[0] = htobe16(BENCH_DID);
+    p[1] = htobe16(regs);
+    for (i = 0; i < regs; i++) {
+        p[i + 2] = htobe16(1);
+    }
+
+    return 0;
+}
+
+
+/* decode with scale factors bound to plan steps at load time */
+int bench_decode(bench_ctx_t *ctx, const char **name)
+{
+    *name = __FUNCTION__;
+
+    int i;
+    unsigned long mallocs = bench_mallocs;
+    double start = bench_now();
+
+    for (i = 0; i < ctx->iterations; i++) {
+        suns_dataset_t *data = suns_decode_data(ctx->did_index,
+                                                ctx->buf, ctx->len);
+        if (data == NULL)
+            return -1;
+        suns_dataset_free(data);
+    }
+
+    bench_report(*name, ctx->iterations, bench_now() - start,
+                 bench_mallocs - mallocs);
+
+    return 0;
+}
+
+
+/* decode into an arena that is reset between decodes, as a polled
+   device is */
+int bench_decode_arena(bench_ctx_t *ctx, const char **name)
+{
+    *name = __FUNCTION__;
+
+    int i;
+    arena_t *arena = arena_new(0);
+    unsigned long mallocs;
+    double start;
+
+    if (arena == NULL)
+        return -1;
+
+    mallocs = bench_mallocs;
+    start = bench_now();
+
+    for (i = 0; i < ctx->iterations; i++) {
+        suns_dataset_t *data;
+
+        arena_reset(arena);
+        data = suns_dataset_new_in(arena);
+        if ((data == NULL) ||
+            (suns_decode_dataset(ctx->did_index, ctx->buf, ctx->len,
+                                 data) < 0)) {
+            arena_free(arena);
+            return -1;
+        }
+    }
+
+    bench_report(*name, ctx->iterations, bench_now() - start,
+                 bench_mallocs - mallocs);
+
+    verbose(1, "arena: %lu blocks, %zd bytes used per decode",
+            arena->mallocs, arena_used(arena));
+    arena_free(arena);
+
+    return 0;
+}
+
+
+/* decode into columns that are kept from one decode to the next */
+int bench_decode_columns(bench_ctx_t *ctx, const char **name)
+{
+    *name = __FUNCTION__;
+
+    int i;
+    suns_dataset_t *data = suns_dataset_new_columnar();
+    unsigned long mallocs;
+    double start;
+
+    if (data == NULL)
+        return -1;
+
+    mallocs = bench_mallocs;
+    start = bench_now();
+
+    for (i = 0; i < ctx->iterations; i++) {
+        if (suns_decode_dataset(ctx->did_index, ctx->buf, ctx->len,
+                                data) < 0) {
+            suns_dataset_free(data);
+            return -1;
+        }
+    }
+
+    bench_report(*name, ctx->iterations, bench_now() - start,
+                 bench_mallocs - mallocs);
+
+    suns_dataset_free(data);
+
+    return 0;
+}
+
+
+/* decode into 16 byte samples that refer to the decode plan */
+int bench_decode_samples(bench_ctx_t *ctx, const char **name)
+{
+    *name = __FUNCTION__;
+
+    int i;
+    suns_dataset_t *data = suns_dataset_new_samples();
+    unsigned long mallocs;
+    double start;
+
+    if (data == NULL)
+        return -1;
+
+    mallocs = bench_mallocs;
+    start = bench_now();
+
+    for (i = 0; i < ctx->iterations; i++) {
+        if (suns_decode_dataset(ctx->did_index, ctx->buf, ctx->len,
+                                data) < 0) {
+            suns_dataset_free(data);
+            return -1;
+        }
+    }
+
+    bench_report(*name, ctx->iterations, bench_now() - start,
+                 bench_mallocs - mallocs);
+    printf("    %d samples, %zd bytes each; a value and its list node "
+           "take %zd\n", data->samples->count, sizeof(suns_sample_t),
+           sizeof(suns_value_t) + sizeof(list_node_t));
+
+    suns_dataset_free(data);
+
+    return 0;
+}
+
+
+/* add up one datapoint of every instance of the repeating block by
+   walking the values list */
+int bench_sum_list(bench_ctx_t *ctx, const char **name)
+{
+    *name = __FUNCTION__;
+
+    int i;
+    int64_t sum = 0;
+    list_node_t *c;
+    suns_dataset_t *data = suns_decode_data(ctx->did_index,
+                                            ctx->buf, ctx->len);
+    if (data == NULL)
+        return -1;
+
+    unsigned long mallocs = bench_mallocs;
+    double start = bench_now();
+
+    for (i = 0; i < ctx->iterations; i++) {
+        list_for_each(data->values, c) {
+            suns_value_t *v = c->data;
+            if (v->repeating &&
+                (v->meta == SUNS_VALUE_OK) &&
+                (strcmp(v->name, BENCH_COLUMN) == 0))
+                sum += suns_value_get_int16(v);
+        }
+    }
+
+    bench_report(*name, ctx->iterations, bench_now() - start,
+                 bench_mallocs - mallocs);
+    verbose(1, "sum = %lld", (long long) sum);
+
+    suns_dataset_free(data);
+
+    return 0;
+}
+
+
+/* the same sum from a vector of the values, which is what moving
+   dataset->values from list_t to vector_t would buy */
+int bench_sum_vector(bench_ctx_t *ctx, const char **name)
+{
+    *name = __FUNCTION__;
+
+    int i, j;
+    int64_t sum = 0;
+    suns_value_t *v;
+    vector_t *values = vector_new(0);
+    suns_dataset_t *data = suns_decode_data(ctx->did_index,
+                                            ctx->buf, ctx->len);
+    if ((values == NULL) || (data == NULL) ||
+        (vector_append_list(values, data->values) < 0))
+        return -1;
+
+    unsigned long mallocs = bench_mallocs;
+    double start = bench_now();
+
+    for (i = 0; i < ctx->iterations; i++) {
+        vector_for_each(values, j, v) {
+            if (v->repeating &&
+                (v->meta == SUNS_VALUE_OK) &&
+                (strcmp(v->name, BENCH_COLUMN) == 0))
+                sum += suns_value_get_int16(v);
+        }
+    }
+
+    bench_report(*name, ctx->iterations, bench_now() - start,
+                 bench_mallocs - mallocs);
+    verbose(1, "sum = %lld", (long long) sum);
+
+    vector_free(values, NULL);
+    suns_dataset_free(data);
+
+    return 0;
+}
+
+
+/* positions in the values list of the instances of BENCH_COLUMN,
+   or NULL.  *n is set to how many there are */
+static unsigned int *bench_column_positions(suns_dataset_t *data, int *n)
+{
+    list_node_t *c;
+    unsigned int i = 0;
+    unsigned int *pos = malloc(sizeof(unsigned int) *
+                               max(list_count(data->values), 1));
+    if (pos == NULL)
+        return NULL;
+
+    *n = 0;
+    list_for_each(data->values, c) {
+        suns_value_t *v = c->data;
+        if (v->repeating && (strcmp(v->name, BENCH_COLUMN) == 0))
+            pos[(*n)++] = i;
+        i++;
+    }
+
+    return pos;
+}
+
+
+/* the same sum, fetching each instance by its position in the values
+   list, which is what an indexed lookup on a list_t costs */
+int bench_index_list(bench_ctx_t *ctx, const char **name)
+{
+    *name = __FUNCTION__;
+
+    int i, j, n;
+    int64_t sum = 0;
+    unsigned int *pos;
+    suns_dataset_t *data = suns_decode_data(ctx->did_index,
+                                            ctx->buf, ctx->len);
+    if ((data == NULL) ||
+        ((pos = bench_column_positions(data, &n)) == NULL))
+        return -1;
+
+    unsigned long mallocs = bench_mallocs;
+    double start = bench_now();
+
+    for (i = 0; i < ctx->iterations; i++) {
+        for (j = 0; j < n; j++) {
+            suns_value_t *v = list_get_node_number(data->values,
+                                                   pos[j])->data;
+            if (v->meta == SUNS_VALUE_OK)
+                sum += suns_value_get_int16(v);
+        }
+    }
+
+    bench_report(*name, ctx->iterations, bench_now() - start,
+                 bench_mallocs - mallocs);
+    verbose(1, "sum = %lld", (long long) sum);
+
+    free(pos);
+    suns_dataset_free(data);
+
+    return 0;
+}
+
+
+/* the same indexed lookups from a vector of the values */
+int bench_index_vector(bench_ctx_t *ctx, const char **name)
+{
+    *name = __FUNCTION__;
+
+    int i, j, n;
+    int64_t sum = 0;
+    unsigned int *pos;
+    vector_t *values = vector_new(0);
+    suns_dataset_t *data = suns_decode_data(ctx->did_index,
+                                            ctx->buf, ctx->len);
+    if ((values == NULL) || (data == NULL) ||
+        (vector_append_list(values, data->values) < 0) ||
+        ((pos = bench_column_positions(data, &n)) == NULL))
+        return -1;
+
+    unsigned long mallocs = bench_mallocs;
+    double start = bench_now();
+
+    for (i = 0; i < ctx->iterations; i++) {
+        for (j = 0; j < n; j++) {
+            suns_value_t *v = vector_get(values, pos[j]);
+            if (v->meta == SUNS_VALUE_OK)
+                sum += suns_value_get_int16(v);
+        }
+    }
+
+    bench_report(*name, ctx->iterations, bench_now() - start,
+                 bench_mallocs - mallocs);
+    verbose(1, "sum = %lld", (long long) sum);
+
+    free(pos);
+    vector_free(values, NULL);
+    suns_dataset_free(data);
+
+    return 0;
+}
+
+
+/* the same sum from the datapoint's column */
+int bench_sum_columns(bench_ctx_t *ctx, const char **name)
+{
+    *name = __FUNCTION__;
+
+    int i, j;
+    int64_t sum = 0;
+    suns_column_t *col;
+    suns_dataset_t *data = suns_dataset_new_columnar();
+
+    if ((data == NULL) ||
+        (suns_decode_dataset(ctx->did_index, ctx->buf, ctx->len, data) < 0))
+        return -1;
+
+    col = suns_columns_find(data->columns, BENCH_COLUMN);
+    if (col == NULL) {
+        error("no column %s", BENCH_COLUMN);
+        return -1;
+    }
+
+    unsigned long mallocs = bench_mallocs;
+    double start = bench_now();
+
+    for (i = 0; i < ctx->iterations; i++) {
+        int16_t *x = col->data;
+        for (j = 0; j < data->columns->count; j++) {
+            if (suns_column_is_implemented(col, j))
+                sum += x[j];
+        }
+    }
+
+    bench_report(*name, ctx->iterations, bench_now() - start,
+                 bench_mallocs - mallocs);
+    verbose(1, "sum = %lld", (long long) sum);
+
+    suns_dataset_free(data);
+
+    return 0;
+}
+
+
+/* a health check that wants a few points out of the model, read
+   through a view instead of decoding everything */
+int bench_view_points(bench_ctx_t *ctx, const char **name)
+{
+    *name = __FUNCTION__;
+
+    int i, j;
+    suns_view_t view;
+    suns_value_t v;
+    char *points[] = { "DCW", "DCWh", "Evt" };
+    int steps[3];
+
+    if (suns_view_init(&view, ctx->did_index, ctx->buf, ctx->len) < 0)
+        return -1;
+    for (j = 0; j < 3; j++) {
+        steps[j] = suns_view_find(&view, points[j]);
+        if (steps[j] < 0) {
+            error("no datapoint %s", points[j]);
+            return -1;
+        }
+    }
+
+    unsigned long mallocs = bench_mallocs;
+    double start = bench_now();
+
+    for (i = 0; i < ctx->iterations; i++) {
+        if (suns_view_init(&view, ctx->did_index, ctx->buf, ctx->len) < 0)
+            return -1;
+        for (j = 0; j < 3; j++) {
+            if (suns_view_get(&view, steps[j], 0, &v) < 0)
+                return -1;
+        }
+    }
+
+    bench_report(*name, ctx->iterations, bench_now() - start,
+                 bench_mallocs - mallocs);
+
+    suns_view_clear(&view);
+
+    return 0;
+}
+
+
+/* the per-dataset name search that used to follow every decode */
+int bench_resolve_sf_by_name(bench_ctx_t *ctx, const char **name)
+{
+    *name = __FUNCTION__;
+
+    int i;
+    suns_dataset_t *data = suns_decode_data(ctx->did_index,
+                                            ctx->buf, ctx->len);
+    if (data == NULL)
+        return -1;
+
+    unsigned long mallocs = bench_mallocs;
+    double start = bench_now();
+
+    for (i = 0; i < ctx->iterations; i++) {
+        if (suns_resolve_scale_factors(data) < 0)
+            return -1;
+    }
+
+    bench_report(*name, ctx->iterations, bench_now() - start,
+                 bench_mallocs - mallocs);
+
+    suns_dataset_free(data);
+
+    return 0;
+}
+
+
+/* the scale factor resolution every decode used to end with: a search
+   of the whole value list for each value that names a scale factor */
+static void bench_resolve_sf_search(suns_dataset_t *data)
+{
+    list_node_t *c;
+    suns_value_t *v;
+    suns_value_t *sf;
+
+    list_for_each(data->values, c) {
+        v = c->data;
+        if (v->tp.name && suns_type_is_numeric(v->tp.type)) {
+            sf = suns_search_value_list(data->values, v->tp.name);
+            if (sf && (sf->tp.type == SUNS_SF))
+                suns_value_apply_sf(v, sf);
+        }
+    }
+}
+
+
+/* time iterations of a decode of ctx->buf, followed by the old scale
+   factor search if search is set, and return the us per decode */
+static double bench_decode_sf_time(bench_ctx_t *ctx, int iterations,
+                                   int search)
+{
+    int i;
+    double start = bench_now();
+
+    for (i = 0; i < iterations; i++) {
+        suns_dataset_t *data = suns_decode_data(ctx->did_index,
+                                                ctx->buf, ctx->len);
+        if (data == NULL)
+            return -1;
+        if (search)
+            bench_resolve_sf_search(data);
+        suns_dataset_free(data);
+    }
+
+    return ((bench_now() - start) * 1000000.0) / iterations;
+}
+
+
+/* decode the same register images with scale factors found by the old
+   per-value search and bound to plan steps at load time, from one
+   repeating block to twice the -n count.  the search runs after a
+   decode that has already bound them, so the old path is the new one
+   plus the search it no longer does. */
+int bench_decode_sf_compare(bench_ctx_t *ctx, const char **name)
+{
+    *name = __FUNCTION__;
+
+    int counts[] = { 1, 8, ctx->repeats, ctx->repeats * 2 };
+    int saved_repeats = ctx->repeats;
+    unsigned char *saved_buf = ctx->buf;
+    size_t saved_len = ctx->len;
+    int rc = 0;
+    int i, iterations;
+    double searched, bound;
+
+    printf("%-28s %8s %14s %14s %8s\n", *name, "repeats",
+           "search us", "bound us", "ratio");
+
+    for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        ctx->repeats = counts[i];
+        if (bench_build_buf(ctx) < 0) {
+            rc = -1;
+            break;
+        }
+
+        /* the search is quadratic; keep the larger models from
+           taking all day */
+        iterations = max(ctx->iterations / max(counts[i] / 8, 1), 100);
+        searched = bench_decode_sf_time(ctx, iterations, 1);
+        bound = bench_decode_sf_time(ctx, iterations, 0);
+        free(ctx->buf);
+        if ((searched < 0) || (bound < 0)) {
+            rc = -1;
+            break;
+        }
+
+        printf("%-28s %8d %14.3f %14.3f %7.1fx\n", "", counts[i],
+               searched, bound, searched / bound);
+    }
+
+    ctx->repeats = saved_repeats;
+    ctx->buf = saved_buf;
+    ctx->len = saved_len;
+
+    return rc;
+}
+
+
+typedef void (*bench_regs_load_f)(const unsigned char *buf, int n,
+                                  uint16_t *regs, suns_regs_masks_t *masks);
+
+static int bench_regs(bench_ctx_t *ctx, const char *name,
+                      bench_regs_load_f load)
+{
+    int i;
+    int n = ctx->len / 2;
+    int mask_size = suns_regs_mask_size(n);
+    uint16_t *regs = malloc((n * sizeof(uint16_t)) + (3 * mask_size));
+    suns_regs_masks_t masks;
+    unsigned long sum = 0;
+
+    if (regs == NULL) {
+        error("memory error: can't malloc() %d registers", n);
+        return -1;
+    }
+    masks.min = (uint8_t *) (regs + n);
+    masks.max = masks.min + mask_size;
+    masks.zero = masks.max + mask_size;
+
+    unsigned long mallocs = bench_mallocs;
+    double start = bench_now();
+
+    for (i = 0; i < ctx->iterations; i++) {
+        load(ctx->buf, n, regs, &masks);
+        sum += regs[i & 1] + masks.max[0];
+    }
+
+    bench_report(name, ctx->iterations, bench_now() - start,
+                 bench_mallocs - mallocs);
+    debug("checksum %lu", sum);
+
+    free(regs);
+
+    return 0;
+}
+
+
+/* swapping the model's registers into host order and marking the
+   not-implemented markers, one register at a time */
+int bench_regs_load_scalar(bench_ctx_t *ctx, const char **name)
+{
+    *name = __FUNCTION__;
+
+    return bench_regs(ctx, *name, suns_regs_load_scalar);
+}
+
+
+/* the same with the best kernel the cpu supports */
+int bench_regs_load(bench_ctx_t *ctx, const char **name)
+{
+    *name = __FUNCTION__;
+
+    return bench_regs(ctx, *name, suns_regs_load);
+}
+
+
+void bench_usage(char *argv0)
+{
+    printf("Usage: %s [-m model file] [-n repeats] [-i iterations] [-v]\n",
+           argv0);
+    printf("   -m: model file to load (default: %s)\n", BENCH_MODEL_FILE);
+    printf("   -n: instances of the repeating block (default: 32)\n");
+    printf("   -i: iterations of each benchmark (default: 10000)\n");
+    printf("   -v: verbose level (up to -vvvv for most verbose)\n");
+}
+
+
+/* look up every datapoint of the model by name, as the host parser
+   does for every point of a logger post */
+static int bench_find_dps(bench_ctx_t *ctx, const char *name, int indexed)
+{
+    int i, j;
+    int n = 0;
+    list_node_t *c, *d;
+    hash_t *dp_index = ctx->model->dp_index;
+
+    list_for_each(ctx->model->dp_blocks, c) {
+        suns_dp_block_t *dp_block = c->data;
+        n += list_count(dp_block->dp_list);
+    }
+    char **names = malloc(sizeof(char *) * n);
+    if (names == NULL)
+        return -1;
+    n = 0;
+    list_for_each(ctx->model->dp_blocks, c) {
+        suns_dp_block_t *dp_block = c->data;
+        list_for_each(dp_block->dp_list, d)
+            names[n++] = ((suns_dp_t *) d->data)->name;
+    }
+
+    /* without the index the blocks are searched */
+    if (! indexed)
+        ctx->model->dp_index = NULL;
+
+    unsigned long mallocs = bench_mallocs;
+    double start = bench_now();
+
+    for (i = 0; i < ctx->iterations; i++) {
+        for (j = 0; j < n; j++) {
+            if (suns_search_model_for_dp_by_name(ctx->model, names[j],
+                                                 NULL) == NULL) {
+                ctx->model->dp_index = dp_index;
+                free(names);
+                return -1;
+            }
+        }
+    }
+
+    bench_report(name, ctx->iterations, bench_now() - start,
+                 bench_mallocs - mallocs);
+
+    ctx->model->dp_index = dp_index;
+    free(names);
+
+    return 0;
+}
+
+
+int bench_find_dp_search(bench_ctx_t *ctx, const char **name)
+{
+    *name = __FUNCTION__;
+    return bench_find_dps(ctx, *name, 0);
+}
+
+
+int bench_find_dp_index(bench_ctx_t *ctx, const char **name)
+{
+    *name = __FUNCTION__;
+    return bench_find_dps(ctx, *name, 1);
+}
+
+
+/* a spread of register values and scale factors like those found in
+   inverter models */
+static const struct {
+    int64_t x;
+    int sf;
+} bench_sf_values[] = {
+    { 2305, -1 }, { -1520, -2 }, { 60012, -3 }, { 480, 0 },
+    { 123456789, -3 }, { 7, -2 }, { -32768, 1 }, { 4294967295LL, -4 },
+};
+
+typedef int (*bench_format_f)(char *buf, size_t len, int64_t x, int e,
+                              int maxdigits);
+
+/* the formatting used before suns_format_decimal(): convert the
+   integer to a string and insert the decimal point */
+static int bench_format_string(char *buf, size_t len, int64_t x, int e,
+                               int maxdigits)
+{
+    char base[BUFFER_SIZE];
+
+    snprintf(base, sizeof(base), "%" PRId64, x);
+    return _suns_snprintf_int_sf(buf, len, base, e, maxdigits);
+}
+
+static int bench_format(bench_ctx_t *ctx, const char *name,
+                        bench_format_f format)
+{
+    int i, j;
+    int n = sizeof(bench_sf_values) / sizeof(bench_sf_values[0]);
+    char buf[BUFFER_SIZE];
+    unsigned long sum = 0;
+
+    unsigned long mallocs = bench_mallocs;
+    double start = bench_now();
+
+    for (i = 0; i < ctx->iterations; i++) {
+        for (j = 0; j < n; j++) {
+            format(buf, sizeof(buf), bench_sf_values[j].x,
+                   bench_sf_values[j].sf, 16);
+            sum += buf[1];
+        }
+    }
+
+    bench_report(name, ctx->iterations, bench_now() - start,
+                 bench_mallocs - mallocs);
+    debug("checksum %lu", sum);
+
+    return 0;
+}
+
+
+/* formatting a batch of scaled values through a temporary string */
+int bench_format_sf_string(bench_ctx_t *ctx, const char **name)
+{
+    *name = __FUNCTION__;
+    return bench_format(ctx, *name, bench_format_string);
+}
+
+
+/* the same with the digit pair formatter */
+int bench_format_sf(bench_ctx_t *ctx, const char **name)
+{
+    *name = __FUNCTION__;
+    return bench_format(ctx, *name, suns_snprintf_int_sf);
+}
+
+
+/* write a decoded dataset into a memory sink.  if escape is set the
+   values lose their output fragments, as values that don't come
+   from a decode plan have none.  if columnar is set the repeating
+   block is decoded into columns, as it is for a polled device. */
+static int bench_write(bench_ctx_t *ctx, const char *name,
+                       suns_dataset_write_f write, int escape, int columnar)
+{
+    int i;
+    sink_t *sink = sink_new_memory(0);
+    suns_dataset_t *data;
+    list_node_t *c;
+    size_t total = 0;
+
+    if (columnar) {
+        data = suns_dataset_new_columnar();
+        if ((data != NULL) &&
+            (suns_decode_dataset(ctx->did_index, ctx->buf, ctx->len,
+                                 data) < 0)) {
+            suns_dataset_free(data);
+            data = NULL;
+        }
+    } else {
+        data = suns_decode_data(ctx->did_index, ctx->buf, ctx->len);
+    }
+
+    if ((sink == NULL) || (data == NULL))
+        return -1;
+
+    if (escape) {
+        list_for_each(data->values, c) {
+            ((suns_value_t *) c->data)->step = -1;
+        }
+    }
+
+    unsigned long mallocs = bench_mallocs;
+    double start = bench_now();
+
+    for (i = 0; i < ctx->iterations; i++) {
+        sink_reset(sink);
+        if (write(sink, data) < 0)
+            return -1;
+        total += sink_len(sink);
+    }
+
+    bench_report(name, ctx->iterations, bench_now() - start,
+                 bench_mallocs - mallocs);
+    debug("%zd bytes per dataset", total / ctx->iterations);
+
+    suns_dataset_free(data);
+    sink_free(sink);
+
+    return 0;
+}
+
+
+/* logger xml, escaping each datapoint's id as it goes */
+int bench_write_xml_escaped(bench_ctx_t *ctx, const char **name)
+{
+    *name = __FUNCTION__;
+    return bench_write(ctx, *name, suns_dataset_xml_write, 1, 0);
+}
+
+
+/* logger xml, copying the ids escaped with the decode plan */
+int bench_write_xml(bench_ctx_t *ctx, const char **name)
+{
+    *name = __FUNCTION__;
+    return bench_write(ctx, *name, suns_dataset_xml_write, 0, 0);
+}
+
+
+/* json, escaping each datapoint's name, units and label as it goes */
+int bench_write_json_escaped(bench_ctx_t *ctx, const char **name)
+{
+    *name = __FUNCTION__;
+    return bench_write(ctx, *name, suns_dataset_json_write, 1, 0);
+}
+
+
+/* json, copying the fragments kept with the decode plan */
+int bench_write_json(bench_ctx_t *ctx, const char **name)
+{
+    *name = __FUNCTION__;
+    return bench_write(ctx, *name, suns_dataset_json_write, 0, 0);
+}
+
+
+/* json, written straight from the columns of the repeating block */
+int bench_write_json_columns(bench_ctx_t *ctx, const char **name)
+{
+    *name = __FUNCTION__;
+    return bench_write(ctx, *name, suns_dataset_json_write, 0, 1);
+}
+
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    int i;
+    int rc = 0;
+    char *model_file = BENCH_MODEL_FILE;
+    const char *bench_name;
+    bench_ctx_t ctx;
+
+    memset(&ctx, 0, sizeof(bench_ctx_t));
+    ctx.repeats = 32;
+    ctx.iterations = 10000;
+
+    while ((opt = getopt(argc, argv, "m:n:i:vh")) != -1) {
+        switch (opt) {
+        case 'm':
+            model_file = optarg;
+            break;
+
+        case 'n':
+            ctx.repeats = atoi(optarg);
+            break;
+
+        case 'i':
+            ctx.iterations = atoi(optarg);
+            break;
+
+        case 'v':
+            verbose_level++;
+            break;
+
+        default:
+            bench_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    suns_parser_init();
+    if (suns_parse_xml_model_file(model_file) < 0) {
+        error("unable to parse %s", model_file);
+        exit(EXIT_FAILURE);
+    }
+
+    ctx.did_index = suns_get_did_index();
+    suns_model_did_t *did = suns_find_did(ctx.did_index, BENCH_DID);
+    if (did == NULL) {
+        error("model %d not found in %s", BENCH_DID, model_file);
+        exit(EXIT_FAILURE);
+    }
+    ctx.model = did->model;
+    suns_model_fill_offsets(ctx.model);
+    suns_model_compile_plan(ctx.model);
+
+    if (bench_build_buf(&ctx) < 0)
+        exit(EXIT_FAILURE);
+
+    printf("model %d, %d repeating blocks, %zd registers\n",
+           BENCH_DID, ctx.repeats, (ctx.len / 2) - 2);
+
+    bench_f bench_list[] = {
+        bench_decode,
+        bench_decode_arena,
+        bench_decode_columns,
+        bench_decode_samples,
+        bench_sum_list,
+        bench_sum_vector,
+        bench_index_list,
+        bench_index_vector,
+        bench_sum_columns,
+        bench_view_points,
+        bench_resolve_sf_by_name,
+        bench_decode_sf_compare,
+        bench_regs_load_scalar,
+        bench_regs_load,
+        bench_find_dp_search,
+        bench_find_dp_index,
+        bench_format_sf_string,
+        bench_format_sf,
+        bench_write_xml,
+        bench_write_xml_escaped,
+        bench_write_json_escaped,
+        bench_write_json,
+        bench_write_json_columns,
+        NULL,
+    };
+
+    for (i = 0; bench_list[i] != NULL; i++) {
+        if (bench_list[i](&ctx, &bench_name) < 0) {
+            printf("FAIL:  %s\n", bench_name);
+            rc = 1;
+        }
+    }
+
+    free(ctx.buf);
+
+    exit(rc);
+}
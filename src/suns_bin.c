@@ -0,0 +1,506 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * suns_bin.c
+ *
+ * compact binary record format for device reads
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+
+#include "trx/macros.h"
+#include "trx/debug.h"
+#include "trx/hash.h"
+#include "suns_bin.h"
+
+
+static void suns_bin_put16(sink_t *sink, uint16_t x)
+{
+    x = htole16(x);
+    sink_write(sink, (const char *) &x, 2);
+}
+
+
+static void suns_bin_put32(sink_t *sink, uint32_t x)
+{
+    x = htole32(x);
+    sink_write(sink, (const char *) &x, 4);
+}
+
+
+static void suns_bin_put64(sink_t *sink, uint64_t x)
+{
+    x = htole64(x);
+    sink_write(sink, (const char *) &x, 8);
+}
+
+
+static void suns_bin_put_string(sink_t *sink, const char *s)
+{
+    size_t len;
+
+    if (s == NULL) {
+        suns_bin_put16(sink, SUNS_BIN_NULL);
+        return;
+    }
+
+    len = min(strlen(s), SUNS_BIN_NULL - 1);
+    suns_bin_put16(sink, len);
+    sink_write(sink, s, len);
+}
+
+
+/* overwrite a field written earlier, once its value is known */
+static void suns_bin_patch16(sink_t *sink, size_t offset, uint16_t x)
+{
+    x = htole16(x);
+    memcpy(sink_data(sink) + offset, &x, 2);
+}
+
+
+static void suns_bin_patch32(sink_t *sink, size_t offset, uint32_t x)
+{
+    x = htole32(x);
+    memcpy(sink_data(sink) + offset, &x, 4);
+}
+
+
+/* the number of v's datapoint in its model, or -1 if the model has no
+   index to number them by */
+static int suns_bin_point(suns_model_t *m, suns_value_t *v)
+{
+    suns_dp_ref_t *ref;
+
+    if (m->dp_index == NULL)
+        return -1;
+
+    ref = hash_get(m->dp_index, v->name);
+    if (ref == NULL)
+        return -1;
+
+    return ref - m->dp_refs;
+}
+
+
+/* a partial dataset is written with its points only if every one of
+   them can be numbered; otherwise the reader decodes all of them */
+static int suns_bin_points_known(suns_dataset_t *data)
+{
+    list_node_t *c;
+
+    if (list_count(data->values) >= SUNS_BIN_NULL)
+        return 0;
+
+    list_for_each(data->values, c) {
+        if (suns_bin_point(data->did->model, c->data) < 0)
+            return 0;
+    }
+
+    return 1;
+}
+
+
+static void suns_bin_write_dataset(sink_t *sink, suns_dataset_t *data)
+{
+    list_node_t *c;
+    uint16_t flags = 0;
+    int partial = data->partial && suns_bin_points_known(data);
+
+    if (data->unchanged)
+        flags |= SUNS_BIN_UNCHANGED;
+    if (partial)
+        flags |= SUNS_BIN_PARTIAL;
+
+    suns_bin_put16(sink, data->did->did);
+    suns_bin_put16(sink, data->index);
+    suns_bin_put16(sink, flags);
+    suns_bin_put16(sink, data->regs_len / 2);
+    sink_write(sink, (const char *) data->regs, data->regs_len & ~1);
+
+    if (! partial)
+        return;
+
+    suns_bin_put16(sink, list_count(data->values));
+    list_for_each(data->values, c) {
+        suns_value_t *v = c->data;
+        suns_bin_put16(sink, suns_bin_point(data->did->model, v));
+        suns_bin_put16(sink, v->index);
+    }
+}
+
+
+/**
+ * write a device read as one binary record (see suns_bin.h).
+ *
+ * only datasets that still have the registers they were decoded from
+ * can be written, which means the device needs an arena.  the others
+ * are left out.
+ *
+ * returns 0 on success or -1 if the sink failed
+ */
+int suns_device_bin_write(sink_t *sink, suns_device_t *device)
+{
+    size_t start = sink_len(sink);
+    size_t count_offset;
+    list_node_t *c;
+    int n = 0;
+
+    suns_bin_put32(sink, 0);
+    sink_write(sink, SUNS_BIN_MAGIC, 4);
+    suns_bin_put16(sink, SUNS_BIN_VERSION);
+    suns_bin_put16(sink, 0);
+    suns_bin_put64(sink, (int64_t) device->unixtime);
+    suns_bin_put32(sink, device->usec);
+    suns_bin_put16(sink, device->addr);
+    suns_bin_put_string(sink, device->lid);
+    suns_bin_put_string(sink, device->ns);
+    suns_bin_put_string(sink, device->manufacturer);
+    suns_bin_put_string(sink, device->model);
+    suns_bin_put_string(sink, device->serial_number);
+
+    count_offset = sink_len(sink);
+    suns_bin_put16(sink, 0);
+
+    list_for_each(device->datasets, c) {
+        suns_dataset_t *data = c->data;
+        if (data->regs == NULL) {
+            debug("no registers kept for did %d; not written",
+                  data->did->did);
+            continue;
+        }
+        suns_bin_write_dataset(sink, data);
+        n++;
+    }
+
+    if (sink->error)
+        return -1;
+
+    suns_bin_patch16(sink, count_offset, n);
+    suns_bin_patch32(sink, start, sink_len(sink) - start - 4);
+
+    return 0;
+}
+
+
+/**
+ * read the next record from stream into *buf, which is grown (and *size
+ * updated) as needed.
+ *
+ * returns the length of the record, including its length field, 0 at
+ * the end of the stream, or -1 if the record is truncated or corrupt
+ */
+int suns_bin_fread(FILE *stream, unsigned char **buf, size_t *size)
+{
+    uint32_t len;
+    unsigned char *p;
+    size_t n;
+
+    n = fread(&len, 1, 4, stream);
+    if ((n == 0) && feof(stream))
+        return 0;
+    if (n != 4) {
+        error("truncated record length");
+        return -1;
+    }
+
+    len = le32toh(len);
+    if (len > SUNS_BIN_MAX_RECORD) {
+        error("record length %u is too long", len);
+        return -1;
+    }
+
+    if (*size < len + 4) {
+        p = realloc(*buf, len + 4);
+        if (p == NULL) {
+            error("memory error: can't read a %u byte record", len);
+            return -1;
+        }
+        *buf = p;
+        *size = len + 4;
+    }
+
+    p = *buf;
+    p[0] = len & 0xff;
+    p[1] = (len >> 8) & 0xff;
+    p[2] = (len >> 16) & 0xff;
+    p[3] = (len >> 24) & 0xff;
+    if (fread(p + 4, 1, len, stream) != len) {
+        error("truncated record");
+        return -1;
+    }
+
+    return len + 4;
+}
+
+
+/* reads fields from a record, setting error instead of running off
+   its end */
+typedef struct suns_bin_cursor {
+    const unsigned char *p;
+    const unsigned char *end;
+    int error;
+} suns_bin_cursor_t;
+
+
+static const unsigned char *suns_bin_get(suns_bin_cursor_t *cur, size_t len)
+{
+    const unsigned char *p = cur->p;
+
+    if (cur->error || (size_t) (cur->end - cur->p) < len) {
+        cur->error = 1;
+        return NULL;
+    }
+
+    cur->p += len;
+    return p;
+}
+
+
+static uint16_t suns_bin_get16(suns_bin_cursor_t *cur)
+{
+    const unsigned char *p = suns_bin_get(cur, 2);
+    uint16_t x;
+
+    if (p == NULL)
+        return 0;
+
+    memcpy(&x, p, 2);
+    return le16toh(x);
+}
+
+
+static uint32_t suns_bin_get32(suns_bin_cursor_t *cur)
+{
+    const unsigned char *p = suns_bin_get(cur, 4);
+    uint32_t x;
+
+    if (p == NULL)
+        return 0;
+
+    memcpy(&x, p, 4);
+    return le32toh(x);
+}
+
+
+static uint64_t suns_bin_get64(suns_bin_cursor_t *cur)
+{
+    const unsigned char *p = suns_bin_get(cur, 8);
+    uint64_t x;
+
+    if (p == NULL)
+        return 0;
+
+    memcpy(&x, p, 8);
+    return le64toh(x);
+}
+
+
+static char *suns_bin_get_string(suns_bin_cursor_t *cur, arena_t *arena)
+{
+    uint16_t len = suns_bin_get16(cur);
+    const unsigned char *p;
+    char *s;
+
+    if (len == SUNS_BIN_NULL)
+        return NULL;
+
+    p = suns_bin_get(cur, len);
+    if (p == NULL)
+        return NULL;
+
+    s = arena_alloc(arena, len + 1);
+    if (s == NULL)
+        return NULL;
+    memcpy(s, p, len);
+    s[len] = '\0';
+
+    return s;
+}
+
+
+/* is (point, index) among the n points of the table?  the table is in
+   the order the values were decoded, so the search starts after the
+   last match (*next) and usually ends there. */
+static int suns_bin_has_point(const unsigned char *points, int n, int *next,
+                              int point, int index)
+{
+    int i, j;
+    uint16_t x[2];
+
+    for (i = 0; i < n; i++) {
+        j = (*next + i) % n;
+        memcpy(x, points + (j * 4), 4);
+        if ((le16toh(x[0]) == point) && (le16toh(x[1]) == index)) {
+            *next = j + 1;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/* drop the values that weren't decoded when the record was written */
+static void suns_bin_keep_points(suns_dataset_t *data,
+                                 const unsigned char *points, int n)
+{
+    list_node_t *c, *next_node;
+    int next = 0;
+
+    for (c = data->values->head; c != NULL; c = next_node) {
+        suns_value_t *v = c->data;
+        int point = suns_bin_point(data->did->model, v);
+        next_node = c->next;
+        if (! suns_bin_has_point(points, n, &next, point, v->index))
+            list_node_del(data->values, c);
+    }
+}
+
+
+/**
+ * decode a record read by suns_bin_fread() back into device, replacing
+ * its datasets.  the registers of each dataset are decoded with the
+ * models in did_index, as if they had just been read.
+ *
+ * the device must have an arena (see suns_device_new_with_arena()),
+ * which holds everything decoded from the record.
+ *
+ * returns 0 on success or -1 if the record is corrupt
+ */
+int suns_bin_decode(suns_did_index_t *did_index,
+                    const unsigned char *rec,
+                    size_t len,
+                    suns_device_t *device)
+{
+    suns_bin_cursor_t cur = { rec, rec + len, 0 };
+    const unsigned char *magic;
+    char *man, *mod, *sn;
+    int i, n;
+
+    if (device->arena == NULL) {
+        error("binary records can only be decoded into a device "
+              "with an arena");
+        return -1;
+    }
+
+    if (suns_bin_get32(&cur) != len - 4) {
+        error("record length doesn't match");
+        return -1;
+    }
+
+    magic = suns_bin_get(&cur, 4);
+    if ((magic == NULL) || (memcmp(magic, SUNS_BIN_MAGIC, 4) != 0)) {
+        error("not a binary record");
+        return -1;
+    }
+
+    n = suns_bin_get16(&cur);
+    if (n != SUNS_BIN_VERSION) {
+        error("unsupported binary record version %d", n);
+        return -1;
+    }
+    suns_bin_get16(&cur);  /* flags */
+
+    suns_device_free_datasets(device);
+    device->unixtime = (time_t) (int64_t) suns_bin_get64(&cur);
+    device->usec = suns_bin_get32(&cur);
+    device->addr = suns_bin_get16(&cur);
+    device->lid = suns_bin_get_string(&cur, device->arena);
+    device->ns = suns_bin_get_string(&cur, device->arena);
+    man = suns_bin_get_string(&cur, device->arena);
+    mod = suns_bin_get_string(&cur, device->arena);
+    sn = suns_bin_get_string(&cur, device->arena);
+
+    n = suns_bin_get16(&cur);
+    for (i = 0; (i < n) && (! cur.error); i++) {
+        int did_num = suns_bin_get16(&cur);
+        int index = suns_bin_get16(&cur);
+        int flags = suns_bin_get16(&cur);
+        size_t regs_len = suns_bin_get16(&cur) * 2;
+        const unsigned char *regs = suns_bin_get(&cur, regs_len);
+        const unsigned char *points = NULL;
+        int npoints = 0;
+        suns_model_did_t *did;
+        suns_dataset_t *data;
+        unsigned char *buf;
+
+        if (flags & SUNS_BIN_PARTIAL) {
+            npoints = suns_bin_get16(&cur);
+            points = suns_bin_get(&cur, npoints * 4);
+        }
+        if (cur.error)
+            break;
+
+        did = suns_find_did(did_index, did_num);
+        if (did == NULL) {
+            warning("unknown did %d in record; skipped", did_num);
+            continue;
+        }
+
+        data = suns_dataset_new_in(device->arena);
+        buf = arena_alloc(device->arena, regs_len);
+        if ((data == NULL) || (buf == NULL)) {
+            error("memory error: can't decode did %d", did_num);
+            return -1;
+        }
+        memcpy(buf, regs, regs_len);
+
+        suns_decode_model_data(did, buf, regs_len, data);
+        data->index = index;
+        data->unchanged = (flags & SUNS_BIN_UNCHANGED) != 0;
+        if (flags & SUNS_BIN_PARTIAL) {
+            suns_bin_keep_points(data, points, npoints);
+            data->partial = 1;
+        }
+
+        suns_device_add_dataset(device, data);
+    }
+
+    if (cur.error) {
+        error("truncated record");
+        return -1;
+    }
+
+    /* a partial read may not have decoded the common model's strings */
+    if (device->manufacturer == NULL)
+        device->manufacturer = man;
+    if (device->model == NULL)
+        device->model = mod;
+    if (device->serial_number == NULL)
+        device->serial_number = sn;
+
+    return 0;
+}
@@ -0,0 +1,104 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * suns_bin.h
+ *
+ * compact binary record stream for captured device reads
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef _SUNS_BIN_H_
+#define _SUNS_BIN_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "trx/sink.h"
+#include "suns_model.h"
+
+
+/* each device read is written as one record.  multi-byte fields are
+   little-endian; the registers are kept in modbus (big-endian) order,
+   exactly as read.
+
+   record:
+     u32  length of the rest of the record
+     u8   magic[4] "SUNb"
+     u16  version (SUNS_BIN_VERSION)
+     u16  flags (0)
+     i64  unixtime
+     u32  usec
+     u16  modbus address
+     str  lid, ns, manufacturer, model, serial number
+     u16  dataset count
+     dataset[]
+
+   str:
+     u16  length, or SUNS_BIN_NULL for NULL
+     u8   chars[length] (not NUL terminated)
+
+   dataset:
+     u16  did
+     u16  index (instance of the did on the device)
+     u16  flags (SUNS_BIN_UNCHANGED, SUNS_BIN_PARTIAL)
+     u16  register count (the model data after the did and length)
+     u8   registers[count * 2]
+     if SUNS_BIN_PARTIAL, the points that were decoded:
+       u16  point count
+       point[]
+
+   point:
+     u16  datapoint number in the model (see suns_model_index_dps())
+     u16  repeating block index, or 0
+*/
+#define SUNS_BIN_MAGIC "SUNb"
+#define SUNS_BIN_VERSION 1
+#define SUNS_BIN_NULL 0xFFFF
+
+/* a record longer than this is taken to be corrupt */
+#define SUNS_BIN_MAX_RECORD (16 * 1024 * 1024)
+
+/* dataset flags */
+#define SUNS_BIN_UNCHANGED 0x0001  /* see suns_dataset_t.unchanged */
+#define SUNS_BIN_PARTIAL   0x0002  /* only some points were decoded */
+
+
+int suns_device_bin_write(sink_t *sink, suns_device_t *device);
+int suns_bin_fread(FILE *stream, unsigned char **buf, size_t *size);
+int suns_bin_decode(suns_did_index_t *did_index,
+                    const unsigned char *rec,
+                    size_t len,
+                    suns_device_t *device);
+
+#endif /* _SUNS_BIN_H_ */
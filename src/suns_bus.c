@@ -0,0 +1,222 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * suns_bus.c
+ *
+ * scheduling reads of many devices sharing one modbus bus
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ * A bus is a list of unit ids reached through one modbus context,
+ * usually a multi-drop rs-485 line.  Only one request can be on the
+ * line at a time, so the units are read in turn; what matters is not
+ * wasting the line.  The port is opened once, each unit keeps its map
+ * and datasets between cycles so steady state reads are the planned
+ * bulk reads, and units that don't answer are backed off so their
+ * timeouts don't eat every cycle.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trx/macros.h"
+#include "trx/debug.h"
+#include "suns_model.h"
+#include "suns_map.h"
+#include "suns_bus.h"
+
+
+suns_bus_t *suns_bus_new(void)
+{
+    suns_bus_t *bus = malloc(sizeof(suns_bus_t));
+    if (bus == NULL) {
+        error("memory error: can't malloc(sizeof(suns_bus_t))");
+        return NULL;
+    }
+
+    memset(bus, 0, sizeof(suns_bus_t));
+    bus->units = list_new();
+
+    return bus;
+}
+
+
+static void suns_bus_unit_free(suns_bus_unit_t *unit)
+{
+    suns_map_free(unit->map);
+    if (unit->device)
+        suns_device_free(unit->device);
+    free(unit);
+}
+
+
+void suns_bus_free(suns_bus_t *bus)
+{
+    if (bus == NULL)
+        return;
+
+    list_free(bus->units, (list_free_data_f) suns_bus_unit_free);
+    free(bus);
+}
+
+
+suns_bus_unit_t *suns_bus_add_unit(suns_bus_t *bus, int addr)
+{
+    suns_bus_unit_t *unit = malloc(sizeof(suns_bus_unit_t));
+    if (unit == NULL) {
+        error("memory error: can't malloc(sizeof(suns_bus_unit_t))");
+        return NULL;
+    }
+
+    memset(unit, 0, sizeof(suns_bus_unit_t));
+    unit->addr = addr;
+    unit->device = suns_device_new_with_arena();
+    if (unit->device == NULL) {
+        free(unit);
+        return NULL;
+    }
+    unit->device->addr = addr;
+
+    list_node_add(bus->units, list_node_new(unit));
+
+    return unit;
+}
+
+
+/**
+ * add the unit ids in spec to the bus.  spec is a comma separated
+ * list of addresses and ranges, such as "1-20,25,30".
+ *
+ * returns the number of units added, or -1 if spec is malformed
+ */
+int suns_bus_parse_units(suns_bus_t *bus, const char *spec)
+{
+    const char *p = spec;
+    int count = 0;
+
+    while (*p) {
+        int first, last, n;
+
+        if (sscanf(p, "%d-%d%n", &first, &last, &n) == 2) {
+            p += n;
+        } else if (sscanf(p, "%d%n", &first, &n) == 1) {
+            last = first;
+            p += n;
+        } else {
+            error("can't parse unit ids at \"%s\"", p);
+            return -1;
+        }
+
+        /* 0 is broadcast and 248-255 are reserved */
+        if ((first < 1) || (last > 247) || (first > last)) {
+            error("unit ids must be between 1 and 247: %d-%d", first, last);
+            return -1;
+        }
+
+        for (; first <= last; first++) {
+            if (suns_bus_add_unit(bus, first) == NULL)
+                return -1;
+            count++;
+        }
+
+        if (*p == ',') {
+            p++;
+        } else if (*p) {
+            error("can't parse unit ids at \"%s\"", p);
+            return -1;
+        }
+    }
+
+    if (count == 0) {
+        error("no unit ids given");
+        return -1;
+    }
+
+    return count;
+}
+
+
+/**
+ * account for a read of unit that took the bus from start_ms to
+ * end_ms.  a unit that fails is skipped for twice as many cycles each
+ * time it fails again, up to SUNS_BUS_MAX_BACKOFF.
+ */
+void suns_bus_unit_done(suns_bus_t *bus, suns_bus_unit_t *unit,
+                        int64_t start_ms, int64_t end_ms, int rc)
+{
+    unit->read_ms = end_ms - start_ms;
+    unit->busy_ms += unit->read_ms;
+    bus->busy_ms += unit->read_ms;
+
+    if (rc < 0) {
+        unit->errors++;
+        unit->failures++;
+        unit->skip = min(1 << min(unit->failures - 1, 5),
+                         SUNS_BUS_MAX_BACKOFF);
+        verbose(1, "unit %d failed %d times in a row; skipping %d cycles",
+                unit->addr, unit->failures, unit->skip);
+        return;
+    }
+
+    unit->reads++;
+    unit->failures = 0;
+    if (unit->last_ms)
+        unit->cycle_ms = end_ms - unit->last_ms;
+    unit->last_ms = end_ms;
+}
+
+
+/* write per unit timing and the bus utilization */
+void suns_bus_report(suns_bus_t *bus, FILE *stream, int64_t now_ms)
+{
+    int64_t elapsed = now_ms - bus->start_ms;
+    list_node_t *c;
+
+    fprintf(stream, "%5s %7s %7s %9s %9s %9s\n",
+            "addr", "reads", "errors", "read ms", "cycle ms", "busy %");
+
+    list_for_each(bus->units, c) {
+        suns_bus_unit_t *unit = c->data;
+        fprintf(stream, "%5d %7d %7d %9lld %9lld %9.1f\n",
+                unit->addr, unit->reads, unit->errors,
+                (long long) unit->read_ms, (long long) unit->cycle_ms,
+                elapsed > 0 ? (100.0 * unit->busy_ms) / elapsed : 0.0);
+    }
+
+    fprintf(stream, "%d cycles in %lld ms, bus busy %.1f%%\n",
+            bus->cycles, (long long) elapsed,
+            elapsed > 0 ? (100.0 * bus->busy_ms) / elapsed : 0.0);
+}
@@ -0,0 +1,90 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * suns_bus.h
+ *
+ * scheduling reads of many devices sharing one modbus bus
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef _SUNS_BUS_H_
+#define _SUNS_BUS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "trx/list.h"
+#include "suns_model.h"
+#include "suns_map.h"
+
+
+/* most cycles a unit that keeps failing is skipped for */
+#define SUNS_BUS_MAX_BACKOFF 32
+
+
+/* one unit id on the bus */
+typedef struct suns_bus_unit {
+    int addr;
+    suns_map_t *map;           /* register map, once discovered */
+    suns_link_t link;          /* read size and timeout learned */
+    suns_device_t *device;     /* datasets decoded by the last read */
+    int failures;              /* consecutive failed reads */
+    int skip;                  /* cycles left before trying again */
+    int reads;                 /* successful reads */
+    int errors;                /* failed reads */
+    int64_t read_ms;           /* bus time taken by the last read */
+    int64_t busy_ms;           /* bus time taken by all reads */
+    int64_t last_ms;           /* when the last successful read ended */
+    int64_t cycle_ms;          /* time between the last two successful
+                                  reads */
+} suns_bus_unit_t;
+
+
+typedef struct suns_bus {
+    list_t *units;             /* list of suns_bus_unit_t, in poll order */
+    int cycles;
+    int64_t start_ms;
+    int64_t busy_ms;           /* time the bus spent in reads */
+} suns_bus_t;
+
+
+suns_bus_t *suns_bus_new(void);
+void suns_bus_free(suns_bus_t *bus);
+suns_bus_unit_t *suns_bus_add_unit(suns_bus_t *bus, int addr);
+int suns_bus_parse_units(suns_bus_t *bus, const char *spec);
+void suns_bus_unit_done(suns_bus_t *bus, suns_bus_unit_t *unit,
+                        int64_t start_ms, int64_t end_ms, int rc);
+void suns_bus_report(suns_bus_t *bus, FILE *stream, int64_t now_ms);
+
+#endif /* _SUNS_BUS_H_ */
@@ -0,0 +1,187 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * suns_changes.c
+ *
+ * change detection between successive reads of a device
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trx/macros.h"
+#include "trx/debug.h"
+#include "suns_changes.h"
+#include "suns_regs.h"
+
+
+suns_changes_t *suns_changes_new(int keyframe)
+{
+    suns_changes_t *changes = malloc(sizeof(suns_changes_t));
+    if (changes == NULL) {
+        debug("malloc() failed");
+        return NULL;
+    }
+
+    memset(changes, 0, sizeof(suns_changes_t));
+    changes->keyframe = keyframe;
+    changes->full = 1;
+
+    return changes;
+}
+
+
+void suns_changes_free(suns_changes_t *changes)
+{
+    if (changes == NULL)
+        return;
+
+    free(changes->regs);
+    free(changes);
+}
+
+
+/**
+ * start comparing a read of len registers against the previous one.
+ *
+ * the read is a keyframe, to be decoded in full, if it is the first,
+ * if the number of registers changed (the map was rediscovered) or if
+ * keyframe reads have passed since the last one.
+ *
+ * returns 1 for a keyframe, otherwise 0
+ */
+int suns_changes_begin(suns_changes_t *changes, int len)
+{
+    changes->reads++;
+    changes->full = ((changes->len == 0) ||
+                     (changes->len != len) ||
+                     ((changes->keyframe > 0) &&
+                      (changes->reads >= changes->keyframe)));
+    if (changes->full)
+        changes->reads = 0;
+
+    return changes->full;
+}
+
+
+/**
+ * compare len registers of regs at offset with the same registers of
+ * the previous read.  the block is compared whole first, so an
+ * unchanged model costs a memcmp().
+ *
+ * if mask isn't NULL, bit i of mask is set if register offset + i
+ * changed and cleared if it didn't.  mask must hold
+ * suns_regs_mask_size(len) bytes.
+ *
+ * returns the number of registers that changed.  every register has
+ * changed if there is no previous read.
+ */
+int suns_changes_diff(suns_changes_t *changes,
+                      const uint16_t *regs,
+                      int offset,
+                      int len,
+                      uint8_t *mask)
+{
+    const uint16_t *prev = changes->regs + offset;
+    int n = 0;
+    int i;
+
+    if ((changes->len == 0) || (offset + len > changes->len)) {
+        if (mask)
+            memset(mask, 0xff, suns_regs_mask_size(len));
+        return len;
+    }
+
+    if (memcmp(prev, regs + offset, len * sizeof(uint16_t)) == 0) {
+        if (mask)
+            memset(mask, 0, suns_regs_mask_size(len));
+        return 0;
+    }
+
+    if (mask)
+        memset(mask, 0, suns_regs_mask_size(len));
+    for (i = 0; i < len; i++) {
+        if (prev[i] != regs[offset + i]) {
+            if (mask)
+                mask[i >> 3] |= 1 << (i & 7);
+            n++;
+        }
+    }
+
+    return n;
+}
+
+
+/**
+ * keep len registers of regs to compare the next read against.
+ *
+ * returns 0 on success or -1 on failure, after which the next read
+ * is a keyframe
+ */
+int suns_changes_end(suns_changes_t *changes,
+                     const uint16_t *regs,
+                     int len)
+{
+    if (len > changes->size) {
+        uint16_t *r = realloc(changes->regs, len * sizeof(uint16_t));
+        if (r == NULL) {
+            debug("realloc() failed");
+            changes->len = 0;
+            return -1;
+        }
+        changes->regs = r;
+        changes->size = len;
+    }
+
+    memcpy(changes->regs, regs, len * sizeof(uint16_t));
+    changes->len = len;
+
+    return 0;
+}
+
+
+/* returns 1 if any of the n bits of mask starting at bit r is set */
+int suns_changes_any(const uint8_t *mask, int r, int n)
+{
+    int i;
+
+    for (i = r; i < r + n; i++) {
+        if (suns_regs_bit(mask, i))
+            return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,75 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * suns_changes.h
+ *
+ * change detection between successive reads of a device
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef _SUNS_CHANGES_H_
+#define _SUNS_CHANGES_H_
+
+#include <stdint.h>
+
+
+/* the registers of the previous read of a device, so the next read
+   only decodes the datapoints whose registers changed.  a read that
+   isn't compared against the previous one, but decoded in full, is a
+   keyframe. */
+typedef struct suns_changes {
+    uint16_t *regs;      /* registers of the previous read */
+    int len;             /* registers in regs, 0 before the first read */
+    int size;            /* registers allocated for regs */
+    int keyframe;        /* decode every keyframe'th read in full, or 0
+                            for only the first read */
+    int reads;           /* reads since the last keyframe */
+    int full;            /* the current read is a keyframe */
+} suns_changes_t;
+
+
+suns_changes_t *suns_changes_new(int keyframe);
+void suns_changes_free(suns_changes_t *changes);
+int suns_changes_begin(suns_changes_t *changes, int len);
+int suns_changes_diff(suns_changes_t *changes,
+                      const uint16_t *regs,
+                      int offset,
+                      int len,
+                      uint8_t *mask);
+int suns_changes_end(suns_changes_t *changes,
+                     const uint16_t *regs,
+                     int len);
+int suns_changes_any(const uint8_t *mask, int r, int n);
+
+#endif /* _SUNS_CHANGES_H_ */
@@ -0,0 +1,658 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * suns_columns.c
+ *
+ * columnar representation of the repeating block of a dataset
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <endian.h>
+
+#include "trx/macros.h"
+#include "trx/debug.h"
+#include "suns_model.h"
+#include "suns_columns.h"
+#include "suns_samples.h"
+
+
+suns_columns_t *suns_columns_new(void)
+{
+    suns_columns_t *cols = malloc(sizeof(suns_columns_t));
+
+    if (cols == NULL) {
+        error("memory error: can't malloc(sizeof(suns_columns_t))");
+        return NULL;
+    }
+    memset(cols, 0, sizeof(suns_columns_t));
+
+    return cols;
+}
+
+
+static void suns_columns_free_columns(suns_columns_t *cols)
+{
+    int i;
+
+    for (i = 0; i < cols->n_columns; i++) {
+        free(cols->columns[i].data);
+        free(cols->columns[i].ni);
+    }
+    free(cols->columns);
+    free(cols->values);
+
+    cols->columns = NULL;
+    cols->values = NULL;
+    cols->n_columns = 0;
+    cols->count = 0;
+    cols->capacity = 0;
+    cols->names = NULL;
+    cols->plan = NULL;
+}
+
+
+void suns_columns_free(suns_columns_t *cols)
+{
+    assert(cols);
+
+    suns_columns_free_columns(cols);
+    free(cols);
+}
+
+
+/* set up one column for each step of the plan's repeating block */
+static int suns_columns_layout(suns_columns_t *cols,
+                               suns_decode_plan_t *plan)
+{
+    int n = plan->n_steps - plan->n_fixed;
+    suns_value_t *v;
+    int i;
+
+    suns_columns_free_columns(cols);
+
+    if (n == 0) {
+        cols->plan = plan;
+        return 0;
+    }
+
+    cols->columns = malloc(sizeof(suns_column_t) * n);
+    cols->values = malloc(sizeof(suns_value_t) * n);
+    if ((cols->columns == NULL) || (cols->values == NULL)) {
+        error("memory error: can't malloc() %d columns", n);
+        free(cols->columns);
+        free(cols->values);
+        cols->columns = NULL;
+        cols->values = NULL;
+        return -1;
+    }
+    memset(cols->columns, 0, sizeof(suns_column_t) * n);
+    memset(cols->values, 0, sizeof(suns_value_t) * n);
+
+    for (i = 0; i < n; i++) {
+        suns_column_t *col = &(cols->columns[i]);
+        suns_decode_step_t *step = &(plan->steps[plan->n_fixed + i]);
+
+        col->step = step;
+        if (step->tp->type == SUNS_STRING)
+            col->width = step->tp->len + 1;
+        else if (step->tp->type == SUNS_PAD)
+            col->width = 0;
+        else
+            col->width = step->size;
+        col->sf = step->tp->sf;
+        col->sf_column = -1;
+        if (step->sf_step >= plan->n_fixed)
+            col->sf_column = step->sf_step - plan->n_fixed;
+
+        /* what every instance of the column shares */
+        v = &(cols->values[i]);
+        v->name = step->dp->name;
+        v->repeating = 1;
+        v->step = plan->n_fixed + i;
+        v->tp = *(step->tp);
+        v->units = step->units;
+        v->label = step->label;
+    }
+
+    cols->n_columns = n;
+    cols->plan = plan;
+
+    return 0;
+}
+
+
+/* make room for count instances in every column */
+static int suns_columns_reserve(suns_columns_t *cols, int count)
+{
+    int capacity;
+    int i;
+
+    if (count <= cols->capacity)
+        return 0;
+
+    capacity = max(count, cols->capacity * 2);
+
+    for (i = 0; i < cols->n_columns; i++) {
+        suns_column_t *col = &(cols->columns[i]);
+        void *data;
+        uint32_t *ni;
+
+        if (col->width > 0) {
+            data = realloc(col->data, col->width * capacity);
+            if (data == NULL) {
+                error("memory error: can't grow column %s to %d instances",
+                      col->step->dp->name, capacity);
+                return -1;
+            }
+            col->data = data;
+        }
+
+        ni = realloc(col->ni, sizeof(uint32_t) * ((capacity + 31) / 32));
+        if (ni == NULL) {
+            error("memory error: can't grow column %s to %d instances",
+                  col->step->dp->name, capacity);
+            return -1;
+        }
+        col->ni = ni;
+    }
+
+    cols->capacity = capacity;
+
+    return 0;
+}
+
+
+/* the value that marks a datapoint of type as not implemented, for the
+   integer types that have one.  see suns_check_not_implemented(). */
+static int suns_column_ni_value(suns_type_t type, uint64_t *ni)
+{
+    switch (type) {
+    case SUNS_INT16:
+    case SUNS_SF:
+        *ni = 0x8000;
+        return 1;
+
+    case SUNS_UINT16:
+    case SUNS_ENUM16:
+    case SUNS_BITFIELD16:
+        *ni = 0xFFFF;
+        return 1;
+
+    case SUNS_INT32:
+        *ni = 0x80000000;
+        return 1;
+
+    case SUNS_UINT32:
+    case SUNS_ENUM32:
+    case SUNS_BITFIELD32:
+        *ni = 0xFFFFFFFF;
+        return 1;
+
+    case SUNS_INT64:
+        *ni = 0x8000000000000000ULL;
+        return 1;
+
+    case SUNS_UINT64:
+        *ni = 0xFFFFFFFFFFFFFFFFULL;
+        return 1;
+
+    case SUNS_IPV4:
+        *ni = 0;
+        return 1;
+
+    default:
+        return 0;
+    }
+}
+
+
+#define suns_column_set_ni(col, i) \
+    ((col)->ni[(i) >> 5] |= (1U << ((i) & 31)))
+
+
+/* copy one datapoint out of count instances of the repeating block
+   starting at buf, stride bytes apart */
+static void suns_column_decode(suns_column_t *col,
+                               unsigned char *buf,
+                               int stride,
+                               int count)
+{
+    suns_type_t type = col->step->tp->type;
+    unsigned char *p = buf + col->step->byte_offset;
+    uint64_t ni = 0;
+    int has_ni = suns_column_ni_value(type, &ni);
+    int i;
+
+    memset(col->ni, 0, sizeof(uint32_t) * ((count + 31) / 32));
+
+    switch (col->width) {
+    case 0:
+        break;
+
+    case 2: {
+        uint16_t *out = col->data;
+        for (i = 0; i < count; i++, p += stride) {
+            uint16_t x;
+            memcpy(&x, p, 2);
+            out[i] = be16toh(x);
+            if (has_ni && (out[i] == (uint16_t) ni))
+                suns_column_set_ni(col, i);
+        }
+        break;
+    }
+
+    case 4: {
+        uint32_t *out = col->data;
+        for (i = 0; i < count; i++, p += stride) {
+            uint32_t x;
+            memcpy(&x, p, 4);
+            out[i] = be32toh(x);
+            if ((has_ni && (out[i] == (uint32_t) ni)) ||
+                ((type == SUNS_FLOAT32) && isnan(((float32_t *) out)[i])))
+                suns_column_set_ni(col, i);
+        }
+        break;
+    }
+
+    case 8: {
+        uint64_t *out = col->data;
+        for (i = 0; i < count; i++, p += stride) {
+            uint64_t x;
+            memcpy(&x, p, 8);
+            out[i] = be64toh(x);
+            if ((has_ni && (out[i] == ni)) ||
+                ((type == SUNS_FLOAT64) && isnan(((float64_t *) out)[i])))
+                suns_column_set_ni(col, i);
+        }
+        break;
+    }
+
+    default: {
+        /* strings, and anything else without a byte order */
+        char *out = col->data;
+        int size = col->step->size;
+        for (i = 0; i < count; i++, p += stride, out += col->width) {
+            if (type == SUNS_STRING) {
+                strncpy(out, (char *) p, size);
+                out[size] = '\0';
+            } else {
+                memcpy(out, p, min(size, col->width));
+            }
+        }
+        break;
+    }
+    }
+}
+
+
+/* warn about implemented values that reference a not-implemented scale
+   factor, as suns_value_apply_sf() does for each value in a list */
+static void suns_columns_check_sf(suns_columns_t *cols,
+                                  suns_column_t *col,
+                                  int sf_ni,
+                                  char *sf_name)
+{
+    suns_value_t v;
+    int i;
+
+    for (i = 0; i < cols->count; i++) {
+        if (col->sf_column >= 0) {
+            suns_column_t *sf = &(cols->columns[col->sf_column]);
+            if (suns_column_is_implemented(sf, i))
+                continue;
+        } else if (! sf_ni) {
+            return;
+        }
+
+        if (! suns_column_is_implemented(col, i))
+            continue;
+
+        suns_column_get_value(cols, col, i, &v);
+        if (! suns_value_acc_is_zero(&v)) {
+            warning("implemented datapoint %s references the "
+                    "not-implemented scale factor %s",
+                    v.name, sf_name);
+        }
+    }
+}
+
+
+/**
+ * decode the repeating block of len bytes of model data in buf (not
+ * including the did and length header) into cols, using the provided
+ * plan.  the non-repeating part is only read for the scale factors it
+ * holds.  storage is kept from one decode to the next and only grows.
+ *
+ * returns the number of instances decoded, or -1 on a memory error.
+ */
+int suns_decode_columns(suns_decode_plan_t *plan,
+                        unsigned char *buf,
+                        size_t len,
+                        suns_columns_t *cols)
+{
+    int count = 0;
+    int i;
+
+    if ((cols->plan != plan) && (suns_columns_layout(cols, plan) < 0))
+        return -1;
+
+    cols->count = 0;
+
+    /* only whole instances */
+    if ((plan->repeat_len > 0) && (len > plan->fixed_bytes)) {
+        count = (len - plan->fixed_bytes) / (plan->repeat_len * 2);
+        while ((count > 0) &&
+               (plan->fixed_bytes + (count * plan->repeat_bytes) > len))
+            count--;
+    }
+    if (count == 0)
+        return 0;
+
+    if (suns_columns_reserve(cols, count) < 0)
+        return -1;
+
+    cols->names = suns_decode_plan_names(plan, count);
+    if (cols->names == NULL)
+        return -1;
+
+    for (i = 0; i < cols->n_columns; i++) {
+        suns_column_decode(&(cols->columns[i]), buf + plan->fixed_bytes,
+                           plan->repeat_bytes, count);
+    }
+    cols->count = count;
+
+    /* scale factors from the non-repeating part are shared by every
+       instance.  one that is not implemented gives a scale factor of
+       0, as suns_value_apply_sf() does. */
+    for (i = 0; i < cols->n_columns; i++) {
+        suns_column_t *col = &(cols->columns[i]);
+        int sf_step = col->step->sf_step;
+        int sf_ni = 0;
+
+        if (sf_step < 0)
+            continue;
+
+        if (col->sf_column < 0) {
+            suns_decode_step_t *s = &(plan->steps[sf_step]);
+            int16_t sf;
+
+            if (s->byte_offset + s->size > len)
+                continue;
+
+            memcpy(&sf, buf + s->byte_offset, 2);
+            sf = be16toh(sf);
+            sf_ni = (sf == (int16_t) 0x8000);
+            col->sf = sf_ni ? 0 : sf;
+        }
+
+        suns_columns_check_sf(cols, col, sf_ni,
+                              plan->steps[sf_step].dp->name);
+    }
+
+    return count;
+}
+
+
+/* find the column of the datapoint called name, or NULL */
+suns_column_t *suns_columns_find(suns_columns_t *cols, const char *name)
+{
+    int i;
+
+    if (cols->n_columns == 0)
+        return NULL;
+
+    /* column i holds step n_fixed + i */
+    i = suns_decode_plan_find_step(cols->plan, name) - cols->plan->n_fixed;
+    if ((i < 0) || (i >= cols->n_columns))
+        return NULL;
+
+    return &(cols->columns[i]);
+}
+
+
+/* returns 1 if element i of the column is implemented */
+int suns_column_is_implemented(suns_column_t *col, int i)
+{
+    return ! (col->ni[i >> 5] & (1U << (i & 31)));
+}
+
+
+/* the scale factor of element i of the column */
+int suns_column_get_sf(suns_columns_t *cols, suns_column_t *col, int i)
+{
+    suns_column_t *sf;
+
+    if (col->sf_column < 0)
+        return col->sf;
+
+    sf = &(cols->columns[col->sf_column]);
+    if (! suns_column_is_implemented(sf, i))
+        return 0;
+
+    return ((int16_t *) sf->data)[i];
+}
+
+
+/* element i of a column of one of the integer types, widened to 64
+   bits.  returns 0 for any other type. */
+int64_t suns_column_get_int(suns_column_t *col, int i)
+{
+    switch (col->step->tp->type) {
+    case SUNS_INT16:
+    case SUNS_SF:
+        return ((int16_t *) col->data)[i];
+
+    case SUNS_UINT16:
+    case SUNS_ACC16:
+    case SUNS_ENUM16:
+    case SUNS_BITFIELD16:
+        return ((uint16_t *) col->data)[i];
+
+    case SUNS_INT32:
+        return ((int32_t *) col->data)[i];
+
+    case SUNS_UINT32:
+    case SUNS_ACC32:
+    case SUNS_ENUM32:
+    case SUNS_BITFIELD32:
+    case SUNS_IPV4:
+        return ((uint32_t *) col->data)[i];
+
+    case SUNS_INT64:
+    case SUNS_UINT64:
+    case SUNS_ACC64:
+        return ((int64_t *) col->data)[i];
+
+    default:
+        return 0;
+    }
+}
+
+
+/* element i of a string column, or NULL for any other type */
+char *suns_column_get_string(suns_column_t *col, int i)
+{
+    if (col->step->tp->type != SUNS_STRING)
+        return NULL;
+
+    return (char *) col->data + (i * col->width);
+}
+
+
+/**
+ * element i of the column as a value, so the value formatting functions
+ * can be used on it.  the value is the column's entry in cols->values,
+ * with the parts that differ from one instance to the next filled in
+ * for instance i, so it is only good until the column is asked for
+ * another instance, or the next decode.  it must not be passed to
+ * suns_value_free().  the raw wire data isn't kept.
+ */
+suns_value_t *suns_column_value(suns_columns_t *cols, suns_column_t *col,
+                                int i)
+{
+    int c = col - cols->columns;
+    suns_value_t *v = &(cols->values[c]);
+
+    v->name_with_index = cols->names[(i * cols->n_columns) + c];
+    v->index = i + 1;
+    v->tp.sf = suns_column_get_sf(cols, col, i);
+    v->meta = suns_column_is_implemented(col, i) ?
+        SUNS_VALUE_OK : SUNS_VALUE_NOT_IMPLEMENTED;
+
+    switch (col->width) {
+    case 0:
+        break;
+    case 2:
+        v->value.u16 = ((uint16_t *) col->data)[i];
+        break;
+    case 4:
+        v->value.u32 = ((uint32_t *) col->data)[i];
+        break;
+    case 8:
+        v->value.u64 = ((uint64_t *) col->data)[i];
+        break;
+    default:
+        if (col->step->tp->type == SUNS_STRING)
+            v->value.s = suns_column_get_string(col, i);
+        break;
+    }
+
+    return v;
+}
+
+
+/* copy element i of the column into v; see suns_column_value() */
+void suns_column_get_value(suns_columns_t *cols, suns_column_t *col, int i,
+                           suns_value_t *v)
+{
+    *v = *suns_column_value(cols, col, i);
+}
+
+
+/**
+ * the columns the device keeps for the nth model of its map, created
+ * the first time they're asked for.  they outlive the arena, so the
+ * columns laid out by one read are decoded into again by the next.
+ *
+ * returns NULL if memory runs out.
+ */
+suns_columns_t *suns_device_columns(suns_device_t *device, int n)
+{
+    suns_columns_t *cols;
+
+    if (device->columns == NULL) {
+        device->columns = vector_new(0);
+        if (device->columns == NULL)
+            return NULL;
+    }
+
+    while (vector_count(device->columns) <= n) {
+        cols = suns_columns_new();
+        if (cols == NULL)
+            return NULL;
+        if (vector_push(device->columns, cols) < 0) {
+            suns_columns_free(cols);
+            return NULL;
+        }
+    }
+
+    return vector_get(device->columns, n);
+}
+
+
+/* a dataset that decodes its repeating block into columns */
+suns_dataset_t *suns_dataset_new_columnar(void)
+{
+    suns_dataset_t *d = suns_dataset_new();
+
+    if (d == NULL)
+        return NULL;
+
+    d->columns = suns_columns_new();
+    if (d->columns == NULL) {
+        suns_dataset_free(d);
+        return NULL;
+    }
+
+    return d;
+}
+
+
+void suns_value_iter_init(suns_value_iter_t *iter, suns_dataset_t *data)
+{
+    iter->node = data->values->head;
+    iter->instance = 0;
+    iter->column = 0;
+    iter->sample = 0;
+}
+
+
+suns_value_t *suns_value_iter_next(suns_value_iter_t *iter,
+                                   suns_dataset_t *data)
+{
+    suns_columns_t *cols = data->columns;
+    suns_value_t *v;
+
+    if (iter->node) {
+        v = iter->node->data;
+        iter->node = iter->node->next;
+        return v;
+    }
+
+    if (data->samples) {
+        if (iter->sample >= data->samples->count)
+            return NULL;
+        suns_samples_get_value(data->samples, iter->sample++,
+                               &(iter->scratch));
+        return &(iter->scratch);
+    }
+
+    if ((cols == NULL) || (cols->n_columns == 0) ||
+        (iter->instance >= cols->count))
+        return NULL;
+
+    v = suns_column_value(cols, &(cols->columns[iter->column]),
+                          iter->instance);
+
+    if (++(iter->column) == cols->n_columns) {
+        iter->column = 0;
+        iter->instance++;
+    }
+
+    return v;
+}
@@ -0,0 +1,123 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * suns_columns.h
+ *
+ * columnar representation of the repeating block of a dataset
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef _SUNS_COLUMNS_H_
+#define _SUNS_COLUMNS_H_
+
+#include "suns_model.h"
+
+
+/* one datapoint of a repeating block, for every instance of the block.
+
+   data is an array of cols->count elements in host byte order, of the
+   C type that goes with the datapoint's type: int16_t for int16 and
+   sunssf, uint16_t for uint16, acc16, enum16 and bitfield16, and so on
+   up to float64_t.  strings are width bytes each, NUL terminated.  pad
+   datapoints have a width of 0 and no data. */
+typedef struct suns_column {
+    suns_decode_step_t *step;  /* the datapoint, from the decode plan */
+    int width;                 /* bytes per element */
+    void *data;
+    uint32_t *ni;              /* bit i is set if element i is not
+                                  implemented */
+    int sf;                    /* scale factor of every element, when
+                                  sf_column is -1 */
+    int sf_column;             /* column holding a scale factor for each
+                                  instance, or -1 */
+} suns_column_t;
+
+
+/* the repeating block of a dataset decoded column by column, instead
+   of into one suns_value_t per datapoint per instance */
+typedef struct suns_columns {
+    suns_decode_plan_t *plan;  /* the columns were laid out for this */
+    suns_column_t *columns;    /* one per repeating block step */
+    int n_columns;
+    int count;                 /* instances decoded */
+    int capacity;              /* instances there is room for */
+    char **names;              /* interned names, from the plan */
+    suns_value_t *values;      /* one per column, holding what every
+                                  instance shares.  see
+                                  suns_column_value(). */
+} suns_columns_t;
+
+
+/* walks the values of a dataset in the order suns_decode_plan() would
+   have listed them: the values list, then the dataset's samples or each
+   instance held in its columns.  values from columns come from
+   suns_column_value(), so each is only good until the iterator reaches
+   the same column of the next instance.  values from samples are built
+   in scratch, which the next step overwrites.  either way they point
+   into the dataset and must not be passed to suns_value_free(). */
+typedef struct suns_value_iter {
+    list_node_t *node;
+    int instance;
+    int column;
+    int sample;
+    suns_value_t scratch;      /* the value of the current sample */
+} suns_value_iter_t;
+
+#define suns_dataset_for_each_value(data, iter, v)                      \
+    for (suns_value_iter_init(&(iter), (data));                        \
+         ((v) = suns_value_iter_next(&(iter), (data))) != NULL; )
+
+
+suns_columns_t *suns_columns_new(void);
+void suns_columns_free(suns_columns_t *cols);
+int suns_decode_columns(suns_decode_plan_t *plan,
+                        unsigned char *buf,
+                        size_t len,
+                        suns_columns_t *cols);
+suns_column_t *suns_columns_find(suns_columns_t *cols, const char *name);
+int suns_column_is_implemented(suns_column_t *col, int i);
+int suns_column_get_sf(suns_columns_t *cols, suns_column_t *col, int i);
+int64_t suns_column_get_int(suns_column_t *col, int i);
+char *suns_column_get_string(suns_column_t *col, int i);
+suns_value_t *suns_column_value(suns_columns_t *cols, suns_column_t *col,
+                                int i);
+void suns_column_get_value(suns_columns_t *cols, suns_column_t *col, int i,
+                           suns_value_t *v);
+suns_dataset_t *suns_dataset_new_columnar(void);
+suns_columns_t *suns_device_columns(suns_device_t *device, int n);
+void suns_value_iter_init(suns_value_iter_t *iter, suns_dataset_t *data);
+suns_value_t *suns_value_iter_next(suns_value_iter_t *iter,
+                                   suns_dataset_t *data);
+
+#endif /* _SUNS_COLUMNS_H_ */
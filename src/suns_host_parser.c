@@ -240,7 +240,7 @@ int suns_host_parse_model(ezxml_t m,
     }
 
     /* search for the model */
-    data->did = suns_find_did(sps->did_list, int_did);
+    data->did = suns_find_did(sps->did_index, int_did);
 
     if (data->did == NULL) {
         dr_fail->status = STATUS_FAILURE;
@@ -300,9 +300,8 @@ int suns_host_parse_datapoint(ezxml_t p,
 
     suns_parse_xml_attr(p, point_attr);
 
-    /* look up the datapoint name in the model */
-    suns_dp_block_t *dp_block_ref;
-    dp = suns_search_model_for_dp_by_name(model, v->name, &dp_block_ref);
+    /* look up the datapoint name in the model's index */
+    dp = suns_search_model_for_dp_by_name(model, v->name, NULL);
 
     if (dp == NULL) {
         dr_fail->status = STATUS_FAILURE;
@@ -181,6 +181,7 @@ model_block: MODELTOK NAME OBRACE model_elmts EBRACE
 
     /* resolve defines */
     suns_model_resolve_defines($$);
+    suns_model_index_dps($$);
     /* this is also run again in suns_app.c if explicitly requested */
     suns_model_check_consistency($$);
 }
@@ -196,8 +197,17 @@ model_elmts: /* empty */
            | model_elmts did
 {
     $2->model = $$;
-    /* add the did to the global did_list */
-    list_node_add(sps->did_list, list_node_new($2));
+    /* add the did to the global did_list and did index */
+    int added = suns_parser_add_did($2);
+    if (added < 0) {
+        yyerror("can't add did to the did index");
+        YYABORT;
+    }
+    if (added > 0) {
+        snprintf(yyerror_buf, BUFFER_SIZE, "did %d is already defined; "
+                 "keeping the first definition", $2->did);
+        yyerror(yyerror_buf);
+    }
     /* add the did to the list in the model */
     list_node_add($$->did_list, list_node_new($2));
     /* use model name if the did has no name assigned to it */
@@ -0,0 +1,161 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * suns_link.c
+ *
+ * what has been learned about talking to a device
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trx/macros.h"
+#include "trx/debug.h"
+#include "suns_link.h"
+
+
+/**
+ * start with what the user configured: reads of up to max_read
+ * registers and a timeout of max_timeout milliseconds.  max_timeout
+ * stays the upper bound on the learned timeout, and a fixed fraction of
+ * it the lower bound.
+ */
+void suns_link_init(suns_link_t *link, int max_read, int max_timeout)
+{
+    memset(link, 0, sizeof(suns_link_t));
+
+    link->max_read = max_read;
+    link->timeout = max_timeout;
+    link->max_timeout = max_timeout;
+    link->min_timeout = max(max_timeout / SUNS_LINK_MIN_TIMEOUT_DIVISOR, 1);
+}
+
+
+/* the timeout the round trip time estimates call for, in milliseconds */
+static int suns_link_rto(suns_link_t *link)
+{
+    return (link->srtt + (4 * link->rttvar) + 999) / 1000;
+}
+
+
+/* recompute the timeout from the round trip time estimates */
+static void suns_link_update_timeout(suns_link_t *link)
+{
+    link->timeout = max(link->min_timeout,
+                        min(suns_link_rto(link), link->max_timeout));
+}
+
+
+/**
+ * account for a response (including an exception response) that took
+ * rtt_us microseconds.  don't call this for a request that was sent
+ * more than once, since the response could belong to any of the tries.
+ */
+void suns_link_sample(suns_link_t *link, int rtt_us)
+{
+    int srtt_ms = link->srtt / 1000;
+    int rto = suns_link_rto(link);
+
+    if (link->srtt == 0) {
+        link->srtt = max(rtt_us, 1);
+        link->rttvar = rtt_us / 2;
+    } else {
+        int delta = link->srtt - rtt_us;
+        if (delta < 0)
+            delta = -delta;
+        link->rttvar = ((3 * link->rttvar) + delta) / 4;
+        link->srtt = ((7 * link->srtt) + rtt_us) / 8;
+        if (link->srtt <= 0)
+            link->srtt = 1;
+    }
+
+    /* the estimates move a little with every sample; only a change
+       of a millisecond is worth saving */
+    if ((link->srtt / 1000 != srtt_ms) || (suns_link_rto(link) != rto))
+        link->changed = 1;
+
+    suns_link_update_timeout(link);
+}
+
+
+/* back off after a timeout */
+void suns_link_timed_out(suns_link_t *link)
+{
+    link->timeout = min(link->timeout * 2, link->max_timeout);
+}
+
+
+/**
+ * the device answered a read of len registers, covering registers it
+ * is known to have, with an exception.  it doesn't accept reads that
+ * long, so halve the read size.
+ *
+ * returns the new read size, or -1 if reads can't get any shorter
+ */
+int suns_link_reject_read(suns_link_t *link, int len)
+{
+    int max_read = min(link->max_read, len) / 2;
+
+    /* model headers are 2 registers, so there is no going lower */
+    if (max_read < 2)
+        return -1;
+
+    verbose(1, "read of %d registers rejected; reading at most %d",
+            len, max_read);
+    link->max_read = max_read;
+    link->changed = 1;
+
+    return max_read;
+}
+
+
+/**
+ * restore what was learned about a link in an earlier run.  a saved
+ * read size only ever lowers link->max_read, so a smaller -l still
+ * applies, and the timeout stays within link->max_timeout.
+ */
+void suns_link_restore(suns_link_t *link, int max_read, int srtt,
+                       int rttvar)
+{
+    if (max_read >= 2)
+        link->max_read = min(link->max_read, max_read);
+
+    if ((srtt > 0) && (rttvar >= 0)) {
+        link->srtt = srtt;
+        link->rttvar = rttvar;
+        suns_link_update_timeout(link);
+    }
+}
@@ -0,0 +1,80 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * suns_link.h
+ *
+ * what has been learned about talking to a device
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef _SUNS_LINK_H_
+#define _SUNS_LINK_H_
+
+
+/* the shortest response timeout, however fast a device has been, is
+   this fraction of the configured timeout (-T): 50 ms for the default
+   of 2 seconds.  a slower link configured with a longer -T keeps a
+   proportionally longer floor. */
+#define SUNS_LINK_MIN_TIMEOUT_DIVISOR 40
+
+/* times a request is asked again for a device that answers busy (or
+   acknowledges a request it hasn't finished), one timeout apart,
+   before the answer counts against the retries */
+#define SUNS_LINK_MAX_WAITS 8
+
+
+/* the read size and response timeout learned for one device.  the
+   timeout follows the smoothed round trip time and its variation, as
+   tcp does (rfc 6298), and doubles on each timeout. */
+typedef struct suns_link {
+    int max_read;       /* largest read the device accepts, in registers */
+    int srtt;           /* smoothed round trip time, in microseconds,
+                           or 0 if not measured yet */
+    int rttvar;         /* round trip time variation, in microseconds */
+    int timeout;        /* response timeout, in milliseconds */
+    int max_timeout;    /* upper bound, and the timeout until measured */
+    int min_timeout;    /* lower bound (see SUNS_LINK_MIN_TIMEOUT_DIVISOR) */
+    int changed;        /* what is learned changed since it was saved
+                           (see suns_map_save()) */
+} suns_link_t;
+
+
+void suns_link_init(suns_link_t *link, int max_read, int max_timeout);
+void suns_link_sample(suns_link_t *link, int rtt_us);
+void suns_link_timed_out(suns_link_t *link);
+int suns_link_reject_read(suns_link_t *link, int len);
+void suns_link_restore(suns_link_t *link, int max_read, int srtt,
+                       int rttvar);
+
+#endif /* _SUNS_LINK_H_ */
@@ -0,0 +1,794 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * suns_map.c
+ *
+ * register maps of sunspec devices and the reads used to cover them
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <endian.h>
+
+#include "trx/macros.h"
+#include "trx/debug.h"
+#include "suns_model.h"
+#include "suns_output.h"
+#include "suns_map.h"
+#include "suns_regs.h"
+#include "suns_changes.h"
+#include "suns_columns.h"
+
+
+suns_map_t *suns_map_new(void)
+{
+    suns_map_t *map = malloc(sizeof(suns_map_t));
+    if (map == NULL) {
+        error("memory error: can't malloc(sizeof(suns_map_t))");
+        return NULL;
+    }
+
+    memset(map, 0, sizeof(suns_map_t));
+
+    map->base_register = -1;
+    map->end_offset = -1;
+    map->models = list_new();
+
+    return map;
+}
+
+
+void suns_map_free(suns_map_t *map)
+{
+    if (map == NULL)
+        return;
+
+    list_free(map->models, free);
+    free(map->common);
+    free(map);
+}
+
+
+/* append a model to the end of the map */
+suns_map_model_t *suns_map_add_model(suns_map_t *map,
+                                     uint16_t did,
+                                     uint16_t len,
+                                     int offset)
+{
+    suns_map_model_t *model = malloc(sizeof(suns_map_model_t));
+    if (model == NULL) {
+        error("memory error: can't malloc(sizeof(suns_map_model_t))");
+        return NULL;
+    }
+
+    model->did = did;
+    model->len = len;
+    model->offset = offset;
+
+    list_node_add(map->models, list_node_new(model));
+
+    return model;
+}
+
+
+/**
+ * number of registers spanned by the map, from the base register
+ * through the end marker (or the end of the last model if there is
+ * no end marker).
+ */
+int suns_map_len(suns_map_t *map)
+{
+    if (map->end_offset >= 0)
+        return map->end_offset + 2;
+
+    if (map->models->tail) {
+        suns_map_model_t *last = map->models->tail->data;
+        return last->offset + last->len + 2;
+    }
+
+    /* just the signature */
+    return 2;
+}
+
+
+/**
+ * plan the reads needed to fetch every model in the map, headers and
+ * bodies together, in as few reads of at most max_read registers as
+ * possible.  the signature is not re-read, but the end marker is, so
+ * a change in the model chain can be noticed.
+ *
+ * \param map map to plan reads for
+ * \param max_read maximum registers in a single read
+ * \param reads set to a malloc()ed array of reads; must be free()d
+ *
+ * returns the number of reads, or -1 on error
+ */
+int suns_map_plan_reads(suns_map_t *map,
+                        int max_read,
+                        suns_map_read_t **reads)
+{
+    int start = 2;   /* skip the signature */
+    int end = suns_map_len(map);
+    int count;
+    int i;
+
+    if (max_read <= 0) {
+        error("invalid maximum read length %d", max_read);
+        return -1;
+    }
+
+    count = ((end - start) + max_read - 1) / max_read;
+
+    *reads = malloc(sizeof(suns_map_read_t) * (count > 0 ? count : 1));
+    if (*reads == NULL) {
+        error("memory error: can't malloc() %d reads", count);
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        (*reads)[i].offset = start + (i * max_read);
+        (*reads)[i].len = min(max_read, end - (*reads)[i].offset);
+    }
+
+    return count;
+}
+
+
+/* the common model, if it is the first model in the map */
+suns_map_model_t *suns_map_common_model(suns_map_t *map)
+{
+    suns_map_model_t *first;
+
+    if (map->models->head == NULL)
+        return NULL;
+
+    first = map->models->head->data;
+    if (first->did != 1)
+        return NULL;
+
+    return first;
+}
+
+
+/* keep a copy of the common model body, used to recognize the device */
+int suns_map_set_common(suns_map_t *map, uint16_t *regs, int len)
+{
+    uint16_t *common = malloc(sizeof(uint16_t) * (len > 0 ? len : 1));
+    if (common == NULL) {
+        error("memory error: can't malloc() %d registers", len);
+        return -1;
+    }
+
+    memcpy(common, regs, sizeof(uint16_t) * len);
+    free(map->common);
+    map->common = common;
+    map->common_len = len;
+
+    return 0;
+}
+
+
+/**
+ * number of registers, from the base register, read to check a cached
+ * map with suns_map_validate(): the signature up to the end of the
+ * common model.
+ *
+ * returns the length, or -1 if the map has no common model to check
+ */
+int suns_map_validate_len(suns_map_t *map)
+{
+    suns_map_model_t *common = suns_map_common_model(map);
+
+    if ((common == NULL) ||
+        (map->common == NULL) ||
+        (map->common_len != common->len))
+        return -1;
+
+    return common->offset + 2 + common->len;
+}
+
+
+/**
+ * check that a cached map still describes the device, from the
+ * suns_map_validate_len() registers read at its base register.
+ *
+ * returns 0 if the map is valid, or 1 if the device doesn't match it
+ */
+int suns_map_validate(suns_map_t *map, uint16_t *regs)
+{
+    suns_map_model_t *common = suns_map_common_model(map);
+
+    if ((regs[0] != SUNS_ID_HIGH) ||
+        (regs[1] != SUNS_ID_LOW)) {
+        verbose(1, "no sunspec signature at cached base register %d",
+                map->base_register);
+        return 1;
+    }
+
+    if ((regs[common->offset] != 1) ||
+        (regs[common->offset + 1] != common->len) ||
+        (memcmp(regs + common->offset + 2, map->common,
+                sizeof(uint16_t) * common->len) != 0)) {
+        verbose(1, "common model does not match the cached map");
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * add the model whose did and length registers were read at offset
+ * while walking the model chain.  unknown dids are kept in the map so
+ * the chain can be followed past them.
+ *
+ * \param regs the did and length registers, in host byte order
+ *
+ * returns 0 if a model was added, 1 if regs hold the end marker, or
+ * -1 if the chain is broken
+ */
+int suns_map_add_header(suns_map_t *map,
+                        suns_did_index_t *did_index,
+                        int offset,
+                        uint16_t *regs)
+{
+    suns_model_did_t *did;
+    uint16_t len;
+
+    /* did we stumble upon an end marker? */
+    if ((regs[0] == 0xFFFF) &&
+        (regs[1] == 0x0000)) {
+        verbose(1, "found end marker at register %d and %d",
+                map->base_register + offset, map->base_register + offset + 1);
+        map->end_offset = offset;
+        return 1;
+    }
+
+    /* since we're a test program we need to check for a missing
+       end marker.  all we can really do is check for zero, since
+       we can't tell the difference between a did we don't know
+       and some other data. */
+    if (regs[0] == 0) {
+        error("found 0x0000 where we should have found "
+              "an end marker or another did.");
+        return -1;
+    }
+
+    len = regs[1];
+    verbose(1, "found did = %d, len = %d", regs[0], len);
+    did = suns_find_did(did_index, regs[0]);
+
+    if (did == NULL) {
+        warning("unknown did: %d", regs[0]);
+    } else {
+        /* we found a did we know about */
+
+        /* is the length what we expect? */
+        /* check out this pointer indirection!! */
+        suns_dp_block_t *last_dp_block = did->model->dp_blocks->tail->data;
+        if ((did->model->len != len) &&
+            (last_dp_block->repeating &&
+             (((len - did->model->base_len) %
+               (did->model->len - did->model->base_len)) != 0))) {
+            error("data model length %d does not match expected length (base length %d + multiple of repeating block length %d)",
+                  len, did->model->len, (did->model->len - did->model->base_len));
+        }
+    }
+
+    if (suns_map_add_model(map, regs[0], len, offset) == NULL)
+        return -1;
+
+    return 0;
+}
+
+
+/**
+ * check the model chain in a register map for the common model and
+ * the end marker.
+ *
+ * returns 0 if the map is complete or -1 if not
+ */
+int suns_map_check(suns_map_t *map)
+{
+    int rc = 0;
+    suns_map_model_t *first = NULL;
+    list_node_t *c;
+
+    /* record if we've found a common model and an end marker */
+    int found_common_model = 0;
+
+    if (map->models->head)
+        first = map->models->head->data;
+
+    list_for_each(map->models, c) {
+        suns_map_model_t *model = c->data;
+        if (model->did == 1)
+            found_common_model = 1;
+    }
+
+    if (! found_common_model) {
+        error("no common model found");
+        rc = -1;
+    }
+    if (found_common_model && (first->did != 1)) {
+        error("common model exists but is not the first model");
+        rc = -1;
+    }
+    if (map->end_offset < 0) {
+        error("end marker model is not present");
+        rc = -1;
+    }
+
+    return rc;
+}
+
+
+/* the index suns_model_get_did_index() gives model if every model of
+   the map is decoded: 0 if its did appears once, otherwise 1 based */
+static int suns_map_did_index(suns_map_t *map, suns_map_model_t *model)
+{
+    list_node_t *c;
+    int index = 0;
+    int count = 0;
+
+    list_for_each(map->models, c) {
+        suns_map_model_t *m = c->data;
+        if (m->did != model->did)
+            continue;
+        count++;
+        if (m == model)
+            index = count;
+    }
+
+    return (count > 1) ? index : 0;
+}
+
+
+/**
+ * decode every known model in a register image of the map into
+ * datasets attached to device.
+ *
+ * if device already holds datasets from an earlier decode of the same
+ * map they are decoded into again, reusing their storage.  a device
+ * with an arena is instead decoded from scratch after the arena is
+ * reset.
+ *
+ * if device->changes isn't NULL, and this isn't a keyframe, regs are
+ * compared with the previous read and only the values that changed
+ * are decoded (see suns_decode_plan()).  models with no changes get no
+ * dataset, except for the common model, which is decoded in full to
+ * identify the device and marked unchanged.
+ *
+ * otherwise, if device->columnar is set on a device with an arena, the
+ * repeating blocks are decoded into the device's columns (see
+ * suns_device_columns()) instead of the values lists.
+ *
+ * \param regs all suns_map_len() registers of the map, starting at
+ *             the base register, in host byte order
+ *
+ * returns 0 on success, -1 on failure, or 1 if the model headers in
+ * regs no longer match the map (the map must be rediscovered).
+ */
+int suns_map_decode(suns_map_t *map,
+                    suns_did_index_t *did_index,
+                    uint16_t *regs,
+                    suns_device_t *device)
+{
+    int map_len = suns_map_len(map);
+    unsigned char *buf;
+    suns_model_did_t *did;
+    suns_dataset_t *data;  /* holds decoded datapoints */
+    list_node_t *c;
+    list_node_t *reuse;  /* next dataset to reuse */
+    uint8_t *changed = NULL;  /* registers of a model that changed */
+    int full = 1;        /* decode every value of every model */
+    int n = -1;          /* model being decoded, counting from 0 */
+    int rc;
+
+    /* make sure the device still has the layout we planned for */
+    list_for_each(map->models, c) {
+        suns_map_model_t *model = c->data;
+        if ((regs[model->offset] != model->did) ||
+            (regs[model->offset + 1] != model->len)) {
+            verbose(1, "found did %d, len %d at register %d; expected "
+                    "did %d, len %d", regs[model->offset],
+                    regs[model->offset + 1],
+                    map->base_register + model->offset,
+                    model->did, model->len);
+            return 1;
+        }
+    }
+    if ((map->end_offset >= 0) &&
+        ((regs[map->end_offset] != 0xFFFF) ||
+         (regs[map->end_offset + 1] != 0x0000))) {
+        verbose(1, "end marker missing at register %d",
+                map->base_register + map->end_offset);
+        return 1;
+    }
+
+    /* remember who the device is, for validating cached maps.  a map
+       that came from the cache is checked here instead. */
+    suns_map_model_t *common = suns_map_common_model(map);
+    if (common && (map->common == NULL)) {
+        suns_map_set_common(map, regs + common->offset + 2, common->len);
+    } else if (common && ((map->common_len != common->len) ||
+                          (memcmp(regs + common->offset + 2, map->common,
+                                  sizeof(uint16_t) * common->len) != 0))) {
+        verbose(1, "common model does not match the map");
+        return 1;
+    }
+
+    if (device->arena)
+        suns_device_free_datasets(device);
+    reuse = device->datasets->head;
+
+    /* the decoder expects registers in modbus (big-endian) byte order */
+    if (device->arena)
+        buf = arena_alloc(device->arena, map_len * 2);
+    else
+        buf = malloc(map_len * 2);
+    if (buf == NULL) {
+        error("memory error: can't malloc() buffer for %d registers",
+              map_len);
+        return -1;
+    }
+    suns_regs_htobe((uint16_t *) buf, regs, map_len);
+
+    if (device->changes)
+        full = suns_changes_begin(device->changes, map_len);
+    if (! full) {
+        if (device->arena)
+            changed = arena_alloc(device->arena,
+                                  suns_regs_mask_size(map_len));
+        else
+            changed = malloc(suns_regs_mask_size(map_len));
+        if (changed == NULL) {
+            debug("can't allocate a change mask; decoding in full");
+            full = 1;
+        }
+    }
+
+    /* slice the registers into per-model buffers and decode them */
+    list_for_each(map->models, c) {
+        suns_map_model_t *model = c->data;
+        unsigned char *model_buf = buf + (model->offset * 2);
+        /* add 2 to len to include did & len registers, and
+           convert to bytes */
+        size_t model_len = (model->len + 2) * 2;
+
+        n++;
+
+        /* dump the binary data in test model form */
+        if (verbose_level > 2) {
+            suns_binary_model_fprintf(stdout, did_index,
+                                      model_buf, model_len);
+        }
+
+        did = suns_find_did(did_index, model->did);
+
+        /* find the registers that changed since the last read.  a model
+           whose header moved is decoded in full. */
+        const uint8_t *model_changed = NULL;
+        int unchanged = 0;
+        if ((! full) &&
+            (suns_changes_diff(device->changes, regs,
+                               model->offset, 2, NULL) == 0)) {
+            if (suns_changes_diff(device->changes, regs,
+                                  model->offset + 2, model->len,
+                                  changed) > 0) {
+                model_changed = changed;
+            } else if (model->did == 1) {
+                /* still needed to identify the device */
+                unchanged = 1;
+            } else {
+                /* the dataset from the last read, if it was kept,
+                   still holds this model's values */
+                if (did && reuse) {
+                    data = reuse->data;
+                    reuse = reuse->next;
+                    data->unchanged = 1;
+                }
+                continue;
+            }
+        }
+
+        /* if the did for this blob is known, decode it and
+           attach it to the suns_device_t */
+        if (did && reuse) {
+            data = reuse->data;
+            reuse = reuse->next;
+            /* the values may be left from a partial decode */
+            if (device->changes && (model_changed == NULL))
+                list_free_nodes(data->values,
+                                (list_free_data_f) suns_value_free);
+            data->changed = model_changed;
+            data->unchanged = unchanged;
+            data->partial = (model_changed != NULL);
+            rc = suns_decode_dataset(did_index, model_buf, model_len, data);
+            data->changed = NULL;
+            if (rc < 0)
+                continue;
+
+            if (data->did->did == 1) {
+                device->common = data;
+                suns_device_update_common(device);
+            }
+        } else if (did) {
+            data = suns_dataset_new_in(device->arena);
+            if (data == NULL)
+                continue;
+            /* the columns outlive the arena, so they are only laid out
+               again when the map changes */
+            if (device->columnar && device->arena &&
+                (device->changes == NULL))
+                data->columns = suns_device_columns(device, n);
+            data->changed = model_changed;
+            data->unchanged = unchanged;
+            data->partial = (model_changed != NULL);
+            rc = suns_decode_dataset(did_index, model_buf, model_len, data);
+            data->changed = NULL;
+            if (rc < 0) {
+                if (device->arena == NULL)
+                    suns_dataset_free(data);
+                continue;
+            }
+
+            /* assign index */
+            if (device->changes) {
+                /* models without changes are missing from the device,
+                   so count instances in the map instead */
+                data->index = suns_map_did_index(map, model);
+            } else {
+                /* suns_model_get_did_index() must be called before the
+                   dataset is added to the device */
+                data->index = suns_model_get_did_index(device,
+                                                       data->did->did);
+            }
+
+            /* add the dataset to the device */
+            suns_device_add_dataset(device, data);
+        } else {
+            /* unknown data block */
+            if (verbose_level > 0) {
+                dump_buffer(stdout, model_buf, model_len);
+            }
+        }
+    }
+
+    if (device->arena == NULL) {
+        /* the registers go with the buffer */
+        list_for_each(device->datasets, c) {
+            data = c->data;
+            data->regs = NULL;
+            data->regs_len = 0;
+        }
+        free(buf);
+        free(changed);
+    }
+
+    if (device->changes)
+        suns_changes_end(device->changes, regs, map_len);
+
+    return 0;
+}
+
+
+/**
+ * save a map to path so later runs can skip discovery.  the file is
+ * written to a temporary name and renamed into place.
+ *
+ * the format is line oriented text:
+ *
+ *   suns-map 1
+ *   base <register>
+ *   end <offset>
+ *   model <did> <len> <offset>       (one per model, in device order)
+ *   common <len> <hex register> ...
+ *   link <max read> <srtt> <rttvar>  (if link isn't NULL)
+ *
+ * saving clears link->changed.
+ *
+ * returns 0 on success or -1 on failure
+ */
+int suns_map_save(suns_map_t *map, suns_link_t *link, const char *path)
+{
+    char tmp_path[BIG_BUFFER_SIZE];
+    list_node_t *c;
+    FILE *f;
+    int i;
+
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >=
+        sizeof(tmp_path)) {
+        error("map cache path %s is too long", path);
+        return -1;
+    }
+
+    f = fopen(tmp_path, "w");
+    if (f == NULL) {
+        error("can't open %s for writing: %m", tmp_path);
+        return -1;
+    }
+
+    fprintf(f, "suns-map 1\n");
+    fprintf(f, "base %d\n", map->base_register);
+    fprintf(f, "end %d\n", map->end_offset);
+    list_for_each(map->models, c) {
+        suns_map_model_t *model = c->data;
+        fprintf(f, "model %u %u %d\n", model->did, model->len, model->offset);
+    }
+    if (map->common) {
+        fprintf(f, "common %d", map->common_len);
+        for (i = 0; i < map->common_len; i++) {
+            fprintf(f, " %04x", map->common[i]);
+        }
+        fprintf(f, "\n");
+    }
+    if (link) {
+        fprintf(f, "link %d %d %d\n", link->max_read, link->srtt,
+                link->rttvar);
+    }
+
+    if (fclose(f) != 0) {
+        error("error writing %s: %m", tmp_path);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    if (rename(tmp_path, path) < 0) {
+        error("can't rename %s to %s: %m", tmp_path, path);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    if (link)
+        link->changed = 0;
+
+    return 0;
+}
+
+
+/**
+ * load a map saved by suns_map_save().  if link isn't NULL, what was
+ * learned about the link is restored into it with suns_link_restore().
+ *
+ * returns the map, or NULL if the file doesn't exist or can't be parsed
+ */
+suns_map_t *suns_map_load(const char *path, suns_link_t *link)
+{
+    char *line = NULL;
+    size_t line_size = 0;
+    suns_map_t *map;
+    FILE *f;
+    int version = 0;
+    int line_num = 0;
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        debug("can't open %s: %m", path);
+        return NULL;
+    }
+
+    map = suns_map_new();
+    if (map == NULL) {
+        fclose(f);
+        return NULL;
+    }
+
+    while (getline(&line, &line_size, f) > 0) {
+        unsigned int did, len;
+        int n, offset;
+        int max_read, srtt, rttvar;
+
+        line_num++;
+
+        if (line_num == 1) {
+            if ((sscanf(line, "suns-map %d", &version) != 1) ||
+                (version != 1)) {
+                warning("%s is not a version 1 map cache file", path);
+                goto fail;
+            }
+        } else if (sscanf(line, "base %d", &(map->base_register)) == 1) {
+            continue;
+        } else if (sscanf(line, "end %d", &(map->end_offset)) == 1) {
+            continue;
+        } else if (sscanf(line, "model %u %u %d", &did, &len, &offset) == 3) {
+            if (suns_map_add_model(map, did, len, offset) == NULL)
+                goto fail;
+        } else if (sscanf(line, "common %u%n", &len, &n) == 1) {
+            char *p = line + n;
+            unsigned int reg;
+            int i, used;
+
+            map->common = malloc(sizeof(uint16_t) * (len > 0 ? len : 1));
+            if (map->common == NULL)
+                goto fail;
+            map->common_len = len;
+            for (i = 0; i < len; i++) {
+                if (sscanf(p, "%x%n", &reg, &used) != 1) {
+                    warning("%s line %d: expected %d common registers",
+                            path, line_num, len);
+                    goto fail;
+                }
+                map->common[i] = reg;
+                p += used;
+            }
+        } else if (sscanf(line, "link %d %d %d",
+                          &max_read, &srtt, &rttvar) == 3) {
+            if (link)
+                suns_link_restore(link, max_read, srtt, rttvar);
+        } else {
+            warning("%s line %d: can't parse \"%s\"", path, line_num, line);
+            goto fail;
+        }
+    }
+
+    free(line);
+    fclose(f);
+
+    if (map->base_register < 0) {
+        warning("%s has no base register", path);
+        suns_map_free(map);
+        return NULL;
+    }
+
+    return map;
+
+ fail:
+    free(line);
+    fclose(f);
+    suns_map_free(map);
+    return NULL;
+}
+
+
+/**
+ * build the name of the map cache file in dir for the modbus tcp
+ * device at hostname:tcp_port, slave address addr.
+ *
+ * returns 0 on success or -1 if the path doesn't fit in len
+ */
+int suns_map_cache_path(char *path, size_t len, const char *dir,
+                        const char *hostname, int tcp_port, int addr)
+{
+    if (snprintf(path, len, "%s/%s_%d_%d.map", dir, hostname, tcp_port,
+                 addr) >= len) {
+        error("map cache path for %s is too long", dir);
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,108 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * suns_map.h
+ *
+ * register maps of sunspec devices and the reads used to cover them
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef _SUNS_MAP_H_
+#define _SUNS_MAP_H_
+
+#include <stdint.h>
+
+#include "trx/list.h"
+#include "suns_model.h"
+#include "suns_link.h"
+
+
+/* one model in a device's register map */
+typedef struct suns_map_model {
+    uint16_t did;
+    uint16_t len;          /* model length in registers, not including
+                              the did and length registers */
+    int offset;            /* register offset of the did from the
+                              base register */
+} suns_map_model_t;
+
+/* the layout of the sunspec registers on a device, as learned by
+   walking the model chain.  offsets are relative to base_register,
+   which holds the first register of the sunspec signature. */
+typedef struct suns_map {
+    int base_register;     /* base address 1 */
+    list_t *models;        /* list of suns_map_model_t, in device order */
+    int end_offset;        /* offset of the end marker, or -1 if
+                              the chain ended without one */
+    uint16_t *common;      /* registers of the common model body, which
+                              identify the device, or NULL */
+    int common_len;
+} suns_map_t;
+
+/* a single modbus read, relative to the map's base register */
+typedef struct suns_map_read {
+    int offset;
+    int len;
+} suns_map_read_t;
+
+
+suns_map_t *suns_map_new(void);
+void suns_map_free(suns_map_t *map);
+suns_map_model_t *suns_map_add_model(suns_map_t *map,
+                                     uint16_t did,
+                                     uint16_t len,
+                                     int offset);
+int suns_map_len(suns_map_t *map);
+int suns_map_plan_reads(suns_map_t *map,
+                        int max_read,
+                        suns_map_read_t **reads);
+suns_map_model_t *suns_map_common_model(suns_map_t *map);
+int suns_map_set_common(suns_map_t *map, uint16_t *regs, int len);
+int suns_map_validate_len(suns_map_t *map);
+int suns_map_validate(suns_map_t *map, uint16_t *regs);
+int suns_map_add_header(suns_map_t *map,
+                        suns_did_index_t *did_index,
+                        int offset,
+                        uint16_t *regs);
+int suns_map_check(suns_map_t *map);
+int suns_map_decode(suns_map_t *map,
+                    suns_did_index_t *did_index,
+                    uint16_t *regs,
+                    suns_device_t *device);
+int suns_map_save(suns_map_t *map, suns_link_t *link, const char *path);
+suns_map_t *suns_map_load(const char *path, suns_link_t *link);
+int suns_map_cache_path(char *path, size_t len, const char *dir,
+                        const char *hostname, int tcp_port, int addr);
+
+#endif /* _SUNS_MAP_H_ */
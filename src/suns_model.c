@@ -49,6 +49,11 @@
 #include <time.h>
 
 #include "suns_model.h"
+#include "suns_columns.h"
+#include "suns_samples.h"
+#include "suns_regs.h"
+#include "suns_changes.h"
+#include "suns_symbols.h"
 #include "suns_parser.h"
 #include "trx/debug.h"
 #include "trx/macros.h"
@@ -271,6 +276,9 @@ void suns_attribute_free(void *p)
 
 void suns_model_free(suns_model_t *model)
 {
+    suns_decode_plan_free(model->plan);
+    hash_free(model->dp_index, NULL);
+    free(model->dp_refs);
     list_free(model->dp_blocks, (list_free_data_f) suns_model_dp_block_free);
     free(model);
 }
@@ -592,8 +600,14 @@ int suns_buf_to_value(unsigned char *buf,
 
         /* strings */
     case SUNS_STRING:
-        /* same as malloc() if tp->s == NULL */
-        v->value.s = realloc(v->value.s, tp->len + 1);
+        /* keep the storage of a string of the same length, which may
+           not be from the heap */
+        if ((v->tp.type != SUNS_STRING) ||
+            (v->tp.len != tp->len) ||
+            (v->value.s == NULL)) {
+            /* same as malloc() if tp->s == NULL */
+            v->value.s = realloc(v->value.s, tp->len + 1);
+        }
         if (v->value.s == NULL) {
             /* uh oh */
             debug("malloc() returned NULL!");
@@ -819,29 +833,24 @@ void suns_value_free(suns_value_t *v)
         }
     }
 
-    /* if v->name_with_index is not a pointer to v->name
-       it contains a chunk of memory containing the
-       composite name_with_index */
-    if (v->name_with_index != v->name)
-        free(v->name_with_index);
-    
+    /* v->name_with_index points at v->name or into the names
+       interned by the decode plan, so it isn't freed here */
+
     free(v);
 }
 
 
 /**
  * special accessor to set the index value
- * this has the side-effect of keeping v->name_with_index up-to-date
+ *
+ * values in a repeating block get their composite name_with_index from
+ * the names interned by the decode plan (see suns_decode_plan_names()),
+ * so this no longer formats one.
  */
 int suns_value_set_index(suns_value_t *v, int index)
 {
     v->index = index;
 
-    if (v->name)
-        return suns_value_set_name(v, v->name);
-
-    /* if we're here the v->name element hasn't been set
-       so therey's no name to update */
     return 0;
 }
 
@@ -850,34 +859,15 @@ int suns_value_set_index(suns_value_t *v, int index)
  * special accessor to set the value name
  * this is normally a pointer to a string that has been parsed out of
  * a model definition file.
- * it has the side-effect of keeping the the name_with_index up-to-date
+ * it has the side-effect of pointing name_with_index at name, which is
+ * correct for values outside a repeating block.  the decode plan
+ * replaces it with an interned "name,NN" for the others.
  */
 int suns_value_set_name(suns_value_t *v, char *name)
 {
-    /* remember this is called from suns_value_set_index() !! */
-
     v->name = name;
-
-    if (v->repeating) {
-
-        /* do we need some some space for name_with_index? */
-        if ((v->name_with_index == NULL) ||
-            (v->name_with_index == v->name)) {
-            
-            v->name_with_index = malloc(BUFFER_SIZE);
-            if (v->name_with_index == NULL) {
-                error("can't malloc() space for v->name_with_index");
-                return -1;
-            }
-            memset(v->name_with_index, 0, BUFFER_SIZE);
-        }
-        
-        return snprintf(v->name_with_index, BUFFER_SIZE, "%s,%02d",
-                        v->name, v->index);    
-    }
-
-    /* nonrepeating block just points name_with_index at name */
     v->name_with_index = v->name;
+
     return 0;
 }
 
@@ -974,15 +964,67 @@ suns_dataset_t *suns_dataset_new(void)
 }
 
 
+/**
+ * allocate a dataset, and everything later decoded into it, from an
+ * arena.  the dataset is freed by resetting the arena, never with
+ * suns_dataset_free(), and is only decoded into once.
+ *
+ * if arena is NULL this is the same as suns_dataset_new()
+ */
+suns_dataset_t *suns_dataset_new_in(arena_t *arena)
+{
+    suns_dataset_t *d;
+
+    if (arena == NULL)
+        return suns_dataset_new();
+
+    d = arena_zalloc(arena, sizeof(suns_dataset_t));
+    if (d == NULL) {
+        debug("arena_zalloc() failed");
+        return NULL;
+    }
+
+    d->values = arena_zalloc(arena, sizeof(list_t));
+    if (d->values == NULL) {
+        debug("arena_zalloc() failed");
+        return NULL;
+    }
+    d->arena = arena;
+
+    return d;
+}
+
+
 void suns_dataset_free(suns_dataset_t *d)
 {
     assert(d);
+    assert(d->arena == NULL);
 
     list_free(d->values, (list_free_data_f) suns_value_free);
+    if (d->columns)
+        suns_columns_free(d->columns);
+    if (d->samples)
+        suns_samples_free(d->samples);
     free(d);
 }
 
 
+/* a list node for data, from the arena if there is one */
+static list_node_t *suns_list_node_new(arena_t *arena, void *data)
+{
+    list_node_t *node;
+
+    if (arena == NULL)
+        return list_node_new(data);
+
+    node = arena_zalloc(arena, sizeof(list_node_t));
+    if (node)
+        node->data = data;
+
+    return node;
+}
+
+
 suns_device_t *suns_device_new(void)
 {
     suns_device_t *d = malloc(sizeof(suns_device_t));
@@ -1000,18 +1042,70 @@ suns_device_t *suns_device_new(void)
     return d;
 }
 
+/**
+ * allocate a device whose datasets come from an arena.  reading the
+ * device again resets the arena instead of freeing the datasets of the
+ * last read one at a time, so once the arena has grown to fit a read,
+ * later reads don't call malloc() at all.
+ */
+suns_device_t *suns_device_new_with_arena(void)
+{
+    suns_device_t *d = suns_device_new();
+
+    if (d == NULL)
+        return NULL;
+
+    d->arena = arena_new(0);
+    if (d->arena == NULL) {
+        debug("arena_new() failed");
+        suns_device_free(d);
+        return NULL;
+    }
+
+    return d;
+}
+
+
 void suns_device_free(suns_device_t *d)
 {
     assert(d);
 
-    list_free(d->datasets, (list_free_data_f) suns_dataset_free);
+    suns_device_free_datasets(d);
+    list_free(d->datasets, NULL);
+    arena_free(d->arena);
+    suns_changes_free(d->changes);
+    vector_free(d->columns, (vector_free_data_f) suns_columns_free);
     free(d);
 }
 
 
-int suns_device_add_dataset(suns_device_t *device, suns_dataset_t *data)
+/* drop every dataset on a device, along with the pointers into the
+   common model */
+void suns_device_free_datasets(suns_device_t *device)
+{
+    if (device->arena) {
+        /* the nodes are in the arena too */
+        device->datasets->head = NULL;
+        device->datasets->tail = NULL;
+        device->datasets->current = NULL;
+        device->datasets->count = 0;
+        arena_reset(device->arena);
+    } else {
+        list_free_nodes(device->datasets,
+                        (list_free_data_f) suns_dataset_free);
+    }
+    device->common = NULL;
+    device->manufacturer = NULL;
+    device->model = NULL;
+    device->serial_number = NULL;
+}
+
+
+/* cache pointers to the identifying strings in the common model
+   this must be called again whenever the common model is re-decoded,
+   since the strings may move */
+void suns_device_update_common(suns_device_t *device)
 {
-    int rc = 0;
     int i;
     suns_value_t *v;
 
@@ -1027,7 +1121,23 @@ int suns_device_add_dataset(suns_device_t *device, suns_dataset_t *data)
         { NULL,             NULL  }
     };
 
-    rc = list_node_add(device->datasets, list_node_new(data));
+    if (device->common == NULL)
+        return;
+
+    for (i = 0; elmt_map[i].dp != NULL; i++) {
+        v = suns_search_value_list(device->common->values, elmt_map[i].dp);
+        if (v)
+            *(elmt_map[i].ptr) = suns_value_get_string(v);
+    }
+}
+
+
+int suns_device_add_dataset(suns_device_t *device, suns_dataset_t *data)
+{
+    int rc = 0;
+
+    rc = list_node_add(device->datasets,
+                       suns_list_node_new(device->arena, data));
     if (rc < 0) {
         debug("list_node_add() failed");
         error("memory error: failed to add device to dataset");
@@ -1040,12 +1150,7 @@ int suns_device_add_dataset(suns_device_t *device, suns_dataset_t *data)
     /* if we are, then cache the pointers to the pieces we care about */
     if (data->did->did == 1) {
         device->common = data;
-        
-        for (i = 0; elmt_map[i].dp != NULL; i++) {
-            v = suns_search_value_list(device->common->values, elmt_map[i].dp);
-            if (v)
-                *(elmt_map[i].ptr) = suns_value_get_string(v);
-        }
+        suns_device_update_common(device);
     }
 
     /* search the dataset already to see if we've already added
@@ -1071,6 +1176,7 @@ void suns_value_init(suns_value_t *v)
 {
     assert(v != NULL);
     memset(v, 0, sizeof(suns_value_t));
+    v->step = -1;
 }
 
 
@@ -1078,6 +1184,7 @@ void suns_value_set_null(suns_value_t *v)
 {
     assert(v != NULL);
     memset(v, 0, sizeof(suns_value_t));
+    v->step = -1;
 }
 
     
@@ -1459,61 +1566,140 @@ uint32_t suns_value_get_ipv4(suns_value_t *v)
 }
 
 
-/* search for a specified did
-   returns the first suns_model_did_t matching the specified did value
-   returns NULL if no matching did value is found */
-suns_model_did_t *suns_find_did(list_t *did_list, uint16_t did)
+suns_did_index_t *suns_did_index_new(void)
+{
+    suns_did_index_t *index = malloc(sizeof(suns_did_index_t));
+    if (index == NULL) {
+        error("memory error: can't malloc(sizeof(suns_did_index_t))");
+        return NULL;
+    }
+
+    memset(index, 0, sizeof(suns_did_index_t));
+
+    return index;
+}
+
+
+/* frees the index only; the suns_model_did_t entries belong to the
+   models they were parsed with */
+void suns_did_index_free(suns_did_index_t *index)
 {
-    assert(did_list);
+    int i;
 
-    suns_model_did_t *d;
+    if (index == NULL)
+        return;
 
-    debug("looking up model for did %d", did);
+    for (i = 0; i < SUNS_DID_INDEX_PAGES; i++) {
+        free(index->pages[i]);
+    }
+    free(index);
+}
 
-    list_node_t *c;
-    list_for_each(did_list, c) {
-        d = c->data;
-        if (d->did == did) {
-            return d;
+
+/* add a did to the index
+   the first suns_model_did_t added for a did value wins, so lookups
+   behave the same as a front-to-back search of the global did_list.
+   returns 0 on success, 1 if the did was already indexed, or -1 on
+   error */
+int suns_did_index_add(suns_did_index_t *index, suns_model_did_t *did)
+{
+    assert(index);
+    assert(did);
+
+    int page = did->did >> 8;
+
+    if (index->pages[page] == NULL) {
+        index->pages[page] = malloc(sizeof(suns_model_did_t *) * 256);
+        if (index->pages[page] == NULL) {
+            error("memory error: can't malloc() did index page");
+            return -1;
         }
+        memset(index->pages[page], 0, sizeof(suns_model_did_t *) * 256);
     }
 
-    return NULL;
+    if (index->pages[page][did->did & 0xff] != NULL) {
+        debug("did %d is already defined; keeping the first definition",
+              did->did);
+        return 1;
+    }
+
+    index->pages[page][did->did & 0xff] = did;
+    index->count++;
+
+    return 0;
+}
+
+
+/* search for a specified did
+   returns the first suns_model_did_t matching the specified did value
+   returns NULL if no matching did value is found */
+suns_model_did_t *suns_find_did(suns_did_index_t *index, uint16_t did)
+{
+    assert(index);
+
+    suns_model_did_t **page = index->pages[did >> 8];
+
+    if (page == NULL)
+        return NULL;
+
+    return page[did & 0xff];
 }
 
 
 /* take a binary data blob and decode it
-   this relies on the global did_list to find the model */
-suns_dataset_t *suns_decode_data(list_t *did_list,
+   this relies on the global did index to find the model */
+suns_dataset_t *suns_decode_data(suns_did_index_t *did_index,
                                  unsigned char *buf,
                                  size_t len)
 {
-    list_node_t *c;
-    suns_model_did_t *did = NULL;
     suns_dataset_t *data;
 
+    data = suns_dataset_new();
+    if (data == NULL) {
+        debug("suns_dataset_new() failed");
+        return NULL;
+    }
+
+    if (suns_decode_dataset(did_index, buf, len, data) < 0) {
+        suns_dataset_free(data);
+        return NULL;
+    }
+
+    return data;
+}
+
+
+/**
+ * decode a binary data blob into an existing dataset.
+ *
+ * the values already in the dataset, left there by an earlier decode of
+ * the same model, are reused rather than reallocated.  this lets a
+ * device that is polled repeatedly keep the same storage.
+ *
+ * returns 0 on success or -1 if the model is unknown
+ */
+int suns_decode_dataset(suns_did_index_t *did_index,
+                        unsigned char *buf,
+                        size_t len,
+                        suns_dataset_t *data)
+{
+    suns_model_did_t *did = NULL;
+
     /* the first 2 bytes contain the did */
     uint16_t did_value = be16toh(*((uint16_t *)buf));
 
     /* the next 2 bytes contains the length */
     uint16_t did_len = be16toh(*((uint16_t *)buf + 1));
 
-    did = suns_find_did(did_list, did_value);
+    did = suns_find_did(did_index, did_value);
 
     if (did == NULL) {
         warning("unknown did %d", did_value);
-        return NULL;
+        return -1;
     }
     
     suns_model_t *m = did->model;
 
-    data = suns_dataset_new();
-    if (data == NULL) {
-        debug("suns_dataset_new() failed");
-        return NULL;
-    }
-    data->did = did;
-
     debug("did %d found", did_value);
 
     debug("did_len = %d, m->len = %d", did_len, m->len);
@@ -1576,33 +1762,54 @@ suns_dataset_t *suns_decode_data(list_t *did_list,
                to generate a report */
         }
     }
-    if (did == NULL) {
-        error("unknown model did %03d", did_value);
-        return NULL;
+    return suns_decode_model_data(did, buf + 4, did_len * 2, data);
+}
+
+
+/**
+ * decode len bytes of data for the model did (not including the did
+ * and length header) into an existing dataset, without checking len
+ * against the model.  see suns_decode_dataset().
+ */
+int suns_decode_model_data(suns_model_did_t *did,
+                           unsigned char *buf,
+                           size_t len,
+                           suns_dataset_t *data)
+{
+    suns_model_t *m = did->model;
+
+    /* values decoded for some other model can't be reused */
+    if ((data->did != NULL) && (data->did != did)) {
+        list_free_nodes(data->values, (list_free_data_f) suns_value_free);
     }
-    
-    /* now step through all the dp_blocks decoding data */
-    int byte_offset = 0;
-    list_for_each(m->dp_blocks, c) {
-        byte_offset += suns_decode_dp_block(c->data,
-                                            /* offset +4 for header */
-                                            buf + byte_offset + 4,
-                                            (did_len * 2) - byte_offset,
-                                            data->values);
-        if (byte_offset >= (did_len * 2) + 4) {
-            error("buffer overrun in suns_decode_data(): byte offset %d of %d",
-                  byte_offset, did_len * 2);
-            return data;
+    data->did = did;
+    data->regs = buf;
+    data->regs_len = len;
+
+    /* models are normally compiled right after their offsets are
+       filled in, but don't depend on it */
+    if (m->plan == NULL) {
+        if (suns_model_compile_plan(m) < 0) {
+            error("unable to compile decode plan for model %d", did->did);
+            return 0;
         }
-        
     }
-    
-    /* resolve scale factors in the resulting dataset */
-    suns_resolve_scale_factors(data);
 
-    return data;
-}
+    if (data->samples) {
+        /* every datapoint is a sample; the values list stays empty */
+        suns_decode_samples(m->plan, buf, len, data->samples);
+    } else if (data->columns) {
+        /* only the non-repeating part goes in the values list */
+        suns_decode_plan(m->plan, buf, min(len, m->plan->fixed_bytes),
+                         data->values, data->arena, NULL);
+        suns_decode_columns(m->plan, buf, len, data->columns);
+    } else {
+        suns_decode_plan(m->plan, buf, len, data->values, data->arena,
+                         data->changed);
+    }
 
+    return 0;
+}
 
 
 /* fill in any implied offset fields */
@@ -1666,77 +1873,786 @@ void suns_model_fill_offsets(suns_model_t *m)
 }
 
 
-/* decode the provided buffer buf of length len using the provided dp_block
-   the results are appended to value_list and the total buffer length decoded
-   is returned (which should be the same as the len argument)
+/* free the symbol tables compiled with a plan.  they hang off the
+   model's type pairs, which outlive the plan. */
+static void suns_decode_plan_free_symbols(suns_decode_plan_t *plan)
+{
+    suns_type_pair_t *tp;
+    int i;
+
+    if (plan->symbols == NULL)
+        return;
+
+    vector_for_each(plan->symbols, i, tp) {
+        suns_symbols_free(tp->symbols);
+        tp->symbols = NULL;
+    }
+    vector_clear(plan->symbols);
+}
 
-   GOTCHA: all lengths and offset are in bytes, not modbus registers
-   FIXME:  at some point i need to go through everything and pick one system */
-int suns_decode_dp_block(suns_dp_block_t *dp_block,
-                         unsigned char *buf,
-                         size_t len,
-                         list_t *value_list)
+
+void suns_decode_plan_free(suns_decode_plan_t *plan)
 {
-    int len_multiple;
-    int byte_offset = 0;
+    int n_repeat;
+    int j;
+
+    if (plan == NULL)
+        return;
+
+    /* each instance's names share one allocation, starting with the
+       name of its first step */
+    n_repeat = plan->n_steps - plan->n_fixed;
+    for (j = 0; j < plan->n_names; j++) {
+        free(plan->names[j * n_repeat]);
+    }
+    free(plan->names);
+    vector_free(plan->old_names, free);
+    hash_free(plan->step_index, NULL);
+    suns_decode_plan_free_symbols(plan);
+    vector_free(plan->symbols, NULL);
+    if (plan->attached)
+        plan->attached_free(plan->attached);
+    pthread_mutex_destroy(&(plan->names_lock));
+
+    free(plan->steps);
+    free(plan);
+}
+
+
+/**
+ * keep data with the plan, to be freed by free_f when the plan is,
+ * unless some other data is attached first.  this lets a layer built
+ * on decoded values, such as the output formats, cache what it
+ * derives from a plan without the plan knowing about it.  threads
+ * decoding with the plan may race to attach; one of them wins.
+ *
+ * returns whatever is attached to the plan.  if that isn't data, the
+ * caller still owns data.
+ */
+void *suns_decode_plan_attach(suns_decode_plan_t *plan, void *data,
+                              void (*free_f)(void *attached))
+{
+    void *attached = NULL;
+
+    /* every caller passes the same free_f */
+    plan->attached_free = free_f;
+    if (__atomic_compare_exchange_n(&(plan->attached), &attached, data, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return data;
+
+    return attached;
+}
+
+
+/* the data attached to the plan, or NULL */
+void *suns_decode_plan_attached(suns_decode_plan_t *plan)
+{
+    return __atomic_load_n(&(plan->attached), __ATOMIC_ACQUIRE);
+}
+
+
+/**
+ * return the interned names of the repeating block steps for at least
+ * count instances.  the name of step i (i >= n_fixed) in instance j
+ * (0 based) is names[(j * n_repeat) + (i - n_fixed)], "name,NN" with
+ * the 1 based repeat index.
+ *
+ * the table grows to the largest count asked for.  names are never
+ * moved or freed until the plan is, and a names array that is
+ * outgrown is kept too, so the pointers handed out stay valid while
+ * other threads decode with the same plan.  only growing the table
+ * takes plan->names_lock.
+ *
+ * returns NULL on a memory error.
+ */
+char **suns_decode_plan_names(suns_decode_plan_t *plan, int count)
+{
+    int n_repeat = plan->n_steps - plan->n_fixed;
+    char **names = NULL;
+    int n_names;
+    int i, j;
+
+    /* n_names is published after names, so a names array read after
+       it is at least that big */
+    if (count <= __atomic_load_n(&(plan->n_names), __ATOMIC_ACQUIRE))
+        return __atomic_load_n(&(plan->names), __ATOMIC_ACQUIRE);
+
+    pthread_mutex_lock(&(plan->names_lock));
+
+    /* another thread may have grown it while we waited */
+    if (count <= plan->n_names) {
+        names = plan->names;
+        goto done;
+    }
+
+    /* at least double, so a growing device doesn't cost a copy each read */
+    n_names = plan->n_names * 2;
+    if (n_names < count)
+        n_names = count;
+
+    names = malloc(sizeof(char *) * n_names * n_repeat);
+    if (names == NULL) {
+        error("memory error: can't malloc() %d names", n_names * n_repeat);
+        goto done;
+    }
+    if (plan->n_names > 0)
+        memcpy(names, plan->names, sizeof(char *) * plan->n_names * n_repeat);
+
+    for (j = plan->n_names; j < n_names; j++) {
+        size_t size = 0;
+        char *p;
+
+        for (i = plan->n_fixed; i < plan->n_steps; i++) {
+            size += snprintf(NULL, 0, "%s,%02d",
+                             plan->steps[i].dp->name, j + 1) + 1;
+        }
+        p = malloc(size);
+        if (p == NULL) {
+            error("memory error: can't malloc() %zd bytes of names", size);
+            /* the instances named so far are complete */
+            while (j-- > plan->n_names)
+                free(names[j * n_repeat]);
+            free(names);
+            names = NULL;
+            goto done;
+        }
+        for (i = plan->n_fixed; i < plan->n_steps; i++) {
+            names[(j * n_repeat) + (i - plan->n_fixed)] = p;
+            p += sprintf(p, "%s,%02d", plan->steps[i].dp->name, j + 1) + 1;
+        }
+    }
+
+    /* readers may still hold the array being replaced */
+    if (plan->names) {
+        if (plan->old_names == NULL)
+            plan->old_names = vector_new(4);
+        if (plan->old_names == NULL ||
+            vector_push(plan->old_names, plan->names) < 0) {
+            error("memory error: can't keep the old names array");
+            for (j = plan->n_names; j < n_names; j++)
+                free(names[j * n_repeat]);
+            free(names);
+            names = NULL;
+            goto done;
+        }
+    }
+    __atomic_store_n(&(plan->names), names, __ATOMIC_RELEASE);
+    __atomic_store_n(&(plan->n_names), n_names, __ATOMIC_RELEASE);
+
+ done:
+    pthread_mutex_unlock(&(plan->names_lock));
+
+    return names;
+}
+
+
+/* find the step index of the datapoint called name, or -1 */
+int suns_decode_plan_find_step(suns_decode_plan_t *plan, const char *name)
+{
+    suns_decode_step_t *step = hash_get(plan->step_index, name);
+
+    if (step == NULL)
+        return -1;
+
+    return step - plan->steps;
+}
+
+
+/**
+ * compile a model into a flat decode plan (see suns_decode_plan_t).
+ *
+ * must be called after suns_model_fill_offsets() since it relies on
+ * dp_block->len.  any existing plan is replaced.
+ *
+ * returns 0 on success or -1 on failure.
+ */
+int suns_model_compile_plan(suns_model_t *m)
+{
+    list_node_t *c, *d;
+    suns_decode_plan_t *plan;
+    int n = 0;
     int i;
-    list_node_t *c;
-    suns_value_t *v;
-    int repeat_index = 1;  /* repeat index is 1 based */
 
-    if (dp_block->repeating) {
-        debug("repeating block");
-        len_multiple = len / dp_block->len / 2;
-    } else {
-        len_multiple = 1;
+    list_for_each(m->dp_blocks, d) {
+        suns_dp_block_t *dp_block = d->data;
+        n += list_count(dp_block->dp_list);
     }
 
-    debug("len_multiple = %d", len_multiple);
-    
-    for (i = 0; i < len_multiple; i++) {
+    plan = malloc(sizeof(suns_decode_plan_t));
+    if (plan == NULL) {
+        error("memory error: can't malloc(sizeof(suns_decode_plan_t))");
+        return -1;
+    }
+    memset(plan, 0, sizeof(suns_decode_plan_t));
+    pthread_mutex_init(&(plan->names_lock), NULL);
+
+    plan->steps = malloc(sizeof(suns_decode_step_t) * (n > 0 ? n : 1));
+    if (plan->steps == NULL) {
+        error("memory error: can't malloc() %d decode steps", n);
+        pthread_mutex_destroy(&(plan->names_lock));
+        free(plan);
+        return -1;
+    }
+    memset(plan->steps, 0, sizeof(suns_decode_step_t) * (n > 0 ? n : 1));
+
+    /* byte offsets advance by the size of each datapoint, the same
+       way the data is laid out on the wire */
+    int byte_offset = 0;
+    list_for_each(m->dp_blocks, d) {
+        suns_dp_block_t *dp_block = d->data;
+
+        if (dp_block->repeating) {
+            plan->n_fixed = plan->n_steps;
+            plan->repeat_len = dp_block->len;
+            byte_offset = 0;
+        }
+
         list_for_each(dp_block->dp_list, c) {
             suns_dp_t *dp = c->data;
-            int size = suns_type_pair_size(dp->type_pair);
-            v = suns_value_new();
+            suns_decode_step_t *step = &(plan->steps[plan->n_steps++]);
+
+            step->dp = dp;
+            step->tp = dp->type_pair;
+            step->byte_offset = byte_offset;
+            step->size = suns_type_pair_size(dp->type_pair);
+            step->sf_step = -1;
+            step->units = suns_find_attribute(dp, "u");
+            step->label = suns_find_attribute(dp, "label");
+            /* fixed size values are decoded from the register lanes;
+               strings, pads and ipv6 addresses are copied from buf */
+            if ((step->tp->type != SUNS_PAD) &&
+                (step->tp->type != SUNS_IPV6) &&
+                (step->size > 0) &&
+                (step->size == suns_type_size(step->tp->type))) {
+                step->n_regs = step->size / 2;
+                step->ni_rule = suns_ni_rule(step->tp->type);
+            }
+
+            byte_offset += step->size;
+        }
+    }
+
+    if (plan->repeat_len == 0)
+        plan->n_fixed = plan->n_steps;
+
+    if (plan->n_fixed > 0) {
+        suns_decode_step_t *step = &(plan->steps[plan->n_fixed - 1]);
+        plan->fixed_bytes = step->byte_offset + step->size;
+    }
+    if (plan->n_steps > plan->n_fixed) {
+        suns_decode_step_t *step = &(plan->steps[plan->n_steps - 1]);
+        plan->repeat_bytes = step->byte_offset + step->size;
+    }
+
+    /* odd length strings would leave later values between registers */
+    plan->lanes = ((plan->fixed_bytes & 1) == 0) &&
+        ((plan->repeat_bytes & 1) == 0);
+    for (i = 0; i < plan->n_steps; i++) {
+        if (plan->steps[i].byte_offset & 1)
+            plan->lanes = 0;
+    }
+
+    /* index the steps by name.  the first datapoint of a name wins, the
+       same as a front to back search of the model. */
+    plan->step_index = hash_new(plan->n_steps);
+    if (plan->step_index == NULL) {
+        error("memory error: can't index %d decode steps", plan->n_steps);
+        suns_decode_plan_free(plan);
+        return -1;
+    }
+    for (i = 0; i < plan->n_steps; i++) {
+        suns_decode_step_t *step = &(plan->steps[i]);
+
+        if ((hash_find(plan->step_index, step->dp->name) == NULL) &&
+            (hash_put(plan->step_index, step->dp->name, step) < 0)) {
+            error("memory error: can't index %d decode steps",
+                  plan->n_steps);
+            suns_decode_plan_free(plan);
+            return -1;
+        }
+    }
+
+    /* compile the symbols of enums and bitfields, so output can look
+       them up by value.  the type pairs still hold the tables of the
+       plan being replaced, if any, which would free them along with
+       itself; they are compiled again, in case the defines changed. */
+    if (m->plan)
+        suns_decode_plan_free_symbols(m->plan);
+    plan->symbols = vector_new(0);
+    if (plan->symbols == NULL) {
+        error("memory error: can't allocate symbol tables");
+        suns_decode_plan_free(plan);
+        return -1;
+    }
+    for (i = 0; i < plan->n_steps; i++) {
+        suns_type_pair_t *tp = plan->steps[i].tp;
+        suns_define_block_t *block;
+
+        if (! suns_type_is_symbolic(tp->type) || (tp->name == NULL) ||
+            (tp->symbols != NULL))
+            continue;
+
+        block = tp->define;
+        if (block == NULL)
+            block = suns_search_define_blocks(m->defines, tp->name);
+        if (block == NULL)
+            continue;
+
+        tp->symbols = suns_symbols_compile(block, tp->type);
+        if ((tp->symbols == NULL) ||
+            (vector_push(plan->symbols, tp) < 0)) {
+            error("memory error: can't compile the symbols of %s",
+                  plan->steps[i].dp->name);
+            suns_symbols_free(tp->symbols);
+            tp->symbols = NULL;
+            suns_decode_plan_free(plan);
+            return -1;
+        }
+    }
+
+    /* bind scale factor references to the step holding the scale factor */
+    for (i = 0; i < plan->n_steps; i++) {
+        suns_decode_step_t *step = &(plan->steps[i]);
+        int sf_step;
+
+        if (step->tp->name == NULL ||
+            ! suns_type_is_numeric(step->tp->type))
+            continue;
+
+        sf_step = suns_decode_plan_find_step(plan, step->tp->name);
+        if (sf_step < 0) {
+            /* suns_check_scale_factors() reports these */
+            continue;
+        }
+
+        /* referenced value must be a sunssf type! */
+        if (plan->steps[sf_step].tp->type != SUNS_SF) {
+            error("scale factor subscript for %s is not a sunsf type",
+                  plan->steps[sf_step].dp->name);
+            continue;
+        }
+
+        step->sf_step = sf_step;
+    }
+
+    suns_decode_plan_free(m->plan);
+    m->plan = plan;
+
+    return 0;
+}
+
+
+/* apply the scale factor value sf to the value v
+   if the scale factor is not implemented v gets a scale factor of 0 and
+   a warning is produced unless v is also not implemented (or is an
+   accumulator that has not started counting) */
+void suns_value_apply_sf(suns_value_t *v, suns_value_t *sf)
+{
+    /* check if the scale factor is implemented */
+    if (sf->meta == SUNS_VALUE_NOT_IMPLEMENTED) {
+        if ((v->meta != SUNS_VALUE_NOT_IMPLEMENTED) &&
+            (! suns_value_acc_is_zero(v)) ) {
+            warning("implemented datapoint %s references the "
+                    "not-implemented scale factor %s",
+                    v->name, sf->name);
+        }
+        /* put zero in the scale factor so we
+           produce a meaningful result */
+        v->tp.sf = 0;
+    } else {
+        /* stash scale factor in the suns_value_t */
+        v->tp.sf = suns_value_get_sunssf(sf);
+    }
+}
+
+
+/* suns_buf_to_value() for a step, taking the value from block when
+   the step is one of the types suns_regs_load() handles */
+static void suns_decode_step_value(suns_decode_step_t *step,
+                                   unsigned char *buf,
+                                   suns_regs_block_t *block,
+                                   int r,
+                                   suns_value_t *v)
+{
+    uint64_t x;
+
+    if ((block == NULL) || (step->n_regs == 0)) {
+        suns_buf_to_value(buf, step->tp, v);
+        return;
+    }
+
+    x = suns_regs_lane(block->regs, r, step->n_regs);
+    switch (step->n_regs) {
+    case 1:
+        v->value.u16 = x;
+        break;
+    case 2:
+        v->value.u32 = x;
+        break;
+    default:
+        v->value.u64 = x;
+        break;
+    }
+
+    v->meta = suns_regs_not_implemented(step->ni_rule, block->regs,
+                                        &(block->masks), r, step->n_regs) ?
+        SUNS_VALUE_NOT_IMPLEMENTED : SUNS_VALUE_OK;
+    v->tp = *(step->tp);
+    v->raw_len = step->size;
+    memcpy(v->raw, buf, v->raw_len);
+}
+
+
+/* decode a single step of a plan at buf, returning the value
+
+   name_with_index is the step's interned name for a repeating block,
+   or NULL outside of one.
+
+   block holds the registers of the whole model as loaded by
+   suns_regs_load(), with buf at register r, or is NULL if the value
+   must be decoded from buf.
+
+   v is a value left over from an earlier decode, or NULL.  if it was
+   decoded from the same step it is refreshed in place, otherwise it is
+   freed and a new value is allocated, from arena if it isn't NULL. */
+static suns_value_t *suns_decode_step(suns_decode_step_t *step,
+                                      unsigned char *buf,
+                                      suns_regs_block_t *block,
+                                      int r,
+                                      char *name_with_index,
+                                      int repeat_index,
+                                      suns_value_t *v,
+                                      arena_t *arena)
+{
+    int repeating = (name_with_index != NULL);
+
+    if (v != NULL) {
+        if ((v->name == step->dp->name) &&
+            (v->index == repeat_index) &&
+            (v->repeating == repeating)) {
+            suns_decode_step_value(step, buf, block, r, v);
+            return v;
+        }
+        suns_value_free(v);
+    }
+
+    if (arena) {
+        v = arena_zalloc(arena, sizeof(suns_value_t));
+        if (v == NULL)
+            return NULL;
+
+        v->repeating = repeating;
+        v->index = repeat_index;
+        v->name = step->dp->name;
+        v->name_with_index = repeating ? name_with_index : v->name;
+
+        /* give suns_buf_to_value() a string to copy into */
+        if (step->tp->type == SUNS_STRING) {
+            v->tp.type = SUNS_STRING;
+            v->tp.len = step->tp->len;
+            v->value.s = arena_alloc(arena, step->tp->len + 1);
+            if (v->value.s == NULL)
+                return NULL;
+        }
+    } else {
+        v = suns_value_new();
+        if (v == NULL)
+            return NULL;
+
+        suns_value_set_null(v);
+
+        /* note if this value is part of a repeating block */
+        v->repeating = repeating;
+
+        suns_value_set_name(v, step->dp->name);
+        suns_value_set_index(v, repeat_index);
+        if (repeating)
+            v->name_with_index = name_with_index;
+    }
+
+    suns_decode_step_value(step, buf, block, r, v);
+
+    v->units = step->units;
+    v->label = step->label;
 
-            if ((byte_offset + size) <= len) {
-                suns_value_set_null(v);
+    return v;
+}
+
+
+/* the step and byte offset of value i of a decode */
+static suns_decode_step_t *suns_decode_plan_value(suns_decode_plan_t *plan,
+                                                  int i,
+                                                  int *offset)
+{
+    int n_repeat = plan->n_steps - plan->n_fixed;
+    suns_decode_step_t *step;
+
+    if (i < plan->n_fixed) {
+        step = &(plan->steps[i]);
+        *offset = step->byte_offset;
+    } else {
+        int j = (i - plan->n_fixed) / n_repeat;
+        step = &(plan->steps[plan->n_fixed + ((i - plan->n_fixed) %
+                                              n_repeat)]);
+        *offset = plan->fixed_bytes + (j * plan->repeat_bytes) +
+            step->byte_offset;
+    }
+
+    return step;
+}
+
+
+/* the value index of the scale factor of value i, or -1 */
+static int suns_decode_plan_sf_value(suns_decode_plan_t *plan, int i)
+{
+    int n_repeat = plan->n_steps - plan->n_fixed;
+    int s = (i < plan->n_fixed) ? i :
+        plan->n_fixed + ((i - plan->n_fixed) % n_repeat);
+    int sf_step = plan->steps[s].sf_step;
+
+    if (sf_step < 0)
+        return -1;
+    if (sf_step < plan->n_fixed)
+        return sf_step;
+    return i - s + sf_step;
+}
+
+
+/* mark the n_values values of a decode of len bytes that must be
+   decoded given the registers that changed.  see suns_decode_plan(). */
+static void suns_decode_plan_wanted(suns_decode_plan_t *plan,
+                                    size_t len,
+                                    int n_values,
+                                    const uint8_t *changed,
+                                    uint8_t *wanted)
+{
+    int n_regs = len / 2;
+    int i, sf_i, offset;
+
+    for (i = 0; i < n_values; i++) {
+        suns_decode_step_t *step = suns_decode_plan_value(plan, i, &offset);
+        int r = offset / 2;
+        int n = (step->size + 1) / 2;
+
+        if (r + n > n_regs)
+            n = n_regs - r;
+        wanted[i] = (n > 0) && suns_changes_any(changed, r, n);
+    }
+
+    /* a new scale factor changes the values it applies to */
+    for (i = 0; i < n_values; i++) {
+        sf_i = suns_decode_plan_sf_value(plan, i);
+        if ((sf_i >= 0) && (sf_i < n_values) && wanted[sf_i])
+            wanted[i] = 1;
+    }
+
+    /* and a changed value needs its scale factor to be read */
+    for (i = 0; i < n_values; i++) {
+        sf_i = suns_decode_plan_sf_value(plan, i);
+        if ((sf_i >= 0) && (sf_i < n_values) && wanted[i])
+            wanted[sf_i] = 1;
+    }
+}
 
-                /* note if this value is part of a repeating block */
-                v->repeating = dp_block->repeating;
 
-                /* use accessors to keep v->name_with_index in sync */
-                suns_value_set_name(v, dp->name);
-                suns_value_set_index(v, repeat_index);
+/**
+ * decode len bytes of model data in buf (not including the did and
+ * length header) using the provided plan.  the number of bytes decoded
+ * is returned.
+ *
+ * value_list is normally empty, and the decoded values are appended to
+ * it.  any values already in value_list are assumed to be from an
+ * earlier decode with the same plan and are reused in order; values
+ * left over at the end are freed.
+ *
+ * if arena isn't NULL the values and list nodes are allocated from it,
+ * and value_list must be empty.
+ *
+ * if changed isn't NULL it has a bit for each register of buf, and
+ * only the values with a register whose bit is set are decoded, along
+ * with the values whose scale factor changed and the scale factors of
+ * every decoded value.  value_list is emptied first, since its values
+ * can't be matched up with a partial decode.
+ *
+ * GOTCHA: all lengths and offset are in bytes, not modbus registers
+ */
+int suns_decode_plan(suns_decode_plan_t *plan,
+                     unsigned char *buf,
+                     size_t len,
+                     list_t *value_list,
+                     arena_t *arena,
+                     const uint8_t *changed)
+{
+    suns_decode_step_t *step;
+    suns_value_t **values;
+    uint8_t *wanted = NULL;  /* values to decode, if changed isn't NULL */
+    char **names = NULL;
+    int n_repeat = plan->n_steps - plan->n_fixed;
+    int fixed_bytes = plan->fixed_bytes;
+    int repeat_bytes = plan->repeat_bytes;
+    int len_multiple = 0;
+    int byte_offset = 0;
+    int n_values;
+    int i, j;
+    list_node_t *node = value_list->head;  /* next value to reuse */
 
-                suns_buf_to_value(buf + byte_offset, dp->type_pair, v);
+    /* decoded values, by step, so scale factors can be found by index */
+    if ((plan->repeat_len > 0) && (len > fixed_bytes)) {
+        len_multiple = (len - fixed_bytes) / (plan->repeat_len * 2);
+    }
+    n_values = plan->n_fixed + (len_multiple * n_repeat);
 
-                /* check for attributes we care about */
-                v->units = suns_find_attribute(dp, "u");
-                v->label = suns_find_attribute(dp, "label");
+    if (changed && node) {
+        list_free_nodes(value_list, (list_free_data_f) suns_value_free);
+        node = NULL;
+    }
 
-                /* debug("v->tp.type = %s", suns_type_string(v->tp.type)); */
-                list_node_add(value_list, list_node_new(v));
-                byte_offset += size;
-		
+    /* the registers, loaded in one pass, follow the value pointers */
+    size_t values_size = sizeof(suns_value_t *) *
+        (n_values > 0 ? n_values : 1);
+    size_t size = values_size;
+    int n_regs = plan->lanes ? (len / 2) : 0;
+    int mask_size = suns_regs_mask_size(n_regs);
+    if (n_regs > 0)
+        size += (sizeof(uint16_t) * n_regs) + (3 * mask_size);
+    if (changed)
+        size += n_values;
+
+    if (arena) {
+        assert(list_count(value_list) == 0);
+        values = arena_alloc(arena, size);
+    } else {
+        values = malloc(size);
+    }
+    if (values == NULL) {
+        error("memory error: can't malloc() %d value pointers", n_values);
+        return 0;
+    }
+    memset(values, 0, values_size);
+
+    suns_regs_block_t regs_block;
+    suns_regs_block_t *block = NULL;
+    if (n_regs > 0) {
+        regs_block.regs = (uint16_t *) ((char *) values + values_size);
+        regs_block.masks.min = (uint8_t *) (regs_block.regs + n_regs);
+        regs_block.masks.max = regs_block.masks.min + mask_size;
+        regs_block.masks.zero = regs_block.masks.max + mask_size;
+        regs_block.n = n_regs;
+        suns_regs_load(buf, n_regs, regs_block.regs, &(regs_block.masks));
+        block = &regs_block;
+    }
+
+    if (changed) {
+        wanted = (uint8_t *) values + (size - n_values);
+        suns_decode_plan_wanted(plan, len, n_values, changed, wanted);
+    }
+
+    for (i = 0; i < plan->n_fixed; i++) {
+        step = &(plan->steps[i]);
+        if ((step->byte_offset + step->size) > len) {
+            if (step->tp->type != SUNS_PAD) {
+                warning("%s offset %d defined in the model exceeds "
+                        "length of device data",
+                        step->dp->name, step->dp->offset);
             } else {
-                if (dp->type_pair->type != SUNS_PAD) {
+                debug("ignoring missing pad register at offset %d",
+                      step->dp->offset);
+            }
+            /* the repeating block can't start inside missing data */
+            len_multiple = 0;
+            break;
+        }
+        byte_offset = step->byte_offset + step->size;
+        if (wanted && ! wanted[i])
+            continue;
+        values[i] = suns_decode_step(step, buf + step->byte_offset,
+                                     block, step->byte_offset / 2, NULL, 1,
+                                     node ? node->data : NULL, arena);
+        if (values[i])
+            values[i]->step = i;
+        if (node) {
+            node->data = values[i];
+            node = node->next;
+        }
+    }
+
+    if (len_multiple > 0) {
+        debug("len_multiple = %d", len_multiple);
+        names = suns_decode_plan_names(plan, len_multiple);
+        if (names == NULL)
+            len_multiple = 0;
+    }
+
+    /* repeat index is 1 based */
+    for (j = 0; j < len_multiple; j++) {
+        for (i = plan->n_fixed; i < plan->n_steps; i++) {
+            int offset;
+            step = &(plan->steps[i]);
+            offset = fixed_bytes + (j * repeat_bytes) + step->byte_offset;
+            if ((offset + step->size) > len) {
+                if (step->tp->type != SUNS_PAD) {
                     warning("%s offset %d defined in the model exceeds "
                             "length of device data",
-                            dp->name, dp->offset + (i * dp_block->len));
+                            step->dp->name,
+                            step->dp->offset + (j * plan->repeat_len));
                 } else {
                     debug("ignoring missing pad register at offset %d",
-                          dp->offset + (i * dp_block->len));
+                          step->dp->offset + (j * plan->repeat_len));
                 }
-                debug("requested = %d, len = %zd",
-                      (dp->offset * 2) + suns_type_size(dp->type_pair->type),
-                      len);
-                return byte_offset;
+                len_multiple = j;
+                break;
+            }
+            int k = plan->n_fixed + (j * n_repeat) + (i - plan->n_fixed);
+            byte_offset = offset + step->size;
+            if (wanted && ! wanted[k])
+                continue;
+            values[k] = suns_decode_step(step, buf + offset,
+                                         block, offset / 2,
+                                         names[(j * n_repeat) +
+                                               (i - plan->n_fixed)],
+                                         j + 1,
+                                         node ? node->data : NULL, arena);
+            if (values[k])
+                values[k]->step = i;
+            if (node) {
+                node->data = values[k];
+                node = node->next;
             }
         }
-        repeat_index++;
     }
 
+    /* resolve scale factors through the steps bound at compile time.
+       a scale factor in the repeating block applies to values from
+       the same instance of the block. */
+    for (i = 0; i < n_values; i++) {
+        int sf_i;
+
+        if (values[i] == NULL)
+            continue;
+
+        sf_i = suns_decode_plan_sf_value(plan, i);
+        if ((sf_i >= 0) && (values[sf_i] != NULL))
+            suns_value_apply_sf(values[i], values[sf_i]);
+    }
+
+    /* drop values that weren't reused this time around */
+    while (node) {
+        list_node_t *next = node->next;
+        suns_value_free(node->data);
+        list_node_free(value_list, list_node_del(value_list, node));
+        node = next;
+    }
+
+    /* values that didn't replace an existing one go on the end */
+    for (i = list_count(value_list); i < n_values; i++) {
+        if (values[i] != NULL)
+            list_node_add(value_list,
+                          suns_list_node_new(arena, values[i]));
+    }
+
+    if (arena == NULL)
+        free(values);
+
     return byte_offset;
 }
 
@@ -1843,11 +2759,72 @@ suns_dp_t *suns_search_dp_block_for_dp_by_name(suns_dp_block_t *dp_block,
 
 
 /**
- * search a model for a suns_dp_t by name.
+ * build the index suns_search_model_for_dp_by_name() uses to find a
+ * model's datapoints by name.  this is called once the model has been
+ * loaded, and again if datapoints are added to it later.  if a name
+ * appears more than once the first datapoint is found, as when
+ * searching the blocks in order.
+ *
+ * returns 0 on success or -1 on failure, in which case the model is
+ * searched without an index
+ */
+int suns_model_index_dps(suns_model_t *m)
+{
+    list_node_t *c, *d;
+    int n = 0;
+
+    hash_free(m->dp_index, NULL);
+    free(m->dp_refs);
+    m->dp_index = NULL;
+    m->dp_refs = NULL;
+
+    list_for_each(m->dp_blocks, c) {
+        suns_dp_block_t *dp_block = c->data;
+        n += list_count(dp_block->dp_list);
+    }
+
+    m->dp_refs = malloc(sizeof(suns_dp_ref_t) * (n > 0 ? n : 1));
+    m->dp_index = hash_new(n);
+    if ((m->dp_refs == NULL) || (m->dp_index == NULL)) {
+        error("memory error: can't index %d datapoints", n);
+        goto fail;
+    }
+
+    n = 0;
+    list_for_each(m->dp_blocks, c) {
+        suns_dp_block_t *dp_block = c->data;
+        list_for_each(dp_block->dp_list, d) {
+            suns_dp_ref_t *ref = &(m->dp_refs[n++]);
+            ref->dp = d->data;
+            ref->dp_block = dp_block;
+            if ((hash_find(m->dp_index, ref->dp->name) == NULL) &&
+                (hash_put(m->dp_index, ref->dp->name, ref) < 0)) {
+                error("memory error: can't index datapoint %s",
+                      ref->dp->name);
+                goto fail;
+            }
+        }
+    }
+
+    return 0;
+
+ fail:
+    hash_free(m->dp_index, NULL);
+    free(m->dp_refs);
+    m->dp_index = NULL;
+    m->dp_refs = NULL;
+    return -1;
+}
+
+
+/**
+ * search a model for a suns_dp_t by name, through its index if it has
+ * one (see suns_model_index_dps()).
  *
  * \param *m model to search
  * \param *name name to search for
- * \param **dp_block_ref set to the suns_dp_block_t the suns_dp_t was found in
+ * \param **dp_block_ref set to the suns_dp_block_t the suns_dp_t was found
+ *                      in, if not NULL
  */
 suns_dp_t *suns_search_model_for_dp_by_name(suns_model_t *m,
                                             char *name,
@@ -1855,6 +2832,16 @@ suns_dp_t *suns_search_model_for_dp_by_name(suns_model_t *m,
 {
     list_node_t *c;
     suns_dp_t *dp;
+    suns_dp_block_t *unused;
+
+    if (dp_block_ref == NULL)
+        dp_block_ref = &unused;
+
+    if (m->dp_index) {
+        suns_dp_ref_t *ref = hash_get(m->dp_index, name);
+        *dp_block_ref = ref ? ref->dp_block : NULL;
+        return ref ? ref->dp : NULL;
+    }
 
     list_for_each(m->dp_blocks, c) {
         suns_dp_block_t *dp_block = c->data;
@@ -1888,46 +2875,67 @@ suns_value_t *suns_search_value_list(list_t *list, char *name)
 
 
 /* search the values in a suns_dataset_t to resolve all the
-   scale factor pointers */
+   scale factor pointers
+
+   this searches by name, through an index of the values built for the
+   purpose.  suns_decode_data() doesn't use it; scale factors there are
+   bound to decode plan steps when the model is loaded (see
+   suns_model_compile_plan()). */
 int suns_resolve_scale_factors(suns_dataset_t *dataset)
 {
     list_node_t *c;
     suns_value_t *v;
     suns_value_t *found;
+    hash_t *index;
+    int rc = 0;
+
+    index = hash_new(list_count(dataset->values));
+    if (index == NULL) {
+        error("memory error: can't index %d values",
+              list_count(dataset->values));
+        return -1;
+    }
+
+    /* only scale factors can be referenced; the first of a name wins,
+       as in suns_search_value_list() */
+    list_for_each(dataset->values, c) {
+        v = c->data;
+        if ((v->tp.type == SUNS_SF) &&
+            (hash_find(index, v->name) == NULL) &&
+            (hash_put(index, v->name, v) < 0)) {
+            error("memory error: can't index %d values",
+                  list_count(dataset->values));
+            hash_free(index, NULL);
+            return -1;
+        }
+    }
 
     list_for_each(dataset->values, c) {
         v = c->data;
         if (v->tp.name && suns_type_is_numeric(v->tp.type)) {
-            found = suns_search_value_list(dataset->values, v->tp.name);
+            found = hash_get(index, v->tp.name);
+            if (found == NULL) {
+                /* it may name a value that isn't a scale factor */
+                found = suns_search_value_list(dataset->values, v->tp.name);
+            }
             if (found) {
                 /* referenced value must be a sunssf type! */
                 if (found->tp.type != SUNS_SF) {
                     error("scale factor subscript for %s is not a sunsf type",
                           found->name);
                     /* bail - model must be corrected. */
-                    return -1;
+                    rc = -1;
+                    break;
                 }
 
-                /* check if the scale factor is implemented */
-                if (found->meta == SUNS_VALUE_NOT_IMPLEMENTED) {
-                    if ((v->meta != SUNS_VALUE_NOT_IMPLEMENTED) &&
-                        (! suns_value_acc_is_zero(v)) ) {
-                        warning("implemented datapoint %s references the "
-                                "not-implemented scale factor %s",
-                                v->name, found->name);
-                    }
-                    /* put zero in the scale factor so we
-                       produce a meaningful result */
-                    v->tp.sf = 0;
-                } else {
-                    /* stash scale factor in the suns_value_t */
-                    v->tp.sf = suns_value_get_sunssf(found);
-                }
+                suns_value_apply_sf(v, found);
             }
         }
     }
 
-    return 0;
+    hash_free(index, NULL);
+
+    return rc;
 }
 
 
@@ -44,9 +44,13 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <pthread.h>
 
 #include "trx/list.h"
 #include "trx/buffer.h"
+#include "trx/arena.h"
+#include "trx/vector.h"
+#include "trx/hash.h"
 
 
 #define SUNS_ID_HIGH 0x5375   /* Su */
@@ -101,11 +105,16 @@ typedef struct suns_type_pair {
     suns_type_t type;
 
     /* the type's subscript is one of the following: */
-    char *name;        /* scale factor name (other datapoint) */
-    size_t len;        /* string length */
     int sf;            /* fixed scale factor */
                        /* also used to store scale factors from logger xml */
+                       /* (next to type, so the two share 8 bytes) */
+    char *name;        /* scale factor name (other datapoint) */
+    size_t len;        /* string length */
     suns_define_block_t *define;  /* pointer to a define block */
+
+    /* the define block compiled for lookups by value, for enums and
+       bitfields.  see suns_symbols.h. */
+    struct suns_symbols *symbols;
 } suns_type_pair_t;
 
 
@@ -127,6 +136,12 @@ typedef struct suns_model {
     list_t *dp_blocks;
     list_t *defines;
     list_t *test_data;
+    struct suns_decode_plan *plan;  /* built by suns_model_compile_plan() */
+
+    /* datapoint name -> suns_dp_ref_t, built when the model is loaded by
+       suns_model_index_dps().  models without one are searched. */
+    hash_t *dp_index;
+    struct suns_dp_ref *dp_refs;
 } suns_model_t;
 
 typedef struct suns_dp {
@@ -136,6 +151,62 @@ typedef struct suns_dp {
     list_t *attributes;
 } suns_dp_t;
 
+/* a datapoint and the block holding it, as found in a model's index */
+typedef struct suns_dp_ref {
+    suns_dp_t *dp;
+    suns_dp_block_t *dp_block;
+} suns_dp_ref_t;
+
+/* a decode plan is a model flattened into an array of steps, one per
+   datapoint, so suns_decode_data() doesn't have to chase the dp_block
+   lists or search attributes by name on every read.
+
+   steps [0, n_fixed) cover the non-repeating blocks; the remaining
+   steps describe one instance of the repeating block, if any. */
+typedef struct suns_decode_step {
+    suns_dp_t *dp;
+    suns_type_pair_t *tp;
+    int byte_offset;       /* from the start of the fixed or repeating part */
+    int size;              /* in bytes */
+    int sf_step;           /* step index of the scale factor, or -1 */
+    char *units;           /* "u" attribute, or NULL */
+    char *label;           /* "label" attribute, or NULL */
+    int n_regs;            /* registers in a 16, 32 or 64 bit value,
+                              or 0 for other types */
+    int ni_rule;           /* a suns_ni_rule_t, for n_regs > 0 */
+} suns_decode_step_t;
+
+typedef struct suns_decode_plan {
+    suns_decode_step_t *steps;
+    int n_steps;
+    int n_fixed;           /* number of steps in the non-repeating part */
+    int repeat_len;        /* repeating block length in registers, or 0 */
+    int fixed_bytes;       /* size of the non-repeating part */
+    int repeat_bytes;      /* size of one instance of the repeating block */
+    int lanes;             /* every value starts on a register, so the
+                              data can be loaded by suns_regs_load() */
+    hash_t *step_index;    /* datapoint name to its (first) step */
+
+    /* interned "name,NN" names of the repeating block steps, n_repeat
+       per instance, for the first n_names instances.  see
+       suns_decode_plan_names(). */
+    char **names;
+    int n_names;
+    vector_t *old_names;   /* smaller names arrays that were replaced */
+    pthread_mutex_t names_lock;  /* held to grow names */
+
+    /* type pairs whose symbol tables were compiled with this plan, and
+       are freed with it */
+    vector_t *symbols;
+
+    /* data another layer keeps with the plan, such as the output
+       fragments built by suns_output.c, and how to free it with the
+       plan.  set once with a release store; see
+       suns_decode_plan_attach(). */
+    void *attached;
+    void (*attached_free)(void *attached);
+} suns_decode_plan_t;
+
 /*  suns_model_did_t is used to build an index of did values
     more than one did can reference the same model */
 typedef struct suns_model_did {
@@ -144,6 +215,15 @@ typedef struct suns_model_did {
     suns_model_t *model;
 } suns_model_did_t;
 
+/* dense index of did values to suns_model_did_t.  dids are 16 bits,
+   so this is a two level table of 256 pages of 256 entries each.  pages
+   are only allocated for the did ranges that are actually in use. */
+#define SUNS_DID_INDEX_PAGES 256
+typedef struct suns_did_index {
+    suns_model_did_t **pages[SUNS_DID_INDEX_PAGES];
+    int count;
+} suns_did_index_t;
+
 /* used to hold test data */
 typedef struct suns_data {
     uint16_t offset;
@@ -195,7 +275,8 @@ typedef enum suns_value_meta {
 #define SUNS_VALUE_RAW_SIZE 8
 typedef struct suns_value {
     char *name;                /* datapoint name associated with this */
-    char *name_with_index;     /* composite name including index */
+    char *name_with_index;     /* composite name including index, owned
+                                  by the decode plan (never free()d) */
     char *lname;               /* long/legacy name */
     suns_type_pair_t tp;       /* type_pair of value (note: not a pointer) */
     suns_value_meta_t meta;    /* meta-value (null, error, etc.) */
@@ -216,6 +297,9 @@ typedef struct suns_value {
     int repeating;           /* is this value part of a repeating block? */
     time_t unixtime;         /* optional value-specific timestamp */
     int usec;                /* optional microsecond component */
+    int step;                /* decode plan step the value came from,
+                                or -1.  it fills the padding after usec,
+                                so it costs no memory. */
     char *units;             /* optional units string */
     char *description;       /* optional descriptive string */    
     char *label;             /* short descriptive label */
@@ -234,6 +318,36 @@ typedef struct suns_dataset {
     int index;        /* index, for aggregated devices */
     int unixtime;
     int usec;
+
+    arena_t *arena;   /* holds the values, or NULL if they're on the heap */
+
+    /* if not NULL, the repeating block is decoded into these columns
+       instead of the values list.  see suns_columns.h. */
+    struct suns_columns *columns;
+
+    /* if not NULL, every datapoint is decoded into these compact samples
+       instead of the values list.  see suns_samples.h. */
+    struct suns_samples *samples;
+
+    /* if not NULL, a bit per register of the model data (after the did
+       and length) set for the registers that changed since the previous
+       read.  only the datapoints covering a set bit, and their scale
+       factors, are decoded into the values list.  see suns_changes.h. */
+    const uint8_t *changed;
+
+    /* nothing in the dataset changed since the previous read; it was
+       only decoded to identify the device.  device output skips it. */
+    int unchanged;
+
+    /* only the values that changed were decoded (see changed above) */
+    int partial;
+
+    /* the model data (after the did and length) the dataset was decoded
+       from, in modbus order.  it points into the read buffer, so it is
+       only set while that is kept: with the datasets in a device arena.
+       see suns_bin.h. */
+    const unsigned char *regs;
+    size_t regs_len;
 } suns_dataset_t;
 
 
@@ -260,6 +374,21 @@ typedef struct suns_device {
     char *iface;  /* optional interface id string (only if d.id is used) */
     char *lid;    /* logger id string; required by default */
     char *ns;     /* domain namespace for the logger id */
+
+    /* holds the datasets decoded by the last read, or NULL if they're
+       on the heap.  each read starts by resetting it. */
+    arena_t *arena;
+
+    /* if not NULL, each read only decodes the values that changed
+       since the previous one.  see suns_changes.h. */
+    struct suns_changes *changes;
+
+    /* if set, reads decode repeating blocks into columns (see
+       suns_columns.h) kept in the columns vector, one per model in the
+       map, from read to read.  only used with an arena and without
+       changes, and only for output that walks the columns. */
+    int columnar;
+    vector_t *columns;
 } suns_device_t;
     
 
@@ -320,11 +449,15 @@ int suns_value_acc_is_zero(suns_value_t *v);
 int suns_type_is_symbolic(suns_type_t t);
 
 suns_dataset_t *suns_dataset_new(void);
+suns_dataset_t *suns_dataset_new_in(arena_t *arena);
 void suns_dataset_free(suns_dataset_t *d);
 
 suns_device_t *suns_device_new(void);
+suns_device_t *suns_device_new_with_arena(void);
 void suns_device_free(suns_device_t *d);
 int suns_device_add_dataset(suns_device_t *d, suns_dataset_t *data);
+void suns_device_free_datasets(suns_device_t *device);
+void suns_device_update_common(suns_device_t *device);
 
 /* suns_value_t stuff */
 suns_model_t *suns_model_new(void);
@@ -381,17 +514,36 @@ void suns_attribute_list_free(list_t *l);
 void suns_attribute_free(void *a);
 
 
-suns_model_did_t *suns_find_did(list_t *did_list, uint16_t did);
-suns_dataset_t *suns_decode_data(list_t *did_list,
+suns_did_index_t *suns_did_index_new(void);
+void suns_did_index_free(suns_did_index_t *index);
+int suns_did_index_add(suns_did_index_t *index, suns_model_did_t *did);
+suns_model_did_t *suns_find_did(suns_did_index_t *index, uint16_t did);
+suns_dataset_t *suns_decode_data(suns_did_index_t *did_index,
 				 unsigned char *buf,
 				 size_t len);
-
-int suns_decode_dp_block(suns_dp_block_t *dp_block,
-			 unsigned char *buf,
-			 size_t len,
-			 list_t *value_list);
+int suns_decode_dataset(suns_did_index_t *did_index,
+                        unsigned char *buf,
+                        size_t len,
+                        suns_dataset_t *data);
+int suns_decode_model_data(suns_model_did_t *did,
+                           unsigned char *buf,
+                           size_t len,
+                           suns_dataset_t *data);
 
 void suns_model_fill_offsets(suns_model_t *m);
+int suns_model_compile_plan(suns_model_t *m);
+void suns_decode_plan_free(suns_decode_plan_t *plan);
+void *suns_decode_plan_attach(suns_decode_plan_t *plan, void *data,
+                              void (*free_f)(void *attached));
+void *suns_decode_plan_attached(suns_decode_plan_t *plan);
+char **suns_decode_plan_names(suns_decode_plan_t *plan, int count);
+int suns_decode_plan_find_step(suns_decode_plan_t *plan, const char *name);
+int suns_decode_plan(suns_decode_plan_t *plan,
+                     unsigned char *buf,
+                     size_t len,
+                     list_t *value_list,
+                     arena_t *arena,
+                     const uint8_t *changed);
 
 suns_define_block_t *suns_search_define_blocks(list_t *list, char *name);
 suns_define_t *suns_define_new(void);
@@ -406,8 +558,10 @@ suns_dp_t *suns_search_dp_block_for_dp_by_name(suns_dp_block_t *dp_block,
 suns_dp_t *suns_search_model_for_dp_by_name(suns_model_t *m,
                                             char *name,
                                             suns_dp_block_t **dp_block_ref);
+int suns_model_index_dps(suns_model_t *m);
 suns_value_t *suns_search_value_list(list_t *list, char *name);
 int suns_resolve_scale_factors(suns_dataset_t *dataset);
+void suns_value_apply_sf(suns_value_t *v, suns_value_t *sf);
 char * suns_find_attribute(suns_dp_t *dp, char *name);
 void suns_model_xml_define_block_fprintf(FILE *stream,
                                          suns_define_block_t *block);
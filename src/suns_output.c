@@ -50,7 +50,11 @@
 #include "trx/date.h"
 #include "trx/debug.h"
 #include "suns_model.h"
+#include "suns_columns.h"
+#include "suns_samples.h"
+#include "suns_symbols.h"
 #include "suns_output.h"
+#include "suns_bin.h"
 #include "suns_parser.h"
 
 /* list of model output formats */
@@ -70,16 +74,21 @@ static suns_model_export_format_t suns_model_export_formats[] = {
 
 /* list of dataset output functions */
 static suns_dataset_output_format_t suns_dataset_output_formats[] = {
-    { "text", suns_dataset_text_fprintf },
-    /*    { "sql",  suns_dataset_sql_fprintf }, */
-    /*    { "csv",  suns_dataset_csv_fprintf }, */
-    { "xml",  suns_dataset_xml_fprintf },
+    { "text", suns_dataset_text_write },
+    /*    { "sql",  suns_dataset_sql_write }, */
+    /*    { "csv",  suns_dataset_csv_write }, */
+    { "xml",  suns_dataset_xml_write },
     { NULL, NULL }
 };
 
 static suns_device_output_format_t suns_device_output_formats[] = {
-    { "text",  suns_device_text_fprintf },
-    { "xml",  suns_device_xml_fprintf },
+    { "text",  suns_device_text_write },
+    { "xml",  suns_device_xml_write,
+      suns_xml_begin, suns_device_xml_item, suns_xml_end },
+    { "bin",  suns_device_bin_write },
+    { "json",  suns_device_json_write,
+      suns_json_begin, suns_device_json_item, suns_json_end, 1 },
+    { "ndjson",  suns_device_ndjson_write, NULL, NULL, NULL, 1 },
     { NULL, NULL }
 };
 
@@ -147,11 +156,11 @@ int suns_model_export_slang_all(FILE *stream, char *type,
 
 
 /* output a dataset */
-int suns_dataset_output(char *fmt, suns_dataset_t *data, FILE *stream)
+int suns_dataset_output(char *fmt, suns_dataset_t *data, sink_t *sink)
 {
     assert(fmt);
     assert(data);
-    assert(stream);
+    assert(sink);
     
     int i;
     suns_dataset_output_format_t *output = NULL;
@@ -169,35 +178,42 @@ int suns_dataset_output(char *fmt, suns_dataset_t *data, FILE *stream)
         return -1;
     }
 
-    return 0;
+    return output->write(sink, data);
 }
 
 
-int suns_device_output(char *fmt, suns_device_t *device, FILE *stream)
+static suns_device_output_format_t *suns_device_output_find(char *fmt)
 {
-    assert(device);
-    
-    int rc = 0;
-    list_node_t *c;
     int i;
-    suns_device_output_format_t *output = NULL;
 
     for (i = 0; suns_device_output_formats[i].name != NULL; i++) {
         debug("i = %d", i);
-        if (strcmp(suns_device_output_formats[i].name, fmt) == 0) {
-            output = &(suns_device_output_formats[i]);
-            break;
-        }
+        if (strcmp(suns_device_output_formats[i].name, fmt) == 0)
+            return &(suns_device_output_formats[i]);
     }
 
+    return NULL;
+}
+
+
+int suns_device_output(char *fmt, suns_device_t *device, sink_t *sink)
+{
+    assert(device);
+    
+    int rc = 0;
+    list_node_t *c;
+    suns_device_output_format_t *output = suns_device_output_find(fmt);
+
     if (output != NULL) {
-        return output->fprintf(stream, device);
+        return output->write(sink, device);
     }
 
     /* no device output format is defined; fall back to just
        calling suns_dataset_output() for each dataset */
     list_for_each(device->datasets, c) {
-        rc = suns_dataset_output(fmt, c->data, stream);
+        if (((suns_dataset_t *) c->data)->unchanged)
+            continue;
+        rc = suns_dataset_output(fmt, c->data, sink);
         if (rc < 0)
             break;
     }
@@ -205,6 +221,63 @@ int suns_device_output(char *fmt, suns_device_t *device, FILE *stream)
     return rc;
 }
 
+
+/* start a document that holds the devices written with
+   suns_device_output_item() until suns_output_end().  the sink can be
+   flushed between devices, so the whole document never has to be in
+   memory.  formats without such documents write nothing here and a
+   whole document per device.
+
+   the caller counts the devices in the document and passes the count
+   to each suns_device_output_item(), so formats can separate them. */
+int suns_output_begin(char *fmt, sink_t *sink)
+{
+    suns_device_output_format_t *output = suns_device_output_find(fmt);
+
+    if ((output == NULL) || (output->begin == NULL))
+        return 0;
+
+    return output->begin(sink);
+}
+
+
+int suns_device_output_item(char *fmt, suns_device_t *device, int n,
+                            sink_t *sink)
+{
+    suns_device_output_format_t *output = suns_device_output_find(fmt);
+
+    if ((output == NULL) || (output->item == NULL))
+        return suns_device_output(fmt, device, sink);
+
+    return output->item(sink, device, n);
+}
+
+
+int suns_output_end(char *fmt, sink_t *sink)
+{
+    suns_device_output_format_t *output = suns_device_output_find(fmt);
+
+    if ((output == NULL) || (output->end == NULL))
+        return 0;
+
+    return output->end(sink);
+}
+
+
+/* non-zero if devices written in fmt are best decoded with their
+   repeating blocks in columns; see suns_device_t */
+int suns_output_columnar(char *fmt)
+{
+    suns_device_output_format_t *output;
+
+    if (fmt == NULL)
+        return 0;
+
+    output = suns_device_output_find(fmt);
+
+    return output ? output->columnar : 0;
+}
+
     
 void suns_dp_fprint(FILE *stream, suns_dp_t *dp)
 {
@@ -296,7 +369,7 @@ void suns_registers_fprintf(FILE * stream,
  * test slave mode for testing.
  *
  */
-void suns_binary_model_fprintf(FILE *stream, list_t *did_list,
+void suns_binary_model_fprintf(FILE *stream, suns_did_index_t *did_index,
                               unsigned char *buf, size_t len)
 {
     suns_model_did_t *did;
@@ -305,7 +378,7 @@ void suns_binary_model_fprintf(FILE *stream, list_t *did_list,
     /* the first 2 bytes contain the did */
     uint16_t did_value = be16toh(*((uint16_t *)buf));
 
-    did = suns_find_did(did_list, did_value);
+    did = suns_find_did(did_index, did_value);
 
     fprintf(stream, "data captured_%d {\n", did_value);
     if (did) {
@@ -751,21 +824,89 @@ void suns_data_block_fprintf(FILE *stream, suns_data_block_t *block)
 }
    
 
-int suns_dataset_text_fprintf(FILE *stream, suns_dataset_t *data)
+/* write the symbol of an enum value, or of each set bit of a bitfield
+   that has one, from the table compiled for the value's datapoint */
+void suns_write_symbols(sink_t *sink, suns_value_t *v)
 {
-    assert(stream);
+    suns_symbols_t *symbols = v->tp.symbols;
+    suns_define_t *d;
+    uint32_t bits;
+
+    switch (v->tp.type) {
+    case SUNS_ENUM16:
+        d = suns_symbols_find(symbols, suns_value_get_enum16(v));
+        if (d) {
+            sink_putc(sink, ' ');
+            sink_puts(sink, d->name);
+        }
+        break;
+
+    case SUNS_ENUM32:
+        d = suns_symbols_find(symbols, suns_value_get_enum32(v));
+        if (d) {
+            sink_putc(sink, ' ');
+            sink_puts(sink, d->name);
+        }
+        break;
+
+    case SUNS_BITFIELD16:
+    case SUNS_BITFIELD32:
+        if (v->tp.type == SUNS_BITFIELD16)
+            bits = suns_value_get_bitfield16(v);
+        else
+            bits = suns_value_get_bitfield32(v);
+        while (bits) {
+            d = suns_symbols_bit(symbols, __builtin_ctz(bits));
+            if (d) {
+                sink_putc(sink, ' ');
+                sink_puts(sink, d->name);
+            }
+            bits &= bits - 1;
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+
+/* format a value with one of the suns_snprintf_value_*() functions
+   straight into the sink's buffer */
+static int suns_write_value(sink_t *sink, suns_value_t *v,
+                            suns_value_snprintf_f snprintf_value)
+{
+    char *p = sink_reserve(sink, BUFFER_SIZE);
+    size_t len;
+
+    if (p == NULL)
+        return -1;
+
+    p[0] = '\0';
+    snprintf_value(p, BUFFER_SIZE, v);
+    len = strnlen(p, BUFFER_SIZE - 1);
+    sink_commit(sink, len);
+
+    return len;
+}
+
+
+int suns_dataset_text_write(sink_t *sink, suns_dataset_t *data)
+{
+    assert(sink);
     assert(data);
 
-    list_node_t *c;
+    suns_value_iter_t iter;
+    suns_value_t *v;
     char scaled_value_buf[BUFFER_SIZE];
     
-    fprintf(stream, "data model: %s(%d)\n",
-            data->did->name,
-            data->did->did);
+    sink_puts(sink, "data model: ");
+    sink_puts(sink, data->did->name);
+    sink_putc(sink, '(');
+    sink_int(sink, data->did->did);
+    sink_puts(sink, ")\n");
     
-    list_for_each(data->values, c) {
-        suns_value_t *v = c->data;
-
+    suns_dataset_for_each_value(data, iter, v) {
         /* don't display scale factors unless verbose_level > 1 */
         if ((verbose_level < 1) && (v->tp.type == SUNS_SF))
             continue;
@@ -779,23 +920,32 @@ int suns_dataset_text_fprintf(FILE *stream, suns_dataset_t *data)
 
         suns_snprintf_value_sf_text(scaled_value_buf, BUFFER_SIZE, v);
         if (v->repeating) {
-            fprintf(stream, "  %02d:", v->index);
+            /* "  %02d:" */
+            sink_puts(sink, ((v->index >= 0) && (v->index < 10)) ?
+                      "  0" : "  ");
+            sink_int(sink, v->index);
+            sink_putc(sink, ':');
         } else {
-            fprintf(stream, "     ");
+            sink_puts(sink, "     ");
         }
-        fprintf(stream, "%-30s%20s",
-                (v->label ? v->label : v->name),
-                scaled_value_buf);
+        /* "%-30s%20s" */
+        sink_pad(sink, (v->label ? v->label : v->name), -30);
+        sink_pad(sink, scaled_value_buf, 20);
         
-        if (v->units)
-            fprintf(stream, " %s", v->units);
-
-        /* display enum values if value is implemented
-           and enum symbols are defined */
-        if (((v->tp.type == SUNS_ENUM16) ||
-             (v->tp.type == SUNS_ENUM32)) &&
-            (v->meta != SUNS_VALUE_NOT_IMPLEMENTED) &&
-            (v->tp.name != NULL)) {
+        if (v->units) {
+            sink_putc(sink, ' ');
+            sink_puts(sink, v->units);
+        }
+
+        /* display enum and bitfield symbols if the value is
+           implemented and symbols are defined */
+        if (v->tp.symbols && (v->meta != SUNS_VALUE_NOT_IMPLEMENTED)) {
+            suns_write_symbols(sink, v);
+        } else if (((v->tp.type == SUNS_ENUM16) ||
+                    (v->tp.type == SUNS_ENUM32)) &&
+                   (v->meta != SUNS_VALUE_NOT_IMPLEMENTED) &&
+                   (v->tp.name != NULL)) {
+            /* a type pair that isn't part of a decode plan */
             suns_define_block_t *b;
             b = suns_search_define_blocks(data->did->model->defines,
                                           v->tp.name);
@@ -810,20 +960,21 @@ int suns_dataset_text_fprintf(FILE *stream, suns_dataset_t *data)
                 suns_define_t *d =
                     suns_search_enum_defines(b->list, value);
                 if (d) {
-                    fprintf(stream, " %s", d->name);
+                    sink_putc(sink, ' ');
+                    sink_puts(sink, d->name);
                 }
             }
         }
 
-        fprintf(stream, "\n");
+        sink_putc(sink, '\n');
     }    
-    fprintf(stream, "\n");
+    sink_putc(sink, '\n');
 
-    return 0;
+    return sink->error ? -1 : 0;
 }
 
 
-int suns_device_text_fprintf(FILE *stream, suns_device_t *device)
+int suns_device_text_write(sink_t *sink, suns_device_t *device)
 {
     int rc = 0;
     list_node_t *c;
@@ -832,12 +983,18 @@ int suns_device_text_fprintf(FILE *stream, suns_device_t *device)
     /* set date to now */
     date_snprintf_rfc3339(timestamp, BUFFER_SIZE,
                           device->unixtime, device->usec);
-    fprintf(stream, "Timestamp: %s\n\n", timestamp);
+    sink_puts(sink, "Timestamp: ");
+    sink_puts(sink, timestamp);
+    sink_puts(sink, "\n\n");
     
     list_for_each(device->datasets, c) {
         suns_dataset_t *d = c->data;
+
+        /* only decoded to identify the device */
+        if (d->unchanged)
+            continue;
         
-        rc = suns_dataset_text_fprintf(stream, d);
+        rc = suns_dataset_text_write(sink, d);
         if (rc < 0)
             break;
     }
@@ -906,32 +1063,33 @@ void suns_model_sql_fprintf(FILE *stream, suns_model_t *model)
 }
 
 
-int suns_dataset_sql_fprintf(FILE *stream, suns_dataset_t *data)
+int suns_dataset_sql_write(sink_t *sink, suns_dataset_t *data)
 {
-    list_node_t *c;
+    suns_value_iter_t iter;
+    suns_value_t *v;
 
     suns_model_t *m = data->did->model;
     
-    fprintf(stream, "INSERT INTO %s (unixtime,timestamp,addr",
-            m->name);
-    list_for_each(data->values, c) {
-        suns_value_t *v = c->data;
-        fprintf(stream, ",%s", v->name);
+    sink_puts(sink, "INSERT INTO ");
+    sink_puts(sink, m->name);
+    sink_puts(sink, " (unixtime,timestamp,addr");
+    suns_dataset_for_each_value(data, iter, v) {
+        sink_putc(sink, ',');
+        sink_puts(sink, v->name);
     }
 
     /* FIXME: need to store actual time values, not spacers */
-    fprintf(stream, ") VALUES (%d,'%s',%d", 0, "NULL", 0);
-    list_for_each(data->values, c) {
-        suns_value_t *v = c->data;
-        char buf[BUFFER_SIZE];
+    sink_puts(sink, ") VALUES (0,'NULL',0");
+    suns_dataset_for_each_value(data, iter, v) {
         /* FIXME: should store NULL instead of "not implemented" */
-        suns_snprintf_value_sql(buf, BUFFER_SIZE, v);
         /* FIXME: should store numeric values, not strings */
-        fprintf(stream, ",\"%s\"", buf);
+        sink_puts(sink, ",\"");
+        suns_write_value(sink, v, suns_snprintf_value_sql);
+        sink_putc(sink, '"');
     }
-    fprintf(stream, ");\n");
+    sink_puts(sink, ");\n");
     
-    return 0;
+    return sink->error ? -1 : 0;
 }
 
 
@@ -1009,28 +1167,27 @@ void suns_model_csv_fprintf(FILE *stream, suns_model_t *model)
     fprintf(stream, "\n");
 }
 
-int suns_dataset_csv_fprintf(FILE *stream, suns_dataset_t *data)
+int suns_dataset_csv_write(sink_t *sink, suns_dataset_t *data)
 {
-    list_node_t *c;
+    suns_value_iter_t iter;
+    suns_value_t *v;
     /* suns_model_t *m = data->did->model; */
     
-    fprintf(stream, "unixtime,timestamp,addr");
-    list_for_each(data->values, c) {
-        suns_value_t *v = c->data;
-        fprintf(stream, ",%s", v->name);
+    sink_puts(sink, "unixtime,timestamp,addr");
+    suns_dataset_for_each_value(data, iter, v) {
+        sink_putc(sink, ',');
+        sink_puts(sink, v->name);
     }
     /* FIXME: need to store actual time values, not spacers */
-    fprintf(stream, "%d,\"%s\",%d", 0, "NULL", 0);
-    list_for_each(data->values, c) {
-        suns_value_t *v = c->data;
-        char buf[BUFFER_SIZE];
-        suns_snprintf_value_csv(buf, BUFFER_SIZE, v);
+    sink_puts(sink, "0,\"NULL\",0");
+    suns_dataset_for_each_value(data, iter, v) {
         /* FIXME: should store numeric values, not strings */
-        fprintf(stream, ",%s", buf);
+        sink_putc(sink, ',');
+        suns_write_value(sink, v, suns_snprintf_value_csv);
     }
-    fprintf(stream, "\n\n");
+    sink_puts(sink, "\n\n");
 
-    return 0;
+    return sink->error ? -1 : 0;
 }
  
 
@@ -1050,103 +1207,177 @@ static int value_output_xml_meta(char *buf, size_t len, suns_value_t *v)
     return snprintf(buf, len, "%s", suns_value_meta_string(v->meta));
 }
 
+/* like the json vector, built once rather than copied from
+   suns_output_value_base_fmt for every value */
+static suns_value_output_vector_t suns_output_value_xml_fmt = {
+    .null       =  value_output_null,
+    .undef      =  value_output_undef,
+    .int16      =  value_output_int16,
+    .uint16     =  value_output_uint16,
+    .acc16      =  value_output_uint16,
+    .int32      =  value_output_int32,
+    .uint32     =  value_output_uint32,
+    .float32    =  value_output_float32,
+    .acc32      =  value_output_int32,
+    .enum16     =  value_output_uint16,
+    .enum32     =  value_output_uint32,
+    /* xml data format does not allow values in hex */
+    .bitfield16 =  value_output_uint16,
+    .bitfield32 =  value_output_uint32,
+    .int64      =  value_output_int64,
+    .uint64     =  value_output_uint64,
+    .acc64      =  value_output_uint64,
+    .float64    =  value_output_float64,
+    .sunssf     =  value_output_int16,
+    .string     =  value_output_xml_string,
+    .meta       =  value_output_xml_meta,
+    .ipv4       =  value_output_ipv4,
+    .ipv6       =  value_output_ipv6,
+};
+
 int suns_snprintf_value_xml(char *str, size_t size,
                              suns_value_t *v)
 {
-    suns_value_output_vector_t fmt = suns_output_value_base_fmt;
-    fmt.string     =  value_output_xml_string;
-    fmt.meta       =  value_output_xml_meta;
+    return suns_snprintf_value(str, size, v, &suns_output_value_xml_fmt);
+}
 
-    /* xml data format does not allow values in hex */
-    fmt.bitfield16 =  value_output_uint16;
-    fmt.bitfield32 =  value_output_uint32;
 
-    return suns_snprintf_value(str, size, v, &fmt);
+/* the fragments of v, if it was decoded with the plan of frags */
+static const suns_point_fragments_t *
+suns_value_fragments(const suns_plan_fragments_t *frags, suns_value_t *v)
+{
+    if ((frags == NULL) || (v->step < 0) || (v->step >= frags->n_points))
+        return NULL;
+
+    return &(frags->points[v->step]);
 }
 
 
+/* write s xml-escaped straight into the sink */
+static void suns_xml_write_escaped(sink_t *sink, char *s)
+{
+    size_t len = SUNS_XML_ESCAPED_LEN(strlen(s));
+    char *p = sink_reserve(sink, len);
+
+    if (p == NULL)
+        return;
+
+    sink_commit(sink, string_escape_xml(s, p, len));
+}
+
 
-int suns_dataset_xml_fprintf(FILE *stream, suns_dataset_t *data)
+int suns_dataset_xml_write(sink_t *sink, suns_dataset_t *data)
 {
-    list_node_t *c;
-    char value[BUFFER_SIZE];
+    suns_plan_fragments_t *frags = suns_plan_fragments(data);
+    suns_value_iter_t iter;
+    suns_value_t *v;
     
-    fprintf(stream, "   <m id=\"%d\"", data->did->did);
+    sink_puts(sink, "   <m id=\"");
+    sink_int(sink, data->did->did);
+    sink_putc(sink, '"');
     /* x is used to indicate the instance number of a model
        when there is more than one of a given model */
-    if (data->index != 0)
-        fprintf(stream, " x=\"%d\"", data->index);
-    fprintf(stream, ">\n");
+    if (data->index != 0) {
+        sink_puts(sink, " x=\"");
+        sink_int(sink, data->index);
+        sink_putc(sink, '"');
+    }
+    sink_puts(sink, ">\n");
 
-    list_for_each(data->values, c) {
-        suns_value_t *v = c->data;
+    suns_dataset_for_each_value(data, iter, v) {
+        const suns_point_fragments_t *p = suns_value_fragments(frags, v);
 
         /* skip scale factors and "not implemented" values */
         if ((v->tp.type == SUNS_SF) ||
             (v->meta == SUNS_VALUE_NOT_IMPLEMENTED))
             continue;
 
-        /* do not apply scale factor here */
-        suns_snprintf_value_xml(value, BUFFER_SIZE, v);
-        fprintf(stream, "    <p id=\"%s\"", v->name);
-        if (v->tp.sf != 0)
-            fprintf(stream, " sf=\"%d\"", v->tp.sf);
-        /*
+        sink_puts(sink, "    <p id=\"");
+        if (p)
+            sink_write(sink, p->xml_id, p->xml_id_len);
         else
-            debug("no scale factor for %s", v->name);
-        */
+            suns_xml_write_escaped(sink, v->name);
+        sink_putc(sink, '"');
+        if (v->tp.sf != 0) {
+            sink_puts(sink, " sf=\"");
+            sink_int(sink, v->tp.sf);
+            sink_putc(sink, '"');
+        }
         
-        if (v->repeating)
-            fprintf(stream, " x=\"%d\"", v->index);
-        fprintf(stream, ">%s</p>\n", value);
+        if (v->repeating) {
+            sink_puts(sink, " x=\"");
+            sink_int(sink, v->index);
+            sink_putc(sink, '"');
+        }
+        sink_putc(sink, '>');
+        /* do not apply scale factor here.  strings are escaped
+           straight into the sink, since they can outgrow the value
+           buffer once escaped. */
+        if ((v->tp.type == SUNS_STRING) && (v->meta == SUNS_VALUE_OK))
+            suns_xml_write_escaped(sink, v->value.s);
+        else
+            suns_write_value(sink, v, suns_snprintf_value_xml);
+        sink_puts(sink, "</p>\n");
     }
-    fprintf(stream, "   </m>\n");
+    sink_puts(sink, "   </m>\n");
     
-    return 0;
+    return sink->error ? -1 : 0;
 }
 
 
-int suns_device_xml_fprintf(FILE *stream, suns_device_t *device)
+/* write  name="value" with value xml-escaped, if value is set */
+static void suns_write_xml_attr(sink_t *sink, const char *name, char *value)
 {
-    int rc = 0;
-    list_node_t *c;
-    char safe_string[BUFFER_SIZE];
-    
-    /* root element */
-    /*    fprintf(stream, "<sunSpecData v=\"1\" xmlns=\"http://www.sunspec.org/data/v1\">\n"); */
-    fprintf(stream, "<sunSpecData v=\"1\">\n");
+    if (value == NULL)
+        return;
 
-    fprintf(stream, " <d");
+    sink_putc(sink, ' ');
+    sink_puts(sink, name);
+    sink_puts(sink, "=\"");
+    suns_xml_write_escaped(sink, value);
+    sink_putc(sink, '"');
+}
 
-    if (device->lid) {
-        string_escape_xml(device->lid, safe_string, BUFFER_SIZE);
-        fprintf(stream, " lid=\"%s\"", safe_string);
-    }
 
-    if (device->ns) {
-        string_escape_xml(device->ns, safe_string, BUFFER_SIZE);
-        fprintf(stream, " ns=\"%s\"", safe_string);
-    }        
-    
-    if (device->manufacturer) {
-        string_escape_xml(device->manufacturer, safe_string, BUFFER_SIZE);
-        fprintf(stream, " man=\"%s\"", safe_string);
-    }
-    
-    if (device->model) {
-        string_escape_xml(device->model, safe_string, BUFFER_SIZE);
-        fprintf(stream, " mod=\"%s\"", safe_string);
-    }
+/* root element of a post holding any number of devices */
+int suns_xml_begin(sink_t *sink)
+{
+    /*    sink_puts(sink, "<sunSpecData v=\"1\" xmlns=\"http://www.sunspec.org/data/v1\">\n"); */
+    sink_puts(sink, "<sunSpecData v=\"1\">\n");
+
+    return sink->error ? -1 : 0;
+}
+
+
+int suns_xml_end(sink_t *sink)
+{
+    sink_puts(sink, "</sunSpecData>\n");
+
+    return sink->error ? -1 : 0;
+}
+
+
+/* a device's <d> element, to go between suns_xml_begin() and
+   suns_xml_end() */
+int suns_device_xml_item(sink_t *sink, suns_device_t *device, int n)
+{
+    int rc = 0;
+    list_node_t *c;
+    char timestamp[BUFFER_SIZE];
     
-    if (device->serial_number) {
-        string_escape_xml(device->serial_number, safe_string, BUFFER_SIZE);
-        fprintf(stream, " sn=\"%s\"", safe_string);
-    }
+    sink_puts(sink, " <d");
+    suns_write_xml_attr(sink, "lid", device->lid);
+    suns_write_xml_attr(sink, "ns", device->ns);
+    suns_write_xml_attr(sink, "man", device->manufacturer);
+    suns_write_xml_attr(sink, "mod", device->model);
+    suns_write_xml_attr(sink, "sn", device->serial_number);
     
     /* set date to now */
-    date_snprintf_rfc3339_z(safe_string, BUFFER_SIZE,
+    date_snprintf_rfc3339_z(timestamp, BUFFER_SIZE,
                             device->unixtime, device->usec);
-    fprintf(stream, " t=\"%s\">\n", safe_string);
+    sink_puts(sink, " t=\"");
+    sink_puts(sink, timestamp);
+    sink_puts(sink, "\">\n");
     
     list_for_each(device->datasets, c) {
         suns_dataset_t *d = c->data;
@@ -1154,14 +1385,30 @@ int suns_device_xml_fprintf(FILE *stream, suns_device_t *device)
         /* don't include common model block */
         /* if (d->did->did == 1)
            continue; */
+
+        /* only decoded to identify the device */
+        if (d->unchanged)
+            continue;
         
-        rc = suns_dataset_xml_fprintf(stream, d);
+        rc = suns_dataset_xml_write(sink, d);
         if (rc < 0)
             break;
     }
 
-    fprintf(stream, " </d>\n");
-    fprintf(stream, "</sunSpecData>\n");
+    sink_puts(sink, " </d>\n");
+
+    return rc;
+}
+
+
+/* a post holding just the one device */
+int suns_device_xml_write(sink_t *sink, suns_device_t *device)
+{
+    int rc;
+
+    suns_xml_begin(sink);
+    rc = suns_device_xml_item(sink, device, 0);
+    suns_xml_end(sink);
 
     return rc;
 }
@@ -1390,6 +1637,746 @@ void suns_model_xml_dp_fprintf(FILE *stream,
 }
 
 
+/**********************************************************************
+ *
+ * json and ndjson formats
+ *
+ **********************************************************************/
+
+/**
+ * write s into out as a quoted json string, escaping quotes, backslashes
+ * and control characters.  out holds len chars, including the NUL; a
+ * string that doesn't fit is cut short, never in the middle of an
+ * escape, and still closed.  SUNS_JSON_QUOTED_LEN() is always enough.
+ *
+ * returns the number of characters written to out
+ */
+int suns_json_quote(char *out, size_t len, const char *s)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t i = 0;
+    size_t need;
+    unsigned char c;
+
+    if (len < 3) {
+        if (len > 0)
+            out[0] = '\0';
+        return 0;
+    }
+
+    out[i++] = '"';
+    for ( ; *s != '\0'; s++) {
+        c = *s;
+        if ((c == '"') || (c == '\\'))
+            need = 2;
+        else if (c < 32)
+            need = 6;
+        else
+            need = 1;
+
+        /* leave room for the closing quote and the NUL */
+        if (i + need + 2 > len)
+            break;
+
+        if (need == 2) {
+            out[i++] = '\\';
+            out[i++] = c;
+        } else if (need == 6) {
+            memcpy(out + i, "\\u00", 4);
+            out[i + 4] = hex[c >> 4];
+            out[i + 5] = hex[c & 0xf];
+            i += 6;
+        } else {
+            out[i++] = c;
+        }
+    }
+    out[i++] = '"';
+    out[i] = '\0';
+
+    return i;
+}
+
+static int value_output_json_null(char *buf, size_t len, suns_value_t *v)
+{
+    return snprintf(buf, len, "null");
+}
+
+static int value_output_json_string(char *buf, size_t len, suns_value_t *v)
+{
+    return suns_json_quote(buf, len, v->value.s);
+}
+
+/* json has no nan or infinity */
+static int value_output_json_float32_sf(char *buf, size_t len,
+                                        suns_value_t *v)
+{
+    if (! isfinite(v->value.f32))
+        return value_output_json_null(buf, len, v);
+    return value_output_float32_sf(buf, len, v);
+}
+
+static int value_output_json_float64_sf(char *buf, size_t len,
+                                        suns_value_t *v)
+{
+    if (! isfinite(v->value.f64))
+        return value_output_json_null(buf, len, v);
+    return value_output_float64_sf(buf, len, v);
+}
+
+static int value_output_json_ipv4(char *buf, size_t len, suns_value_t *v)
+{
+    char addr[BUFFER_SIZE];
+
+    value_output_ipv4(addr, BUFFER_SIZE, v);
+    return suns_json_quote(buf, len, addr);
+}
+
+/* numbers are scaled, and everything that isn't a number or a string
+   is null.  the vector is built once rather than copied from
+   suns_output_value_base_fmt on every call, since json output formats
+   every value through it. */
+static suns_value_output_vector_t suns_output_value_json_fmt = {
+    .null       =  value_output_json_null,
+    .undef      =  value_output_json_null,
+    .int16      =  value_output_int16_sf,
+    .uint16     =  value_output_uint16_sf,
+    .acc16      =  value_output_uint16_sf,
+    .int32      =  value_output_int32_sf,
+    .uint32     =  value_output_uint32_sf,
+    .float32    =  value_output_json_float32_sf,
+    .acc32      =  value_output_uint32_sf,
+    .enum16     =  value_output_uint16,
+    .enum32     =  value_output_uint32,
+    /* json has no hex numbers */
+    .bitfield16 =  value_output_uint16,
+    .bitfield32 =  value_output_uint32,
+    .int64      =  value_output_int64_sf,
+    .uint64     =  value_output_uint64_sf,
+    .acc64      =  value_output_uint64_sf,
+    .float64    =  value_output_json_float64_sf,
+    .sunssf     =  value_output_int16,
+    .string     =  value_output_json_string,
+    .meta       =  value_output_json_null,
+    .ipv4       =  value_output_json_ipv4,
+    .ipv6       =  value_output_json_null,
+};
+
+int suns_snprintf_value_json(char *str, size_t size, suns_value_t *v)
+{
+    return suns_snprintf_value(str, size, v, &suns_output_value_json_fmt);
+}
+
+
+static void suns_json_write_string(sink_t *sink, const char *s)
+{
+    size_t len = SUNS_JSON_QUOTED_LEN(strlen(s));
+    char *p = sink_reserve(sink, len);
+
+    if (p == NULL)
+        return;
+
+    sink_commit(sink, suns_json_quote(p, len, s));
+}
+
+
+/* see suns_point_fragments_t */
+static void suns_json_write_key(sink_t *sink, const char *name)
+{
+    suns_json_write_string(sink, name);
+    sink_puts(sink, ":{\"v\":");
+}
+
+
+static void suns_json_write_tail(sink_t *sink, const char *units,
+                                 const char *label)
+{
+    if (units) {
+        sink_puts(sink, ",\"u\":");
+        suns_json_write_string(sink, units);
+    }
+    if (label) {
+        sink_puts(sink, ",\"l\":");
+        suns_json_write_string(sink, label);
+    }
+    sink_putc(sink, '}');
+}
+
+
+static void suns_json_write_point(sink_t *sink, suns_value_t *v,
+                                  const suns_point_fragments_t *p)
+{
+    if (p)
+        sink_write(sink, p->json_key, p->json_key_len);
+    else
+        suns_json_write_key(sink, v->name);
+
+    /* strings can outgrow the value buffer once escaped */
+    if ((v->tp.type == SUNS_STRING) && (v->meta == SUNS_VALUE_OK))
+        suns_json_write_string(sink, v->value.s);
+    else
+        suns_write_value(sink, v, suns_snprintf_value_json);
+
+    if (p)
+        sink_write(sink, p->json_tail, p->json_tail_len);
+    else
+        suns_json_write_tail(sink, v->units, v->label);
+}
+
+
+/* start a line at depth in the json format; ndjson stays on one line */
+static void suns_json_indent(sink_t *sink, int pretty, int depth)
+{
+    if (! pretty)
+        return;
+
+    sink_putc(sink, '\n');
+    sink_pad(sink, "", depth * 2);
+}
+
+
+/* where suns_json_write_value() is in a model's json */
+typedef struct suns_json_state {
+    int pretty;
+    int depth;
+    int n;          /* points written to the current points object */
+    int repeating;  /* in the repeating array */
+    int index;      /* repeating block instance being written */
+} suns_json_state_t;
+
+
+/* write a value of a model, opening the repeating array or the next
+   instance of it first if the value starts one */
+static void suns_json_write_value(sink_t *sink, suns_json_state_t *s,
+                                  suns_value_t *v,
+                                  const suns_point_fragments_t *p)
+{
+    if (v->repeating && (! s->repeating || (v->index != s->index))) {
+        if (s->repeating) {
+            /* close the last instance */
+            sink_puts(sink, "}},");
+        } else {
+            /* close the fixed block's points */
+            sink_puts(sink, "},");
+            suns_json_indent(sink, s->pretty, s->depth + 1);
+            sink_puts(sink, "\"repeating\":[");
+            s->repeating = 1;
+        }
+        suns_json_indent(sink, s->pretty, s->depth + 2);
+        sink_puts(sink, "{\"x\":");
+        sink_int(sink, v->index);
+        sink_puts(sink, ",\"points\":{");
+        s->index = v->index;
+        s->n = 0;
+    }
+
+    if (s->n++ > 0)
+        sink_putc(sink, ',');
+    suns_json_indent(sink, s->pretty, s->depth + (s->repeating ? 3 : 1));
+    suns_json_write_point(sink, v, p);
+}
+
+
+/* a model, as
+     {"id":did,"x":index,"points":{...},
+      "repeating":[{"x":1,"points":{...}},...]}
+   x is left out of the model for its first instance, like the xml
+   format, and repeating is left out of models without one.
+
+   a repeating block decoded into columns is written straight from the
+   columns, skipping the values that aren't written before they are
+   made.  samples are written one at a time through a value on the
+   stack. */
+static int suns_dataset_json_write_depth(sink_t *sink, suns_dataset_t *data,
+                                         int pretty, int depth)
+{
+    suns_plan_fragments_t *frags = suns_plan_fragments(data);
+    suns_columns_t *cols = data->columns;
+    suns_json_state_t s = { pretty, depth, 0, 0, 0 };
+    list_node_t *c;
+    suns_value_t *v;
+    int i, j;
+
+    sink_puts(sink, "{\"id\":");
+    sink_int(sink, data->did->did);
+    if (data->index != 0) {
+        sink_puts(sink, ",\"x\":");
+        sink_int(sink, data->index);
+    }
+    sink_puts(sink, ",\"points\":{");
+
+    list_for_each(data->values, c) {
+        v = c->data;
+
+        /* skip scale factors (values are scaled), pads and
+           "not implemented" values */
+        if ((v->tp.type == SUNS_SF) ||
+            (v->tp.type == SUNS_PAD) ||
+            (v->meta == SUNS_VALUE_NOT_IMPLEMENTED))
+            continue;
+
+        suns_json_write_value(sink, &s, v, suns_value_fragments(frags, v));
+    }
+
+    for (i = 0; data->samples && (i < data->samples->count); i++) {
+        suns_value_t sample;
+
+        suns_samples_get_value(data->samples, i, &sample);
+        if ((sample.tp.type == SUNS_SF) ||
+            (sample.tp.type == SUNS_PAD) ||
+            (sample.meta == SUNS_VALUE_NOT_IMPLEMENTED))
+            continue;
+
+        suns_json_write_value(sink, &s, &sample,
+                              suns_value_fragments(frags, &sample));
+    }
+
+    for (i = 0; cols && (i < cols->count); i++) {
+        for (j = 0; j < cols->n_columns; j++) {
+            suns_column_t *col = &(cols->columns[j]);
+            suns_type_t type = col->step->tp->type;
+
+            if ((type == SUNS_SF) || (type == SUNS_PAD) ||
+                (! suns_column_is_implemented(col, i)))
+                continue;
+
+            v = suns_column_value(cols, col, i);
+            suns_json_write_value(sink, &s, v,
+                                  suns_value_fragments(frags, v));
+        }
+    }
+
+    if (s.repeating)
+        sink_puts(sink, "}}]");
+    else
+        sink_putc(sink, '}');
+    sink_putc(sink, '}');
+
+    return sink->error ? -1 : 0;
+}
+
+
+int suns_dataset_json_write(sink_t *sink, suns_dataset_t *data)
+{
+    return suns_dataset_json_write_depth(sink, data, 1, 0);
+}
+
+
+/* write ,"name":"value" if value is set */
+static void suns_json_write_attr(sink_t *sink, const char *name,
+                                 const char *value)
+{
+    if (value == NULL)
+        return;
+
+    sink_puts(sink, ",\"");
+    sink_puts(sink, name);
+    sink_puts(sink, "\":");
+    suns_json_write_string(sink, value);
+}
+
+
+/* a device, with the same attributes as the xml format, as
+     {"t":timestamp,"lid":...,"models":[...]} */
+static int suns_device_json_write_mode(sink_t *sink, suns_device_t *device,
+                                       int pretty)
+{
+    int rc = 0;
+    int n = 0;
+    list_node_t *c;
+    char timestamp[BUFFER_SIZE];
+
+    date_snprintf_rfc3339_z(timestamp, BUFFER_SIZE,
+                            device->unixtime, device->usec);
+    sink_puts(sink, "{\"t\":\"");
+    sink_puts(sink, timestamp);
+    sink_putc(sink, '"');
+    suns_json_write_attr(sink, "lid", device->lid);
+    suns_json_write_attr(sink, "ns", device->ns);
+    suns_json_write_attr(sink, "man", device->manufacturer);
+    suns_json_write_attr(sink, "mod", device->model);
+    suns_json_write_attr(sink, "sn", device->serial_number);
+    sink_puts(sink, ",\"models\":[");
+
+    list_for_each(device->datasets, c) {
+        suns_dataset_t *d = c->data;
+
+        /* only decoded to identify the device */
+        if (d->unchanged)
+            continue;
+
+        if (n++ > 0)
+            sink_putc(sink, ',');
+        suns_json_indent(sink, pretty, 1);
+        rc = suns_dataset_json_write_depth(sink, d, pretty, 1);
+        if (rc < 0)
+            break;
+    }
+
+    suns_json_indent(sink, pretty, 0);
+    sink_puts(sink, "]}");
+
+    return rc;
+}
+
+
+int suns_device_json_write(sink_t *sink, suns_device_t *device)
+{
+    int rc = suns_device_json_write_mode(sink, device, 1);
+
+    sink_putc(sink, '\n');
+
+    return rc;
+}
+
+
+/* a document of many devices is an array of device objects */
+int suns_json_begin(sink_t *sink)
+{
+    sink_putc(sink, '[');
+
+    return sink->error ? -1 : 0;
+}
+
+
+int suns_json_end(sink_t *sink)
+{
+    sink_puts(sink, "]\n");
+
+    return sink->error ? -1 : 0;
+}
+
+
+/* a device object, to go between suns_json_begin() and
+   suns_json_end() */
+int suns_device_json_item(sink_t *sink, suns_device_t *device, int n)
+{
+    if (n > 0)
+        sink_puts(sink, ",\n");
+
+    return suns_device_json_write_mode(sink, device, 1);
+}
+
+
+/* one line per device */
+int suns_device_ndjson_write(sink_t *sink, suns_device_t *device)
+{
+    int rc = suns_device_json_write_mode(sink, device, 0);
+
+    sink_putc(sink, '\n');
+
+    return rc;
+}
+
+
+/**********************************************************************
+ *
+ * compiled output fragments
+ *
+ **********************************************************************/
+
+static void suns_plan_fragments_free(void *attached)
+{
+    suns_plan_fragments_t *frags = attached;
+
+    free(frags->points);
+    free(frags->strings);
+    free(frags);
+}
+
+
+/* build the json and xml fragments of every step of a decode plan, or
+   return NULL on a memory error */
+static suns_plan_fragments_t *
+suns_plan_fragments_build(suns_decode_plan_t *plan)
+{
+    suns_plan_fragments_t *frags = malloc(sizeof(suns_plan_fragments_t));
+    sink_t *sink = sink_new_memory(0);
+    suns_point_fragments_t *points;
+    size_t start;
+    char *p;
+    int i;
+
+    if (frags)
+        memset(frags, 0, sizeof(suns_plan_fragments_t));
+    if ((frags == NULL) || (sink == NULL))
+        goto fail;
+    frags->n_points = plan->n_steps;
+    frags->points = malloc(sizeof(suns_point_fragments_t) *
+                           (plan->n_steps > 0 ? plan->n_steps : 1));
+    if (frags->points == NULL)
+        goto fail;
+    points = frags->points;
+
+    for (i = 0; i < plan->n_steps; i++) {
+        suns_decode_step_t *step = &(plan->steps[i]);
+        start = sink_len(sink);
+        suns_json_write_key(sink, step->dp->name);
+        points[i].json_key_len = sink_len(sink) - start;
+        start = sink_len(sink);
+        suns_json_write_tail(sink, step->units, step->label);
+        points[i].json_tail_len = sink_len(sink) - start;
+        start = sink_len(sink);
+        suns_xml_write_escaped(sink, step->dp->name);
+        points[i].xml_id_len = sink_len(sink) - start;
+    }
+
+    frags->strings = malloc(sink_len(sink) + 1);
+    if ((sink->error) || (frags->strings == NULL))
+        goto fail;
+    memcpy(frags->strings, sink_data(sink), sink_len(sink));
+
+    /* in the order they were written above */
+    p = frags->strings;
+    for (i = 0; i < plan->n_steps; i++) {
+        points[i].json_key = p;
+        p += points[i].json_key_len;
+        points[i].json_tail = p;
+        p += points[i].json_tail_len;
+        points[i].xml_id = p;
+        p += points[i].xml_id_len;
+    }
+
+    sink_free(sink);
+    return frags;
+
+ fail:
+    error("memory error: can't build output fragments");
+    if (sink)
+        sink_free(sink);
+    if (frags)
+        suns_plan_fragments_free(frags);
+    return NULL;
+}
+
+
+/**
+ * the output fragments of the plan data was decoded with (see
+ * suns_point_fragments_t), so writing a value copies them instead of
+ * escaping its name, units and label again.  they are built the first
+ * time a plan is written and kept with it.
+ *
+ * returns NULL if data has no plan or the fragments can't be built;
+ * values are then escaped as they are written.
+ */
+suns_plan_fragments_t *suns_plan_fragments(suns_dataset_t *data)
+{
+    suns_decode_plan_t *plan;
+    suns_plan_fragments_t *frags;
+    suns_plan_fragments_t *attached;
+
+    if ((data->did == NULL) || (data->did->model == NULL) ||
+        ((plan = data->did->model->plan) == NULL))
+        return NULL;
+
+    frags = suns_decode_plan_attached(plan);
+    if (frags)
+        return frags;
+
+    /* writers that get here at once each build them, and all but the
+       first attached are thrown away */
+    frags = suns_plan_fragments_build(plan);
+    if (frags == NULL)
+        return NULL;
+    attached = suns_decode_plan_attach(plan, frags,
+                                       suns_plan_fragments_free);
+    if (attached != frags)
+        suns_plan_fragments_free(frags);
+
+    return attached;
+}
+
+
+/* two digit pairs "00" through "99", so the integer conversion below
+   does one division per two digits */
+static const char suns_digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+
+/* write the decimal digits of x so they end just before end, and
+   return the number of digits written.  the caller provides at least
+   SUNS_DECIMAL_DIGITS_MAX chars before end. */
+static int suns_format_digits(char *end, uint64_t x)
+{
+    char *p = end;
+    unsigned int pair;
+
+    while (x >= 100) {
+        pair = (x % 100) * 2;
+        x /= 100;
+        *--p = suns_digit_pairs[pair + 1];
+        *--p = suns_digit_pairs[pair];
+    }
+    if (x >= 10) {
+        pair = x * 2;
+        *--p = suns_digit_pairs[pair + 1];
+        *--p = suns_digit_pairs[pair];
+    } else {
+        *--p = '0' + x;
+    }
+
+    return end - p;
+}
+
+
+/* format the magnitude x (with a leading '-' if negative is set) times
+   10^e in normalized scientific notation: the first digit, a decimal
+   point and the remaining digits if there are any, and then the
+   exponent unless it is 0.  "-7e2" rather than "-7.e2", which isn't a
+   json number.  returns the number of chars written, or -1 if buf is
+   too small. */
+static int suns_format_decimal_e(char *buf,
+                                 size_t len,
+                                 uint64_t x,
+                                 int negative,
+                                 int e)
+{
+    char digits[SUNS_DECIMAL_DIGITS_MAX];
+    char exp_digits[SUNS_DECIMAL_DIGITS_MAX];
+    char *d;
+    int ndigits, exp_ndigits = 0;
+    unsigned int exp_abs;
+    size_t need;
+    char *p = buf;
+
+    ndigits = suns_format_digits(digits + SUNS_DECIMAL_DIGITS_MAX, x);
+    d = digits + SUNS_DECIMAL_DIGITS_MAX - ndigits;
+
+    /* normalize e */
+    e += ndigits - 1;
+
+    need = negative + ndigits + (ndigits > 1);
+    if (e != 0) {
+        exp_abs = (e < 0) ? -(unsigned int) e : (unsigned int) e;
+        exp_ndigits = suns_format_digits(exp_digits + SUNS_DECIMAL_DIGITS_MAX,
+                                         exp_abs);
+        need += 1 + (e < 0) + exp_ndigits;
+    }
+    if (need + 1 > len) {
+        debug("len = %zd is too small for %zd chars", len, need);
+        return -1;
+    }
+
+    if (negative)
+        *p++ = '-';
+
+    /* first digit, then the decimal point and the rest */
+    *p++ = d[0];
+    if (ndigits > 1) {
+        *p++ = '.';
+        memcpy(p, d + 1, ndigits - 1);
+        p += ndigits - 1;
+    }
+
+    /* now add exponent if needed */
+    if (e != 0) {
+        *p++ = 'e';
+        if (e < 0)
+            *p++ = '-';
+        memcpy(p, exp_digits + SUNS_DECIMAL_DIGITS_MAX - exp_ndigits,
+               exp_ndigits);
+        p += exp_ndigits;
+    }
+    *p = '\0';
+
+    return p - buf;
+}
+
+
+/* format the magnitude x (negated if negative is set) times 10^e
+   exactly in base 10, placing the decimal point straight from e
+   rather than converting through a floating point type.  values that
+   would need more than maxdigits digits (or more than maxdigits + 2
+   digits once the zeros implied by e are written out) use scientific
+   notation instead.
+
+   the output matches _suns_snprintf_int_sf() char for char in
+   positional notation.  scientific notation keeps the sign in front of
+   the first digit and leaves out a decimal point with nothing after
+   it (see suns_format_decimal_e()).  the return value is always the length of the string written, like
+   snprintf(); -1 means buf was too small. */
+int suns_format_decimal(char *buf,
+                        size_t len,
+                        uint64_t x,
+                        int negative,
+                        int e,
+                        int maxdigits)
+{
+    char digits[SUNS_DECIMAL_DIGITS_MAX];
+    char *d;
+    int ndigits, numlen, point;
+    size_t need;
+    char *p = buf;
+
+    /* short circuit x == 0 (ignore exponent) */
+    if (x == 0) {
+        negative = 0;
+        e = 0;
+    }
+
+    ndigits = suns_format_digits(digits + SUNS_DECIMAL_DIGITS_MAX, x);
+    d = digits + SUNS_DECIMAL_DIGITS_MAX - ndigits;
+    numlen = ndigits + negative;
+
+    /* if the resulting number of digits is greater than maxdigits use
+       scientific notation */
+    if ((e != 0) &&
+        ((numlen > maxdigits) || (numlen + abs(e) > maxdigits + 2))) {
+        return suns_format_decimal_e(buf, len, x, negative, e);
+    }
+
+    /* point is the number of digits to the left of the decimal point */
+    point = ndigits + e;
+    if (e >= 0)
+        need = numlen + e;
+    else if (point > 0)
+        need = numlen + 1;
+    else
+        need = negative + 2 - point + ndigits;
+    if (need + 1 > len) {
+        debug("len = %zd is too small for %zd chars", len, need);
+        return -1;
+    }
+
+    if (negative)
+        *p++ = '-';
+
+    if (e >= 0) {
+        memcpy(p, d, ndigits);
+        p += ndigits;
+        memset(p, '0', e);
+        p += e;
+    } else if (point > 0) {
+        /* there are digits to the left of the decimal point */
+        memcpy(p, d, point);
+        p += point;
+        *p++ = '.';
+        memcpy(p, d + point, ndigits - point);
+        p += ndigits - point;
+    } else {
+        /* all the digits are to the right of the decimal point, maybe
+           after some zeros */
+        *p++ = '0';
+        *p++ = '.';
+        memset(p, '0', -point);
+        p += -point;
+        memcpy(p, d, ndigits);
+        p += ndigits;
+    }
+    *p = '\0';
+
+    return p - buf;
+}
+
+
 /* convert the provided integer and exponent into
    normalized scientific notation.
 
@@ -1407,17 +2394,11 @@ int suns_snprintf_int_sf_e(char *buf,
                            int64_t x,
                            int e)
 {
-    int numlen;
-    char tmpbuf[BUFFER_SIZE];
+    /* negate in unsigned arithmetic so INT64_MIN works */
+    if (x < 0)
+        return suns_format_decimal_e(buf, len, -(uint64_t) x, 1, e);
 
-    numlen = snprintf(tmpbuf, BUFFER_SIZE - 1, "%" PRId64, (int64_t) x);
-    if (numlen > BUFFER_SIZE - 1) {
-        /* tmpbuf is too small */
-        debug("tmpbuf[BUFFER_SIZE] is too small to hold x = %" PRId64, x);
-        return -1;
-    }
-
-    return _suns_snprintf_int_sf_e(buf, len, tmpbuf, e);
+    return suns_format_decimal_e(buf, len, x, 0, e);
 }
 
 int suns_snprintf_uint_sf_e(char *buf,
@@ -1425,21 +2406,14 @@ int suns_snprintf_uint_sf_e(char *buf,
                             uint64_t x,
                             int e)
 {
-    int numlen;
-    char tmpbuf[BUFFER_SIZE];
-    
-    numlen = snprintf(tmpbuf, BUFFER_SIZE - 1, "%" PRIu64, (uint64_t) x);
-    if (numlen > BUFFER_SIZE - 1) {
-        /* tmpbuf is too small */
-        debug("tmpbuf[BUFFER_SIZE] is too small to hold x = %" PRIu64, x);
-        return -1;
-    }
-
-    return _suns_snprintf_int_sf_e(buf, len, tmpbuf, e);
+    return suns_format_decimal_e(buf, len, x, 0, e);
 }
 
-/* inner function used after the type-specific conversion of the
-   base number to a string */
+/* string based version of suns_snprintf_int_sf_e(), used after the
+   type-specific conversion of the base number to a string.  this was
+   the original implementation and is kept unchanged; it treats a '-'
+   as a digit and always writes the decimal point, which
+   suns_format_decimal_e() doesn't. */
 int _suns_snprintf_int_sf_e(char *buf,
                             size_t len,
                             char *base,
@@ -1485,11 +2459,9 @@ int _suns_snprintf_int_sf_e(char *buf,
 
 
 /* outputs a sunspec value with its scale factor applied, with
-   no loss of precision due to conversion to base 2 floating point
-
-   this uses long int as its argument so it works for all 32 bit
-   datatype (signed and unsigned).  it will not work for unsigned 64 bit
-   integers, so this will have to be revisited at some point.
+   no loss of precision due to conversion to base 2 floating point.
+   the int64_t argument covers every signed type; unsigned types use
+   suns_snprintf_uint_sf() so the full uint64 range works.
  */
 int suns_snprintf_int_sf(char *buf,
                          size_t len,
@@ -1497,23 +2469,11 @@ int suns_snprintf_int_sf(char *buf,
                          int e,
                          int maxdigits)
 {
-    int numlen;
-    char tmpbuf[BUFFER_SIZE];
-
-    /* short circuit x == 0 (ignore exponent) */
-    if (x == 0) {
-        strncpy(buf, "0", len);
-        return 0;
-    }
+    /* negate in unsigned arithmetic so INT64_MIN works */
+    if (x < 0)
+        return suns_format_decimal(buf, len, -(uint64_t) x, 1, e, maxdigits);
 
-    numlen = snprintf(tmpbuf, BUFFER_SIZE, "%" PRId64, x);
-    if (numlen > BUFFER_SIZE) {
-        /* tmpbuf is too small */
-        debug("tmpbuf[BUFFER_SIZE] is too small to hold x = %" PRId64, x);
-        return -1;
-    }
-
-    return _suns_snprintf_int_sf(buf, len, tmpbuf, e, maxdigits);
+    return suns_format_decimal(buf, len, x, 0, e, maxdigits);
 }
 
 int suns_snprintf_uint_sf(char *buf,
@@ -1522,25 +2482,13 @@ int suns_snprintf_uint_sf(char *buf,
                           int e,
                           int maxdigits)
 {
-    int numlen;
-    char tmpbuf[BUFFER_SIZE];
-
-    /* short circuit x == 0 (ignore exponent) */
-    if (x == 0) {
-        strncpy(buf, "0", len);
-        return 0;
-    }
-
-    numlen = snprintf(tmpbuf, BUFFER_SIZE, "%" PRIu64, x);
-    if (numlen > BUFFER_SIZE) {
-        /* tmpbuf is too small */
-        debug("tmpbuf[BUFFER_SIZE] is too small to hold x = %" PRId64, x);
-        return -1;
-    }
-
-    return _suns_snprintf_int_sf(buf, len, tmpbuf, e, maxdigits);
+    return suns_format_decimal(buf, len, x, 0, e, maxdigits);
 }
 
+/* string based version of suns_snprintf_int_sf(), used after the
+   type-specific conversion of the base number to a string.  like
+   _suns_snprintf_int_sf_e() it is kept as the reference for the unit
+   tests. */
 int _suns_snprintf_int_sf(char *buf,
                           size_t len,
                           char *base,
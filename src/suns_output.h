@@ -41,6 +41,11 @@
 #ifndef _SUNS_OUTPUT_H_
 #define _SUNS_OUTPUT_H_
 
+#include "trx/sink.h"
+
+/* decimal digits in the largest uint64_t */
+#define SUNS_DECIMAL_DIGITS_MAX 20
+
 typedef int (*suns_value_snprintf_f)(char *buf, size_t len,
                                      suns_value_t *value);
 
@@ -94,23 +99,82 @@ typedef struct suns_model_export_format {
 } suns_model_export_format_t;
 
 
-typedef int (*suns_dataset_fprintf_f)(FILE *stream,
-				      suns_dataset_t *data);
+typedef int (*suns_dataset_write_f)(sink_t *sink,
+                                    suns_dataset_t *data);
 
 typedef struct suns_dataset_output_format {
     char *name;
-    suns_dataset_fprintf_f fprintf;
+    suns_dataset_write_f write;
 } suns_dataset_output_format_t;
 
 
-typedef int (*suns_device_fprintf_f)(FILE *stream,
-				      suns_device_t *data);
+typedef int (*suns_device_write_f)(sink_t *sink,
+                                   suns_device_t *data);
+
+typedef int (*suns_document_write_f)(sink_t *sink);
+
+/* n is the number of devices already in the document */
+typedef int (*suns_device_item_f)(sink_t *sink,
+                                  suns_device_t *device, int n);
+
+/* formats whose documents can hold any number of devices also define
+   begin, item and end, so a document can be written one device at a
+   time: begin, then item for each device, then end.  they are NULL
+   for formats where every device is a document of its own.
 
+   columnar is set for formats that write repeating blocks decoded into
+   columns without going through the values (see suns_output_columnar()). */
 typedef struct suns_device_output_format {
     char *name;
-    suns_device_fprintf_f fprintf;
+    suns_device_write_f write;
+    suns_document_write_f begin;
+    suns_device_item_f item;
+    suns_document_write_f end;
+    int columnar;
 } suns_device_output_format_t;
 
+/* the parts of a datapoint's output that are the same for every
+   value, escaped once when the model's decode plan is compiled.
+
+   json:
+
+     "name":{"v":VALUE,"u":"units","l":"label"}
+     \__ key ___/     \________ tail _________/
+
+   the units and label are left out of the tail if not defined.
+
+   logger xml, where only the escaped id is kept:
+
+     <p id="name" sf="-2">VALUE</p>
+            \__/
+           xml_id */
+typedef struct suns_point_fragments {
+    const char *json_key;
+    size_t json_key_len;
+    const char *json_tail;
+    size_t json_tail_len;
+    const char *xml_id;
+    size_t xml_id_len;
+} suns_point_fragments_t;
+
+/* the fragments of every step of a decode plan, built the first time
+   a dataset decoded with the plan is written, and kept with the plan
+   (see suns_decode_plan_attach()).  a value finds its fragments by
+   its step. */
+typedef struct suns_plan_fragments {
+    suns_point_fragments_t *points;  /* one per step */
+    int n_points;
+    char *strings;                   /* what the points point into */
+} suns_plan_fragments_t;
+
+/* longest string string_escape_xml() makes of n chars, including the
+   NUL */
+#define SUNS_XML_ESCAPED_LEN(n) (((n) * 6) + 1)
+
+/* longest quoted json string suns_json_quote() makes of n chars,
+   including the NUL */
+#define SUNS_JSON_QUOTED_LEN(n) (((n) * 6) + 3)
+
 
 void suns_dp_fprint(FILE *stream, suns_dp_t *dp);
 void suns_define_block_fprint(FILE *stream, suns_define_block_t *block);
@@ -124,19 +188,36 @@ void suns_data_block_fprintf(FILE *stream, suns_data_block_t *block);
 int suns_model_export(FILE *stream, char *type, suns_model_t *model);
 int suns_model_export_all(FILE *stream, char *type,
                           list_t *model_list, list_t *define_list);
-int suns_dataset_text_fprintf(FILE *stream, suns_dataset_t *data);
-int suns_dataset_output(char *fmt, suns_dataset_t *data, FILE *stream);
-int suns_device_output(char *fmt, suns_device_t *device, FILE *stream);
+void suns_write_symbols(sink_t *sink, suns_value_t *v);
+int suns_dataset_text_write(sink_t *sink, suns_dataset_t *data);
+int suns_dataset_output(char *fmt, suns_dataset_t *data, sink_t *sink);
+int suns_device_output(char *fmt, suns_device_t *device, sink_t *sink);
+int suns_output_begin(char *fmt, sink_t *sink);
+int suns_device_output_item(char *fmt, suns_device_t *device, int n,
+                            sink_t *sink);
+int suns_output_end(char *fmt, sink_t *sink);
+int suns_output_columnar(char *fmt);
+suns_plan_fragments_t *suns_plan_fragments(suns_dataset_t *data);
 void suns_model_sql_fprintf(FILE *stream, suns_model_t *model);
-int suns_dataset_sql_fprintf(FILE *stream, suns_dataset_t *data);
+int suns_dataset_sql_write(sink_t *sink, suns_dataset_t *data);
 void suns_model_csv_fprintf(FILE *stream, suns_model_t *model);
-int suns_dataset_csv_fprintf(FILE *string, suns_dataset_t *data);
-int suns_dataset_xml_fprintf(FILE *stream, suns_dataset_t *data);
+int suns_dataset_csv_write(sink_t *sink, suns_dataset_t *data);
+int suns_dataset_xml_write(sink_t *sink, suns_dataset_t *data);
 void suns_model_xml_strings(FILE *stream,
                             suns_model_did_t *did,
                             list_t *dp_block_list);
-int suns_device_xml_fprintf(FILE *stream,
-                            suns_device_t *device);
+int suns_device_xml_write(sink_t *sink, suns_device_t *device);
+int suns_xml_begin(sink_t *sink);
+int suns_device_xml_item(sink_t *sink, suns_device_t *device, int n);
+int suns_xml_end(sink_t *sink);
+int suns_json_quote(char *out, size_t len, const char *s);
+int suns_snprintf_value_json(char *str, size_t size, suns_value_t *v);
+int suns_dataset_json_write(sink_t *sink, suns_dataset_t *data);
+int suns_device_json_write(sink_t *sink, suns_device_t *device);
+int suns_json_begin(sink_t *sink);
+int suns_device_json_item(sink_t *sink, suns_device_t *device, int n);
+int suns_json_end(sink_t *sink);
+int suns_device_ndjson_write(sink_t *sink, suns_device_t *device);
 
 int suns_snprintf_value(char *str, size_t size,
                         suns_value_t *v, suns_value_output_vector_t *fmt);
@@ -147,12 +228,12 @@ int suns_snprintf_value_sf_text(char *str, size_t size,
                                 suns_value_t *v);
 int suns_snprintf_value_sql(char *str, size_t size,
                             suns_value_t *v);
-int suns_device_text_fprintf(FILE *stream, suns_device_t *device);
+int suns_device_text_write(sink_t *sink, suns_device_t *device);
 void suns_attribute_fprintf(FILE *stream, suns_attribute_t *a, int offset);
 void suns_registers_fprintf(FILE * stream,
                             unsigned char *buf, size_t len,
                             char *line_prefix);
-void suns_binary_model_fprintf(FILE *stream, list_t *did_list,
+void suns_binary_model_fprintf(FILE *stream, suns_did_index_t *did_index,
                                unsigned char *buf, size_t len);
 void suns_model_xml_fprintf(FILE *stream, suns_model_t *model);
 int suns_model_xml_export_all(FILE *stream, char *type,
@@ -163,6 +244,12 @@ void suns_model_xml_dp_block_fprintf(FILE *stream,
 void suns_model_xml_dp_fprintf(FILE *stream,
                                suns_dp_t *dp,
                                int did);
+int suns_format_decimal(char *buf,
+                        size_t len,
+                        uint64_t x,
+                        int negative,
+                        int e,
+                        int maxdigits);
 int suns_snprintf_int_sf_e(char *buf,
                            size_t len,
                            int64_t x,
@@ -171,10 +258,6 @@ int suns_snprintf_uint_sf_e(char *buf,
                             size_t len,
                             uint64_t x,
                             int e);
-int suns_snprintf_uint_sf_e(char *buf,
-                            size_t len,
-                            uint64_t x,
-                            int e);
 int suns_snprintf_int_sf(char *buf,
                          size_t len,
                          int64_t x,
@@ -43,6 +43,7 @@
 #include "trx/macros.h"
 #include "trx/debug.h"
 #include "suns_model.h"
+#include "suns_columns.h"
 #include "suns_parser.h"
 #include "suns_output.h"
 #include "suns_output_sqlite.h"
@@ -507,9 +508,10 @@ int suns_output_sqlite_dataset(sqlite3 *db,
                                              &rowid, err)) < 0)
         return rc;
 
-    list_node_t *c;
-    list_for_each(ds->values, c) {
-        if ((rc = suns_output_sqlite_value(db, c->data,
+    suns_value_iter_t iter;
+    suns_value_t *v;
+    suns_dataset_for_each_value(ds, iter, v) {
+        if ((rc = suns_output_sqlite_value(db, v,
                                            ds->did->did, rowid, err)) < 0)
             break;
     }
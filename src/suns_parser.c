@@ -90,6 +90,25 @@ list_t *suns_get_did_list(void)
 
 }
 
+/* accessor for the global did index */
+suns_did_index_t *suns_get_did_index(void)
+{
+    return _sps.did_index;
+}
+
+
+/* add a did to the global did_list and did index
+
+   returns 0 on success, 1 if the did was already defined (the first
+   definition is kept in the index) or -1 on failure */
+int suns_parser_add_did(suns_model_did_t *did)
+{
+    list_node_add(_sps.did_list, list_node_new(did));
+
+    return suns_did_index_add(_sps.did_index, did);
+}
+
+
 /* accessor for global data_block_list */
 list_t *suns_get_data_block_list(void)
 {
@@ -113,6 +132,7 @@ void suns_parser_init(void)
 
     _sps.model_list = list_new();
     _sps.did_list = list_new();
+    _sps.did_index = suns_did_index_new();
     _sps.data_block_list = list_new();
     _sps.define_list = list_new();
 }
@@ -133,19 +153,11 @@ suns_dp_t * suns_model_find_dp_by_name(list_t *list, char *name)
 }
 
 
-/* linear search of a model's dp_block_list looking for *name */
+/* search a model's dp_block_list looking for *name, through the
+   model's index if it has one */
 suns_dp_t *suns_dp_find_in_model(suns_model_t *m, char *name)
 {
-    list_node_t *c;
-    list_for_each(m->dp_blocks, c) {
-        suns_dp_block_t *block = c->data;
-        suns_dp_t *dp = suns_model_find_dp_by_name(block->dp_list, name);
-        if (dp)
-            return dp;
-    }
-
-    /* not found */
-    return NULL;
+    return suns_search_model_for_dp_by_name(m, name, NULL);
 }
 
 
@@ -158,6 +170,7 @@ suns_dp_t *suns_dp_find_in_model(suns_model_t *m, char *name)
 int suns_parse_model_file(const char *file)
 {
     FILE *f;
+    int rc = 0;
 
     debug_s(file);
 
@@ -169,12 +182,13 @@ int suns_parse_model_file(const char *file)
     
     /* set up the yacc/bison globals and call yyparse */
     yyin = f;
-    yyparse();
+    if (yyparse() != 0)
+        rc = -1;
 
     /* close the file */
     fclose(yyin);
 
-    return 0;
+    return rc;
 }
 
 
@@ -211,6 +225,9 @@ suns_model_did_t *suns_parse_xml_model_elmt(ezxml_t model)
         list_node_add(did->model->dp_blocks, list_node_new(b));
     }
 
+    /* the strings, and the host parser, look points up by name */
+    suns_model_index_dps(did->model);
+
     return did;
 }
 
@@ -224,7 +241,7 @@ suns_model_did_t *suns_parse_xml_model_elmt(ezxml_t model)
  * suns_parse_xml_model_elmt().
  */ 
 suns_model_did_t *suns_parse_xml_strings_elmt(ezxml_t strings,
-                                              list_t *did_list)
+                                              suns_did_index_t *did_index)
 {
     int did_int;
 
@@ -245,7 +262,7 @@ suns_model_did_t *suns_parse_xml_strings_elmt(ezxml_t strings,
     }
 
     /* look up model */
-    suns_model_did_t *did = suns_find_did(did_list, did_int);
+    suns_model_did_t *did = suns_find_did(did_index, did_int);
     if (did == NULL) {
         /* skip this strings block - we haven't
            yet parsed the model it refers to */
@@ -340,7 +357,16 @@ int suns_parse_xml_model_file(const char *file)
         suns_model_did_t *did = suns_parse_xml_model_elmt(model);
         if (did) {
             /* models and did are 1:1 in the xml format */
-            list_node_add(sps->did_list, list_node_new(did));
+            int added = suns_parser_add_did(did);
+            if (added < 0) {
+                error("%s: can't add did %d to the did index",
+                      file, did->did);
+                rc = -1;
+                break;
+            }
+            if (added > 0)
+                error("%s: did %d is already defined; keeping the first "
+                      "definition", file, did->did);
             list_node_add(sps->model_list, list_node_new(did->model));
         }
     }
@@ -349,7 +375,7 @@ int suns_parse_xml_model_file(const char *file)
     for (strings = ezxml_child(x, "strings");
          strings; strings = strings->next) {
         /* parse strings element */
-        suns_parse_xml_strings_elmt(strings, sps->did_list);
+        suns_parse_xml_strings_elmt(strings, sps->did_index);
     }
 
     /* free the ezxml structure */
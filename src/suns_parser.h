@@ -58,6 +58,7 @@ typedef struct suns_parser_state {
        of the test data blocks */
     list_t *model_list;          /* all models */
     list_t *did_list;            /* index of all dids (dids > models) */
+    suns_did_index_t *did_index; /* the same dids, indexed by value */
     list_t *define_list;         /* global defines */
     list_t *data_block_list;     /* static test data blocks */
 } suns_parser_state_t;
@@ -80,6 +81,8 @@ suns_parser_state_t *suns_get_parser_state(void);
 /* accessors used to access the parsed suns model definition file */
 list_t *suns_get_model_list(void);
 list_t *suns_get_did_list(void);
+suns_did_index_t *suns_get_did_index(void);
+int suns_parser_add_did(suns_model_did_t *did);
 list_t *suns_get_data_block_list(void);
 list_t *suns_get_define_list(void);
 int suns_parse_xml_model_file(const char *file);
@@ -0,0 +1,1447 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * suns_poller.c
+ *
+ * concurrent polling of many modbus tcp devices
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ * The poller drives one modbus tcp session per device from a small
+ * number of worker threads.  Each worker owns a share of the device
+ * list and an epoll instance; sockets are non-blocking and every
+ * device is a small state machine that issues one read at a time:
+ *
+ *   CONNECTING -> SIGNATURE -> DISCOVER -> READ -> IDLE
+ *
+ * Discovery is skipped once a device's map is known.  A map loaded
+ * from the cache is checked first (VALIDATE) with the same single read
+ * of the signature and common model as the blocking client, and is
+ * discovered again if the device doesn't match it.  Decoding uses
+ * the same suns_map_decode() as the blocking client, so the results
+ * are the same suns_device_t datasets.
+ *
+ * libmodbus contexts are blocking, so the modbus tcp framing for
+ * function 0x03 is done here.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+
+#include "trx/macros.h"
+#include "trx/debug.h"
+#include "suns_model.h"
+#include "suns_map.h"
+#include "suns_changes.h"
+#include "suns_output.h"
+#include "suns_parser.h"
+#include "suns_poller.h"
+
+
+/* longest time a worker sleeps without checking poller->stop */
+#define SUNS_POLLER_TICK 100
+
+/* modbus exceptions */
+#define SUNS_MBTCP_ILLEGAL_ADDRESS 0x02
+#define SUNS_MBTCP_ILLEGAL_VALUE 0x03
+#define SUNS_MBTCP_ACKNOWLEDGE 0x05
+#define SUNS_MBTCP_BUSY 0x06
+
+
+/* a document every worker writes its devices into, when several
+   workers poll each device once.  devices are written and flushed one
+   at a time under the lock, so they stay whole and are counted in the
+   order they are written out. */
+typedef struct suns_poller_document {
+    pthread_mutex_t lock;
+    int n;             /* devices written so far */
+} suns_poller_document_t;
+
+
+typedef struct suns_poller_worker {
+    suns_poller_t *poller;
+    pthread_t thread;
+    int started;       /* thread was started */
+    int epfd;
+    suns_poller_device_t **devices;
+    int n_devices;
+    int next;          /* next device to start in this sweep */
+    int active;        /* devices with a poll in progress */
+    int keep_open;     /* keep connections open between sweeps */
+    int failures;      /* devices that failed in the last sweep */
+    sink_t *out;       /* output of the worker's devices, for stdout */
+    int documents;     /* the worker writes a document around each
+                          sweep (see suns_output_begin()) */
+    int n;             /* devices in the worker's document */
+    suns_poller_document_t *shared;  /* or the document is shared */
+} suns_poller_worker_t;
+
+
+/**
+ * build a read holding registers request.
+ *
+ * \param start first register, base address 0
+ *
+ * returns the length of the request in bytes
+ */
+int suns_mbtcp_read_request(unsigned char *buf, uint16_t tid, int unit,
+                            int start, int len)
+{
+    buf[0] = tid >> 8;
+    buf[1] = tid & 0xFF;
+    buf[2] = 0;              /* protocol id */
+    buf[3] = 0;
+    buf[4] = 0;              /* length of the remaining bytes */
+    buf[5] = 6;
+    buf[6] = unit;
+    buf[7] = SUNS_MBTCP_READ_HOLDING;
+    buf[8] = (start >> 8) & 0xFF;
+    buf[9] = start & 0xFF;
+    buf[10] = (len >> 8) & 0xFF;
+    buf[11] = len & 0xFF;
+
+    return SUNS_MBTCP_REQUEST_LEN;
+}
+
+
+/**
+ * find the length of the frame at the start of buf.
+ *
+ * returns the frame length in bytes, 0 if more bytes are needed to
+ * know it, or -1 if buf doesn't start with a valid frame
+ */
+int suns_mbtcp_frame_len(const unsigned char *buf, size_t len)
+{
+    int frame_len;
+
+    if (len < 6)
+        return 0;
+
+    if ((buf[2] != 0) || (buf[3] != 0))
+        return -1;
+
+    /* the length field counts the unit id and the pdu */
+    frame_len = 6 + ((buf[4] << 8) | buf[5]);
+    if ((frame_len < SUNS_MBTCP_HEADER_LEN + 2) ||
+        (frame_len > SUNS_MBTCP_MAX_ADU))
+        return -1;
+
+    return frame_len;
+}
+
+
+/**
+ * decode a complete response to a read holding registers request.
+ * registers are returned in host byte order, as libmodbus does.
+ *
+ * \param exception set to the modbus exception code, or 0
+ *
+ * returns the number of registers, or -1 on an exception or a
+ * malformed response
+ */
+int suns_mbtcp_read_response(const unsigned char *buf, size_t len,
+                             uint16_t *tid, uint16_t *regs, int max_regs,
+                             int *exception)
+{
+    int count;
+    int i;
+
+    *exception = 0;
+
+    if (suns_mbtcp_frame_len(buf, len) != len)
+        return -1;
+
+    *tid = (buf[0] << 8) | buf[1];
+
+    if (buf[7] == (SUNS_MBTCP_READ_HOLDING | 0x80)) {
+        *exception = buf[8];
+        return -1;
+    }
+
+    if ((buf[7] != SUNS_MBTCP_READ_HOLDING) ||
+        (buf[8] != len - 9) ||
+        (buf[8] % 2))
+        return -1;
+
+    count = buf[8] / 2;
+    if (count > max_regs)
+        return -1;
+
+    for (i = 0; i < count; i++) {
+        regs[i] = (buf[9 + (i * 2)] << 8) | buf[10 + (i * 2)];
+    }
+
+    return count;
+}
+
+
+/* monotonic milliseconds */
+static int64_t suns_poller_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((int64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+
+/* monotonic microseconds, for timing requests */
+static int64_t suns_poller_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((int64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+
+suns_poller_t *suns_poller_new(void)
+{
+    suns_poller_t *poller = malloc(sizeof(suns_poller_t));
+    if (poller == NULL) {
+        error("memory error: can't malloc(sizeof(suns_poller_t))");
+        return NULL;
+    }
+
+    memset(poller, 0, sizeof(suns_poller_t));
+
+    poller->devices = list_new();
+    poller->threads = 1;
+    poller->timeout = 2000;
+    poller->retries = 2;
+    poller->max_read = 125;
+    poller->pipeline = 1;
+    poller->output_fmt = "text";
+    poller->keyframe = -1;
+
+    return poller;
+}
+
+
+void suns_poller_free(suns_poller_t *poller)
+{
+    if (poller == NULL)
+        return;
+
+    list_free(poller->devices, (list_free_data_f) suns_poller_device_free);
+    free(poller);
+}
+
+
+suns_poller_device_t *suns_poller_device_new(const char *hostname,
+                                             int tcp_port, int addr)
+{
+    suns_poller_device_t *dev = malloc(sizeof(suns_poller_device_t));
+    if (dev == NULL) {
+        error("memory error: can't malloc(sizeof(suns_poller_device_t))");
+        return NULL;
+    }
+
+    memset(dev, 0, sizeof(suns_poller_device_t));
+
+    dev->hostname = strdup(hostname);
+    dev->tcp_port = tcp_port;
+    dev->addr = addr;
+    dev->fd = -1;
+    dev->state = SUNS_POLLER_IDLE;
+    dev->device = suns_device_new_with_arena();
+    if ((dev->hostname == NULL) || (dev->device == NULL)) {
+        error("memory error: can't allocate device %s", hostname);
+        suns_poller_device_free(dev);
+        return NULL;
+    }
+    dev->device->addr = addr;
+
+    return dev;
+}
+
+
+void suns_poller_device_free(suns_poller_device_t *dev)
+{
+    if (dev == NULL)
+        return;
+
+    if (dev->fd >= 0)
+        close(dev->fd);
+    suns_map_free(dev->map);
+    free(dev->reads);
+    free(dev->regs);
+    if (dev->device)
+        suns_device_free(dev->device);
+    free(dev->hostname);
+    free(dev->lid);
+    free(dev);
+}
+
+
+/* look up the address of a device once, when the list is loaded */
+static int suns_poller_resolve(suns_poller_device_t *dev)
+{
+    struct addrinfo hints;
+    struct addrinfo *res;
+    char port[16];
+    int rc;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof(port), "%d", dev->tcp_port);
+
+    rc = getaddrinfo(dev->hostname, port, &hints, &res);
+    if (rc != 0) {
+        error("can't resolve %s: %s", dev->hostname, gai_strerror(rc));
+        return -1;
+    }
+
+    memcpy(&(dev->sa), res->ai_addr, res->ai_addrlen);
+    dev->sa_len = res->ai_addrlen;
+    freeaddrinfo(res);
+
+    return 0;
+}
+
+
+/**
+ * add a device to the poller, looking up its address.
+ *
+ * returns the new device, or NULL on error
+ */
+suns_poller_device_t *suns_poller_add_device(suns_poller_t *poller,
+                                             const char *hostname,
+                                             int tcp_port, int addr)
+{
+    suns_poller_device_t *dev = suns_poller_device_new(hostname, tcp_port,
+                                                       addr);
+    if (dev == NULL)
+        return NULL;
+
+    dev->device->ns = poller->ns;
+    dev->device->columnar = suns_output_columnar(poller->output_fmt);
+    suns_link_init(&(dev->link), poller->max_read, poller->timeout);
+    if (poller->keyframe >= 0) {
+        dev->device->changes = suns_changes_new(poller->keyframe);
+        if (dev->device->changes == NULL) {
+            error("memory error: can't allocate change tracking for %s",
+                  hostname);
+            suns_poller_device_free(dev);
+            return NULL;
+        }
+    }
+
+    if (suns_poller_resolve(dev) < 0) {
+        suns_poller_device_free(dev);
+        return NULL;
+    }
+
+    /* start from the cached map and link, if there are any.  the map
+       is validated by the first poll, which discovers it again if the
+       device doesn't match (see suns_poller_start_read()) */
+    if (poller->map_cache_dir) {
+        char path[BIG_BUFFER_SIZE];
+        if (suns_map_cache_path(path, sizeof(path), poller->map_cache_dir,
+                                hostname, tcp_port, addr) == 0) {
+            dev->map = suns_map_load(path, &(dev->link));
+            if (dev->map)
+                verbose(1, "using cached map %s", path);
+        }
+    }
+
+    if (list_node_add(poller->devices, list_node_new(dev)) < 0) {
+        error("memory error: can't add device %s", hostname);
+        suns_poller_device_free(dev);
+        return NULL;
+    }
+
+    return dev;
+}
+
+
+/**
+ * load a device list.  each line names one device:
+ *
+ *   host[:port] [address [logger id]]
+ *
+ * blank lines and lines starting with '#' are ignored.  the port and
+ * modbus address default to default_port and default_addr.
+ *
+ * returns the number of devices loaded, or -1 on error
+ */
+int suns_poller_load_devices(suns_poller_t *poller, const char *path,
+                             int default_port, int default_addr)
+{
+    FILE *f;
+    char *line = NULL;
+    size_t line_size = 0;
+    int line_no = 0;
+    int count = 0;
+    int rc = 0;
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        error("can't open device list %s: %m", path);
+        return -1;
+    }
+
+    while (getline(&line, &line_size, f) >= 0) {
+        char host[256];
+        char lid[256];
+        int port = default_port;
+        int addr = default_addr;
+        char *colon;
+        int n;
+
+        line_no++;
+
+        lid[0] = '\0';
+        n = sscanf(line, " %255s %d %255s", host, &addr, lid);
+        if ((n <= 0) || (host[0] == '#'))
+            continue;
+
+        colon = strchr(host, ':');
+        if (colon) {
+            *colon = '\0';
+            if (sscanf(colon + 1, "%d", &port) != 1) {
+                error("%s:%d: bad port number: %s", path, line_no, colon + 1);
+                rc = -1;
+                continue;
+            }
+        }
+
+        suns_poller_device_t *dev = suns_poller_add_device(poller, host,
+                                                           port, addr);
+        if (dev == NULL) {
+            error("%s:%d: skipping device %s", path, line_no, host);
+            rc = -1;
+            continue;
+        }
+        if (lid[0]) {
+            dev->lid = strdup(lid);
+            dev->device->lid = dev->lid;
+        }
+        count++;
+    }
+
+    free(line);
+    fclose(f);
+
+    if ((rc < 0) && (count == 0))
+        return -1;
+
+    verbose(1, "loaded %d devices from %s", count, path);
+
+    return count;
+}
+
+
+static void suns_poller_close(suns_poller_device_t *dev)
+{
+    if (dev->fd >= 0) {
+        close(dev->fd);
+        dev->fd = -1;
+    }
+    dev->rx_len = 0;
+    dev->tx_len = 0;
+    dev->tx_sent = 0;
+}
+
+
+/* forget every request in flight; late responses will be dropped */
+static void suns_poller_clear_requests(suns_poller_device_t *dev)
+{
+    memset(dev->req, 0, sizeof(dev->req));
+    dev->in_flight = 0;
+}
+
+
+/* end the current poll of a device; rc < 0 if it failed */
+static void suns_poller_finish(suns_poller_worker_t *w,
+                               suns_poller_device_t *dev,
+                               int rc)
+{
+    suns_poller_t *poller = w->poller;
+
+    dev->state = SUNS_POLLER_IDLE;
+    w->active--;
+    suns_poller_clear_requests(dev);
+
+    if (rc < 0) {
+        /* shorter reads didn't help, so length wasn't the problem */
+        dev->link.max_read = dev->max_read;
+
+        error("failure while reading device %s:%d address %d",
+              dev->hostname, dev->tcp_port, dev->addr);
+        w->failures++;
+        suns_poller_close(dev);
+        return;
+    }
+
+    if (! w->keep_open)
+        suns_poller_close(dev);
+
+    /* only cache complete maps.  the cache also keeps what was
+       learned about the link, so save again when that changes. */
+    if ((dev->discovered || dev->link.changed) && poller->map_cache_dir &&
+        dev->map && dev->map_complete) {
+        char path[BIG_BUFFER_SIZE];
+        if ((suns_map_cache_path(path, sizeof(path), poller->map_cache_dir,
+                                 dev->hostname, dev->tcp_port,
+                                 dev->addr) == 0) &&
+            (suns_map_save(dev->map, &(dev->link), path) == 0)) {
+            verbose(1, "saved register map to %s", path);
+            dev->discovered = 0;
+        }
+    }
+
+    if (w->shared) {
+        pthread_mutex_lock(&(w->shared->lock));
+        suns_device_output_item(poller->output_fmt, dev->device,
+                                w->shared->n++, w->out);
+        sink_flush(w->out);
+        pthread_mutex_unlock(&(w->shared->lock));
+        return;
+    }
+
+    /* the sink is only written out between devices, so each device's
+       output stays together */
+    if (w->documents)
+        suns_device_output_item(poller->output_fmt, dev->device,
+                                w->n++, w->out);
+    else
+        suns_device_output(poller->output_fmt, dev->device, w->out);
+    sink_flush_full(w->out);
+}
+
+
+/* write as much of the pending requests as the socket will take */
+static int suns_poller_flush(suns_poller_worker_t *w,
+                             suns_poller_device_t *dev)
+{
+    struct epoll_event ev;
+    ssize_t n;
+
+    while (dev->tx_sent < dev->tx_len) {
+        n = send(dev->fd, dev->tx + dev->tx_sent,
+                 dev->tx_len - dev->tx_sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                break;
+            debug("send() failed: %m");
+            return -1;
+        }
+        dev->tx_sent += n;
+    }
+
+    /* only ask to hear about writability while there is more to send */
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    if (dev->tx_sent < dev->tx_len)
+        ev.events |= EPOLLOUT;
+    ev.data.ptr = dev;
+    epoll_ctl(w->epfd, EPOLL_CTL_MOD, dev->fd, &ev);
+
+    return 0;
+}
+
+
+/* queue (or requeue) a request with a new transaction id and send it */
+static int suns_poller_send(suns_poller_worker_t *w,
+                            suns_poller_device_t *dev,
+                            suns_poller_request_t *req)
+{
+    verbose(2, "%s:%d address %d: read register %d, length %d, try %d",
+            dev->hostname, dev->tcp_port, dev->addr,
+            req->start + 1, req->len, req->tries);
+
+    /* make room by dropping what has already been sent */
+    if (dev->tx_sent > 0) {
+        memmove(dev->tx, dev->tx + dev->tx_sent, dev->tx_len - dev->tx_sent);
+        dev->tx_len -= dev->tx_sent;
+        dev->tx_sent = 0;
+    }
+    if (dev->tx_len + SUNS_MBTCP_REQUEST_LEN > sizeof(dev->tx)) {
+        error("%s:%d is not accepting requests", dev->hostname,
+              dev->tcp_port);
+        return -1;
+    }
+
+    req->tid = ++(dev->tid);
+    dev->tx_len += suns_mbtcp_read_request(dev->tx + dev->tx_len, req->tid,
+                                           dev->addr, req->start, req->len);
+    req->plan = dev->plan;
+    req->waiting = 0;
+    req->sent = suns_poller_now_us();
+    req->deadline = suns_poller_now() + dev->link.timeout;
+
+    return suns_poller_flush(w, dev);
+}
+
+
+/**
+ * start a new request; start is base address 0 and read is the index
+ * of the planned read it fetches, if any.
+ *
+ * returns 0, or -1 if the poll of the device has failed
+ */
+static int suns_poller_request(suns_poller_worker_t *w,
+                               suns_poller_device_t *dev,
+                               int start, int len, int read)
+{
+    suns_poller_request_t *req = NULL;
+    int i;
+
+    for (i = 0; i < SUNS_POLLER_MAX_PIPELINE; i++) {
+        if (! dev->req[i].busy) {
+            req = &(dev->req[i]);
+            break;
+        }
+    }
+    if (req == NULL) {
+        error("too many requests in flight to %s:%d", dev->hostname,
+              dev->tcp_port);
+        suns_poller_finish(w, dev, -1);
+        return -1;
+    }
+
+    req->busy = 1;
+    req->start = start;
+    req->len = len;
+    req->read = read;
+    req->tries = 0;
+    req->waits = 0;
+    dev->in_flight++;
+
+    if (suns_poller_send(w, dev, req) < 0) {
+        suns_poller_finish(w, dev, -1);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static void suns_poller_release(suns_poller_device_t *dev,
+                                suns_poller_request_t *req)
+{
+    req->busy = 0;
+    dev->in_flight--;
+}
+
+
+/* places to look for the sunspec signature */
+static const int suns_poller_search_registers[] = { 40001, 1, 50001, 0x40001,
+                                                    -1 };
+
+/* try the next place the signature might be */
+static void suns_poller_next_signature(suns_poller_worker_t *w,
+                                       suns_poller_device_t *dev)
+{
+    int reg = suns_poller_search_registers[dev->step];
+
+    if (reg < 0) {
+        error("sunspec block not found on device %s:%d address %d",
+              dev->hostname, dev->tcp_port, dev->addr);
+        suns_poller_finish(w, dev, -1);
+        return;
+    }
+
+    dev->step++;
+    suns_poller_request(w, dev, reg - 1, 2, -1);
+}
+
+
+/* keep the pipeline full of planned reads */
+static void suns_poller_fill_reads(suns_poller_worker_t *w,
+                                   suns_poller_device_t *dev)
+{
+    int window = max(1, min(w->poller->pipeline, SUNS_POLLER_MAX_PIPELINE));
+
+    while ((dev->state == SUNS_POLLER_READ) &&
+           (dev->step < dev->n_reads) &&
+           (dev->in_flight < window)) {
+        suns_map_read_t *read = &(dev->reads[dev->step]);
+        if (suns_poller_request(w, dev,
+                                dev->map->base_register + read->offset - 1,
+                                read->len, dev->step) < 0)
+            return;
+        dev->step++;
+    }
+}
+
+
+static void suns_poller_discovered(suns_poller_worker_t *w,
+                                   suns_poller_device_t *dev);
+static void suns_poller_stale_map(suns_poller_worker_t *w,
+                                  suns_poller_device_t *dev);
+
+/* start reading the map, discovering it first if it isn't known */
+static void suns_poller_start_read(suns_poller_worker_t *w,
+                                   suns_poller_device_t *dev)
+{
+    if (dev->map == NULL) {
+        dev->map = suns_map_new();
+        if (dev->map == NULL) {
+            suns_poller_finish(w, dev, -1);
+            return;
+        }
+        dev->state = SUNS_POLLER_SIGNATURE;
+        dev->step = 0;
+        dev->discovered = 1;
+        dev->validated = 1;
+        suns_poller_next_signature(w, dev);
+        return;
+    }
+
+    /* a map loaded from the cache is checked with a single read of the
+       signature and the common model before it is trusted */
+    if (! dev->validated) {
+        int len = suns_map_validate_len(dev->map);
+        if (len < 0) {
+            verbose(1, "cached map has no common model to check");
+            suns_poller_stale_map(w, dev);
+            return;
+        }
+        dev->state = SUNS_POLLER_VALIDATE;
+        suns_poller_request(w, dev, dev->map->base_register - 1, len, -1);
+        return;
+    }
+
+    /* a map loaded from the cache hasn't been planned yet */
+    if (dev->regs == NULL) {
+        suns_poller_discovered(w, dev);
+        return;
+    }
+
+    dev->state = SUNS_POLLER_READ;
+    dev->step = 0;
+    dev->done = 0;
+    suns_poller_fill_reads(w, dev);
+}
+
+
+/* plan the reads of the map with the read size learned so far */
+static int suns_poller_plan(suns_poller_device_t *dev)
+{
+    free(dev->reads);
+    dev->plan++;
+    dev->n_reads = suns_map_plan_reads(dev->map, dev->link.max_read,
+                                       &(dev->reads));
+    if (dev->n_reads < 0) {
+        dev->reads = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* discovery is over; plan the reads of the map */
+static void suns_poller_discovered(suns_poller_worker_t *w,
+                                   suns_poller_device_t *dev)
+{
+    free(dev->regs);
+    dev->regs = NULL;
+
+    dev->map_complete = (suns_map_check(dev->map) == 0);
+
+    if (suns_poller_plan(dev) < 0) {
+        suns_poller_finish(w, dev, -1);
+        return;
+    }
+
+    dev->regs = malloc(sizeof(uint16_t) * suns_map_len(dev->map));
+    if (dev->regs == NULL) {
+        error("memory error: can't malloc() %d registers",
+              suns_map_len(dev->map));
+        suns_poller_finish(w, dev, -1);
+        return;
+    }
+
+    /* a map with no models has nothing to read */
+    if (dev->n_reads == 0) {
+        suns_poller_finish(w, dev, 0);
+        return;
+    }
+
+    suns_poller_start_read(w, dev);
+}
+
+
+/* a cached map doesn't describe the device; discover it instead */
+static void suns_poller_stale_map(suns_poller_worker_t *w,
+                                  suns_poller_device_t *dev)
+{
+    verbose(1, "cached map for %s:%d address %d is stale; rediscovering",
+            dev->hostname, dev->tcp_port, dev->addr);
+
+    suns_map_free(dev->map);
+    dev->map = NULL;
+
+    suns_poller_start_read(w, dev);
+}
+
+
+/* forget the map and datasets of a device and discover it again */
+static void suns_poller_rediscover(suns_poller_worker_t *w,
+                                   suns_poller_device_t *dev)
+{
+    warning("register map on %s:%d address %d has changed; rediscovering",
+            dev->hostname, dev->tcp_port, dev->addr);
+
+    suns_map_free(dev->map);
+    dev->map = NULL;
+    suns_device_free_datasets(dev->device);
+    dev->rediscovered = 1;
+
+    suns_poller_start_read(w, dev);
+}
+
+
+/* handle the response to a request, which has already been released;
+   count < 0 on failure */
+static void suns_poller_response(suns_poller_worker_t *w,
+                                 suns_poller_device_t *dev,
+                                 suns_poller_request_t *req,
+                                 uint16_t *regs, int count,
+                                 int exception)
+{
+    suns_parser_state_t *sps = suns_get_parser_state();
+    int rc;
+
+    if ((count >= 0) && (count != req->len)) {
+        error("%s:%d address %d: asked for %d registers, got %d",
+              dev->hostname, dev->tcp_port, dev->addr, req->len, count);
+        count = -1;
+    }
+
+    switch (dev->state) {
+    case SUNS_POLLER_VALIDATE:
+        if ((count >= 0) && (suns_map_validate(dev->map, regs) == 0)) {
+            verbose(1, "cached map for %s:%d address %d is valid",
+                    dev->hostname, dev->tcp_port, dev->addr);
+            dev->validated = 1;
+            suns_poller_start_read(w, dev);
+        } else {
+            suns_poller_stale_map(w, dev);
+        }
+        break;
+
+    case SUNS_POLLER_SIGNATURE:
+        if ((count == 2) &&
+            (regs[0] == SUNS_ID_HIGH) &&
+            (regs[1] == SUNS_ID_LOW)) {
+            dev->map->base_register = req->start + 1;
+            verbose(1, "found sunspec signature at register %d",
+                    dev->map->base_register);
+            if (dev->map->base_register == 0x40001)
+                error("sunspec block found at 0x40001, not decimal 40001!");
+            dev->state = SUNS_POLLER_DISCOVER;
+            dev->offset = 2;
+            suns_poller_request(w, dev,
+                                dev->map->base_register + dev->offset - 1,
+                                2, -1);
+        } else {
+            if (exception == SUNS_MBTCP_ILLEGAL_ADDRESS)
+                verbose(1, "illegal address exception when "
+                        "reading register %d", req->start + 1);
+            suns_poller_next_signature(w, dev);
+        }
+        break;
+
+    case SUNS_POLLER_DISCOVER:
+        rc = -1;
+        if (count == 2)
+            rc = suns_map_add_header(dev->map, sps->did_index,
+                                     dev->offset, regs);
+        if (rc == 0) {
+            /* jump ahead to next data block */
+            dev->offset += regs[1] + 2;
+            suns_poller_request(w, dev,
+                                dev->map->base_register + dev->offset - 1,
+                                2, -1);
+        } else if ((rc > 0) || (list_count(dev->map->models) > 0)) {
+            /* keep what we learned so the models found so far
+               can be read */
+            suns_poller_discovered(w, dev);
+        } else {
+            suns_poller_finish(w, dev, -1);
+        }
+        break;
+
+    case SUNS_POLLER_READ:
+        /* reads planned before the map was planned again */
+        if (req->plan != dev->plan)
+            break;
+
+        /* some devices answer reads longer than they support with an
+           exception, so plan shorter reads and start over */
+        if ((count < 0) &&
+            ((exception == SUNS_MBTCP_ILLEGAL_ADDRESS) ||
+             (exception == SUNS_MBTCP_ILLEGAL_VALUE)) &&
+            (suns_link_reject_read(&(dev->link), req->len) > 0)) {
+            if (suns_poller_plan(dev) < 0) {
+                suns_poller_finish(w, dev, -1);
+                break;
+            }
+            suns_poller_start_read(w, dev);
+            break;
+        }
+
+        if (count < 0) {
+            suns_poller_finish(w, dev, -1);
+            break;
+        }
+        memcpy(dev->regs + dev->reads[req->read].offset, regs,
+               sizeof(uint16_t) * count);
+        dev->done++;
+        if (dev->done < dev->n_reads) {
+            suns_poller_fill_reads(w, dev);
+            break;
+        }
+
+        rc = suns_map_decode(dev->map, sps->did_index, dev->regs,
+                             dev->device);
+        if ((rc == 1) && ! dev->rediscovered) {
+            suns_poller_rediscover(w, dev);
+            break;
+        }
+        suns_poller_finish(w, dev, rc == 0 ? 0 : -1);
+        break;
+
+    default:
+        break;
+    }
+}
+
+
+/* a request timed out; retry it or give up */
+static void suns_poller_timeout(suns_poller_worker_t *w,
+                                suns_poller_device_t *dev,
+                                suns_poller_request_t *req)
+{
+    suns_poller_request_t failed;
+
+    /* a device that answered busy is asked again once its wait is
+       over.  it did answer, so that is neither a try nor a reason to
+       back off the timeout */
+    if (req->waiting && (req->waits < SUNS_LINK_MAX_WAITS)) {
+        req->waits++;
+        if (suns_poller_send(w, dev, req) < 0)
+            suns_poller_finish(w, dev, -1);
+        return;
+    }
+
+    suns_link_timed_out(&(dev->link));
+
+    req->tries++;
+    if (req->tries < w->poller->retries) {
+        if (suns_poller_send(w, dev, req) < 0)
+            suns_poller_finish(w, dev, -1);
+        return;
+    }
+
+    error("modbus read timed out: register %d, length %d on %s:%d "
+          "address %d", req->start + 1, req->len,
+          dev->hostname, dev->tcp_port, dev->addr);
+
+    failed = *req;
+    suns_poller_release(dev, req);
+
+    /* the signature search moves on to the next place to look */
+    if (dev->state == SUNS_POLLER_SIGNATURE) {
+        suns_poller_next_signature(w, dev);
+        return;
+    }
+
+    suns_poller_response(w, dev, &failed, NULL, -1, 0);
+}
+
+
+/* start a non-blocking connect() */
+static int suns_poller_connect(suns_poller_worker_t *w,
+                               suns_poller_device_t *dev)
+{
+    struct epoll_event ev;
+    int one = 1;
+
+    dev->fd = socket(dev->sa.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (dev->fd < 0) {
+        error("socket() failed: %m");
+        return -1;
+    }
+    setsockopt(dev->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLOUT;
+    ev.data.ptr = dev;
+    if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, dev->fd, &ev) < 0) {
+        error("epoll_ctl() failed: %m");
+        return -1;
+    }
+
+    if ((connect(dev->fd, (struct sockaddr *) &(dev->sa), dev->sa_len) < 0) &&
+        (errno != EINPROGRESS)) {
+        error("can't connect to %s:%d: %m", dev->hostname, dev->tcp_port);
+        return -1;
+    }
+
+    dev->state = SUNS_POLLER_CONNECTING;
+    dev->deadline = suns_poller_now() + w->poller->timeout;
+
+    return 0;
+}
+
+
+/* start polling a device */
+static void suns_poller_begin(suns_poller_worker_t *w,
+                              suns_poller_device_t *dev)
+{
+    w->active++;
+
+    dev->rediscovered = 0;
+    dev->max_read = dev->link.max_read;
+    dev->rx_len = 0;
+    dev->device->unixtime = time(NULL);
+
+    if (dev->fd < 0) {
+        if (suns_poller_connect(w, dev) < 0)
+            suns_poller_finish(w, dev, -1);
+        return;
+    }
+
+    suns_poller_start_read(w, dev);
+}
+
+
+/* read what has arrived and handle any complete responses */
+static void suns_poller_receive(suns_poller_worker_t *w,
+                                suns_poller_device_t *dev)
+{
+    uint16_t regs[SUNS_MBTCP_MAX_ADU / 2];
+    suns_poller_request_t *req;
+    suns_poller_request_t answered;
+    uint16_t tid;
+    int exception;
+    int i;
+    int frame_len;
+    int count;
+    ssize_t n;
+
+    n = recv(dev->fd, dev->rx + dev->rx_len,
+             sizeof(dev->rx) - dev->rx_len, 0);
+    if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+        return;
+
+    if (n <= 0) {
+        if (dev->state == SUNS_POLLER_IDLE) {
+            /* the device hung up between polls */
+            debug("%s:%d closed the connection", dev->hostname,
+                  dev->tcp_port);
+            suns_poller_close(dev);
+        } else {
+            error("connection to %s:%d lost", dev->hostname, dev->tcp_port);
+            suns_poller_finish(w, dev, -1);
+        }
+        return;
+    }
+    dev->rx_len += n;
+
+    while ((frame_len = suns_mbtcp_frame_len(dev->rx, dev->rx_len)) != 0) {
+        if (frame_len < 0) {
+            error("bad modbus tcp frame from %s:%d",
+                  dev->hostname, dev->tcp_port);
+            if (dev->state == SUNS_POLLER_IDLE)
+                suns_poller_close(dev);
+            else
+                suns_poller_finish(w, dev, -1);
+            return;
+        }
+        if (frame_len > dev->rx_len)
+            return;
+
+        count = suns_mbtcp_read_response(dev->rx, frame_len, &tid,
+                                         regs, SUNS_MBTCP_MAX_ADU / 2,
+                                         &exception);
+
+        /* consume the frame */
+        memmove(dev->rx, dev->rx + frame_len, dev->rx_len - frame_len);
+        dev->rx_len -= frame_len;
+
+        /* late answers to requests we've already retried are dropped */
+        req = NULL;
+        if ((dev->state != SUNS_POLLER_IDLE) &&
+            (dev->state != SUNS_POLLER_CONNECTING)) {
+            for (i = 0; i < SUNS_POLLER_MAX_PIPELINE; i++) {
+                if (dev->req[i].busy && (dev->req[i].tid == tid)) {
+                    req = &(dev->req[i]);
+                    break;
+                }
+            }
+        }
+        if (req == NULL) {
+            debug("dropping response with transaction id %d", tid);
+            continue;
+        }
+
+        /* an answer to a retry could belong to any of the tries, so
+           only first tries are timed */
+        if (req->tries == 0)
+            suns_link_sample(&(dev->link),
+                             suns_poller_now_us() - req->sent);
+
+        if (exception)
+            verbose(1, "%s:%d address %d: modbus exception %d reading "
+                    "register %d", dev->hostname, dev->tcp_port, dev->addr,
+                    exception, req->start + 1);
+
+        /* a busy device is given one timeout to get ready before it is
+           asked again (see suns_poller_timeout()) */
+        if ((exception == SUNS_MBTCP_BUSY) ||
+            (exception == SUNS_MBTCP_ACKNOWLEDGE)) {
+            req->waiting = 1;
+            req->deadline = suns_poller_now() + dev->link.timeout;
+            continue;
+        }
+
+        answered = *req;
+        suns_poller_release(dev, req);
+        suns_poller_response(w, dev, &answered, regs, count, exception);
+
+        /* the response may have ended the session */
+        if (dev->fd < 0)
+            return;
+    }
+}
+
+
+/* handle epoll events for a device */
+static void suns_poller_event(suns_poller_worker_t *w,
+                              suns_poller_device_t *dev,
+                              uint32_t events)
+{
+    int err = 0;
+    socklen_t err_len = sizeof(err);
+
+    if (dev->state == SUNS_POLLER_CONNECTING) {
+        getsockopt(dev->fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+        if (err) {
+            error("can't connect to %s:%d: %s", dev->hostname,
+                  dev->tcp_port, strerror(err));
+            suns_poller_finish(w, dev, -1);
+            return;
+        }
+        verbose(1, "connected to %s:%d", dev->hostname, dev->tcp_port);
+        suns_poller_start_read(w, dev);
+        return;
+    }
+
+    if ((events & EPOLLOUT) && (dev->state != SUNS_POLLER_IDLE)) {
+        if (suns_poller_flush(w, dev) < 0) {
+            suns_poller_finish(w, dev, -1);
+            return;
+        }
+    }
+
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+        suns_poller_receive(w, dev);
+}
+
+
+/* start devices until the session limit is reached */
+static void suns_poller_fill(suns_poller_worker_t *w)
+{
+    while ((w->active < SUNS_POLLER_MAX_SESSIONS) &&
+           (w->next < w->n_devices)) {
+        suns_poller_begin(w, w->devices[w->next++]);
+    }
+}
+
+
+/* wait for events for at most timeout milliseconds and handle them */
+static void suns_poller_wait(suns_poller_worker_t *w, int timeout)
+{
+    struct epoll_event events[64];
+    int n;
+    int i;
+
+    if (timeout > SUNS_POLLER_TICK)
+        timeout = SUNS_POLLER_TICK;
+    if (timeout < 0)
+        timeout = 0;
+
+    n = epoll_wait(w->epfd, events, 64, timeout);
+    if ((n < 0) && (errno != EINTR))
+        error("epoll_wait() failed: %m");
+
+    for (i = 0; i < n; i++) {
+        suns_poller_device_t *dev = events[i].data.ptr;
+        if (dev->fd >= 0)
+            suns_poller_event(w, dev, events[i].events);
+    }
+}
+
+
+/* poll every device of the worker once */
+static void suns_poller_sweep(suns_poller_worker_t *w)
+{
+    suns_poller_t *poller = w->poller;
+    int64_t now;
+    int64_t first;
+    int i;
+    int j;
+
+    w->next = 0;
+    w->failures = 0;
+
+    if (w->documents) {
+        suns_output_begin(poller->output_fmt, w->out);
+        w->n = 0;
+    }
+
+    suns_poller_fill(w);
+
+    while ((w->active > 0) && ! *(poller->stop)) {
+        now = suns_poller_now();
+
+        /* handle expired requests, and find the next deadline */
+        first = now + SUNS_POLLER_TICK;
+        for (i = 0; i < w->next; i++) {
+            suns_poller_device_t *dev = w->devices[i];
+            if (dev->state == SUNS_POLLER_IDLE)
+                continue;
+            if (dev->state == SUNS_POLLER_CONNECTING) {
+                if (dev->deadline <= now) {
+                    error("timed out connecting to %s:%d",
+                          dev->hostname, dev->tcp_port);
+                    suns_poller_finish(w, dev, -1);
+                } else if (dev->deadline < first) {
+                    first = dev->deadline;
+                }
+                continue;
+            }
+            for (j = 0; j < SUNS_POLLER_MAX_PIPELINE; j++) {
+                suns_poller_request_t *req = &(dev->req[j]);
+                if (req->busy && (req->deadline <= now))
+                    suns_poller_timeout(w, dev, req);
+                if (req->busy && (req->deadline < first))
+                    first = req->deadline;
+            }
+        }
+
+        suns_poller_fill(w);
+
+        if (w->active > 0)
+            suns_poller_wait(w, first - now);
+    }
+
+    if (w->documents)
+        suns_output_end(poller->output_fmt, w->out);
+    sink_flush(w->out);
+}
+
+
+static void *suns_poller_worker(void *arg)
+{
+    suns_poller_worker_t *w = arg;
+    suns_poller_t *poller = w->poller;
+    int64_t next = suns_poller_now();
+    int64_t now;
+
+    while (! *(poller->stop)) {
+        suns_poller_sweep(w);
+
+        if (poller->interval <= 0)
+            break;
+
+        /* keep to the schedule, but don't try to catch up on
+           polls we've missed */
+        next += poller->interval;
+        now = suns_poller_now();
+        if (next < now)
+            next = now;
+
+        /* idle connections still need attention if a device hangs up */
+        while ((now < next) && ! *(poller->stop)) {
+            suns_poller_wait(w, next - now);
+            now = suns_poller_now();
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * poll every device in the device list, writing each device's datasets
+ * to stdout in poller->output_fmt.  devices are spread across
+ * poller->threads worker threads.  each worker buffers its output and
+ * writes it at the end of a sweep, or between devices once
+ * SINK_FLUSH_SIZE is waiting.
+ *
+ * formats whose documents hold many devices (see suns_output_begin())
+ * get one document per sweep with a single worker, and one document
+ * for the whole run when several workers poll each device once.
+ * several workers polling on an interval sweep on their own schedules,
+ * so each device is then a document of its own.
+ *
+ * if poller->interval is set devices are polled on that schedule until
+ * *poller->stop is set, otherwise each device is polled once.
+ *
+ * returns 0 if every device was read in the last sweep, or -1
+ */
+int suns_poller_run(suns_poller_t *poller)
+{
+    static volatile sig_atomic_t never = 0;
+    suns_poller_worker_t *workers;
+    suns_poller_document_t doc;
+    int n_devices = list_count(poller->devices);
+    int threads = poller->threads;
+    int failures = 0;
+    list_node_t *c;
+    int i;
+
+    if (n_devices <= 0) {
+        error("no devices to poll");
+        return -1;
+    }
+
+    if (poller->stop == NULL)
+        poller->stop = &never;
+    if (threads < 1)
+        threads = 1;
+    if (threads > n_devices)
+        threads = n_devices;
+
+    workers = malloc(sizeof(suns_poller_worker_t) * threads);
+    if (workers == NULL) {
+        error("memory error: can't malloc() %d workers", threads);
+        return -1;
+    }
+    memset(workers, 0, sizeof(suns_poller_worker_t) * threads);
+
+    /* deal the devices out to the workers */
+    for (i = 0; i < threads; i++) {
+        workers[i].poller = poller;
+        workers[i].devices = malloc(sizeof(suns_poller_device_t *) *
+                                    ((n_devices / threads) + 1));
+        workers[i].epfd = epoll_create1(0);
+        workers[i].out = sink_new_file(stdout);
+        if ((workers[i].devices == NULL) || (workers[i].epfd < 0) ||
+            (workers[i].out == NULL)) {
+            error("can't set up poller worker %d: %m", i);
+            threads = i + 1;
+            failures = -1;
+            goto out;
+        }
+    }
+    i = 0;
+    list_for_each(poller->devices, c) {
+        suns_poller_worker_t *w = &(workers[i++ % threads]);
+        w->devices[w->n_devices++] = c->data;
+    }
+    for (i = 0; i < threads; i++) {
+        workers[i].keep_open =
+            (workers[i].n_devices <= SUNS_POLLER_MAX_SESSIONS);
+        workers[i].documents = (threads == 1);
+        if ((threads > 1) && (poller->interval <= 0))
+            workers[i].shared = &doc;
+    }
+
+    verbose(1, "polling %d devices with %d threads", n_devices, threads);
+
+    if (threads == 1) {
+        suns_poller_worker(&(workers[0]));
+    } else {
+        /* the workers' devices all go in one document, which is
+           started and finished here while no worker is writing */
+        if (workers[0].shared) {
+            pthread_mutex_init(&(doc.lock), NULL);
+            doc.n = 0;
+            suns_output_begin(poller->output_fmt, workers[0].out);
+            sink_flush(workers[0].out);
+        }
+        for (i = 0; i < threads; i++) {
+            if (pthread_create(&(workers[i].thread), NULL,
+                               suns_poller_worker, &(workers[i])) == 0) {
+                workers[i].started = 1;
+            } else {
+                error("can't start poller thread %d", i);
+                /* run this share of the devices ourselves */
+                suns_poller_worker(&(workers[i]));
+            }
+        }
+        for (i = 0; i < threads; i++) {
+            if (workers[i].started)
+                pthread_join(workers[i].thread, NULL);
+        }
+        if (workers[0].shared) {
+            suns_output_end(poller->output_fmt, workers[0].out);
+            sink_flush(workers[0].out);
+            pthread_mutex_destroy(&(doc.lock));
+        }
+    }
+
+    for (i = 0; i < threads; i++) {
+        failures += workers[i].failures;
+    }
+
+ out:
+    for (i = 0; i < threads; i++) {
+        if (workers[i].epfd > 0)
+            close(workers[i].epfd);
+        sink_free(workers[i].out);
+        free(workers[i].devices);
+    }
+    free(workers);
+
+    if (failures != 0) {
+        if (failures > 0)
+            error("%d of %d devices could not be read", failures, n_devices);
+        return -1;
+    }
+
+    return 0;
+}
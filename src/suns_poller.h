@@ -0,0 +1,173 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * suns_poller.h
+ *
+ * concurrent polling of many modbus tcp devices
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef _SUNS_POLLER_H_
+#define _SUNS_POLLER_H_
+
+#include <stdint.h>
+#include <signal.h>
+#include <sys/socket.h>
+
+#include "trx/list.h"
+#include "suns_model.h"
+#include "suns_map.h"
+
+
+/* modbus tcp framing */
+#define SUNS_MBTCP_HEADER_LEN 7      /* mbap header, including unit id */
+#define SUNS_MBTCP_REQUEST_LEN 12    /* read holding registers request */
+#define SUNS_MBTCP_MAX_ADU 260
+#define SUNS_MBTCP_READ_HOLDING 0x03
+
+/* devices with a session open at once in each worker thread */
+#define SUNS_POLLER_MAX_SESSIONS 256
+
+/* most requests kept in flight on one connection */
+#define SUNS_POLLER_MAX_PIPELINE 16
+
+
+typedef enum suns_poller_state {
+    SUNS_POLLER_IDLE,         /* between polls */
+    SUNS_POLLER_CONNECTING,   /* waiting for connect() to finish */
+    SUNS_POLLER_VALIDATE,     /* checking a map loaded from the cache */
+    SUNS_POLLER_SIGNATURE,    /* searching for the sunspec signature */
+    SUNS_POLLER_DISCOVER,     /* walking the model headers */
+    SUNS_POLLER_READ,         /* reading the planned map */
+} suns_poller_state_t;
+
+
+/* a request in flight */
+typedef struct suns_poller_request {
+    int busy;
+    uint16_t tid;              /* modbus tcp transaction id */
+    int start;                 /* base address 0 */
+    int len;
+    int read;                  /* index into the planned reads */
+    int tries;
+    int waiting;               /* the device answered busy */
+    int waits;                 /* times it was asked again after that */
+    int plan;                  /* plan of the map the read belongs to */
+    int64_t sent;              /* monotonic microseconds, for timing */
+    int64_t deadline;          /* monotonic milliseconds */
+} suns_poller_request_t;
+
+
+/* one device in the device list, and its session state */
+typedef struct suns_poller_device {
+    char *hostname;
+    int tcp_port;
+    int addr;
+    char *lid;
+    struct sockaddr_storage sa;
+    socklen_t sa_len;
+
+    int fd;                    /* -1 when not connected */
+    suns_poller_state_t state;
+    suns_map_t *map;
+    suns_map_read_t *reads;    /* planned reads of the map */
+    int n_reads;
+    int plan;                  /* bumped each time the reads are planned */
+    uint16_t *regs;            /* register image of the map */
+    int step;                  /* signature candidate or next read */
+    int done;                  /* planned reads completed */
+    int offset;                /* model header being discovered */
+    int rediscovered;          /* map rediscovered during this poll */
+    int discovered;            /* map discovered and not saved yet */
+    int map_complete;          /* suns_map_check() found no gaps */
+    int validated;             /* map known to describe the device */
+    suns_link_t link;          /* read size and timeout learned */
+    int max_read;              /* link.max_read when this poll began */
+    suns_device_t *device;     /* datasets decoded by the last poll */
+
+    /* requests in flight, matched to responses by transaction id */
+    suns_poller_request_t req[SUNS_POLLER_MAX_PIPELINE];
+    int in_flight;
+    uint16_t tid;              /* last transaction id used */
+    int64_t deadline;          /* connect() deadline, monotonic ms */
+    unsigned char tx[SUNS_MBTCP_REQUEST_LEN * SUNS_POLLER_MAX_PIPELINE];
+    int tx_len;
+    int tx_sent;
+    unsigned char rx[SUNS_MBTCP_MAX_ADU];
+    int rx_len;
+} suns_poller_device_t;
+
+
+typedef struct suns_poller {
+    list_t *devices;           /* list of suns_poller_device_t */
+    int threads;
+    int timeout;               /* longest wait for a response, in
+                                  milliseconds */
+    int retries;               /* attempts at each request */
+    int max_read;              /* max registers in a single read */
+    int pipeline;              /* reads kept in flight per connection */
+    int interval;              /* poll interval in milliseconds, or 0 to
+                                  poll each device once */
+    char *output_fmt;
+    char *ns;
+    int keyframe;              /* only decode what changed between polls,
+                                  and everything every keyframe polls
+                                  (see suns_changes.h), or -1 */
+    char *map_cache_dir;       /* directory of cached register maps, or
+                                  NULL */
+    volatile sig_atomic_t *stop;  /* polling stops when set non-zero */
+} suns_poller_t;
+
+
+int suns_mbtcp_read_request(unsigned char *buf, uint16_t tid, int unit,
+                            int start, int len);
+int suns_mbtcp_frame_len(const unsigned char *buf, size_t len);
+int suns_mbtcp_read_response(const unsigned char *buf, size_t len,
+                             uint16_t *tid, uint16_t *regs, int max_regs,
+                             int *exception);
+
+suns_poller_t *suns_poller_new(void);
+void suns_poller_free(suns_poller_t *poller);
+suns_poller_device_t *suns_poller_device_new(const char *hostname,
+                                             int tcp_port, int addr);
+void suns_poller_device_free(suns_poller_device_t *dev);
+suns_poller_device_t *suns_poller_add_device(suns_poller_t *poller,
+                                             const char *hostname,
+                                             int tcp_port, int addr);
+int suns_poller_load_devices(suns_poller_t *poller, const char *path,
+                             int default_port, int default_addr);
+int suns_poller_run(suns_poller_t *poller);
+
+
+#endif /* _SUNS_POLLER_H_ */
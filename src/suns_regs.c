@@ -0,0 +1,350 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * suns_regs.c
+ *
+ * bulk conversion of modbus register blocks
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ * a model read from a device is a block of big-endian 16 bit
+ * registers.  rather than byte-swapping each datapoint as it is decoded
+ * and testing it against the not-implemented marker of its type, the
+ * whole block is swapped into host order in one pass, which also notes
+ * which registers hold 0x8000, 0xffff or 0x0000.  every marker is made
+ * of those, so a datapoint is then checked with a few bit tests.
+ *
+ * the pass is done 16 registers at a time with avx2 or 8 at a time
+ * with sse2 where the cpu has them, and one at a time otherwise.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <endian.h>
+
+#include "trx/macros.h"
+#include "trx/debug.h"
+#include "suns_model.h"
+#include "suns_regs.h"
+
+#ifdef SUNS_REGS_X86
+#include <immintrin.h>
+#endif
+
+
+/* load registers [start, n) one at a time */
+static void suns_regs_load_range(const unsigned char *buf, int start, int n,
+                                 uint16_t *regs, suns_regs_masks_t *masks)
+{
+    int i;
+
+    for (i = start; i < n; i++) {
+        uint16_t x;
+        uint8_t bit = 1 << (i & 7);
+
+        if ((i & 7) == 0) {
+            masks->min[i >> 3] = 0;
+            masks->max[i >> 3] = 0;
+            masks->zero[i >> 3] = 0;
+        }
+
+        memcpy(&x, buf + (i * 2), 2);
+        x = be16toh(x);
+        regs[i] = x;
+
+        if (x == 0x8000)
+            masks->min[i >> 3] |= bit;
+        else if (x == 0xffff)
+            masks->max[i >> 3] |= bit;
+        else if (x == 0x0000)
+            masks->zero[i >> 3] |= bit;
+    }
+}
+
+
+/**
+ * swap n big-endian registers in buf into host order in regs, and fill
+ * in masks (each suns_regs_mask_size(n) bytes long).
+ */
+void suns_regs_load_scalar(const unsigned char *buf, int n, uint16_t *regs,
+                           suns_regs_masks_t *masks)
+{
+    suns_regs_load_range(buf, 0, n, regs, masks);
+}
+
+
+#ifdef SUNS_REGS_X86
+
+int suns_regs_have_avx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+
+/* one mask bit for each of the 8 16 bit lanes of eq */
+__attribute__((target("sse2")))
+static inline uint8_t suns_regs_movemask_sse2(__m128i eq)
+{
+    return _mm_movemask_epi8(_mm_packs_epi16(eq, _mm_setzero_si128()));
+}
+
+
+__attribute__((target("sse2")))
+void suns_regs_load_sse2(const unsigned char *buf, int n, uint16_t *regs,
+                         suns_regs_masks_t *masks)
+{
+    const __m128i min = _mm_set1_epi16((short) 0x8000);
+    const __m128i max = _mm_set1_epi16((short) 0xffff);
+    const __m128i zero = _mm_setzero_si128();
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (buf + (i * 2)));
+
+        x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+        _mm_storeu_si128((__m128i *) (regs + i), x);
+
+        masks->min[i >> 3] = suns_regs_movemask_sse2(_mm_cmpeq_epi16(x, min));
+        masks->max[i >> 3] = suns_regs_movemask_sse2(_mm_cmpeq_epi16(x, max));
+        masks->zero[i >> 3] =
+            suns_regs_movemask_sse2(_mm_cmpeq_epi16(x, zero));
+    }
+
+    suns_regs_load_range(buf, i, n, regs, masks);
+}
+
+
+/* one mask bit for each of the 16 16 bit lanes of eq, stored in two
+   bytes at mask */
+__attribute__((target("avx2")))
+static inline void suns_regs_movemask_avx2(__m256i eq, uint8_t *mask)
+{
+    /* packing works within each 128 bit half, leaving the low half's
+       lanes in bits 0-7 of the byte mask and the high half's in bits
+       16-23 */
+    int m = _mm256_movemask_epi8(_mm256_packs_epi16(eq,
+                                                    _mm256_setzero_si256()));
+
+    mask[0] = m & 0xff;
+    mask[1] = (m >> 16) & 0xff;
+}
+
+
+__attribute__((target("avx2")))
+void suns_regs_load_avx2(const unsigned char *buf, int n, uint16_t *regs,
+                         suns_regs_masks_t *masks)
+{
+    const __m256i swap = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6,
+                                          9, 8, 11, 10, 13, 12, 15, 14,
+                                          1, 0, 3, 2, 5, 4, 7, 6,
+                                          9, 8, 11, 10, 13, 12, 15, 14);
+    const __m256i min = _mm256_set1_epi16((short) 0x8000);
+    const __m256i max = _mm256_set1_epi16((short) 0xffff);
+    const __m256i zero = _mm256_setzero_si256();
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (buf + (i * 2)));
+
+        x = _mm256_shuffle_epi8(x, swap);
+        _mm256_storeu_si256((__m256i *) (regs + i), x);
+
+        suns_regs_movemask_avx2(_mm256_cmpeq_epi16(x, min),
+                                masks->min + (i >> 3));
+        suns_regs_movemask_avx2(_mm256_cmpeq_epi16(x, max),
+                                masks->max + (i >> 3));
+        suns_regs_movemask_avx2(_mm256_cmpeq_epi16(x, zero),
+                                masks->zero + (i >> 3));
+    }
+
+    suns_regs_load_range(buf, i, n, regs, masks);
+}
+
+
+__attribute__((target("sse2")))
+static void suns_regs_htobe_sse2(uint16_t *dst, const uint16_t *src, int n)
+{
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (src + i));
+        x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+        _mm_storeu_si128((__m128i *) (dst + i), x);
+    }
+
+    for (; i < n; i++) {
+        dst[i] = htobe16(src[i]);
+    }
+}
+
+#endif /* SUNS_REGS_X86 */
+
+
+/* swap n registers, in host order, into modbus (big-endian) order */
+void suns_regs_htobe(uint16_t *dst, const uint16_t *src, int n)
+{
+    int i;
+
+#ifdef SUNS_REGS_X86
+    if (__builtin_cpu_supports("sse2")) {
+        suns_regs_htobe_sse2(dst, src, n);
+        return;
+    }
+#endif
+
+    for (i = 0; i < n; i++) {
+        dst[i] = htobe16(src[i]);
+    }
+}
+
+
+/* suns_regs_load_scalar() with the fastest kernel the cpu supports */
+void suns_regs_load(const unsigned char *buf, int n, uint16_t *regs,
+                    suns_regs_masks_t *masks)
+{
+#ifdef SUNS_REGS_X86
+    if (__builtin_cpu_supports("avx2")) {
+        suns_regs_load_avx2(buf, n, regs, masks);
+        return;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        suns_regs_load_sse2(buf, n, regs, masks);
+        return;
+    }
+#endif
+
+    suns_regs_load_scalar(buf, n, regs, masks);
+}
+
+
+/* the not-implemented rule for a type; see suns_check_not_implemented() */
+suns_ni_rule_t suns_ni_rule(suns_type_t type)
+{
+    switch (type) {
+    case SUNS_INT16:
+    case SUNS_SF:
+    case SUNS_INT32:
+    case SUNS_INT64:
+        return SUNS_NI_MIN;
+
+    case SUNS_UINT16:
+    case SUNS_ENUM16:
+    case SUNS_BITFIELD16:
+    case SUNS_UINT32:
+    case SUNS_ENUM32:
+    case SUNS_BITFIELD32:
+    case SUNS_UINT64:
+        return SUNS_NI_MAX;
+
+    case SUNS_IPV4:
+        return SUNS_NI_ZERO;
+
+    case SUNS_FLOAT32:
+    case SUNS_FLOAT64:
+        return SUNS_NI_NAN;
+
+    default:
+        return SUNS_NI_NONE;
+    }
+}
+
+
+/* the n_regs (1, 2 or 4) host order registers starting at r as one
+   value, most significant register first */
+uint64_t suns_regs_lane(const uint16_t *regs, int r, int n_regs)
+{
+    uint64_t x = 0;
+    int i;
+
+    for (i = 0; i < n_regs; i++) {
+        x = (x << 16) | regs[r + i];
+    }
+
+    return x;
+}
+
+
+/* returns 1 if the n_regs registers starting at r are the
+   not-implemented marker for rule */
+int suns_regs_not_implemented(suns_ni_rule_t rule,
+                              const uint16_t *regs,
+                              suns_regs_masks_t *masks,
+                              int r, int n_regs)
+{
+    int i;
+
+    switch (rule) {
+    case SUNS_NI_MIN:
+        if (! suns_regs_bit(masks->min, r))
+            return 0;
+        for (i = 1; i < n_regs; i++) {
+            if (! suns_regs_bit(masks->zero, r + i))
+                return 0;
+        }
+        return 1;
+
+    case SUNS_NI_MAX:
+        for (i = 0; i < n_regs; i++) {
+            if (! suns_regs_bit(masks->max, r + i))
+                return 0;
+        }
+        return 1;
+
+    case SUNS_NI_ZERO:
+        for (i = 0; i < n_regs; i++) {
+            if (! suns_regs_bit(masks->zero, r + i))
+                return 0;
+        }
+        return 1;
+
+    case SUNS_NI_NAN:
+        if (n_regs == 2) {
+            uint32_t u32 = suns_regs_lane(regs, r, 2);
+            float32_t f32;
+            memcpy(&f32, &u32, sizeof(f32));
+            return isnan(f32);
+        } else {
+            uint64_t u64 = suns_regs_lane(regs, r, 4);
+            float64_t f64;
+            memcpy(&f64, &u64, sizeof(f64));
+            return isnan(f64);
+        }
+
+    default:
+        return 0;
+    }
+}
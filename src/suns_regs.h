@@ -0,0 +1,100 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * suns_regs.h
+ *
+ * bulk conversion of modbus register blocks
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef _SUNS_REGS_H_
+#define _SUNS_REGS_H_
+
+#include <stdint.h>
+
+#include "suns_model.h"
+
+
+/* one bit per register, set for the register values that make up the
+   not-implemented markers of the sunspec types.  bit i of a mask is
+   (mask[i >> 3] >> (i & 7)) & 1. */
+typedef struct suns_regs_masks {
+    uint8_t *min;     /* register is 0x8000 */
+    uint8_t *max;     /* register is 0xffff */
+    uint8_t *zero;    /* register is 0x0000 */
+} suns_regs_masks_t;
+
+#define suns_regs_mask_size(n) (((n) + 7) / 8)
+#define suns_regs_bit(mask, i) (((mask)[(i) >> 3] >> ((i) & 7)) & 1)
+
+/* how a value of a given type is marked not implemented, in terms of
+   its registers.  see suns_check_not_implemented(). */
+typedef enum suns_ni_rule {
+    SUNS_NI_NONE = 0,   /* can't be (accumulators, pad, strings...) */
+    SUNS_NI_MIN,        /* 0x8000 followed by 0x0000s */
+    SUNS_NI_MAX,        /* every register 0xffff */
+    SUNS_NI_ZERO,       /* every register 0x0000 */
+    SUNS_NI_NAN,        /* a floating point nan */
+} suns_ni_rule_t;
+
+/* a block of registers loaded by suns_regs_load() */
+typedef struct suns_regs_block {
+    uint16_t *regs;             /* host order */
+    suns_regs_masks_t masks;
+    int n;
+} suns_regs_block_t;
+
+
+void suns_regs_htobe(uint16_t *dst, const uint16_t *src, int n);
+void suns_regs_load(const unsigned char *buf, int n, uint16_t *regs,
+                    suns_regs_masks_t *masks);
+void suns_regs_load_scalar(const unsigned char *buf, int n, uint16_t *regs,
+                           suns_regs_masks_t *masks);
+#if defined(__x86_64__) || defined(__i386__)
+#define SUNS_REGS_X86
+void suns_regs_load_sse2(const unsigned char *buf, int n, uint16_t *regs,
+                         suns_regs_masks_t *masks);
+void suns_regs_load_avx2(const unsigned char *buf, int n, uint16_t *regs,
+                         suns_regs_masks_t *masks);
+int suns_regs_have_avx2(void);
+#endif
+
+suns_ni_rule_t suns_ni_rule(suns_type_t type);
+uint64_t suns_regs_lane(const uint16_t *regs, int r, int n_regs);
+int suns_regs_not_implemented(suns_ni_rule_t rule,
+                              const uint16_t *regs,
+                              suns_regs_masks_t *masks,
+                              int r, int n_regs);
+
+#endif /* _SUNS_REGS_H_ */
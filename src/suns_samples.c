@@ -0,0 +1,346 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * suns_samples.c
+ *
+ * compact per-sample storage for decoded datasets
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trx/macros.h"
+#include "trx/debug.h"
+#include "suns_model.h"
+#include "suns_regs.h"
+#include "suns_samples.h"
+
+
+suns_samples_t *suns_samples_new(void)
+{
+    suns_samples_t *s = malloc(sizeof(suns_samples_t));
+    if (s == NULL) {
+        debug("malloc() failed");
+        return NULL;
+    }
+
+    memset(s, 0, sizeof(suns_samples_t));
+
+    return s;
+}
+
+
+void suns_samples_free(suns_samples_t *s)
+{
+    if (s == NULL)
+        return;
+
+    free(s->samples);
+    free(s->strings);
+    free(s->regs);
+    free(s);
+}
+
+
+/* grow *p to at least size bytes, keeping its contents */
+static int suns_samples_grow(void **p, size_t *cur, size_t size)
+{
+    void *new;
+
+    if (size <= *cur)
+        return 0;
+
+    new = realloc(*p, size);
+    if (new == NULL) {
+        error("memory error: can't realloc() %zd bytes", size);
+        return -1;
+    }
+    *p = new;
+    *cur = size;
+
+    return 0;
+}
+
+
+/* decode the step at buf (register r of block) into a sample.  a
+   string is copied to *str_off in the strings, which is advanced. */
+static void suns_sample_decode(suns_samples_t *s, int step_index,
+                               unsigned char *buf,
+                               suns_regs_block_t *block, int r,
+                               int index, size_t *str_off,
+                               suns_sample_t *sample)
+{
+    suns_decode_step_t *step = &(s->plan->steps[step_index]);
+    suns_value_t v;
+
+    sample->step = step_index;
+    sample->index = index;
+    sample->sf = 0;
+
+    /* most values come straight from the register lanes */
+    if (block && step->n_regs) {
+        uint64_t x = suns_regs_lane(block->regs, r, step->n_regs);
+        sample->value.u64 = 0;
+        if (step->n_regs == 1)
+            sample->value.u16 = x;
+        else if (step->n_regs == 2)
+            sample->value.u32 = x;
+        else
+            sample->value.u64 = x;
+        sample->meta = suns_regs_not_implemented(step->ni_rule, block->regs,
+                                                 &(block->masks), r,
+                                                 step->n_regs) ?
+            SUNS_VALUE_NOT_IMPLEMENTED : SUNS_VALUE_OK;
+        return;
+    }
+
+    memset(&v, 0, sizeof(suns_value_t));
+
+    /* give suns_buf_to_value() a string to copy into */
+    if (step->tp->type == SUNS_STRING) {
+        v.tp.type = SUNS_STRING;
+        v.tp.len = step->tp->len;
+        v.value.s = s->strings + *str_off;
+    }
+
+    suns_buf_to_value(buf, step->tp, &v);
+
+    sample->meta = v.meta;
+    if (step->tp->type == SUNS_STRING) {
+        sample->value.u64 = 0;
+        sample->value.str = *str_off;
+        *str_off += step->tp->len + 1;
+    } else {
+        sample->value.u64 = v.value.u64;
+    }
+}
+
+
+/**
+ * decode len bytes of model data (not including the did and length
+ * header) into samples, replacing what s held.  the non-repeating
+ * datapoints that fit come first, then each whole instance of the
+ * repeating block.  storage is reused and only grows.
+ *
+ * returns the number of samples, or -1 on a memory error.
+ */
+int suns_decode_samples(suns_decode_plan_t *plan,
+                        unsigned char *buf,
+                        size_t len,
+                        suns_samples_t *s)
+{
+    int n_repeat = plan->n_steps - plan->n_fixed;
+    int n_fixed = 0;
+    int count = 0;
+    size_t strings_len = 0;
+    size_t str_off = 0;
+    suns_regs_block_t regs_block;
+    suns_regs_block_t *block = NULL;
+    int n, i, j, k;
+
+    s->plan = plan;
+    s->count = 0;
+    s->n_fixed = 0;
+    s->names = NULL;
+
+    while ((n_fixed < plan->n_fixed) &&
+           (plan->steps[n_fixed].byte_offset +
+            plan->steps[n_fixed].size <= len))
+        n_fixed++;
+
+    if (n_fixed < plan->n_fixed) {
+        suns_decode_step_t *step = &(plan->steps[n_fixed]);
+        if (step->tp->type != SUNS_PAD) {
+            warning("%s offset %d defined in the model exceeds "
+                    "length of device data",
+                    step->dp->name, step->dp->offset);
+        }
+    } else if ((plan->repeat_len > 0) && (len > plan->fixed_bytes)) {
+        /* only whole instances */
+        count = (len - plan->fixed_bytes) / (plan->repeat_len * 2);
+        while ((count > 0) &&
+               (plan->fixed_bytes + (count * plan->repeat_bytes) > len))
+            count--;
+    }
+    n = n_fixed + (count * n_repeat);
+
+    for (i = 0; i < plan->n_steps; i++) {
+        if (plan->steps[i].tp->type != SUNS_STRING)
+            continue;
+        if (i < n_fixed)
+            strings_len += plan->steps[i].tp->len + 1;
+        else if (i >= plan->n_fixed)
+            strings_len += (plan->steps[i].tp->len + 1) * count;
+    }
+
+    if (n > s->capacity) {
+        size_t size = sizeof(suns_sample_t) * s->capacity;
+        int capacity = max(n, s->capacity * 2);
+        if (suns_samples_grow((void **) &(s->samples), &size,
+                              sizeof(suns_sample_t) * capacity) < 0)
+            return -1;
+        s->capacity = capacity;
+    }
+    if (suns_samples_grow((void **) &(s->strings), &(s->strings_size),
+                          strings_len) < 0)
+        return -1;
+
+    /* load the registers in one pass, as suns_decode_plan() does */
+    if (plan->lanes && (len >= 2)) {
+        int n_regs = len / 2;
+        int mask_size = suns_regs_mask_size(n_regs);
+        if (suns_samples_grow((void **) &(s->regs), &(s->regs_size),
+                              (sizeof(uint16_t) * n_regs) +
+                              (3 * mask_size)) < 0)
+            return -1;
+        regs_block.regs = s->regs;
+        regs_block.masks.min = (uint8_t *) (s->regs + n_regs);
+        regs_block.masks.max = regs_block.masks.min + mask_size;
+        regs_block.masks.zero = regs_block.masks.max + mask_size;
+        regs_block.n = n_regs;
+        suns_regs_load(buf, n_regs, regs_block.regs, &(regs_block.masks));
+        block = &regs_block;
+    }
+
+    if (count > 0) {
+        s->names = suns_decode_plan_names(plan, count);
+        if (s->names == NULL)
+            return -1;
+    }
+
+    k = 0;
+    for (i = 0; i < n_fixed; i++) {
+        int offset = plan->steps[i].byte_offset;
+        suns_sample_decode(s, i, buf + offset, block, offset / 2, 1,
+                           &str_off, &(s->samples[k++]));
+    }
+    for (j = 0; j < count; j++) {
+        for (i = plan->n_fixed; i < plan->n_steps; i++) {
+            int offset = plan->fixed_bytes + (j * plan->repeat_bytes) +
+                plan->steps[i].byte_offset;
+            suns_sample_decode(s, i, buf + offset, block, offset / 2, j + 1,
+                               &str_off, &(s->samples[k++]));
+        }
+    }
+    s->count = n;
+    s->n_fixed = n_fixed;
+
+    /* scale factors, bound to steps when the plan was compiled.  one in
+       the repeating block applies to its own instance. */
+    for (k = 0; k < n; k++) {
+        suns_sample_t *sample = &(s->samples[k]);
+        int sf_step = plan->steps[sample->step].sf_step;
+        int sf_k;
+
+        if (sf_step < 0)
+            continue;
+        if (sf_step < plan->n_fixed) {
+            if (sf_step >= n_fixed)
+                continue;  /* not in the data */
+            sf_k = sf_step;
+        } else {
+            sf_k = k - sample->step + sf_step;
+        }
+
+        if (s->samples[sf_k].meta == SUNS_VALUE_NOT_IMPLEMENTED) {
+            /* let suns_value_apply_sf() decide whether to complain */
+            suns_value_t v, sf;
+            suns_samples_get_value(s, k, &v);
+            suns_samples_get_value(s, sf_k, &sf);
+            suns_value_apply_sf(&v, &sf);
+            sample->sf = v.tp.sf;
+        } else {
+            sample->sf = s->samples[sf_k].value.i16;
+        }
+    }
+
+    return n;
+}
+
+
+/**
+ * fill in v with sample i, so the value formatting functions can be
+ * used on it.  v points into the samples and the decode plan, so it is
+ * only good until the next decode and must not be passed to
+ * suns_value_free().  the raw wire data isn't kept.
+ */
+void suns_samples_get_value(suns_samples_t *s, int i, suns_value_t *v)
+{
+    suns_sample_t *sample = &(s->samples[i]);
+    suns_decode_plan_t *plan = s->plan;
+    suns_decode_step_t *step = &(plan->steps[sample->step]);
+
+    memset(v, 0, sizeof(suns_value_t));
+
+    v->name = step->dp->name;
+    v->name_with_index = v->name;
+    if (sample->step >= plan->n_fixed) {
+        v->repeating = 1;
+        v->name_with_index =
+            s->names[((sample->index - 1) * (plan->n_steps - plan->n_fixed)) +
+                     (sample->step - plan->n_fixed)];
+    }
+    v->index = sample->index;
+    v->step = sample->step;
+    v->tp = *(step->tp);
+    v->tp.sf = sample->sf;
+    v->meta = sample->meta;
+    v->units = step->units;
+    v->label = step->label;
+
+    if (step->tp->type == SUNS_STRING)
+        v->value.s = s->strings + sample->value.str;
+    else
+        v->value.u64 = sample->value.u64;
+}
+
+
+/* a dataset that decodes into samples instead of the values list */
+suns_dataset_t *suns_dataset_new_samples(void)
+{
+    suns_dataset_t *d = suns_dataset_new();
+
+    if (d == NULL)
+        return NULL;
+
+    d->samples = suns_samples_new();
+    if (d->samples == NULL) {
+        suns_dataset_free(d);
+        return NULL;
+    }
+
+    return d;
+}
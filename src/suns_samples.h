@@ -0,0 +1,102 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * suns_samples.h
+ *
+ * compact per-sample storage for decoded datasets
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef _SUNS_SAMPLES_H_
+#define _SUNS_SAMPLES_H_
+
+#include <time.h>
+
+#include "suns_model.h"
+
+
+/* what changes from one read of a datapoint to the next.  everything
+   that is the same for every sample of a datapoint (names, type, units,
+   label) stays in the decode plan step it refers to, so a sample is 16
+   bytes where a suns_value_t and its list node are over 200. */
+typedef struct suns_sample {
+    union {
+        uint16_t u16;
+        uint32_t u32;
+        uint64_t u64;
+        int16_t i16;
+        int32_t i32;
+        int64_t i64;
+        float32_t f32;
+        float64_t f64;
+        uint32_t str;          /* offset of a string in strings */
+    } value;
+    uint16_t step;             /* the datapoint, a step of the plan */
+    uint16_t index;            /* repeat index, 1 based; 1 outside the
+                                  repeating block */
+    int16_t sf;                /* scale factor, or 0 */
+    uint8_t meta;              /* a suns_value_meta_t */
+} suns_sample_t;
+
+
+/* one read of a model as a dense array of samples, in the order
+   suns_decode_plan() would have listed the values.  the time of the
+   read belongs to every sample in it.  storage is kept from one decode
+   to the next and only grows. */
+typedef struct suns_samples {
+    suns_decode_plan_t *plan;  /* the samples refer to these steps */
+    suns_sample_t *samples;
+    int count;
+    int capacity;
+    int n_fixed;               /* samples from the non-repeating part */
+    char **names;              /* interned names, from the plan */
+    char *strings;             /* string values, NUL terminated */
+    size_t strings_size;
+    uint16_t *regs;            /* scratch for suns_regs_load() */
+    size_t regs_size;          /* in bytes */
+    time_t unixtime;
+    int usec;
+} suns_samples_t;
+
+
+suns_samples_t *suns_samples_new(void);
+void suns_samples_free(suns_samples_t *s);
+int suns_decode_samples(suns_decode_plan_t *plan,
+                        unsigned char *buf,
+                        size_t len,
+                        suns_samples_t *s);
+void suns_samples_get_value(suns_samples_t *s, int i, suns_value_t *v);
+suns_dataset_t *suns_dataset_new_samples(void);
+
+#endif /* _SUNS_SAMPLES_H_ */
@@ -0,0 +1,213 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * suns_symbols.c
+ *
+ * symbol tables for enum and bitfield datapoints
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trx/macros.h"
+#include "trx/debug.h"
+#include "suns_model.h"
+#include "suns_symbols.h"
+
+
+/**
+ * compile the defines in block into a table for a datapoint of the
+ * given type (an enum or a bitfield).
+ *
+ * an enum gets a direct table indexed by value if its values are close
+ * together, otherwise a table sorted by value.  a bitfield gets a table
+ * indexed by bit number, holding the define whose value is that bit
+ * alone; defines covering several bits are left out.  the first define
+ * of a value is the one found, as when searching the list.
+ *
+ * returns the table, or NULL on failure
+ */
+suns_symbols_t *suns_symbols_compile(suns_define_block_t *block,
+                                     suns_type_t type)
+{
+    suns_symbols_t *symbols;
+    list_node_t *c;
+    unsigned int lowest = 0, highest = 0;
+    int n = list_count(block->list);
+    int i;
+
+    symbols = malloc(sizeof(suns_symbols_t));
+    if (symbols == NULL) {
+        debug("malloc() failed");
+        return NULL;
+    }
+    memset(symbols, 0, sizeof(suns_symbols_t));
+    symbols->block = block;
+
+    if ((type == SUNS_BITFIELD16) || (type == SUNS_BITFIELD32)) {
+        symbols->kind = SUNS_SYMBOLS_BITS;
+        symbols->n = 32;
+    } else {
+        i = 0;
+        list_for_each(block->list, c) {
+            suns_define_t *define = c->data;
+            if ((i == 0) || (define->value < lowest))
+                lowest = define->value;
+            if ((i == 0) || (define->value > highest))
+                highest = define->value;
+            i++;
+        }
+
+        if ((n > 0) &&
+            ((highest - lowest) <
+             (unsigned int) max(SUNS_SYMBOLS_DIRECT_MIN, 4 * n))) {
+            symbols->kind = SUNS_SYMBOLS_DIRECT;
+            symbols->base = lowest;
+            symbols->n = (highest - lowest) + 1;
+        } else {
+            symbols->kind = SUNS_SYMBOLS_SORTED;
+            symbols->n = n;
+        }
+    }
+
+    symbols->table = calloc(symbols->n > 0 ? symbols->n : 1,
+                            sizeof(suns_define_t *));
+    if (symbols->table == NULL) {
+        debug("calloc() failed");
+        free(symbols);
+        return NULL;
+    }
+
+    i = 0;
+    list_for_each(block->list, c) {
+        suns_define_t *define = c->data;
+        int slot;
+
+        switch (symbols->kind) {
+        case SUNS_SYMBOLS_DIRECT:
+            slot = define->value - symbols->base;
+            if (symbols->table[slot] == NULL)
+                symbols->table[slot] = define;
+            break;
+
+        case SUNS_SYMBOLS_SORTED:
+            symbols->table[i++] = define;
+            break;
+
+        case SUNS_SYMBOLS_BITS:
+            if ((define->value == 0) ||
+                (define->value & (define->value - 1)))
+                break;
+            slot = __builtin_ctz(define->value);
+            if (symbols->table[slot] == NULL)
+                symbols->table[slot] = define;
+            break;
+        }
+    }
+
+    /* an insertion sort is stable, so the first define of a value
+       stays first */
+    if (symbols->kind == SUNS_SYMBOLS_SORTED) {
+        for (i = 1; i < symbols->n; i++) {
+            suns_define_t *define = symbols->table[i];
+            int j = i;
+            while ((j > 0) &&
+                   (symbols->table[j - 1]->value > define->value)) {
+                symbols->table[j] = symbols->table[j - 1];
+                j--;
+            }
+            symbols->table[j] = define;
+        }
+    }
+
+    return symbols;
+}
+
+
+void suns_symbols_free(suns_symbols_t *symbols)
+{
+    if (symbols == NULL)
+        return;
+
+    free(symbols->table);
+    free(symbols);
+}
+
+
+/* the define of an enum value, or NULL if the value has none */
+suns_define_t *suns_symbols_find(suns_symbols_t *symbols,
+                                 unsigned int value)
+{
+    int lo, hi;
+
+    switch (symbols->kind) {
+    case SUNS_SYMBOLS_DIRECT:
+        if ((value < symbols->base) ||
+            (value - symbols->base >= (unsigned int) symbols->n))
+            return NULL;
+        return symbols->table[value - symbols->base];
+
+    case SUNS_SYMBOLS_SORTED:
+        /* find the first entry not less than value */
+        lo = 0;
+        hi = symbols->n;
+        while (lo < hi) {
+            int mid = lo + ((hi - lo) / 2);
+            if (symbols->table[mid]->value < value)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if ((lo < symbols->n) && (symbols->table[lo]->value == value))
+            return symbols->table[lo];
+        return NULL;
+
+    case SUNS_SYMBOLS_BITS:
+        break;
+    }
+
+    return NULL;
+}
+
+
+/* the define of bit (0 to 31) of a bitfield, or NULL if it has none */
+suns_define_t *suns_symbols_bit(suns_symbols_t *symbols, int bit)
+{
+    if ((symbols->kind != SUNS_SYMBOLS_BITS) || (bit < 0) || (bit > 31))
+        return NULL;
+
+    return symbols->table[bit];
+}
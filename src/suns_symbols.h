@@ -0,0 +1,79 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * suns_symbols.h
+ *
+ * symbol tables for enum and bitfield datapoints
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef _SUNS_SYMBOLS_H_
+#define _SUNS_SYMBOLS_H_
+
+#include "suns_model.h"
+
+
+/* how a symbol table is laid out */
+typedef enum suns_symbols_kind {
+    SUNS_SYMBOLS_DIRECT = 0,   /* table[value - base], NULL for gaps */
+    SUNS_SYMBOLS_SORTED,       /* table sorted by value, for enums whose
+                                  values are too far apart for an array */
+    SUNS_SYMBOLS_BITS,         /* table[bit] for bits 0 to 31 */
+} suns_symbols_kind_t;
+
+/* the symbols of an enum or bitfield datapoint, compiled from its
+   define block when the model's decode plan is built, so output can
+   find a symbol without searching the define lists.  see
+   suns_type_pair_t.symbols. */
+typedef struct suns_symbols {
+    suns_symbols_kind_t kind;
+    suns_define_block_t *block;
+    unsigned int base;         /* value of table[0] in a direct table */
+    int n;                     /* entries in table */
+    suns_define_t **table;
+} suns_symbols_t;
+
+/* enums spanning no more than this many values, or a few times the
+   number of symbols, get a direct table */
+#define SUNS_SYMBOLS_DIRECT_MIN 64
+
+
+suns_symbols_t *suns_symbols_compile(suns_define_block_t *block,
+                                     suns_type_t type);
+void suns_symbols_free(suns_symbols_t *symbols);
+suns_define_t *suns_symbols_find(suns_symbols_t *symbols,
+                                 unsigned int value);
+suns_define_t *suns_symbols_bit(suns_symbols_t *symbols, int bit);
+
+#endif /* _SUNS_SYMBOLS_H_ */
@@ -49,14 +49,28 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <endian.h>
 #include <getopt.h>
+#include <ctype.h>
+#include <pthread.h>
 
 #include "trx/debug.h"
 #include "trx/macros.h"
 #include "suns_unit_tests.h"
 #include "suns_model.h"
+#include "suns_columns.h"
+#include "suns_view.h"
+#include "suns_regs.h"
+#include "suns_samples.h"
+#include "suns_symbols.h"
 #include "suns_output.h"
+#include "suns_parser.h"
+#include "suns_map.h"
+#include "suns_changes.h"
+#include "suns_bin.h"
+#include "suns_poller.h"
+#include "suns_bus.h"
 
 
 int test_getopt(int argc, char *argv[])
@@ -94,9 +108,28 @@ int main (int argc, char *argv[])
         unit_test_value_to_buf,
         unit_test_buf_to_value,
         unit_test_snprintf_suns_value_t,
+        unit_test_format_decimal,
         unit_test_type_name_conversion,
         unit_test_suns_value_meta_string,
         unit_test_suns_type_size,
+        unit_test_model_dp_index,
+        unit_test_did_index,
+        unit_test_decode_plan,
+        unit_test_columns,
+        unit_test_symbols,
+        unit_test_view,
+        unit_test_regs,
+        unit_test_samples,
+        unit_test_map_plan_reads,
+        unit_test_map_save_load,
+        unit_test_map_changes,
+        unit_test_bin,
+        unit_test_json,
+        unit_test_xml_stream,
+        unit_test_json_document,
+        unit_test_mbtcp_frames,
+        unit_test_bus_units,
+        unit_test_link,
         NULL,
     };
 
@@ -1209,6 +1242,132 @@ int unit_test_snprintf_suns_value_t(const char **name)
     return pass - total;
 }
 
+
+/* format x * 10^e the way suns_snprintf_int_sf() used to, through a
+   temporary string and _suns_snprintf_int_sf().  values in scientific
+   notation are built here instead, since _suns_snprintf_int_sf_e()
+   counts a '-' as a digit and writes "7." for a single digit. */
+static void test_format_reference(char *buf, size_t len, uint64_t x,
+                                  int negative, int e, int maxdigits)
+{
+    char base[BUFFER_SIZE];
+    char digits[BUFFER_SIZE];
+    int ndigits, numlen;
+
+    if (x == 0) {
+        strncpy(buf, "0", len);
+        return;
+    }
+    ndigits = snprintf(digits, sizeof(digits), "%" PRIu64, x);
+    numlen = ndigits + negative;
+    if ((e != 0) &&
+        ((numlen > maxdigits) || (numlen + abs(e) > maxdigits + 2))) {
+        if (negative)
+            *buf++ = '-';
+        *buf++ = digits[0];
+        if (ndigits > 1) {
+            *buf++ = '.';
+            strcpy(buf, digits + 1);
+            buf += ndigits - 1;
+        }
+        *buf = '\0';
+        if (e + ndigits - 1 != 0)
+            sprintf(buf, "e%d", e + ndigits - 1);
+        return;
+    }
+    base[0] = '-';
+    strcpy(base + negative, digits);
+    _suns_snprintf_int_sf(buf, len, base, e, maxdigits);
+}
+
+
+/* small deterministic generator, so a failure can be reproduced */
+static uint64_t test_xorshift(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+
+int unit_test_format_decimal(const char **name)
+{
+    *name = __FUNCTION__;
+
+    char buf[BUFFER_SIZE];
+    char ref[BUFFER_SIZE];
+    uint64_t state = 0x53756e53;
+    int i;
+    int mismatches = 0;
+
+    /* the edges of the range */
+    UNIT_ASSERT(suns_snprintf_int_sf(buf, sizeof(buf), 0, -3, 16) == 1);
+    UNIT_ASSERT(strcmp(buf, "0") == 0);
+    UNIT_ASSERT(suns_snprintf_int_sf(buf, sizeof(buf), 12345, 0, 16) == 5);
+    UNIT_ASSERT(strcmp(buf, "12345") == 0);
+    suns_snprintf_int_sf(buf, sizeof(buf), -12345, -2, 16);
+    UNIT_ASSERT(strcmp(buf, "-123.45") == 0);
+    suns_snprintf_int_sf(buf, sizeof(buf), -5, -3, 16);
+    UNIT_ASSERT(strcmp(buf, "-0.005") == 0);
+    suns_snprintf_uint_sf(buf, sizeof(buf), 1230, -4, 16);
+    UNIT_ASSERT(strcmp(buf, "0.1230") == 0);
+    suns_snprintf_uint_sf(buf, sizeof(buf), 42, 3, 16);
+    UNIT_ASSERT(strcmp(buf, "42000") == 0);
+    suns_snprintf_int_sf(buf, sizeof(buf), INT64_MIN, 0, 16);
+    UNIT_ASSERT(strcmp(buf, "-9223372036854775808") == 0);
+    suns_snprintf_int_sf(buf, sizeof(buf), INT64_MIN, -2, 16);
+    UNIT_ASSERT(strcmp(buf, "-9.223372036854775808e16") == 0);
+    suns_snprintf_uint_sf(buf, sizeof(buf), UINT64_MAX, -2, 16);
+    UNIT_ASSERT(strcmp(buf, "1.8446744073709551615e17") == 0);
+    suns_snprintf_uint_sf(buf, sizeof(buf), 1234, -20, 16);
+    UNIT_ASSERT(strcmp(buf, "1.234e-17") == 0);
+    suns_snprintf_uint_sf_e(buf, sizeof(buf), 1234, -3);
+    UNIT_ASSERT(strcmp(buf, "1.234") == 0);
+    suns_snprintf_int_sf_e(buf, sizeof(buf), -7, 2);
+    UNIT_ASSERT(strcmp(buf, "-7e2") == 0);
+    suns_snprintf_uint_sf_e(buf, sizeof(buf), 7, 0);
+    UNIT_ASSERT(strcmp(buf, "7") == 0);
+    suns_snprintf_int_sf(buf, sizeof(buf), -7, 30, 16);
+    UNIT_ASSERT(strcmp(buf, "-7e30") == 0);
+
+    /* a buffer that is too small is an error, not a truncation */
+    UNIT_ASSERT(suns_snprintf_int_sf(buf, 7, -12345, -2, 16) == -1);
+    UNIT_ASSERT(suns_snprintf_int_sf(buf, 8, -12345, -2, 16) == 7);
+
+    /* the string based routine is the reference */
+    for (i = 0; i < 100000; i++) {
+        uint64_t x = test_xorshift(&state);
+        int shift = test_xorshift(&state) % 64;
+        int negative = test_xorshift(&state) & 1;
+        int e = (int) (test_xorshift(&state) % 25) - 12;
+        int maxdigits = (i & 1) ? 16 : (int) (test_xorshift(&state) % 22);
+
+        /* cover every magnitude, not just the 19 and 20 digit ones */
+        x >>= shift;
+        if (negative && x > (uint64_t) INT64_MAX + 1)
+            x >>= 1;
+
+        test_format_reference(ref, sizeof(ref), x, negative, e, maxdigits);
+        if (negative)
+            suns_snprintf_int_sf(buf, sizeof(buf), -(int64_t) (x - 1) - 1,
+                                 e, maxdigits);
+        else
+            suns_snprintf_uint_sf(buf, sizeof(buf), x, e, maxdigits);
+
+        if (strcmp(buf, ref) != 0) {
+            debug("x = %s%" PRIu64 ", e = %d, maxdigits = %d: "
+                  "\"%s\" != \"%s\"", negative ? "-" : "", x, e, maxdigits,
+                  buf, ref);
+            mismatches++;
+        }
+    }
+    UNIT_ASSERT(mismatches == 0);
+
+    return 0;
+}
+
+
 int unit_test_type_name_conversion(const char **name)
 {
     *name = __FUNCTION__;
@@ -1339,3 +1498,2077 @@ int unit_test_suns_type_size(const char **name)
 }
 
 
+
+
+/* add a datapoint to a dp_block for unit_test_decode_plan() */
+static void test_dp_add(suns_dp_block_t *dp_block, char *name,
+                        suns_type_t type, char *sf_name)
+{
+    suns_dp_t *dp = suns_dp_new();
+
+    dp->name = name;
+    dp->type_pair = suns_type_pair_new();
+    dp->type_pair->type = type;
+    dp->type_pair->name = sf_name;
+    list_node_add(dp_block->dp_list, list_node_new(dp));
+}
+
+
+int unit_test_model_dp_index(const char **name)
+{
+    *name = __FUNCTION__;
+
+    suns_model_t *m = suns_model_new();
+    suns_dp_block_t *fixed = suns_dp_block_new();
+    suns_dp_block_t *repeating = suns_dp_block_new();
+    suns_dp_block_t *dp_block_ref;
+    suns_dp_t *dp, *found;
+
+    fixed->dp_list = list_new();
+    test_dp_add(fixed, "W", SUNS_INT16, "W_SF");
+    test_dp_add(fixed, "W_SF", SUNS_SF, NULL);
+    list_node_add(m->dp_blocks, list_node_new(fixed));
+    repeating->repeating = 1;
+    repeating->dp_list = list_new();
+    test_dp_add(repeating, "A", SUNS_UINT16, "A_SF");
+    test_dp_add(repeating, "A_SF", SUNS_SF, NULL);
+    test_dp_add(repeating, "W", SUNS_INT16, NULL);
+    list_node_add(m->dp_blocks, list_node_new(repeating));
+
+    /* searched without an index */
+    dp = suns_search_model_for_dp_by_name(m, "A_SF", &dp_block_ref);
+    UNIT_ASSERT((dp != NULL) && (dp_block_ref == repeating));
+
+    UNIT_ASSERT(suns_model_index_dps(m) == 0);
+    UNIT_ASSERT(hash_count(m->dp_index) == 4);
+
+    /* the index finds the same point and block */
+    found = suns_search_model_for_dp_by_name(m, "A_SF", &dp_block_ref);
+    UNIT_ASSERT((found == dp) && (dp_block_ref == repeating));
+    UNIT_ASSERT(suns_dp_find_in_model(m, "A_SF") == dp);
+
+    /* the first of two points with the same name, as a search would */
+    dp = suns_search_model_for_dp_by_name(m, "W", &dp_block_ref);
+    UNIT_ASSERT((dp == fixed->dp_list->head->data) &&
+                (dp_block_ref == fixed));
+
+    dp = suns_search_model_for_dp_by_name(m, "Hz", &dp_block_ref);
+    UNIT_ASSERT((dp == NULL) && (dp_block_ref == NULL));
+    UNIT_ASSERT(suns_dp_find_in_model(m, "Hz") == NULL);
+
+    UNIT_ASSERT(suns_check_scale_factors(m) == 0);
+
+    /* a fixed point can't use a scale factor of the repeating block */
+    ((suns_dp_t *) fixed->dp_list->head->data)->type_pair->name = "A_SF";
+    UNIT_ASSERT(suns_check_scale_factors(m) < 0);
+
+    /* indexing again picks up points added since */
+    test_dp_add(repeating, "Hz", SUNS_UINT16, NULL);
+    UNIT_ASSERT(suns_dp_find_in_model(m, "Hz") == NULL);
+    UNIT_ASSERT(suns_model_index_dps(m) == 0);
+    UNIT_ASSERT(suns_dp_find_in_model(m, "Hz") ==
+                repeating->dp_list->tail->data);
+
+    suns_model_free(m);
+
+    return 0;
+}
+
+
+/* ask the plan of unit_test_decode_plan() for more and more names,
+   as a thread decoding longer and longer devices would */
+static void *test_plan_names_thread(void *arg)
+{
+    suns_decode_plan_t *plan = arg;
+    char expected[16];
+    char **names;
+    int count;
+
+    for (count = 1; count <= 64; count++) {
+        names = suns_decode_plan_names(plan, count);
+        snprintf(expected, sizeof(expected), "A,%02d", count);
+        /* A and A_SF repeat */
+        if ((names == NULL) ||
+            (strcmp(names[(count - 1) * 2], expected) != 0))
+            return plan;
+    }
+
+    return NULL;
+}
+
+
+int unit_test_did_index(const char **name)
+{
+    *name = __FUNCTION__;
+
+    char path[] = "/tmp/suns_did_XXXXXX";
+    const char *xml =
+        "<sunSpecModels v=\"1\">\n"
+        "  <model id=\"64999\" len=\"1\" name=\"first\">\n"
+        "    <block len=\"1\">\n"
+        "      <point id=\"A\" offset=\"0\" type=\"uint16\" />\n"
+        "    </block>\n"
+        "  </model>\n"
+        "  <model id=\"64999\" len=\"2\" name=\"second\">\n"
+        "    <block len=\"2\">\n"
+        "      <point id=\"A\" offset=\"0\" type=\"uint32\" />\n"
+        "    </block>\n"
+        "  </model>\n"
+        "</sunSpecModels>\n";
+    suns_did_index_t *index = suns_did_index_new();
+    suns_model_did_t *a = suns_model_did_new(101);
+    suns_model_did_t *b = suns_model_did_new(0x1ff);
+    suns_model_did_t *again = suns_model_did_new(101);
+    suns_model_did_t *found;
+    suns_dp_t *dp;
+    FILE *f;
+    int fd;
+    int rc;
+
+    UNIT_ASSERT(index && a && b && again);
+    UNIT_ASSERT(suns_did_index_add(index, a) == 0);
+    UNIT_ASSERT(suns_did_index_add(index, b) == 0);
+    UNIT_ASSERT(index->count == 2);
+
+    /* hits, on the same page and another */
+    UNIT_ASSERT(suns_find_did(index, 101) == a);
+    UNIT_ASSERT(suns_find_did(index, 0x1ff) == b);
+
+    /* misses, on a page in use and on one that was never allocated */
+    UNIT_ASSERT(suns_find_did(index, 102) == NULL);
+    UNIT_ASSERT(suns_find_did(index, 0x100) == NULL);
+    UNIT_ASSERT(suns_find_did(index, 0xffff) == NULL);
+
+    /* a second definition is reported and the first one kept */
+    UNIT_ASSERT(suns_did_index_add(index, again) == 1);
+    UNIT_ASSERT(suns_find_did(index, 101) == a);
+    UNIT_ASSERT(index->count == 2);
+
+    suns_did_index_free(index);
+    free(a);
+    free(b);
+    free(again);
+
+    /* the same goes for a model file defining a did twice */
+    fd = mkstemp(path);
+    if (fd < 0) {
+        debug("mkstemp() failed: %m");
+        return -1;
+    }
+    f = fdopen(fd, "w");
+    UNIT_ASSERT(f != NULL);
+    fputs(xml, f);
+    fclose(f);
+
+    suns_parser_init();
+    rc = suns_parse_xml_model_file(path);
+    unlink(path);
+    UNIT_ASSERT(rc == 0);
+    found = suns_find_did(suns_get_did_index(), 64999);
+    UNIT_ASSERT(found != NULL);
+    dp = suns_search_model_for_dp_by_name(found->model, "A", NULL);
+    UNIT_ASSERT(dp != NULL);
+    UNIT_ASSERT(dp->type_pair->type == SUNS_UINT16);
+    UNIT_ASSERT(list_count(suns_get_model_list()) == 2);
+
+    return 0;
+}
+
+
+int unit_test_decode_plan(const char **name)
+{
+    *name = __FUNCTION__;
+
+    int i;
+    int rc;
+    list_node_t *c;
+    suns_model_t *m = suns_model_new();
+    suns_model_did_t *did = suns_model_did_new(999);
+    suns_did_index_t *did_index = suns_did_index_new();
+    suns_dp_block_t *fixed = suns_dp_block_new();
+    suns_dp_block_t *repeating = suns_dp_block_new();
+
+    fixed->dp_list = list_new();
+    test_dp_add(fixed, "W", SUNS_INT16, "W_SF");
+    test_dp_add(fixed, "W_SF", SUNS_SF, NULL);
+    list_node_add(m->dp_blocks, list_node_new(fixed));
+
+    repeating->repeating = 1;
+    repeating->dp_list = list_new();
+    test_dp_add(repeating, "A", SUNS_UINT16, "A_SF");
+    test_dp_add(repeating, "A_SF", SUNS_SF, NULL);
+    list_node_add(m->dp_blocks, list_node_new(repeating));
+
+    did->model = m;
+    suns_did_index_add(did_index, did);
+
+    suns_model_fill_offsets(m);
+    if (suns_model_compile_plan(m) < 0) {
+        debug("suns_model_compile_plan() failed");
+        return -1;
+    }
+
+    if ((m->plan->n_steps != 4) ||
+        (m->plan->n_fixed != 2) ||
+        (m->plan->repeat_len != 2)) {
+        debug("unexpected plan: n_steps %d, n_fixed %d, repeat_len %d",
+              m->plan->n_steps, m->plan->n_fixed, m->plan->repeat_len);
+        return -1;
+    }
+
+    /* did, length, then W, W_SF and two instances of A, A_SF */
+    uint16_t regs[] = { 999, 6, 1234, 0xffff, 10, 0, 20, 1 };
+    unsigned char buf[sizeof(regs)];
+    for (i = 0; i < sizeof(regs) / sizeof(uint16_t); i++) {
+        uint16_t be = htobe16(regs[i]);
+        memcpy(buf + (i * 2), &be, 2);
+    }
+
+    suns_dataset_t *data = suns_decode_data(did_index, buf, sizeof(buf));
+    if (data == NULL) {
+        debug("suns_decode_data() failed");
+        return -1;
+    }
+
+    struct {
+        char *name;
+        int index;
+        int repeating;
+        int sf;
+    } expected[] = {
+        { "W",    1, 0, -1 },
+        { "W_SF", 1, 0, 0 },
+        { "A",    1, 1, 0 },
+        { "A_SF", 1, 1, 0 },
+        { "A",    2, 1, 1 },
+        { "A_SF", 2, 1, 0 },
+    };
+
+    if (list_count(data->values) != 6) {
+        debug("decoded %d values, expected 6", list_count(data->values));
+        return -1;
+    }
+
+    i = 0;
+    list_for_each(data->values, c) {
+        suns_value_t *v = c->data;
+        if ((strcmp(v->name, expected[i].name) != 0) ||
+            (v->index != expected[i].index) ||
+            (v->repeating != expected[i].repeating) ||
+            (v->tp.sf != expected[i].sf)) {
+            debug("value %d: got %s index %d repeating %d sf %d",
+                  i, v->name, v->index, v->repeating, v->tp.sf);
+            return -1;
+        }
+        i++;
+    }
+
+    suns_dataset_free(data);
+
+    /* a not-implemented scale factor leaves its values with a scale
+       factor of 0 */
+    uint16_t ni = htobe16(0x8000);
+    memcpy(buf + 6, &ni, 2);
+    data = suns_decode_data(did_index, buf, sizeof(buf));
+    if (data == NULL) {
+        debug("suns_decode_data() failed");
+        return -1;
+    }
+
+    suns_value_t *w = data->values->head->data;
+    if ((w->tp.sf != 0) || (w->meta != SUNS_VALUE_OK)) {
+        debug("W with not-implemented W_SF: sf %d, meta %s",
+              w->tp.sf, suns_value_meta_string(w->meta));
+        return -1;
+    }
+
+    suns_dataset_free(data);
+
+    /* decoding into an arena gives the same values, and once the arena
+       is big enough decoding again doesn't grow it */
+    arena_t *arena = arena_new(256);
+    unsigned long mallocs = 0;
+    int pass;
+
+    for (pass = 0; pass < 2; pass++) {
+        arena_reset(arena);
+        data = suns_dataset_new_in(arena);
+        UNIT_ASSERT(data != NULL);
+        UNIT_ASSERT(suns_decode_dataset(did_index, buf, sizeof(buf),
+                                        data) == 0);
+        UNIT_ASSERT(list_count(data->values) == 6);
+
+        suns_value_t *a2 = data->values->tail->prev->data;
+        UNIT_ASSERT(strcmp(a2->name_with_index, "A,02") == 0);
+        UNIT_ASSERT(a2->tp.sf == 1);
+
+        if (pass == 0)
+            mallocs = arena->mallocs;
+    }
+    UNIT_ASSERT(arena->mallocs == mallocs);
+    arena_free(arena);
+
+    /* repeating block names are interned by the plan, and stay put
+       when a longer read grows the table */
+    data = suns_decode_data(did_index, buf, sizeof(buf));
+    UNIT_ASSERT(data != NULL);
+    w = data->values->head->data;
+    UNIT_ASSERT(w->name_with_index == w->name);
+    suns_value_t *a2 = data->values->tail->prev->data;
+    UNIT_ASSERT(a2->name_with_index == m->plan->names[2]);
+    char *a2_name = a2->name_with_index;
+    suns_dataset_free(data);
+
+    uint16_t regs3[] = { 999, 8, 1234, 0, 10, 0, 20, 1, 30, 0 };
+    unsigned char buf3[sizeof(regs3)];
+    for (i = 0; i < sizeof(regs3) / sizeof(uint16_t); i++) {
+        uint16_t be = htobe16(regs3[i]);
+        memcpy(buf3 + (i * 2), &be, 2);
+    }
+
+    data = suns_decode_data(did_index, buf3, sizeof(buf3));
+    UNIT_ASSERT(data != NULL);
+    UNIT_ASSERT(list_count(data->values) == 8);
+    UNIT_ASSERT(m->plan->n_names >= 3);
+    suns_value_t *a3 = data->values->tail->prev->data;
+    UNIT_ASSERT(strcmp(a3->name_with_index, "A,03") == 0);
+    a2 = data->values->tail->prev->prev->prev->data;
+    UNIT_ASSERT(a2->name_with_index == a2_name);
+    UNIT_ASSERT(strcmp(a2_name, "A,02") == 0);
+    suns_dataset_free(data);
+
+    /* threads decoding with the same plan grow the table together */
+    pthread_t threads[4];
+    void *thread_rc;
+    int failed = 0;
+
+    for (i = 0; i < 4; i++) {
+        rc = pthread_create(&(threads[i]), NULL, test_plan_names_thread,
+                            m->plan);
+        UNIT_ASSERT(rc == 0);
+    }
+    for (i = 0; i < 4; i++) {
+        pthread_join(threads[i], &thread_rc);
+        if (thread_rc != NULL)
+            failed++;
+    }
+    UNIT_ASSERT(failed == 0);
+    UNIT_ASSERT(m->plan->n_names >= 64);
+    UNIT_ASSERT(a2_name == m->plan->names[2]);
+
+    return 0;
+}
+
+
+/* render a dataset with the given output function into a string */
+static char *test_dataset_sprintf(suns_dataset_write_f f,
+                                  suns_dataset_t *data)
+{
+    char *out;
+    sink_t *sink = sink_new_memory(0);
+
+    if (sink == NULL)
+        return NULL;
+
+    f(sink, data);
+    out = strdup(sink_string(sink));
+    sink_free(sink);
+
+    return out;
+}
+
+
+int unit_test_columns(const char **name)
+{
+    *name = __FUNCTION__;
+
+    int i;
+    suns_model_t *m = suns_model_new();
+    suns_model_did_t *did = suns_model_did_new(998);
+    suns_did_index_t *did_index = suns_did_index_new();
+    suns_dp_block_t *fixed = suns_dp_block_new();
+    suns_dp_block_t *repeating = suns_dp_block_new();
+
+    fixed->dp_list = list_new();
+    test_dp_add(fixed, "Id", SUNS_STRING, NULL);
+    ((suns_dp_t *) fixed->dp_list->tail->data)->type_pair->len = 4;
+    test_dp_add(fixed, "I_SF", SUNS_SF, NULL);
+    list_node_add(m->dp_blocks, list_node_new(fixed));
+
+    repeating->repeating = 1;
+    repeating->dp_list = list_new();
+    test_dp_add(repeating, "I", SUNS_INT16, "I_SF");
+    test_dp_add(repeating, "V", SUNS_UINT16, "V_SF");
+    test_dp_add(repeating, "V_SF", SUNS_SF, NULL);
+    test_dp_add(repeating, "Acc", SUNS_ACC32, NULL);
+    list_node_add(m->dp_blocks, list_node_new(repeating));
+
+    did->model = m;
+    suns_did_index_add(did_index, did);
+
+    suns_model_fill_offsets(m);
+    UNIT_ASSERT(suns_model_compile_plan(m) == 0);
+
+    /* three instances of I, V, V_SF, Acc.  V and I are not implemented
+       in one instance each, and one V_SF is not implemented. */
+    uint16_t regs[] = { 998, 18, 0x6162, 0x6364, 0xffff,
+                        100, 0xffff, 0, 0, 7,
+                        0x8000, 240, 0x8000, 0, 0,
+                        0xfffb, 250, 1, 1, 0 };
+    unsigned char buf[sizeof(regs)];
+    for (i = 0; i < sizeof(regs) / sizeof(uint16_t); i++) {
+        uint16_t be = htobe16(regs[i]);
+        memcpy(buf + (i * 2), &be, 2);
+    }
+
+    suns_dataset_t *data = suns_dataset_new_columnar();
+    UNIT_ASSERT(data != NULL);
+    UNIT_ASSERT(suns_decode_dataset(did_index, buf, sizeof(buf), data) == 0);
+
+    suns_columns_t *cols = data->columns;
+    UNIT_ASSERT(list_count(data->values) == 2);
+    UNIT_ASSERT(cols->count == 3);
+    UNIT_ASSERT(cols->n_columns == 4);
+
+    suns_column_t *col_i = suns_columns_find(cols, "I");
+    suns_column_t *col_v = suns_columns_find(cols, "V");
+    suns_column_t *col_acc = suns_columns_find(cols, "Acc");
+    UNIT_ASSERT(col_i && col_v && col_acc);
+    UNIT_ASSERT(suns_columns_find(cols, "Id") == NULL);
+
+    /* columns are typed arrays in host byte order */
+    UNIT_ASSERT(((int16_t *) col_i->data)[0] == 100);
+    UNIT_ASSERT(((int16_t *) col_i->data)[2] == -5);
+    UNIT_ASSERT(suns_column_is_implemented(col_i, 0));
+    UNIT_ASSERT(! suns_column_is_implemented(col_i, 1));
+    UNIT_ASSERT(! suns_column_is_implemented(col_v, 0));
+    UNIT_ASSERT(suns_column_get_int(col_acc, 2) == 65536);
+
+    /* I_SF is shared, V_SF is per instance */
+    UNIT_ASSERT(col_i->sf_column < 0);
+    UNIT_ASSERT(suns_column_get_sf(cols, col_i, 2) == -1);
+    UNIT_ASSERT(suns_column_get_sf(cols, col_v, 1) == 0);
+    UNIT_ASSERT(suns_column_get_sf(cols, col_v, 2) == 1);
+
+    /* every output format sees the same values as from a list */
+    suns_dataset_t *list_data = suns_decode_data(did_index, buf, sizeof(buf));
+    UNIT_ASSERT(list_data != NULL);
+
+    suns_dataset_write_f formats[] = {
+        suns_dataset_text_write,
+        suns_dataset_xml_write,
+        suns_dataset_csv_write,
+        suns_dataset_sql_write,
+        suns_dataset_json_write,
+    };
+    int saved_verbose_level = verbose_level;
+    verbose_level = 1;  /* show scale factors and not-implemented values */
+    for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        char *from_list = test_dataset_sprintf(formats[i], list_data);
+        char *from_columns = test_dataset_sprintf(formats[i], data);
+        UNIT_ASSERT(from_list && from_columns);
+        if (strcmp(from_list, from_columns) != 0) {
+            debug("output %d differs:\n%s\n%s", i, from_list, from_columns);
+            verbose_level = saved_verbose_level;
+            return -1;
+        }
+        free(from_list);
+        free(from_columns);
+    }
+    verbose_level = saved_verbose_level;
+
+    /* a shorter read reuses the columns */
+    regs[1] = 13;
+    uint16_t be = htobe16(regs[1]);
+    memcpy(buf + 2, &be, 2);
+    int capacity = cols->capacity;
+    UNIT_ASSERT(suns_decode_dataset(did_index, buf, 30, data) == 0);
+    UNIT_ASSERT(cols->count == 2);
+    UNIT_ASSERT(cols->capacity == capacity);
+
+    suns_dataset_free(list_data);
+    suns_dataset_free(data);
+
+    return 0;
+}
+
+
+static void test_define_add(suns_define_block_t *block, char *name,
+                            unsigned int value)
+{
+    suns_define_t *d = suns_define_new();
+
+    d->name = name;
+    d->value = value;
+    list_node_add(block->list, list_node_new(d));
+}
+
+
+int unit_test_symbols(const char **name)
+{
+    *name = __FUNCTION__;
+
+    int i;
+    suns_model_t *m = suns_model_new();
+    suns_model_did_t *did = suns_model_did_new(993);
+    suns_did_index_t *did_index = suns_did_index_new();
+    suns_dp_block_t *fixed = suns_dp_block_new();
+    suns_define_block_t *small = suns_define_block_new();
+    suns_define_block_t *sparse = suns_define_block_new();
+    suns_define_block_t *bits = suns_define_block_new();
+    suns_symbols_t *symbols;
+
+    small->name = "small";
+    small->list = list_new();
+    test_define_add(small, "ZERO", 0);
+    test_define_add(small, "TWO", 2);
+    test_define_add(small, "ALSO_TWO", 2);
+    test_define_add(small, "THREE", 3);
+    list_node_add(m->defines, list_node_new(small));
+
+    sparse->name = "sparse";
+    sparse->list = list_new();
+    test_define_add(sparse, "BIG", 70000);
+    test_define_add(sparse, "FIVE", 5);
+    test_define_add(sparse, "HUGE", 1000000);
+    list_node_add(m->defines, list_node_new(sparse));
+
+    bits->name = "bits";
+    bits->list = list_new();
+    test_define_add(bits, "BIT_0", 0x0001);
+    test_define_add(bits, "BIT_3", 0x0008);
+    test_define_add(bits, "BITS_0_1", 0x0003);
+    test_define_add(bits, "BIT_15", 0x8000);
+    list_node_add(m->defines, list_node_new(bits));
+
+    fixed->dp_list = list_new();
+    test_dp_add(fixed, "E", SUNS_ENUM16, "small");
+    test_dp_add(fixed, "S", SUNS_ENUM32, "sparse");
+    test_dp_add(fixed, "B", SUNS_BITFIELD16, "bits");
+    list_node_add(m->dp_blocks, list_node_new(fixed));
+    did->model = m;
+    suns_did_index_add(did_index, did);
+
+    suns_model_fill_offsets(m);
+    UNIT_ASSERT(suns_model_compile_plan(m) == 0);
+
+    /* close values get an array, the first define of a value wins */
+    symbols = m->plan->steps[0].tp->symbols;
+    UNIT_ASSERT(symbols != NULL);
+    UNIT_ASSERT(symbols->kind == SUNS_SYMBOLS_DIRECT);
+    UNIT_ASSERT(strcmp(suns_symbols_find(symbols, 2)->name, "TWO") == 0);
+    UNIT_ASSERT(suns_symbols_find(symbols, 1) == NULL);
+    UNIT_ASSERT(suns_symbols_find(symbols, 4) == NULL);
+
+    /* far apart values are sorted */
+    symbols = m->plan->steps[1].tp->symbols;
+    UNIT_ASSERT(symbols->kind == SUNS_SYMBOLS_SORTED);
+    UNIT_ASSERT(strcmp(suns_symbols_find(symbols, 5)->name, "FIVE") == 0);
+    UNIT_ASSERT(strcmp(suns_symbols_find(symbols, 1000000)->name,
+                       "HUGE") == 0);
+    UNIT_ASSERT(suns_symbols_find(symbols, 6) == NULL);
+    UNIT_ASSERT(suns_symbols_find(symbols, 0) == NULL);
+    UNIT_ASSERT(suns_symbols_find(symbols, 2000000) == NULL);
+
+    /* bits that have a define of their own */
+    symbols = m->plan->steps[2].tp->symbols;
+    UNIT_ASSERT(symbols->kind == SUNS_SYMBOLS_BITS);
+    UNIT_ASSERT(strcmp(suns_symbols_bit(symbols, 3)->name, "BIT_3") == 0);
+    UNIT_ASSERT(suns_symbols_bit(symbols, 1) == NULL);
+    UNIT_ASSERT(suns_symbols_bit(symbols, 32) == NULL);
+
+    /* text output shows the symbols */
+    uint16_t regs[] = { 993, 4, 3, 0x0001, 0x1170, 0x800b };
+    unsigned char buf[sizeof(regs)];
+    for (i = 0; i < sizeof(regs) / sizeof(uint16_t); i++) {
+        uint16_t be = htobe16(regs[i]);
+        memcpy(buf + (i * 2), &be, 2);
+    }
+    suns_dataset_t *data = suns_decode_data(did_index, buf, sizeof(buf));
+    UNIT_ASSERT(data != NULL);
+    char *out = test_dataset_sprintf(suns_dataset_text_write, data);
+    UNIT_ASSERT(out != NULL);
+    UNIT_ASSERT(strstr(out, " THREE\n") != NULL);
+    UNIT_ASSERT(strstr(out, " BIG\n") != NULL);
+    UNIT_ASSERT(strstr(out, " BIT_0 BIT_3 BIT_15\n") != NULL);
+    free(out);
+    suns_dataset_free(data);
+
+    /* compiling the model again replaces the plan, tables included */
+    UNIT_ASSERT(suns_model_compile_plan(m) == 0);
+    symbols = m->plan->steps[0].tp->symbols;
+    UNIT_ASSERT(symbols != NULL);
+    UNIT_ASSERT(strcmp(suns_symbols_find(symbols, 2)->name, "TWO") == 0);
+    symbols = m->plan->steps[2].tp->symbols;
+    UNIT_ASSERT(symbols != NULL);
+    UNIT_ASSERT(strcmp(suns_symbols_bit(symbols, 3)->name, "BIT_3") == 0);
+    data = suns_decode_data(did_index, buf, sizeof(buf));
+    UNIT_ASSERT(data != NULL);
+    out = test_dataset_sprintf(suns_dataset_text_write, data);
+    UNIT_ASSERT(out != NULL);
+    UNIT_ASSERT(strstr(out, " BIT_0 BIT_3 BIT_15\n") != NULL);
+    free(out);
+    suns_dataset_free(data);
+
+    /* the tables go with the plan */
+    suns_type_pair_t *tp = m->plan->steps[0].tp;
+    suns_decode_plan_free(m->plan);
+    m->plan = NULL;
+    UNIT_ASSERT(tp->symbols == NULL);
+
+    return 0;
+}
+
+
+int unit_test_view(const char **name)
+{
+    *name = __FUNCTION__;
+
+    int i;
+    suns_value_t v;
+    suns_view_t view;
+    suns_model_t *m = suns_model_new();
+    suns_model_did_t *did = suns_model_did_new(997);
+    suns_did_index_t *did_index = suns_did_index_new();
+    suns_dp_block_t *fixed = suns_dp_block_new();
+    suns_dp_block_t *repeating = suns_dp_block_new();
+
+    fixed->dp_list = list_new();
+    test_dp_add(fixed, "W", SUNS_INT16, "W_SF");
+    test_dp_add(fixed, "W_SF", SUNS_SF, NULL);
+    test_dp_add(fixed, "St", SUNS_ENUM16, NULL);
+    test_dp_add(fixed, "Id", SUNS_STRING, NULL);
+    ((suns_dp_t *) fixed->dp_list->tail->data)->type_pair->len = 4;
+    list_node_add(m->dp_blocks, list_node_new(fixed));
+
+    repeating->repeating = 1;
+    repeating->dp_list = list_new();
+    test_dp_add(repeating, "A", SUNS_UINT16, "A_SF");
+    test_dp_add(repeating, "A_SF", SUNS_SF, NULL);
+    list_node_add(m->dp_blocks, list_node_new(repeating));
+
+    did->model = m;
+    suns_did_index_add(did_index, did);
+
+    suns_model_fill_offsets(m);
+    UNIT_ASSERT(suns_model_compile_plan(m) == 0);
+
+    uint16_t regs[] = { 997, 9, 1234, 0xfffe, 0xffff, 0x6162, 0x6364,
+                        10, 0, 20, 1 };
+    unsigned char buf[sizeof(regs)];
+    for (i = 0; i < sizeof(regs) / sizeof(uint16_t); i++) {
+        uint16_t be = htobe16(regs[i]);
+        memcpy(buf + (i * 2), &be, 2);
+    }
+
+    UNIT_ASSERT(suns_view_init(&view, did_index, buf, sizeof(buf)) == 0);
+    UNIT_ASSERT(view.count == 2);
+
+    /* step indexes are found once and work for any view of the model */
+    int w = suns_view_find(&view, "W");
+    int a = suns_view_find(&view, "A");
+    UNIT_ASSERT(w == 0);
+    UNIT_ASSERT(a == 4);
+    UNIT_ASSERT(suns_view_find(&view, "X") < 0);
+
+    UNIT_ASSERT(suns_view_get(&view, w, 0, &v) == 0);
+    UNIT_ASSERT(suns_value_get_int16(&v) == 1234);
+    UNIT_ASSERT(v.tp.sf == -2);
+    UNIT_ASSERT(v.meta == SUNS_VALUE_OK);
+
+    UNIT_ASSERT(suns_view_get_by_name(&view, "St", 0, &v) == 0);
+    UNIT_ASSERT(v.meta == SUNS_VALUE_NOT_IMPLEMENTED);
+
+    UNIT_ASSERT(suns_view_get_by_name(&view, "Id", 0, &v) == 0);
+    UNIT_ASSERT(strcmp(v.value.s, "abcd") == 0);
+
+    UNIT_ASSERT(suns_view_get(&view, a, 2, &v) == 0);
+    UNIT_ASSERT(suns_value_get_uint16(&v) == 20);
+    UNIT_ASSERT(v.tp.sf == 1);
+    UNIT_ASSERT(v.index == 2);
+    UNIT_ASSERT(strcmp(v.name_with_index, "A,02") == 0);
+
+    UNIT_ASSERT(suns_view_get(&view, a, 0, &v) < 0);
+    UNIT_ASSERT(suns_view_get(&view, a, 3, &v) < 0);
+    UNIT_ASSERT(suns_view_get_by_name(&view, "X", 0, &v) < 0);
+
+    /* the whole dataset from a view matches an eager decode */
+    suns_dataset_t *from_view = suns_dataset_new();
+    UNIT_ASSERT(suns_view_decode_dataset(&view, from_view) == 0);
+    suns_dataset_t *eager = suns_decode_data(did_index, buf, sizeof(buf));
+    UNIT_ASSERT(eager != NULL);
+
+    int saved_verbose_level = verbose_level;
+    verbose_level = 1;
+    char *text_view = test_dataset_sprintf(suns_dataset_text_write,
+                                           from_view);
+    char *text_eager = test_dataset_sprintf(suns_dataset_text_write,
+                                            eager);
+    verbose_level = saved_verbose_level;
+    UNIT_ASSERT(text_view && text_eager);
+    UNIT_ASSERT(strcmp(text_view, text_eager) == 0);
+    free(text_view);
+    free(text_eager);
+    suns_dataset_free(from_view);
+    suns_dataset_free(eager);
+    suns_view_clear(&view);
+
+    /* only whole instances that fit in the buffer are visible */
+    UNIT_ASSERT(suns_view_init(&view, did_index, buf, sizeof(buf) - 2) == 0);
+    UNIT_ASSERT(view.count == 1);
+    UNIT_ASSERT(suns_view_get(&view, a, 2, &v) < 0);
+    suns_view_clear(&view);
+
+    buf[0] = buf[1] = 0;  /* did 0 isn't known */
+    UNIT_ASSERT(suns_view_init(&view, did_index, buf, sizeof(buf)) < 0);
+
+    return 0;
+}
+
+
+static int test_regs_masks_equal(suns_regs_masks_t *a,
+                                 suns_regs_masks_t *b, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if ((suns_regs_bit(a->min, i) != suns_regs_bit(b->min, i)) ||
+            (suns_regs_bit(a->max, i) != suns_regs_bit(b->max, i)) ||
+            (suns_regs_bit(a->zero, i) != suns_regs_bit(b->zero, i))) {
+            debug("masks differ at register %d", i);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+int unit_test_regs(const char **name)
+{
+    *name = __FUNCTION__;
+
+    int i, n;
+    int round;
+    list_node_t *c;
+    uint16_t markers[] = { 0x8000, 0xffff, 0x0000, 0x7fc0, 0xfff8 };
+    unsigned char buf[2 * 301];
+    uint16_t regs[301], expect[301];
+    uint8_t min[2][suns_regs_mask_size(301)];
+    uint8_t max[2][suns_regs_mask_size(301)];
+    uint8_t zero[2][suns_regs_mask_size(301)];
+    suns_regs_masks_t masks = { min[0], max[0], zero[0] };
+    suns_regs_masks_t scalar = { min[1], max[1], zero[1] };
+
+    srand(15);
+    for (i = 0; i < sizeof(buf); i += 2) {
+        uint16_t r = rand();
+        if ((rand() & 3) == 0)
+            r = markers[rand() % (sizeof(markers) / sizeof(uint16_t))];
+        buf[i] = r >> 8;
+        buf[i + 1] = r & 0xff;
+    }
+
+    /* every kernel agrees with the scalar one on every length, so the
+       vector loops and their tails are both covered */
+    for (n = 0; n <= 301; n++) {
+        memset(min, 0xaa, sizeof(min));
+        memset(max, 0xaa, sizeof(max));
+        memset(zero, 0xaa, sizeof(zero));
+        suns_regs_load_scalar(buf, n, expect, &scalar);
+        for (i = 0; i < n; i++) {
+            UNIT_ASSERT(expect[i] == ((buf[i * 2] << 8) | buf[i * 2 + 1]));
+            UNIT_ASSERT(suns_regs_bit(scalar.min, i) ==
+                        (expect[i] == 0x8000));
+            UNIT_ASSERT(suns_regs_bit(scalar.max, i) ==
+                        (expect[i] == 0xffff));
+            UNIT_ASSERT(suns_regs_bit(scalar.zero, i) ==
+                        (expect[i] == 0x0000));
+        }
+
+        suns_regs_load(buf, n, regs, &masks);
+        UNIT_ASSERT(memcmp(regs, expect, n * 2) == 0);
+        UNIT_ASSERT(test_regs_masks_equal(&masks, &scalar, n));
+
+#ifdef SUNS_REGS_X86
+        suns_regs_load_sse2(buf, n, regs, &masks);
+        UNIT_ASSERT(memcmp(regs, expect, n * 2) == 0);
+        UNIT_ASSERT(test_regs_masks_equal(&masks, &scalar, n));
+
+        if (suns_regs_have_avx2()) {
+            suns_regs_load_avx2(buf, n, regs, &masks);
+            UNIT_ASSERT(memcmp(regs, expect, n * 2) == 0);
+            UNIT_ASSERT(test_regs_masks_equal(&masks, &scalar, n));
+        }
+#endif
+
+        /* and back to modbus byte order */
+        suns_regs_htobe(regs, expect, n);
+        UNIT_ASSERT(memcmp(regs, buf, n * 2) == 0);
+    }
+
+    /* a model of every numeric type decodes the same through the
+       register lanes as through suns_buf_to_value() */
+    suns_type_t types[] = {
+        SUNS_INT16, SUNS_UINT16, SUNS_ACC16, SUNS_INT32, SUNS_UINT32,
+        SUNS_FLOAT32, SUNS_ACC32, SUNS_INT64, SUNS_UINT64, SUNS_FLOAT64,
+        SUNS_ACC64, SUNS_ENUM16, SUNS_ENUM32, SUNS_BITFIELD16,
+        SUNS_BITFIELD32, SUNS_SF, SUNS_IPV4,
+    };
+    int n_types = sizeof(types) / sizeof(suns_type_t);
+    suns_model_t *m = suns_model_new();
+    suns_model_did_t *did = suns_model_did_new(996);
+    suns_did_index_t *did_index = suns_did_index_new();
+    suns_dp_block_t *fixed = suns_dp_block_new();
+    int len = 0;
+
+    fixed->dp_list = list_new();
+    for (i = 0; i < n_types; i++) {
+        test_dp_add(fixed, suns_type_string(types[i]), types[i],
+                    NULL);
+        len += suns_type_size(types[i]) / 2;
+    }
+    list_node_add(m->dp_blocks, list_node_new(fixed));
+    did->model = m;
+    suns_did_index_add(did_index, did);
+    suns_model_fill_offsets(m);
+    UNIT_ASSERT(suns_model_compile_plan(m) == 0);
+    UNIT_ASSERT(m->plan->lanes);
+
+    unsigned char model_buf[(len + 2) * 2];
+    uint16_t nan32[] = { 0x7fc0, 0x0000 };
+    uint16_t nan64[] = { 0x7ff8, 0x0000, 0x0000, 0x0001 };
+
+    for (round = 0; round < 64; round++) {
+        int r = 2;
+
+        model_buf[0] = 996 >> 8;
+        model_buf[1] = 996 & 0xff;
+        model_buf[2] = 0;
+        model_buf[3] = len;
+        for (i = 0; i < n_types; i++) {
+            int k;
+            int size = suns_type_size(types[i]) / 2;
+            int pick = (round + i) & 7;
+            for (k = 0; k < size; k++) {
+                uint16_t reg = rand();
+                if (pick == 1)
+                    reg = (k == 0) ? 0x8000 : 0x0000;
+                else if (pick == 2)
+                    reg = 0xffff;
+                else if (pick == 3)
+                    reg = 0x0000;
+                else if ((pick == 4) && (size == 2))
+                    reg = nan32[k];
+                else if ((pick == 4) && (size == 4))
+                    reg = nan64[k];
+                else if (pick == 5)
+                    reg = (k == 0) ? 0x8000 : 0x0001;
+                model_buf[(r + k) * 2] = reg >> 8;
+                model_buf[(r + k) * 2 + 1] = reg & 0xff;
+            }
+            r += size;
+        }
+
+        suns_dataset_t *data = suns_decode_data(did_index, model_buf,
+                                                sizeof(model_buf));
+        UNIT_ASSERT(data != NULL);
+
+        i = 0;
+        r = 2;
+        list_for_each(data->values, c) {
+            suns_value_t *v = c->data;
+            suns_value_t expect_v;
+            int size = suns_type_size(types[i]);
+
+            memset(&expect_v, 0, sizeof(expect_v));
+            UNIT_ASSERT(suns_buf_to_value(model_buf + (r * 2),
+                                          &(v->tp), &expect_v) == 0);
+            if (v->meta != expect_v.meta) {
+                debug("%s: meta %d, expected %d", v->name,
+                      v->meta, expect_v.meta);
+                return 1;
+            }
+            UNIT_ASSERT(memcmp(&(v->value), &(expect_v.value), size) == 0);
+            UNIT_ASSERT(v->raw_len == expect_v.raw_len);
+            UNIT_ASSERT(memcmp(v->raw, expect_v.raw, v->raw_len) == 0);
+            r += size / 2;
+            i++;
+        }
+        UNIT_ASSERT(i == n_types);
+        suns_dataset_free(data);
+    }
+
+    return 0;
+}
+
+
+int unit_test_samples(const char **name)
+{
+    *name = __FUNCTION__;
+
+    int i;
+    suns_value_t v;
+    suns_model_t *m = suns_model_new();
+    suns_model_did_t *did = suns_model_did_new(995);
+    suns_did_index_t *did_index = suns_did_index_new();
+    suns_dp_block_t *fixed = suns_dp_block_new();
+    suns_dp_block_t *repeating = suns_dp_block_new();
+
+    /* small enough to keep hours of them in memory */
+    UNIT_ASSERT(sizeof(suns_sample_t) == 16);
+
+    fixed->dp_list = list_new();
+    test_dp_add(fixed, "Id", SUNS_STRING, NULL);
+    ((suns_dp_t *) fixed->dp_list->tail->data)->type_pair->len = 4;
+    test_dp_add(fixed, "W", SUNS_INT32, "W_SF");
+    test_dp_add(fixed, "W_SF", SUNS_SF, NULL);
+    list_node_add(m->dp_blocks, list_node_new(fixed));
+
+    repeating->repeating = 1;
+    repeating->dp_list = list_new();
+    test_dp_add(repeating, "I", SUNS_INT16, "W_SF");
+    test_dp_add(repeating, "V", SUNS_UINT16, "V_SF");
+    test_dp_add(repeating, "V_SF", SUNS_SF, NULL);
+    test_dp_add(repeating, "Wh", SUNS_ACC64, NULL);
+    test_dp_add(repeating, "Tmp", SUNS_FLOAT32, NULL);
+    list_node_add(m->dp_blocks, list_node_new(repeating));
+
+    did->model = m;
+    suns_did_index_add(did_index, did);
+
+    suns_model_fill_offsets(m);
+    UNIT_ASSERT(suns_model_compile_plan(m) == 0);
+
+    /* two instances of I, V, V_SF, Wh, Tmp; the second V_SF is not
+       implemented */
+    uint16_t regs[] = { 995, 23, 0x6162, 0x6364, 0xffff, 0xfc18, 0xfffe,
+                        100, 2300, 0xffff, 0, 0, 0, 12, 0x41c8, 0,
+                        0x8000, 2310, 0x8000, 0, 0, 1, 0, 0x7fc0, 0 };
+    unsigned char buf[sizeof(regs)];
+    for (i = 0; i < sizeof(regs) / sizeof(uint16_t); i++) {
+        uint16_t be = htobe16(regs[i]);
+        memcpy(buf + (i * 2), &be, 2);
+    }
+
+    suns_dataset_t *data = suns_dataset_new_samples();
+    UNIT_ASSERT(data != NULL);
+    UNIT_ASSERT(suns_decode_dataset(did_index, buf, sizeof(buf), data) == 0);
+
+    suns_samples_t *samples = data->samples;
+    UNIT_ASSERT(list_count(data->values) == 0);
+    UNIT_ASSERT(samples->count == 13);
+    UNIT_ASSERT(samples->n_fixed == 3);
+
+    /* the samples hold values and scale factors, the plan the rest */
+    UNIT_ASSERT(samples->samples[1].value.i32 == -1000);
+    UNIT_ASSERT(samples->samples[1].sf == -2);
+    UNIT_ASSERT(samples->samples[3].step == 3);
+    UNIT_ASSERT(samples->samples[3].index == 1);
+    UNIT_ASSERT(samples->samples[3].sf == -2);
+    UNIT_ASSERT(samples->samples[9].index == 2);
+    UNIT_ASSERT(samples->samples[9].sf == 0);
+    UNIT_ASSERT(samples->samples[8].meta == SUNS_VALUE_NOT_IMPLEMENTED);
+    UNIT_ASSERT(samples->samples[12].meta == SUNS_VALUE_NOT_IMPLEMENTED);
+
+    suns_samples_get_value(samples, 0, &v);
+    UNIT_ASSERT(strcmp(v.value.s, "abcd") == 0);
+    suns_samples_get_value(samples, 10, &v);
+    UNIT_ASSERT(strcmp(v.name_with_index, "V_SF,02") == 0);
+    UNIT_ASSERT(v.repeating);
+
+    /* every output format sees the same values as from a list */
+    suns_dataset_t *list_data = suns_decode_data(did_index, buf, sizeof(buf));
+    UNIT_ASSERT(list_data != NULL);
+
+    suns_dataset_write_f formats[] = {
+        suns_dataset_text_write,
+        suns_dataset_xml_write,
+        suns_dataset_csv_write,
+        suns_dataset_sql_write,
+        suns_dataset_json_write,
+    };
+    int saved_verbose_level = verbose_level;
+    verbose_level = 1;
+    for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        char *from_list = test_dataset_sprintf(formats[i], list_data);
+        char *from_samples = test_dataset_sprintf(formats[i], data);
+        UNIT_ASSERT(from_list && from_samples);
+        if (strcmp(from_list, from_samples) != 0) {
+            debug("output %d differs:\n%s\n%s", i, from_list, from_samples);
+            verbose_level = saved_verbose_level;
+            return -1;
+        }
+        free(from_list);
+        free(from_samples);
+    }
+    verbose_level = saved_verbose_level;
+
+    /* a shorter read reuses the storage */
+    suns_sample_t *storage = samples->samples;
+    uint16_t be = htobe16(14);
+    memcpy(buf + 2, &be, 2);
+    UNIT_ASSERT(suns_decode_dataset(did_index, buf, 32, data) == 0);
+    UNIT_ASSERT(samples->count == 8);
+    UNIT_ASSERT(samples->samples == storage);
+
+    /* so does a read that stops inside the non-repeating part */
+    be = htobe16(3);
+    memcpy(buf + 2, &be, 2);
+    UNIT_ASSERT(suns_decode_dataset(did_index, buf, 10, data) == 0);
+    UNIT_ASSERT(samples->count == 1);
+    UNIT_ASSERT(samples->samples == storage);
+
+    suns_dataset_free(list_data);
+    suns_dataset_free(data);
+
+    return 0;
+}
+
+
+int unit_test_map_plan_reads(const char **name)
+{
+    *name = __FUNCTION__;
+
+    int i;
+    int count;
+    suns_map_read_t *reads;
+    suns_map_t *map = suns_map_new();
+
+    /* common model, a 50 register model, then the end marker */
+    map->base_register = 40001;
+    suns_map_add_model(map, 1, 66, 2);
+    suns_map_add_model(map, 101, 50, 70);
+    map->end_offset = 122;
+
+    if (suns_map_len(map) != 124) {
+        debug("suns_map_len() = %d, expected 124", suns_map_len(map));
+        return -1;
+    }
+
+    /* everything after the signature fits in a single read */
+    count = suns_map_plan_reads(map, 125, &reads);
+    if ((count != 1) || (reads[0].offset != 2) || (reads[0].len != 122)) {
+        debug("expected a single read of 122 registers at offset 2");
+        return -1;
+    }
+    free(reads);
+
+    /* model boundaries don't split reads */
+    int expected[][2] = { { 2, 50 }, { 52, 50 }, { 102, 22 } };
+    count = suns_map_plan_reads(map, 50, &reads);
+    if (count != 3) {
+        debug("suns_map_plan_reads() returned %d, expected 3", count);
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        if ((reads[i].offset != expected[i][0]) ||
+            (reads[i].len != expected[i][1])) {
+            debug("read %d: offset %d, len %d", i,
+                  reads[i].offset, reads[i].len);
+            return -1;
+        }
+    }
+    free(reads);
+
+    suns_map_free(map);
+
+    return 0;
+}
+
+
+int unit_test_map_save_load(const char **name)
+{
+    *name = __FUNCTION__;
+
+    char path[] = "/tmp/suns_map_XXXXXX";
+    uint16_t common[] = { 0x416d, 0x616c, 0x0000, 0xffff };
+    suns_map_t *map = suns_map_new();
+    suns_map_t *loaded;
+    suns_map_model_t *a, *b;
+    suns_link_t link, loaded_link;
+    int fd;
+
+    suns_link_init(&link, 62, 2000);
+    suns_link_sample(&link, 20000);
+    suns_link_init(&loaded_link, 125, 2000);
+
+    map->base_register = 40001;
+    suns_map_add_model(map, 1, 4, 2);
+    suns_map_add_model(map, 101, 50, 8);
+    map->end_offset = 60;
+    suns_map_set_common(map, common, 4);
+
+    fd = mkstemp(path);
+    if (fd < 0) {
+        debug("mkstemp() failed: %m");
+        return -1;
+    }
+    close(fd);
+
+    if (suns_map_save(map, &link, path) < 0) {
+        debug("suns_map_save() failed");
+        unlink(path);
+        return -1;
+    }
+
+    loaded = suns_map_load(path, &loaded_link);
+    unlink(path);
+    if (loaded == NULL) {
+        debug("suns_map_load() failed");
+        return -1;
+    }
+
+    if ((loaded->base_register != 40001) ||
+        (loaded->end_offset != 60) ||
+        (list_count(loaded->models) != 2) ||
+        (loaded->common_len != 4) ||
+        (memcmp(loaded->common, common, sizeof(common)) != 0)) {
+        debug("loaded map does not match the saved map");
+        return -1;
+    }
+
+    a = map->models->tail->data;
+    b = loaded->models->tail->data;
+    if ((a->did != b->did) || (a->len != b->len) || (a->offset != b->offset)) {
+        debug("model %d did not survive the round trip", a->did);
+        return -1;
+    }
+
+    if ((loaded_link.max_read != 62) ||
+        (loaded_link.srtt != link.srtt) ||
+        (loaded_link.rttvar != link.rttvar) ||
+        (loaded_link.timeout != link.timeout)) {
+        debug("link did not survive the round trip");
+        return -1;
+    }
+
+    /* what was saved or loaded has nothing new to save */
+    if (link.changed || loaded_link.changed) {
+        debug("link is still marked changed after a save and load");
+        return -1;
+    }
+
+    /* the loaded map is checked against the signature and common model */
+    uint16_t regs[] = { SUNS_ID_HIGH, SUNS_ID_LOW, 1, 4,
+                        0x416d, 0x616c, 0x0000, 0xffff };
+    if (suns_map_validate_len(loaded) != 8) {
+        debug("suns_map_validate_len() = %d, expected 8",
+              suns_map_validate_len(loaded));
+        return -1;
+    }
+    if (suns_map_validate(loaded, regs) != 0) {
+        debug("loaded map does not validate against the device");
+        return -1;
+    }
+    regs[5] = 0x616d;
+    if (suns_map_validate(loaded, regs) != 1) {
+        debug("changed common model validated");
+        return -1;
+    }
+    regs[5] = 0x616c;
+    regs[0] = 0;
+    if (suns_map_validate(loaded, regs) != 1) {
+        debug("missing signature validated");
+        return -1;
+    }
+
+    suns_map_free(map);
+    suns_map_free(loaded);
+
+    /* a map with no common model can't be checked */
+    map = suns_map_new();
+    map->base_register = 40001;
+    suns_map_add_model(map, 101, 50, 2);
+    if (suns_map_validate_len(map) != -1) {
+        debug("map without a common model has something to validate");
+        return -1;
+    }
+    suns_map_free(map);
+
+    return 0;
+}
+
+
+int unit_test_map_changes(const char **name)
+{
+    *name = __FUNCTION__;
+
+    suns_model_t *common = suns_model_new();
+    suns_model_t *m = suns_model_new();
+    suns_model_did_t *common_did = suns_model_did_new(1);
+    suns_model_did_t *did = suns_model_did_new(994);
+    suns_did_index_t *did_index = suns_did_index_new();
+    suns_dp_block_t *common_block = suns_dp_block_new();
+    suns_dp_block_t *fixed = suns_dp_block_new();
+    suns_dp_block_t *repeating = suns_dp_block_new();
+    suns_map_t *map = suns_map_new();
+    suns_device_t *device = suns_device_new_with_arena();
+    suns_dataset_t *data;
+    suns_value_t *v;
+
+    common_block->dp_list = list_new();
+    test_dp_add(common_block, "DA", SUNS_UINT16, NULL);
+    list_node_add(common->dp_blocks, list_node_new(common_block));
+    common_did->model = common;
+    suns_did_index_add(did_index, common_did);
+
+    fixed->dp_list = list_new();
+    test_dp_add(fixed, "W", SUNS_INT16, "W_SF");
+    test_dp_add(fixed, "W_SF", SUNS_SF, NULL);
+    list_node_add(m->dp_blocks, list_node_new(fixed));
+    repeating->repeating = 1;
+    repeating->dp_list = list_new();
+    test_dp_add(repeating, "A", SUNS_UINT16, "A_SF");
+    test_dp_add(repeating, "A_SF", SUNS_SF, NULL);
+    list_node_add(m->dp_blocks, list_node_new(repeating));
+    did->model = m;
+    suns_did_index_add(did_index, did);
+
+    suns_model_fill_offsets(common);
+    suns_model_fill_offsets(m);
+    UNIT_ASSERT(suns_model_compile_plan(common) == 0);
+    UNIT_ASSERT(suns_model_compile_plan(m) == 0);
+
+    /* the signature, the common model, two instances of model 994
+       and the end marker */
+    uint16_t regs[] = { 0x5375, 0x6e53,
+                        1, 1, 7,
+                        994, 6, 1234, 0xffff, 10, 0, 20, 1,
+                        994, 6, 4321, 0xffff, 30, 0, 40, 1,
+                        0xffff, 0 };
+    map->base_register = 40001;
+    suns_map_add_model(map, 1, 1, 2);
+    suns_map_add_model(map, 994, 6, 5);
+    suns_map_add_model(map, 994, 6, 13);
+    map->end_offset = 21;
+
+    UNIT_ASSERT(device != NULL);
+    device->changes = suns_changes_new(4);
+    UNIT_ASSERT(device->changes != NULL);
+
+    /* the first read is a keyframe */
+    UNIT_ASSERT(suns_map_decode(map, did_index, regs, device) == 0);
+    UNIT_ASSERT(list_count(device->datasets) == 3);
+    data = device->datasets->tail->data;
+    UNIT_ASSERT(data->index == 2);
+    UNIT_ASSERT(list_count(data->values) == 6);
+
+    /* nothing changed: only the common model, to identify the device */
+    UNIT_ASSERT(suns_map_decode(map, did_index, regs, device) == 0);
+    UNIT_ASSERT(list_count(device->datasets) == 1);
+    UNIT_ASSERT(device->common != NULL);
+    UNIT_ASSERT(device->common->unchanged);
+
+    /* a changed value comes with its scale factor, in the right
+       instance of the model */
+    regs[19] = 41;
+    UNIT_ASSERT(suns_map_decode(map, did_index, regs, device) == 0);
+    UNIT_ASSERT(list_count(device->datasets) == 2);
+    data = device->datasets->tail->data;
+    UNIT_ASSERT(data->index == 2);
+    UNIT_ASSERT(! data->unchanged);
+    UNIT_ASSERT(list_count(data->values) == 2);
+    v = data->values->head->data;
+    UNIT_ASSERT(strcmp(v->name_with_index, "A,02") == 0);
+    UNIT_ASSERT(v->value.u16 == 41);
+    UNIT_ASSERT(v->tp.sf == 1);
+    v = data->values->tail->data;
+    UNIT_ASSERT(strcmp(v->name_with_index, "A_SF,02") == 0);
+
+    /* a changed scale factor brings the values it applies to */
+    regs[8] = 0xfffe;
+    UNIT_ASSERT(suns_map_decode(map, did_index, regs, device) == 0);
+    UNIT_ASSERT(list_count(device->datasets) == 2);
+    data = device->datasets->tail->data;
+    UNIT_ASSERT(data->index == 1);
+    UNIT_ASSERT(list_count(data->values) == 2);
+    v = data->values->head->data;
+    UNIT_ASSERT(strcmp(v->name, "W") == 0);
+    UNIT_ASSERT(v->tp.sf == -2);
+
+    /* the fourth read since the last keyframe is another */
+    UNIT_ASSERT(suns_map_decode(map, did_index, regs, device) == 0);
+    UNIT_ASSERT(list_count(device->datasets) == 3);
+    UNIT_ASSERT(! device->common->unchanged);
+    data = device->datasets->tail->data;
+    UNIT_ASSERT(list_count(data->values) == 6);
+
+    /* so is a read of a different length */
+    UNIT_ASSERT(suns_changes_begin(device->changes, 10) == 1);
+
+    /* for json output, the repeating blocks go in columns the device
+       keeps from read to read, and are written the same */
+    suns_device_t *columnar = suns_device_new_with_arena();
+    suns_device_t *listed = suns_device_new_with_arena();
+    suns_columns_t *cols;
+    list_node_t *c, *d;
+    int rc;
+    UNIT_ASSERT(columnar && listed);
+    columnar->columnar = suns_output_columnar("json");
+    UNIT_ASSERT(columnar->columnar);
+    UNIT_ASSERT(! suns_output_columnar("xml"));
+    UNIT_ASSERT(suns_map_decode(map, did_index, regs, columnar) == 0);
+    UNIT_ASSERT(suns_map_decode(map, did_index, regs, listed) == 0);
+    data = columnar->datasets->tail->data;
+    cols = data->columns;
+    UNIT_ASSERT(cols != NULL);
+    UNIT_ASSERT(cols->count == 2);
+    UNIT_ASSERT(list_count(data->values) == 2);
+    UNIT_ASSERT(((suns_dataset_t *) listed->datasets->tail->data)->columns
+                == NULL);
+
+    regs[19] = 42;
+    UNIT_ASSERT(suns_map_decode(map, did_index, regs, columnar) == 0);
+    UNIT_ASSERT(suns_map_decode(map, did_index, regs, listed) == 0);
+    UNIT_ASSERT(((suns_dataset_t *) columnar->datasets->tail->data)->columns
+                == cols);
+    for (c = columnar->datasets->head, d = listed->datasets->head;
+         c && d; c = c->next, d = d->next) {
+        char *from_columns = test_dataset_sprintf(suns_dataset_json_write,
+                                                  c->data);
+        char *from_list = test_dataset_sprintf(suns_dataset_json_write,
+                                               d->data);
+        UNIT_ASSERT(from_columns && from_list);
+        rc = strcmp(from_columns, from_list);
+        if (rc != 0)
+            debug("json differs:\n%s\n%s", from_list, from_columns);
+        free(from_columns);
+        free(from_list);
+        UNIT_ASSERT(rc == 0);
+    }
+    UNIT_ASSERT((c == NULL) && (d == NULL));
+
+    suns_device_free(columnar);
+    suns_device_free(listed);
+    suns_device_free(device);
+    suns_map_free(map);
+
+    return 0;
+}
+
+
+/* the device as text output, to compare devices by */
+static char *test_device_sprintf(suns_device_t *device)
+{
+    char *out;
+    sink_t *sink = sink_new_memory(0);
+
+    if (sink == NULL)
+        return NULL;
+
+    suns_device_text_write(sink, device);
+    out = strdup(sink_string(sink));
+    sink_free(sink);
+
+    return out;
+}
+
+
+/* write device as a binary record, decode it into copy and check that
+   both output the same text */
+static int test_bin_round_trip(suns_did_index_t *did_index,
+                               suns_device_t *device,
+                               suns_device_t *copy,
+                               sink_t *sink)
+{
+    size_t start = sink_len(sink);
+    char *a, *b;
+    int rc;
+
+    if (suns_device_bin_write(sink, device) < 0)
+        return -1;
+    if (suns_bin_decode(did_index,
+                        (unsigned char *) sink_data(sink) + start,
+                        sink_len(sink) - start, copy) < 0)
+        return -1;
+
+    a = test_device_sprintf(device);
+    b = test_device_sprintf(copy);
+    rc = (a && b && (strcmp(a, b) == 0)) ? 0 : -1;
+    if (rc < 0)
+        debug("decoded record differs:\n%s\n%s", a, b);
+    free(a);
+    free(b);
+
+    return rc;
+}
+
+
+int unit_test_bin(const char **name)
+{
+    *name = __FUNCTION__;
+
+    suns_model_t *common = suns_model_new();
+    suns_model_t *m = suns_model_new();
+    suns_model_did_t *common_did = suns_model_did_new(1);
+    suns_model_did_t *did = suns_model_did_new(994);
+    suns_did_index_t *did_index = suns_did_index_new();
+    suns_dp_block_t *common_block = suns_dp_block_new();
+    suns_dp_block_t *fixed = suns_dp_block_new();
+    suns_dp_block_t *repeating = suns_dp_block_new();
+    suns_map_t *map = suns_map_new();
+    suns_device_t *device = suns_device_new_with_arena();
+    suns_device_t *copy = suns_device_new_with_arena();
+    sink_t *sink = sink_new_memory(0);
+    suns_dataset_t *data;
+    suns_value_t *v;
+    unsigned char *buf = NULL;
+    size_t size = 0;
+    FILE *stream;
+    int rc;
+
+    common_block->dp_list = list_new();
+    test_dp_add(common_block, "DA", SUNS_UINT16, NULL);
+    list_node_add(common->dp_blocks, list_node_new(common_block));
+    common_did->model = common;
+    suns_did_index_add(did_index, common_did);
+
+    fixed->dp_list = list_new();
+    test_dp_add(fixed, "W", SUNS_INT16, "W_SF");
+    test_dp_add(fixed, "W_SF", SUNS_SF, NULL);
+    list_node_add(m->dp_blocks, list_node_new(fixed));
+    repeating->repeating = 1;
+    repeating->dp_list = list_new();
+    test_dp_add(repeating, "A", SUNS_UINT16, "A_SF");
+    test_dp_add(repeating, "A_SF", SUNS_SF, NULL);
+    list_node_add(m->dp_blocks, list_node_new(repeating));
+    did->model = m;
+    suns_did_index_add(did_index, did);
+
+    suns_model_fill_offsets(common);
+    suns_model_fill_offsets(m);
+    UNIT_ASSERT(suns_model_compile_plan(common) == 0);
+    UNIT_ASSERT(suns_model_compile_plan(m) == 0);
+    UNIT_ASSERT(suns_model_index_dps(common) == 0);
+    UNIT_ASSERT(suns_model_index_dps(m) == 0);
+
+    uint16_t regs[] = { 0x5375, 0x6e53,
+                        1, 1, 7,
+                        994, 6, 1234, 0xffff, 10, 0, 20, 1,
+                        994, 6, 4321, 0xffff, 30, 0, 40, 1,
+                        0xffff, 0 };
+    map->base_register = 40001;
+    suns_map_add_model(map, 1, 1, 2);
+    suns_map_add_model(map, 994, 6, 5);
+    suns_map_add_model(map, 994, 6, 13);
+    map->end_offset = 21;
+
+    UNIT_ASSERT(device && copy && sink);
+    device->changes = suns_changes_new(4);
+    UNIT_ASSERT(device->changes != NULL);
+    device->unixtime = 1300000000;
+    device->usec = 250000;
+    device->addr = 3;
+    device->lid = "11:22:33:44:55:66";
+    device->ns = "mac";
+
+    /* a full read */
+    UNIT_ASSERT(suns_map_decode(map, did_index, regs, device) == 0);
+    UNIT_ASSERT(test_bin_round_trip(did_index, device, copy, sink) == 0);
+    UNIT_ASSERT(list_count(copy->datasets) == 3);
+    UNIT_ASSERT(copy->unixtime == 1300000000);
+    UNIT_ASSERT(copy->usec == 250000);
+    UNIT_ASSERT(copy->addr == 3);
+    UNIT_ASSERT(strcmp(copy->lid, "11:22:33:44:55:66") == 0);
+    UNIT_ASSERT(strcmp(copy->ns, "mac") == 0);
+    data = copy->datasets->tail->data;
+    UNIT_ASSERT(data->index == 2);
+    UNIT_ASSERT(! data->partial);
+    UNIT_ASSERT(list_count(data->values) == 6);
+
+    /* only a changed value and its scale factor */
+    regs[19] = 41;
+    UNIT_ASSERT(suns_map_decode(map, did_index, regs, device) == 0);
+    UNIT_ASSERT(test_bin_round_trip(did_index, device, copy, sink) == 0);
+    UNIT_ASSERT(list_count(copy->datasets) == 2);
+    UNIT_ASSERT(copy->common->unchanged);
+    data = copy->datasets->tail->data;
+    UNIT_ASSERT(data->partial);
+    UNIT_ASSERT(list_count(data->values) == 2);
+    v = data->values->head->data;
+    UNIT_ASSERT(strcmp(v->name_with_index, "A,02") == 0);
+    UNIT_ASSERT(v->value.u16 == 41);
+
+    /* both records read back from a stream */
+    stream = tmpfile();
+    UNIT_ASSERT(stream != NULL);
+    fwrite(sink_data(sink), 1, sink_len(sink), stream);
+    rewind(stream);
+    rc = suns_bin_fread(stream, &buf, &size);
+    UNIT_ASSERT(rc > 0);
+    UNIT_ASSERT(suns_bin_decode(did_index, buf, rc, copy) == 0);
+    UNIT_ASSERT(list_count(copy->datasets) == 3);
+    rc = suns_bin_fread(stream, &buf, &size);
+    UNIT_ASSERT(rc > 0);
+    UNIT_ASSERT(suns_bin_decode(did_index, buf, rc, copy) == 0);
+    UNIT_ASSERT(list_count(copy->datasets) == 2);
+    UNIT_ASSERT(suns_bin_fread(stream, &buf, &size) == 0);
+
+    /* a truncated record is refused */
+    UNIT_ASSERT(suns_bin_decode(did_index, buf, rc - 1, copy) < 0);
+    buf[0] = 0x10;
+    UNIT_ASSERT(suns_bin_decode(did_index, buf, rc, copy) < 0);
+
+    fclose(stream);
+    free(buf);
+    sink_free(sink);
+    suns_device_free(copy);
+    suns_device_free(device);
+    suns_map_free(map);
+
+    return 0;
+}
+
+
+int unit_test_json(const char **name)
+{
+    *name = __FUNCTION__;
+
+    suns_model_t *m = suns_model_new();
+    suns_model_did_t *did = suns_model_did_new(995);
+    suns_dp_block_t *fixed = suns_dp_block_new();
+    suns_dp_block_t *repeating = suns_dp_block_new();
+    suns_dataset_t *data = suns_dataset_new();
+    suns_attribute_t *units = suns_attribute_new();
+    suns_attribute_t *label = suns_attribute_new();
+    suns_dp_t *dp;
+    list_node_t *c;
+    char *compiled, *uncompiled;
+    char buf[16];
+    int rc;
+
+    fixed->dp_list = list_new();
+    test_dp_add(fixed, "W", SUNS_INT16, "W_SF");
+    test_dp_add(fixed, "W_SF", SUNS_SF, NULL);
+    dp = fixed->dp_list->head->data;
+    dp->attributes = list_new();
+    units->name = "u";
+    units->value = "W";
+    label->name = "label";
+    label->value = "Power \"out\"";
+    list_node_add(dp->attributes, list_node_new(units));
+    list_node_add(dp->attributes, list_node_new(label));
+    list_node_add(m->dp_blocks, list_node_new(fixed));
+    repeating->repeating = 1;
+    repeating->dp_list = list_new();
+    test_dp_add(repeating, "A", SUNS_UINT16, NULL);
+    list_node_add(m->dp_blocks, list_node_new(repeating));
+    did->model = m;
+
+    suns_model_fill_offsets(m);
+    UNIT_ASSERT(suns_model_compile_plan(m) == 0);
+
+    /* W = 1234, W_SF = -2 and two instances of A */
+    unsigned char regs[] = { 0x04, 0xd2, 0xff, 0xfe, 0x00, 0x07, 0x00, 0x08 };
+    UNIT_ASSERT(data != NULL);
+    UNIT_ASSERT(suns_decode_model_data(did, regs, sizeof(regs), data) == 0);
+
+    compiled = test_dataset_sprintf(suns_dataset_json_write, data);
+    UNIT_ASSERT(compiled != NULL);
+    /* the fragments were built by the write and kept with the plan */
+    UNIT_ASSERT(suns_decode_plan_attached(m->plan) != NULL);
+    UNIT_ASSERT(suns_plan_fragments(data) ==
+                suns_decode_plan_attached(m->plan));
+    rc = strcmp(compiled,
+                "{\"id\":995,\"points\":{\n"
+                "  \"W\":{\"v\":12.34,\"u\":\"W\",\"l\":\"Power \\\"out\\\"\"}},\n"
+                "  \"repeating\":[\n"
+                "    {\"x\":1,\"points\":{\n"
+                "      \"A\":{\"v\":7}}},\n"
+                "    {\"x\":2,\"points\":{\n"
+                "      \"A\":{\"v\":8}}}]}");
+    if (rc != 0)
+        debug("unexpected json:\n%s", compiled);
+    UNIT_ASSERT(rc == 0);
+
+    /* values that didn't come from a decode plan are escaped as they
+       are written, with the same result */
+    list_for_each(data->values, c) {
+        ((suns_value_t *) c->data)->step = -1;
+    }
+    uncompiled = test_dataset_sprintf(suns_dataset_json_write, data);
+    UNIT_ASSERT(uncompiled != NULL);
+    UNIT_ASSERT(strcmp(compiled, uncompiled) == 0);
+    free(compiled);
+    free(uncompiled);
+
+    /* control characters are escaped, and a string too long for the
+       buffer is cut short between escapes but still closed */
+    UNIT_ASSERT(suns_json_quote(buf, sizeof(buf), "a\tb\\") == 12);
+    UNIT_ASSERT(strcmp(buf, "\"a\\u0009b\\\\\"") == 0);
+    UNIT_ASSERT(suns_json_quote(buf, 6, "a\"bc") == 5);
+    UNIT_ASSERT(strcmp(buf, "\"a\\\"\"") == 0);
+    UNIT_ASSERT(suns_json_quote(buf, 5, "a\"bc") == 3);
+    UNIT_ASSERT(strcmp(buf, "\"a\"") == 0);
+
+    suns_dataset_free(data);
+
+    return 0;
+}
+
+
+/* write device with the output format fmt, as n devices of a single
+   document if n > 0 */
+static char *test_device_output_sprintf(char *fmt, suns_device_t *device,
+                                        int n)
+{
+    char *out;
+    sink_t *sink = sink_new_memory(0);
+    int i;
+
+    if (sink == NULL)
+        return NULL;
+
+    if (n > 0) {
+        suns_output_begin(fmt, sink);
+        for (i = 0; i < n; i++)
+            suns_device_output_item(fmt, device, i, sink);
+        suns_output_end(fmt, sink);
+    } else {
+        suns_device_output(fmt, device, sink);
+    }
+    out = strdup(sink_string(sink));
+    sink_free(sink);
+
+    return out;
+}
+
+
+int unit_test_xml_stream(const char **name)
+{
+    *name = __FUNCTION__;
+
+    suns_model_t *m = suns_model_new();
+    suns_model_did_t *did = suns_model_did_new(995);
+    suns_dp_block_t *fixed = suns_dp_block_new();
+    suns_device_t *device = suns_device_new();
+    suns_dataset_t *data = suns_dataset_new();
+    list_node_t *c;
+    char *compiled, *uncompiled, *streamed, *expected;
+    const char *head = "<sunSpecData v=\"1\">\n";
+    const char *tail = "</sunSpecData>\n";
+    size_t item_len;
+    int rc;
+
+    fixed->dp_list = list_new();
+    test_dp_add(fixed, "W<1>", SUNS_INT16, "W_SF");
+    test_dp_add(fixed, "W_SF", SUNS_SF, NULL);
+    list_node_add(m->dp_blocks, list_node_new(fixed));
+    did->model = m;
+
+    suns_model_fill_offsets(m);
+    UNIT_ASSERT(suns_model_compile_plan(m) == 0);
+
+    unsigned char regs[] = { 0x04, 0xd2, 0xff, 0xfe };
+    UNIT_ASSERT(data != NULL);
+    UNIT_ASSERT(suns_decode_model_data(did, regs, sizeof(regs), data) == 0);
+    list_node_add(device->datasets, list_node_new(data));
+    device->manufacturer = "A&B";
+    device->serial_number = "1";
+
+    /* the point id is escaped when the plan is compiled, the device's
+       attributes as they are written */
+    compiled = test_device_output_sprintf("xml", device, 0);
+    UNIT_ASSERT(compiled != NULL);
+    rc = (strncmp(compiled, head, strlen(head)) == 0) &&
+        (strstr(compiled, " <d man=\"A&amp;B\" sn=\"1\" t=\"") != NULL) &&
+        (strstr(compiled, "    <p id=\"W&lt;1&gt;\"") != NULL);
+    if (! rc)
+        debug("unexpected xml:\n%s", compiled);
+    UNIT_ASSERT(rc);
+
+    /* values that didn't come from a decode plan are escaped as they
+       are written, with the same result */
+    list_for_each(data->values, c) {
+        ((suns_value_t *) c->data)->step = -1;
+    }
+    uncompiled = test_device_output_sprintf("xml", device, 0);
+    UNIT_ASSERT(uncompiled != NULL);
+    UNIT_ASSERT(strcmp(compiled, uncompiled) == 0);
+
+    /* a streamed document is the same post with one <d> per device */
+    item_len = strlen(compiled) - strlen(head) - strlen(tail);
+    expected = malloc(strlen(compiled) + item_len + 1);
+    UNIT_ASSERT(expected != NULL);
+    sprintf(expected, "%s%.*s%.*s%s", head,
+            (int) item_len, compiled + strlen(head),
+            (int) item_len, compiled + strlen(head), tail);
+    streamed = test_device_output_sprintf("xml", device, 2);
+    UNIT_ASSERT(streamed != NULL);
+    UNIT_ASSERT(strcmp(streamed, expected) == 0);
+    free(streamed);
+
+    /* formats without such documents write a whole one per device */
+    streamed = test_device_output_sprintf("text", device, 1);
+    UNIT_ASSERT(streamed != NULL);
+    free(uncompiled);
+    uncompiled = test_device_output_sprintf("text", device, 0);
+    UNIT_ASSERT(uncompiled != NULL);
+    UNIT_ASSERT(strcmp(streamed, uncompiled) == 0);
+
+    free(streamed);
+    free(expected);
+    free(compiled);
+    free(uncompiled);
+    suns_device_free(device);
+
+    return 0;
+}
+
+
+/* skip a json value starting at s (after any white space), and return
+   where it ends, or NULL if it isn't valid json.  *n is set to the
+   number of elements if the value is an array. */
+static const char *test_json_skip_value(const char *s, int *n);
+
+static const char *test_json_skip_space(const char *s)
+{
+    while ((*s == ' ') || (*s == '\t') || (*s == '\n') || (*s == '\r'))
+        s++;
+    return s;
+}
+
+static const char *test_json_skip_string(const char *s)
+{
+    if (*s++ != '"')
+        return NULL;
+    while (*s != '"') {
+        if ((unsigned char) *s < 0x20)
+            return NULL;
+        if (*s == '\\') {
+            s++;
+            if (*s == 'u') {
+                int i;
+                for (i = 1; i <= 4; i++)
+                    if (! isxdigit((unsigned char) s[i]))
+                        return NULL;
+                s += 4;
+            } else if (strchr("\"\\/bfnrt", *s) == NULL) {
+                return NULL;
+            }
+        }
+        s++;
+    }
+    return s + 1;
+}
+
+static const char *test_json_skip_number(const char *s)
+{
+    if (*s == '-')
+        s++;
+    if (*s == '0')
+        s++;
+    else if (isdigit((unsigned char) *s))
+        while (isdigit((unsigned char) *s))
+            s++;
+    else
+        return NULL;
+    if (*s == '.') {
+        s++;
+        if (! isdigit((unsigned char) *s))
+            return NULL;
+        while (isdigit((unsigned char) *s))
+            s++;
+    }
+    if ((*s == 'e') || (*s == 'E')) {
+        s++;
+        if ((*s == '+') || (*s == '-'))
+            s++;
+        if (! isdigit((unsigned char) *s))
+            return NULL;
+        while (isdigit((unsigned char) *s))
+            s++;
+    }
+    return s;
+}
+
+static const char *test_json_skip_value(const char *s, int *n)
+{
+    int count = 0;
+    int dummy;
+
+    s = test_json_skip_space(s);
+    if (*s == '{' || *s == '[') {
+        char close = (*s == '{') ? '}' : ']';
+        int object = (*s == '{');
+        s = test_json_skip_space(s + 1);
+        if (*s == close) {
+            if (n)
+                *n = 0;
+            return s + 1;
+        }
+        for (;;) {
+            if (object) {
+                s = test_json_skip_string(test_json_skip_space(s));
+                if (s == NULL)
+                    return NULL;
+                s = test_json_skip_space(s);
+                if (*s++ != ':')
+                    return NULL;
+            }
+            s = test_json_skip_value(s, &dummy);
+            if (s == NULL)
+                return NULL;
+            count++;
+            s = test_json_skip_space(s);
+            if (*s == close)
+                break;
+            if (*s++ != ',')
+                return NULL;
+        }
+        if (n && ! object)
+            *n = count;
+        return s + 1;
+    }
+    if (*s == '"')
+        return test_json_skip_string(s);
+    if (strncmp(s, "true", 4) == 0)
+        return s + 4;
+    if (strncmp(s, "false", 5) == 0)
+        return s + 5;
+    if (strncmp(s, "null", 4) == 0)
+        return s + 4;
+    return test_json_skip_number(s);
+}
+
+
+/* s is a single json value, optionally followed by white space */
+static int test_json_valid(const char *s, int *n)
+{
+    s = test_json_skip_value(s, n);
+    return (s != NULL) && (*test_json_skip_space(s) == '\0');
+}
+
+
+int unit_test_json_document(const char **name)
+{
+    *name = __FUNCTION__;
+
+    suns_model_t *m = suns_model_new();
+    suns_model_did_t *did = suns_model_did_new(995);
+    suns_dp_block_t *fixed = suns_dp_block_new();
+    suns_device_t *device = suns_device_new();
+    suns_dataset_t *data = suns_dataset_new();
+    sink_t *sink = sink_new_memory(0);
+    char *out;
+    int n = -1;
+    int rc;
+
+    fixed->dp_list = list_new();
+    test_dp_add(fixed, "W", SUNS_INT16, "W_SF");
+    test_dp_add(fixed, "W_SF", SUNS_SF, NULL);
+    test_dp_add(fixed, "Hz", SUNS_UINT16, NULL);
+    list_node_add(m->dp_blocks, list_node_new(fixed));
+    did->model = m;
+
+    suns_model_fill_offsets(m);
+    UNIT_ASSERT(suns_model_compile_plan(m) == 0);
+
+    unsigned char regs[] = { 0x04, 0xd2, 0xff, 0xfe, 0x00, 0x3c };
+    UNIT_ASSERT((data != NULL) && (sink != NULL));
+    UNIT_ASSERT(suns_decode_model_data(did, regs, sizeof(regs), data) == 0);
+    list_node_add(device->datasets, list_node_new(data));
+    device->manufacturer = "A\"B";
+    device->serial_number = "1";
+
+    /* one device on its own is a single object */
+    out = test_device_output_sprintf("json", device, 0);
+    UNIT_ASSERT(out != NULL);
+    rc = test_json_valid(out, NULL) && (out[0] == '{');
+    if (! rc)
+        debug("invalid json:\n%s", out);
+    free(out);
+    UNIT_ASSERT(rc);
+
+    /* several devices in a document are an array of objects */
+    out = test_device_output_sprintf("json", device, 3);
+    UNIT_ASSERT(out != NULL);
+    rc = test_json_valid(out, &n) && (out[0] == '[') && (n == 3);
+    if (! rc)
+        debug("invalid json array of %d:\n%s", n, out);
+    free(out);
+    UNIT_ASSERT(rc);
+
+    /* and a document without any devices is still valid */
+    UNIT_ASSERT(suns_output_begin("json", sink) == 0);
+    UNIT_ASSERT(suns_output_end("json", sink) == 0);
+    UNIT_ASSERT(test_json_valid(sink_string(sink), &n) && (n == 0));
+
+    /* the checker itself rejects what the writers must never make */
+    UNIT_ASSERT(! test_json_valid("{\"v\":1}{\"v\":2}", NULL));
+    UNIT_ASSERT(! test_json_valid("[{\"v\":1},]", NULL));
+    UNIT_ASSERT(! test_json_valid("[-7.e2]", NULL));
+    UNIT_ASSERT(test_json_valid("[-7e2]", NULL));
+
+    sink_free(sink);
+    suns_device_free(device);
+
+    return 0;
+}
+
+
+int unit_test_link(const char **name)
+{
+    *name = __FUNCTION__;
+
+    suns_link_t link;
+    int i;
+
+    suns_link_init(&link, 125, 2000);
+    UNIT_ASSERT(link.timeout == 2000);
+    UNIT_ASSERT(! link.changed);
+
+    /* a fast device gets the shortest timeout */
+    for (i = 0; i < 20; i++)
+        suns_link_sample(&link, 2000);
+    UNIT_ASSERT(link.srtt == 2000);
+    UNIT_ASSERT(link.timeout == 50);
+    UNIT_ASSERT(link.changed);
+
+    /* steady samples have nothing new to save, a slower one does */
+    link.changed = 0;
+    suns_link_sample(&link, 2000);
+    UNIT_ASSERT(! link.changed);
+    suns_link_sample(&link, 40000);
+    UNIT_ASSERT(link.changed);
+
+    /* the shortest timeout follows the configured one, so a 10 ms
+       -T isn't held at 50 ms */
+    suns_link_init(&link, 125, 8000);
+    for (i = 0; i < 20; i++)
+        suns_link_sample(&link, 2000);
+    UNIT_ASSERT(link.timeout == 200);
+    suns_link_init(&link, 125, 10);
+    suns_link_sample(&link, 2000);
+    UNIT_ASSERT(link.timeout == 6);
+
+    /* a slow one gets its round trip time plus four times its
+       variation, which is 800 ms + 4 * 400 ms at first */
+    suns_link_init(&link, 125, 5000);
+    suns_link_sample(&link, 800000);
+    UNIT_ASSERT(link.timeout == 2400);
+
+    /* timeouts back off up to the configured timeout */
+    suns_link_timed_out(&link);
+    UNIT_ASSERT(link.timeout == 4800);
+    suns_link_timed_out(&link);
+    UNIT_ASSERT(link.timeout == 5000);
+
+    /* rejected reads are halved until they can't get any shorter */
+    UNIT_ASSERT(suns_link_reject_read(&link, 125) == 62);
+    UNIT_ASSERT(suns_link_reject_read(&link, 40) == 20);
+    UNIT_ASSERT(link.max_read == 20);
+    for (i = 0; i < 3; i++)
+        UNIT_ASSERT(suns_link_reject_read(&link, link.max_read) > 0);
+    UNIT_ASSERT(link.max_read == 2);
+    UNIT_ASSERT(suns_link_reject_read(&link, 2) < 0);
+    UNIT_ASSERT(link.max_read == 2);
+
+    /* a restored read size doesn't override a smaller -l */
+    suns_link_init(&link, 50, 2000);
+    suns_link_restore(&link, 62, 20000, 5000);
+    UNIT_ASSERT(link.max_read == 50);
+    UNIT_ASSERT(link.timeout == 50);
+    suns_link_restore(&link, 30, 100000, 10000);
+    UNIT_ASSERT(link.max_read == 30);
+    UNIT_ASSERT(link.timeout == 140);
+
+    return 0;
+}
+
+
+int unit_test_mbtcp_frames(const char **name)
+{
+    *name = __FUNCTION__;
+
+    unsigned char req[SUNS_MBTCP_REQUEST_LEN];
+    unsigned char expected_req[] = { 0x12, 0x34, 0x00, 0x00, 0x00, 0x06,
+                                     0x0a, 0x03, 0x9c, 0x40, 0x00, 0x02 };
+    /* two registers holding the sunspec signature */
+    unsigned char rsp[] = { 0x12, 0x34, 0x00, 0x00, 0x00, 0x07,
+                            0x0a, 0x03, 0x04, 0x53, 0x75, 0x6e, 0x53 };
+    /* illegal data address exception */
+    unsigned char exc[] = { 0x12, 0x35, 0x00, 0x00, 0x00, 0x03,
+                            0x0a, 0x83, 0x02 };
+    uint16_t regs[4];
+    uint16_t tid;
+    int exception;
+
+    UNIT_ASSERT(suns_mbtcp_read_request(req, 0x1234, 10, 40000, 2) ==
+                SUNS_MBTCP_REQUEST_LEN);
+    UNIT_ASSERT(memcmp(req, expected_req, sizeof(req)) == 0);
+
+    /* the frame length is known once the mbap length field arrives */
+    UNIT_ASSERT(suns_mbtcp_frame_len(rsp, 5) == 0);
+    UNIT_ASSERT(suns_mbtcp_frame_len(rsp, 6) == sizeof(rsp));
+    UNIT_ASSERT(suns_mbtcp_read_response(rsp, sizeof(rsp) - 1, &tid,
+                                         regs, 4, &exception) < 0);
+
+    UNIT_ASSERT(suns_mbtcp_read_response(rsp, sizeof(rsp), &tid,
+                                         regs, 4, &exception) == 2);
+    UNIT_ASSERT(tid == 0x1234);
+    UNIT_ASSERT(exception == 0);
+    UNIT_ASSERT((regs[0] == SUNS_ID_HIGH) && (regs[1] == SUNS_ID_LOW));
+
+    /* more registers than the caller has room for */
+    UNIT_ASSERT(suns_mbtcp_read_response(rsp, sizeof(rsp), &tid,
+                                         regs, 1, &exception) < 0);
+
+    UNIT_ASSERT(suns_mbtcp_read_response(exc, sizeof(exc), &tid,
+                                         regs, 4, &exception) < 0);
+    UNIT_ASSERT(tid == 0x1235);
+    UNIT_ASSERT(exception == 2);
+
+    /* a non-zero protocol id isn't modbus */
+    rsp[3] = 1;
+    UNIT_ASSERT(suns_mbtcp_frame_len(rsp, sizeof(rsp)) < 0);
+
+    return 0;
+}
+
+
+int unit_test_bus_units(const char **name)
+{
+    *name = __FUNCTION__;
+
+    suns_bus_t *bus = suns_bus_new();
+    suns_bus_unit_t *unit;
+    int expected[] = { 1, 2, 3, 7, 10, 11 };
+    list_node_t *c;
+    int i = 0;
+
+    UNIT_ASSERT(suns_bus_parse_units(bus, "1-3,7,10-11") == 6);
+    list_for_each(bus->units, c) {
+        unit = c->data;
+        UNIT_ASSERT(unit->addr == expected[i]);
+        i++;
+    }
+
+    UNIT_ASSERT(suns_bus_parse_units(bus, "0") < 0);
+    UNIT_ASSERT(suns_bus_parse_units(bus, "5-2") < 0);
+    UNIT_ASSERT(suns_bus_parse_units(bus, "1,x") < 0);
+    UNIT_ASSERT(suns_bus_parse_units(bus, "") < 0);
+
+    /* failing units are skipped for longer each time, up to a limit */
+    unit = bus->units->head->data;
+    suns_bus_unit_done(bus, unit, 0, 100, -1);
+    UNIT_ASSERT(unit->skip == 1);
+    suns_bus_unit_done(bus, unit, 100, 200, -1);
+    UNIT_ASSERT(unit->skip == 2);
+    for (i = 0; i < 10; i++)
+        suns_bus_unit_done(bus, unit, 200, 300, -1);
+    UNIT_ASSERT(unit->skip == SUNS_BUS_MAX_BACKOFF);
+
+    /* a good read resets the backoff and times the cycle */
+    suns_bus_unit_done(bus, unit, 1000, 1050, 0);
+    suns_bus_unit_done(bus, unit, 2000, 2040, 0);
+    UNIT_ASSERT(unit->failures == 0);
+    UNIT_ASSERT(unit->read_ms == 40);
+    UNIT_ASSERT(unit->cycle_ms == 990);
+    UNIT_ASSERT((unit->reads == 2) && (unit->errors == 12));
+
+    suns_bus_free(bus);
+
+    return 0;
+}
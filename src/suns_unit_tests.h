@@ -51,9 +51,28 @@ int unit_test_byte_order(const char **name);
 int unit_test_value_to_buf(const char **name);
 int unit_test_buf_to_value(const char **name);
 int unit_test_snprintf_suns_value_t(const char **name);
+int unit_test_format_decimal(const char **name);
 int unit_test_type_name_conversion(const char **name);
 int unit_test_suns_value_meta_string(const char **name);
 int unit_test_suns_type_size(const char **name);
 int unit_test_suns_snprintf_int_sf_e(const char **name);
+int unit_test_model_dp_index(const char **name);
+int unit_test_did_index(const char **name);
+int unit_test_decode_plan(const char **name);
+int unit_test_columns(const char **name);
+int unit_test_symbols(const char **name);
+int unit_test_view(const char **name);
+int unit_test_regs(const char **name);
+int unit_test_samples(const char **name);
+int unit_test_map_plan_reads(const char **name);
+int unit_test_map_save_load(const char **name);
+int unit_test_map_changes(const char **name);
+int unit_test_bin(const char **name);
+int unit_test_json(const char **name);
+int unit_test_xml_stream(const char **name);
+int unit_test_json_document(const char **name);
+int unit_test_mbtcp_frames(const char **name);
+int unit_test_bus_units(const char **name);
+int unit_test_link(const char **name);
 
 #endif /* _SUNS_UNIT_TESTS_H_ */
@@ -0,0 +1,226 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * suns_view.c
+ *
+ * lazy, read-only views of a model's registers
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+
+#include "trx/macros.h"
+#include "trx/debug.h"
+#include "suns_model.h"
+#include "suns_view.h"
+
+
+/**
+ * set up a view of the model data in buf, which starts with the did and
+ * length registers as suns_decode_data() expects.  the length register
+ * is trusted as far as len allows; nothing else is checked or decoded.
+ *
+ * returns 0 on success or -1 if the model is unknown.
+ */
+int suns_view_init(suns_view_t *view, suns_did_index_t *did_index,
+                   unsigned char *buf, size_t len)
+{
+    suns_decode_plan_t *plan;
+    uint16_t did_value, did_len;
+
+    memset(view, 0, sizeof(suns_view_t));
+
+    if (len < 4) {
+        warning("model data too short to hold a did and length");
+        return -1;
+    }
+
+    memcpy(&did_value, buf, 2);
+    memcpy(&did_len, buf + 2, 2);
+    did_value = be16toh(did_value);
+    did_len = be16toh(did_len);
+
+    view->did = suns_find_did(did_index, did_value);
+    if (view->did == NULL) {
+        warning("unknown did %d", did_value);
+        return -1;
+    }
+
+    /* models are normally compiled right after their offsets are
+       filled in, but don't depend on it */
+    if ((view->did->model->plan == NULL) &&
+        (suns_model_compile_plan(view->did->model) < 0)) {
+        error("unable to compile decode plan for model %d", did_value);
+        return -1;
+    }
+    plan = view->did->model->plan;
+
+    view->plan = plan;
+    view->buf = buf + 4;
+    view->len = min(did_len * 2, len - 4);
+
+    /* only whole instances of the repeating block */
+    if ((plan->repeat_len > 0) && (view->len > plan->fixed_bytes)) {
+        view->count = (view->len - plan->fixed_bytes) /
+            (plan->repeat_len * 2);
+        while ((view->count > 0) &&
+               (plan->fixed_bytes + (view->count * plan->repeat_bytes) >
+                view->len))
+            view->count--;
+    }
+
+    return 0;
+}
+
+
+/* release what the view holds.  the register buffer isn't touched. */
+void suns_view_clear(suns_view_t *view)
+{
+    free(view->str);
+    memset(view, 0, sizeof(suns_view_t));
+}
+
+
+/* the step index of the datapoint called name, or -1.  the index is
+   the same for every view of the same model. */
+int suns_view_find(suns_view_t *view, const char *name)
+{
+    return suns_decode_plan_find_step(view->plan, name);
+}
+
+
+/**
+ * decode the datapoint at step into v, scale factor included.  instance
+ * is the 1 based repeat index for a datapoint in the repeating block,
+ * and ignored otherwise.
+ *
+ * v is overwritten.  a string value points into the view and is only
+ * good until the next string is decoded; v must not be passed to
+ * suns_value_free().
+ *
+ * returns 0 on success, or -1 if the datapoint isn't in the data.
+ */
+int suns_view_get(suns_view_t *view, int step, int instance,
+                  suns_value_t *v)
+{
+    suns_decode_plan_t *plan = view->plan;
+    suns_decode_step_t *s;
+    int repeating;
+    size_t offset;
+
+    if ((step < 0) || (step >= plan->n_steps))
+        return -1;
+
+    s = &(plan->steps[step]);
+    repeating = (step >= plan->n_fixed);
+    if (repeating) {
+        if ((instance < 1) || (instance > view->count))
+            return -1;
+        offset = plan->fixed_bytes +
+            ((instance - 1) * plan->repeat_bytes) + s->byte_offset;
+    } else {
+        instance = 1;
+        offset = s->byte_offset;
+    }
+
+    if (offset + s->size > view->len)
+        return -1;
+
+    suns_value_init(v);
+
+    /* give suns_buf_to_value() a string to copy into */
+    if (s->tp->type == SUNS_STRING) {
+        if (view->str_size < s->tp->len + 1) {
+            char *str = realloc(view->str, s->tp->len + 1);
+            if (str == NULL) {
+                error("memory error: can't realloc() %zd bytes",
+                      s->tp->len + 1);
+                return -1;
+            }
+            view->str = str;
+            view->str_size = s->tp->len + 1;
+        }
+        v->tp.type = SUNS_STRING;
+        v->tp.len = s->tp->len;
+        v->value.s = view->str;
+    }
+
+    if (suns_buf_to_value(view->buf + offset, s->tp, v) < 0)
+        return -1;
+
+    v->name = s->dp->name;
+    v->name_with_index = v->name;
+    v->repeating = repeating;
+    v->index = instance;
+    v->step = step;
+    v->units = s->units;
+    v->label = s->label;
+
+    if (repeating) {
+        char **names = suns_decode_plan_names(plan, instance);
+        if (names)
+            v->name_with_index = names[((instance - 1) *
+                                        (plan->n_steps - plan->n_fixed)) +
+                                       (step - plan->n_fixed)];
+    }
+
+    /* scale factors are bound to sunssf steps, which have none of
+       their own, so this goes at most one level deep */
+    if (s->sf_step >= 0) {
+        suns_value_t sf;
+        if (suns_view_get(view, s->sf_step, instance, &sf) == 0)
+            suns_value_apply_sf(v, &sf);
+    }
+
+    return 0;
+}
+
+
+/* suns_view_get() by datapoint name */
+int suns_view_get_by_name(suns_view_t *view, const char *name,
+                          int instance, suns_value_t *v)
+{
+    return suns_view_get(view, suns_view_find(view, name), instance, v);
+}
+
+
+/* decode every datapoint in view into data, as suns_decode_dataset()
+   would, for when the whole model is wanted after all */
+int suns_view_decode_dataset(suns_view_t *view, suns_dataset_t *data)
+{
+    return suns_decode_model_data(view->did, view->buf, view->len, data);
+}
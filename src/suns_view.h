@@ -0,0 +1,75 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+
+/*
+ * suns_view.h
+ *
+ * lazy, read-only views of a model's registers
+ *
+ * Copyright (c) 2011-2012, John D. Blair <jdb@moship.net>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ *     * Neither the name of John D. Blair nor his lackeys may be used
+ *       to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * JOHN D. BLAIR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef _SUNS_VIEW_H_
+#define _SUNS_VIEW_H_
+
+#include "suns_model.h"
+
+
+/* a view of one model's registers that decodes datapoints only when
+   they are asked for.  nothing is copied: buf must stay valid for as
+   long as the view is used.
+
+   datapoints are named by their step index in the model's decode plan
+   (see suns_view_find()), which is the same for every view of a given
+   model, so it can be looked up once and kept. */
+typedef struct suns_view {
+    suns_model_did_t *did;
+    suns_decode_plan_t *plan;
+    unsigned char *buf;        /* model data, after the did and length */
+    size_t len;                /* in bytes */
+    int count;                 /* instances of the repeating block */
+    char *str;                 /* holds the last string decoded */
+    size_t str_size;
+} suns_view_t;
+
+
+int suns_view_init(suns_view_t *view, suns_did_index_t *did_index,
+                   unsigned char *buf, size_t len);
+void suns_view_clear(suns_view_t *view);
+int suns_view_find(suns_view_t *view, const char *name);
+int suns_view_get(suns_view_t *view, int step, int instance,
+                  suns_value_t *v);
+int suns_view_get_by_name(suns_view_t *view, const char *name,
+                          int instance, suns_value_t *v);
+int suns_view_decode_dataset(suns_view_t *view, suns_dataset_t *data);
+
+#endif /* _SUNS_VIEW_H_ */